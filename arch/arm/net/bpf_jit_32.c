@@ -892,6 +892,7 @@ void bpf_jit_compile(struct sk_filter *fp)
 			       alloc_size, false);
 
 	fp->bpf_func = (void *)ctx.target;
+	fp->jited = 1;
 out:
 	kfree(ctx.offsets);
 	return;
@@ -906,7 +907,7 @@ void bpf_jit_free(struct sk_filter *fp)
 {
 	struct work_struct *work;
 
-	if (fp->bpf_func != sk_run_filter) {
+	if (fp->jited) {
 		work = (struct work_struct *)fp->bpf_func;
 
 		INIT_WORK(work, bpf_jit_free_worker);
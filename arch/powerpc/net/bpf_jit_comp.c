@@ -529,6 +529,10 @@ static int bpf_jit_build_body(struct sk_filter *fp, u32 *image,
 					PPC_JMP(addrs[i + 1 + filter[i].jf]);
 			}
 			break;
+		case BPF_S_MISC_MAP_LD:
+		case BPF_S_MISC_MAP_ADD:
+			/* BPF maps are only reachable from internal BPF */
+			return -ENOTSUPP;
 		default:
 			/* The filter contains something cruel & unusual.
 			 * We don't handle it, but also there shouldn't be
@@ -669,6 +673,7 @@ void bpf_jit_compile(struct sk_filter *fp)
 		((u64 *)image)[0] = (u64)code_base;
 		((u64 *)image)[1] = local_paca->kernel_toc;
 		fp->bpf_func = (void *)image;
+		fp->jited = 1;
 	}
 out:
 	kfree(addrs);
@@ -685,7 +690,7 @@ static void jit_free_defer(struct work_struct *arg)
  */
 void bpf_jit_free(struct sk_filter *fp)
 {
-	if (fp->bpf_func != sk_run_filter) {
+	if (fp->jited) {
 		struct work_struct *work = (struct work_struct *)fp->bpf_func;
 
 		INIT_WORK(work, jit_free_defer);
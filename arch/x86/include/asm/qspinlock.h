@@ -0,0 +1,29 @@
+#ifndef _ASM_X86_QSPINLOCK_H
+#define _ASM_X86_QSPINLOCK_H
+
+#include <asm-generic/qspinlock_types.h>
+
+/*
+ * PPro and OOSTORE need a locked operation to unlock, see
+ * UNLOCK_LOCK_PREFIX; they use the generic atomic_sub() version.
+ */
+#if !(defined(CONFIG_X86_32) && \
+      (defined(CONFIG_X86_OOSTORE) || defined(CONFIG_X86_PPRO_FENCE)))
+#define	queued_spin_unlock queued_spin_unlock
+/**
+ * queued_spin_unlock - release a queued spinlock
+ * @lock : Pointer to queued spinlock structure
+ *
+ * A plain byte store to the locked byte is enough to release the lock
+ * on x86; stores are not reordered with older loads or stores.
+ */
+static inline void queued_spin_unlock(struct qspinlock *lock)
+{
+	barrier();
+	ACCESS_ONCE(*(u8 *)lock) = 0;
+}
+#endif
+
+#include <asm-generic/qspinlock.h>
+
+#endif /* _ASM_X86_QSPINLOCK_H */
@@ -13,7 +13,8 @@
  * on the local processor, one does not.
  *
  * These are fair FIFO ticket locks, which are currently limited to 256
- * CPUs.
+ * CPUs, or queued spinlocks with CONFIG_QUEUED_SPINLOCKS, see
+ * kernel/qspinlock.c.
  *
  * (the type definitions are in asm/spinlock_types.h)
  */
@@ -37,6 +38,10 @@
 # define UNLOCK_LOCK_PREFIX
 #endif
 
+#ifdef CONFIG_QUEUED_SPINLOCKS
+#include <asm/qspinlock.h>
+#else
+
 /*
  * Ticket locks are conceptually two parts, one indicating the current head of
  * the queue, and the other indicating the current tail. The lock is acquired
@@ -134,6 +139,8 @@ static __always_inline void arch_spin_lock_flags(arch_spinlock_t *lock,
 
 #endif	/* CONFIG_PARAVIRT_SPINLOCKS */
 
+#endif	/* CONFIG_QUEUED_SPINLOCKS */
+
 static inline void arch_spin_unlock_wait(arch_spinlock_t *lock)
 {
 	while (arch_spin_is_locked(lock))
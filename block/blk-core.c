@@ -29,11 +29,14 @@
 #include <linux/fault-inject.h>
 #include <linux/list_sort.h>
 #include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/blk-mq.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/block.h>
 
 #include "blk.h"
+#include "blk-mq.h"
 
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_bio_remap);
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_rq_remap);
@@ -56,7 +59,7 @@ struct kmem_cache *blk_requestq_cachep;
  */
 static struct workqueue_struct *kblockd_workqueue;
 
-static void drive_stat_acct(struct request *rq, int new_io)
+void drive_stat_acct(struct request *rq, int new_io)
 {
 	struct hd_struct *part;
 	int rw = rq_data_dir(rq);
@@ -286,7 +289,11 @@ EXPORT_SYMBOL(blk_stop_queue);
 void blk_sync_queue(struct request_queue *q)
 {
 	del_timer_sync(&q->timeout);
-	cancel_delayed_work_sync(&q->delay_work);
+
+	if (q->mq_ops)
+		blk_mq_sync_queue(q);
+	else
+		cancel_delayed_work_sync(&q->delay_work);
 }
 EXPORT_SYMBOL(blk_sync_queue);
 
@@ -433,7 +440,9 @@ void blk_cleanup_queue(struct request_queue *q)
 	 * be trying to tear down @q before its elevator is initialized, in
 	 * which case we don't want to call into draining.
 	 */
-	if (q->elevator)
+	if (q->mq_ops)
+		blk_mq_drain_queue(q);
+	else if (q->elevator)
 		blk_drain_queue(q, true);
 
 	/* @q won't process any more request, flush async actions */
@@ -493,6 +502,7 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	q->backing_dev_info.capabilities = BDI_CAP_MAP_COPY;
 	q->backing_dev_info.name = "block";
 	q->node = node_id;
+	q->poll_nsec = -1;
 
 	err = bdi_init(&q->backing_dev_info);
 	if (err)
@@ -979,6 +989,9 @@ struct request *blk_get_request(struct request_queue *q, int rw, gfp_t gfp_mask)
 
 	BUG_ON(rw != READ && rw != WRITE);
 
+	if (q->mq_ops)
+		return blk_mq_alloc_request(q, rw, gfp_mask);
+
 	spin_lock_irq(q->queue_lock);
 	if (gfp_mask & __GFP_WAIT)
 		rq = get_request_wait(q, rw, NULL);
@@ -1129,6 +1142,11 @@ void __blk_put_request(struct request_queue *q, struct request *req)
 	if (unlikely(--req->ref_count))
 		return;
 
+	if (q->mq_ops) {
+		blk_mq_free_request(req);
+		return;
+	}
+
 	elv_completed_request(q, req);
 
 	/* this is a bio leak */
@@ -1155,6 +1173,11 @@ void blk_put_request(struct request *req)
 	unsigned long flags;
 	struct request_queue *q = req->q;
 
+	if (q->mq_ops) {
+		__blk_put_request(q, req);
+		return;
+	}
+
 	spin_lock_irqsave(q->queue_lock, flags);
 	__blk_put_request(q, req);
 	spin_unlock_irqrestore(q->queue_lock, flags);
@@ -1193,8 +1216,8 @@ void blk_add_request_payload(struct request *rq, struct page *page,
 }
 EXPORT_SYMBOL_GPL(blk_add_request_payload);
 
-static bool bio_attempt_back_merge(struct request_queue *q, struct request *req,
-				   struct bio *bio)
+bool bio_attempt_back_merge(struct request_queue *q, struct request *req,
+			    struct bio *bio)
 {
 	const int ff = bio->bi_rw & REQ_FAILFAST_MASK;
 
@@ -1215,8 +1238,8 @@ static bool bio_attempt_back_merge(struct request_queue *q, struct request *req,
 	return true;
 }
 
-static bool bio_attempt_front_merge(struct request_queue *q,
-				    struct request *req, struct bio *bio)
+bool bio_attempt_front_merge(struct request_queue *q, struct request *req,
+			     struct bio *bio)
 {
 	const int ff = bio->bi_rw & REQ_FAILFAST_MASK;
 
@@ -1869,7 +1892,7 @@ static void blk_account_io_completion(struct request *req, unsigned int bytes)
 	}
 }
 
-static void blk_account_io_done(struct request *req)
+void blk_account_io_done(struct request *req)
 {
 	/*
 	 * Account IO completion.  flush_rq isn't accounted as a
@@ -2593,6 +2616,109 @@ int blk_lld_busy(struct request_queue *q)
 }
 EXPORT_SYMBOL_GPL(blk_lld_busy);
 
+/*
+ * Sleep before polling, so we don't burn a cpu for the part of the device
+ * latency that we know is coming anyway.  Returns true if we slept.
+ */
+static bool blk_poll_hybrid_sleep(struct request_queue *q, ktime_t submit)
+{
+	struct hrtimer_sleeper hs;
+	ktime_t expires;
+	u64 nsecs;
+
+	if (q->poll_nsec > 0)
+		nsecs = q->poll_nsec;
+	else
+		nsecs = ACCESS_ONCE(q->poll_lat_nsec) / 2;
+	if (!nsecs)
+		return false;
+
+	expires = ktime_add_ns(submit, nsecs);
+	if (ktime_to_ns(ktime_get()) >= ktime_to_ns(expires))
+		return false;
+
+	hrtimer_init_on_stack(&hs.timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	hrtimer_set_expires(&hs.timer, expires);
+	hrtimer_init_sleeper(&hs, current);
+
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	hrtimer_start_expires(&hs.timer, HRTIMER_MODE_ABS);
+	if (hs.task)
+		io_schedule();
+	hrtimer_cancel(&hs.timer);
+	__set_current_state(TASK_RUNNING);
+
+	destroy_hrtimer_on_stack(&hs.timer);
+	return true;
+}
+
+static void blk_poll_account(struct request_queue *q, ktime_t submit)
+{
+	u64 lat = ktime_to_ns(ktime_sub(ktime_get(), submit));
+	u64 avg = ACCESS_ONCE(q->poll_lat_nsec);
+
+	/* racy, but this is only a hint for the next sleep */
+	if (avg)
+		lat = (avg * 7 + lat) >> 3;
+	q->poll_lat_nsec = lat;
+}
+
+/**
+ * blk_poll - spin for IO completion instead of sleeping
+ * @q:		the queue the IO was submitted to
+ * @submit:	when the IO was submitted
+ *
+ * Description:
+ *    Called by a synchronous submitter that has set itself to
+ *    %TASK_UNINTERRUPTIBLE and arranged to be woken when its IO completes.
+ *    Instead of sleeping for the completion interrupt, reap completions
+ *    through the driver's poll_fn until we've been woken, or until
+ *    someone else needs the cpu.  Depending on the io_poll_delay setting,
+ *    the first call for an IO may sleep for part of the expected device
+ *    latency before spinning.
+ *
+ * Return:
+ *    true if the caller is runnable again and should recheck its wait
+ *    condition, false if it should go to sleep as usual.
+ */
+bool blk_poll(struct request_queue *q, ktime_t submit)
+{
+	long state;
+
+	if (!q->poll_fn || !blk_queue_poll(q))
+		return false;
+
+	if (q->poll_nsec >= 0 && blk_poll_hybrid_sleep(q, submit))
+		return true;
+
+	state = current->state;
+	while (!need_resched()) {
+		int ret;
+
+		ret = q->poll_fn(q);
+		if (ret > 0) {
+			__set_current_state(TASK_RUNNING);
+			blk_poll_account(q, submit);
+			return true;
+		}
+
+		if (current->state == TASK_RUNNING) {
+			blk_poll_account(q, submit);
+			return true;
+		}
+		if (signal_pending_state(state, current)) {
+			__set_current_state(TASK_RUNNING);
+			return true;
+		}
+		if (ret < 0)
+			break;
+		cpu_relax();
+	}
+
+	return false;
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
 /**
  * blk_rq_unprep_clone - Helper function to free all bios in a cloned request
  * @rq: the clone request to be cleaned up
@@ -2728,6 +2854,7 @@ void blk_start_plug(struct blk_plug *plug)
 
 	plug->magic = PLUG_MAGIC;
 	INIT_LIST_HEAD(&plug->list);
+	INIT_LIST_HEAD(&plug->mq_list);
 	INIT_LIST_HEAD(&plug->cb_list);
 	plug->should_sort = 0;
 
@@ -2817,6 +2944,10 @@ void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
 	BUG_ON(plug->magic != PLUG_MAGIC);
 
 	flush_plug_callbacks(plug);
+
+	if (!list_empty(&plug->mq_list))
+		blk_mq_flush_plug_list(plug, from_schedule);
+
 	if (list_empty(&plug->list))
 		return;
 
@@ -0,0 +1,126 @@
+/*
+ * Tag allocation for the multi-queue block layer.
+ *
+ * Each hardware queue owns a fixed size tag space, backed by a bitmap.
+ * Allocation is lockless: every software queue remembers where it last
+ * found a free tag and starts searching from there, which keeps cpus
+ * submitting to the same hardware queue from fighting over the same
+ * bitmap words.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/blkdev.h>
+
+#include "blk-mq.h"
+
+static unsigned int __blk_mq_get_tag(struct blk_mq_tags *tags,
+				     unsigned int *hint)
+{
+	unsigned int start = *hint, tag;
+
+	if (start >= tags->nr_tags)
+		start = 0;
+
+	tag = start;
+	do {
+		tag = find_next_zero_bit(tags->bitmap, tags->nr_tags, tag);
+		if (tag >= tags->nr_tags) {
+			/* wrap once, then give up */
+			if (!start)
+				break;
+			tag = find_first_zero_bit(tags->bitmap, start);
+			if (tag >= start)
+				break;
+			start = 0;
+		}
+		if (!test_and_set_bit(tag, tags->bitmap)) {
+			*hint = tag + 1;
+			return tag;
+		}
+	} while (1);
+
+	return BLK_MQ_TAG_FAIL;
+}
+
+unsigned int blk_mq_get_tag(struct blk_mq_tags *tags, unsigned int *hint,
+			    gfp_t gfp)
+{
+	DEFINE_WAIT(wait);
+	unsigned int tag;
+
+	tag = __blk_mq_get_tag(tags, hint);
+	if (tag != BLK_MQ_TAG_FAIL || !(gfp & __GFP_WAIT))
+		return tag;
+
+	do {
+		prepare_to_wait_exclusive(&tags->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		tag = __blk_mq_get_tag(tags, hint);
+		if (tag != BLK_MQ_TAG_FAIL)
+			break;
+		io_schedule();
+	} while (1);
+
+	finish_wait(&tags->wait, &wait);
+	return tag;
+}
+
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	BUG_ON(tag >= tags->nr_tags);
+
+	clear_bit(tag, tags->bitmap);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&tags->wait))
+		wake_up(&tags->wait);
+}
+
+bool blk_mq_has_free_tags(struct blk_mq_tags *tags)
+{
+	return find_first_zero_bit(tags->bitmap, tags->nr_tags) <
+			tags->nr_tags;
+}
+
+unsigned int blk_mq_tags_busy(struct blk_mq_tags *tags)
+{
+	return bitmap_weight(tags->bitmap, tags->nr_tags);
+}
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags, int node)
+{
+	struct blk_mq_tags *tags;
+
+	tags = kzalloc_node(sizeof(*tags), GFP_KERNEL, node);
+	if (!tags)
+		return NULL;
+
+	tags->bitmap = kzalloc_node(BITS_TO_LONGS(nr_tags) * sizeof(long),
+				    GFP_KERNEL, node);
+	if (!tags->bitmap)
+		goto err_free_tags;
+
+	tags->rqs = kzalloc_node(nr_tags * sizeof(struct request *),
+				 GFP_KERNEL, node);
+	if (!tags->rqs)
+		goto err_free_bitmap;
+
+	tags->nr_tags = nr_tags;
+	init_waitqueue_head(&tags->wait);
+	return tags;
+
+err_free_bitmap:
+	kfree(tags->bitmap);
+err_free_tags:
+	kfree(tags);
+	return NULL;
+}
+
+void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	kfree(tags->rqs);
+	kfree(tags->bitmap);
+	kfree(tags);
+}
@@ -0,0 +1,1269 @@
+/*
+ * Multi-queue block layer
+ *
+ * Requests are staged on per-cpu software queues and dispatched to one of
+ * the device's hardware queues, each with its own preallocated set of tags
+ * and requests.  Nothing on the submission path touches the shared
+ * request_queue lock, so drivers whose hardware has several submission
+ * queues (or just a cheap one) can scale with the number of submitting cpus.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/backing-dev.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/mm.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/smp.h>
+#include <linux/list_sort.h>
+#include <linux/cpu.h>
+#include <linux/cache.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/blk-mq.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+
+/* FLUSH/FUA sequences, see blk-flush.c */
+enum {
+	REQ_FSEQ_PREFLUSH	= (1 << 0),
+	REQ_FSEQ_DATA		= (1 << 1),
+	REQ_FSEQ_POSTFLUSH	= (1 << 2),
+	REQ_FSEQ_DONE		= (1 << 3),
+
+	REQ_FSEQ_ACTIONS	= REQ_FSEQ_PREFLUSH | REQ_FSEQ_DATA |
+				  REQ_FSEQ_POSTFLUSH,
+};
+
+static struct blk_mq_ctx *__blk_mq_get_ctx(struct request_queue *q,
+					   unsigned int cpu)
+{
+	return per_cpu_ptr(q->queue_ctx, cpu);
+}
+
+/*
+ * This assumes per-cpu software queueing queues. They could be per-node
+ * as well, for instance. For now this is hardcoded as-is. Note that we don't
+ * care about preemption, since we know the ctx's are persistent. This does
+ * mean that we can't rely on ctx always matching the currently running CPU.
+ */
+static struct blk_mq_ctx *blk_mq_get_ctx(struct request_queue *q)
+{
+	return __blk_mq_get_ctx(q, raw_smp_processor_id());
+}
+
+/*
+ * Default mapping from cpu to hardware queue, set up by
+ * blk_mq_update_queue_map().
+ */
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static struct blk_mq_hw_ctx *blk_mq_ctx_to_hctx(struct blk_mq_ctx *ctx)
+{
+	struct request_queue *q = ctx->queue;
+
+	return q->mq_ops->map_queue(q, ctx->cpu);
+}
+
+/*
+ * Check if any of the ctx's have pending work in this hardware queue
+ */
+static bool blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx)
+{
+	return !list_empty_careful(&hctx->dispatch) ||
+		find_first_bit(hctx->ctx_map, hctx->nr_ctx) < hctx->nr_ctx;
+}
+
+/*
+ * Mark this ctx as having pending work in this hardware queue
+ */
+static void blk_mq_hctx_mark_pending(struct blk_mq_hw_ctx *hctx,
+				     struct blk_mq_ctx *ctx)
+{
+	if (!test_bit(ctx->index_hw, hctx->ctx_map))
+		set_bit(ctx->index_hw, hctx->ctx_map);
+}
+
+static void blk_mq_rq_ctx_init(struct request_queue *q, struct blk_mq_ctx *ctx,
+			       struct request *rq, unsigned int tag,
+			       unsigned int rw_flags)
+{
+	blk_rq_init(q, rq);
+
+	rq->mq_ctx = ctx;
+	rq->tag = tag;
+	rq->cmd_flags = rw_flags;
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+
+	ctx->rq_dispatched[rw_is_sync(rw_flags)]++;
+}
+
+static struct request *__blk_mq_alloc_request(struct request_queue *q,
+					      struct blk_mq_hw_ctx *hctx,
+					      struct blk_mq_ctx *ctx,
+					      unsigned int rw_flags, gfp_t gfp)
+{
+	struct request *rq;
+	unsigned int tag;
+
+	tag = blk_mq_get_tag(hctx->tags, &ctx->last_tag, gfp);
+	if (tag == BLK_MQ_TAG_FAIL)
+		return NULL;
+
+	rq = hctx->tags->rqs[tag];
+	blk_mq_rq_ctx_init(q, ctx, rq, tag, rw_flags);
+	return rq;
+}
+
+/**
+ * blk_mq_alloc_request - allocate a request from a multi-queue device
+ * @q:		request queue
+ * @rw:		READ or WRITE, plus any other request flags
+ * @gfp:	allocation mask, %__GFP_WAIT waits for a free tag
+ *
+ * Description:
+ *    Allocates a request and tag from the hardware queue mapped to the
+ *    current cpu.  Returns %NULL if the queue is dead or if no tag was
+ *    available and @gfp doesn't allow waiting.
+ */
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+
+	if (unlikely(blk_queue_dead(q)))
+		return NULL;
+
+	ctx = blk_mq_get_ctx(q);
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	return __blk_mq_alloc_request(q, hctx, ctx, rw, gfp);
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+/**
+ * blk_mq_free_request - release a request and its tag
+ * @rq:		request to free
+ */
+void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct blk_mq_hw_ctx *hctx = blk_mq_ctx_to_hctx(ctx);
+	unsigned int tag = rq->tag;
+
+	ctx->rq_completed[rq_is_sync(rq)]++;
+
+	clear_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
+	blk_mq_put_tag(hctx->tags, tag);
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+static void __blk_mq_end_io(struct request *rq, int error)
+{
+	blk_update_request(rq, error, blk_rq_bytes(rq));
+	blk_account_io_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else if (!--rq->ref_count)
+		blk_mq_free_request(rq);
+}
+
+static void blk_mq_flush_complete_seq(struct request *rq, unsigned int seq,
+				      int error);
+
+/**
+ * blk_mq_end_io - end I/O on a request
+ * @rq:		the request being completed
+ * @error:	%0 for success, < %0 for error
+ *
+ * Description:
+ *    Ends all I/O on @rq, completes its bios and frees the request unless
+ *    the issuer installed a completion callback.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (rq->cmd_flags & REQ_FLUSH_SEQ) {
+		blk_mq_flush_complete_seq(rq, REQ_FSEQ_DATA, error);
+		return;
+	}
+
+	__blk_mq_end_io(rq, error);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static void __blk_mq_complete_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	if (q->mq_ops->complete)
+		q->mq_ops->complete(rq);
+	else
+		blk_mq_end_io(rq, rq->errors);
+}
+
+#if defined(CONFIG_SMP) && defined(CONFIG_USE_GENERIC_SMP_HELPERS)
+static void __blk_mq_complete_request_remote(void *data)
+{
+	__blk_mq_complete_request(data);
+}
+
+static bool blk_mq_complete_remote(struct request *rq)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	int cpu;
+
+	if (!test_bit(QUEUE_FLAG_SAME_COMP, &rq->q->queue_flags))
+		return false;
+
+	cpu = get_cpu();
+	if (cpu == ctx->cpu || !cpu_online(ctx->cpu) ||
+	    (!test_bit(QUEUE_FLAG_SAME_FORCE, &rq->q->queue_flags) &&
+	     cpus_share_cache(cpu, ctx->cpu))) {
+		put_cpu();
+		return false;
+	}
+
+	rq->csd.func = __blk_mq_complete_request_remote;
+	rq->csd.info = rq;
+	rq->csd.flags = 0;
+	__smp_call_function_single(ctx->cpu, &rq->csd, 0);
+	put_cpu();
+	return true;
+}
+#else
+static bool blk_mq_complete_remote(struct request *rq)
+{
+	return false;
+}
+#endif
+
+/**
+ * blk_mq_complete_request - end I/O on a request
+ * @rq:		the request being processed
+ *
+ * Description:
+ *    Ends all I/O on a request.  Unlike blk_mq_end_io() this may be called
+ *    from hard irq context of any cpu: the completion is run on the cpu
+ *    that submitted the request, through ->complete() if the driver has
+ *    one.  Races against the timeout handler, only one of them wins.
+ */
+void blk_mq_complete_request(struct request *rq)
+{
+	if (blk_mark_rq_complete(rq))
+		return;
+
+	if (!blk_mq_complete_remote(rq))
+		__blk_mq_complete_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_complete_request);
+
+/*
+ * Make sure the queue timeout fires no later than @deadline: arm it if it
+ * is idle, or pull it in if it is due later.
+ */
+static void blk_mq_add_timer(struct request_queue *q, unsigned long deadline)
+{
+	unsigned long expiry = round_jiffies_up(deadline);
+
+	if (!timer_pending(&q->timeout) ||
+	    time_before(expiry, q->timeout.expires))
+		mod_timer(&q->timeout, expiry);
+}
+
+/**
+ * blk_mq_start_request - mark a request as handed to the hardware
+ * @rq:		the request
+ *
+ * Description:
+ *    Must be called by ->queue_rq() before the request is visible to the
+ *    device, it arms the timeout for @rq.
+ */
+void blk_mq_start_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	trace_block_rq_issue(q, rq);
+
+	if (!rq->timeout)
+		rq->timeout = q->rq_timeout;
+	rq->deadline = jiffies + rq->timeout;
+
+	/*
+	 * The deadline must be visible before the timeout handler can see
+	 * the request as started.
+	 */
+	smp_wmb();
+	blk_clear_rq_complete(rq);
+	set_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
+
+	if (q->mq_ops->timeout)
+		blk_mq_add_timer(q, rq->deadline);
+}
+EXPORT_SYMBOL(blk_mq_start_request);
+
+static void blk_mq_rq_timed_out(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+
+	switch (q->mq_ops->timeout(rq)) {
+	case BLK_EH_HANDLED:
+		__blk_mq_complete_request(rq);
+		break;
+	case BLK_EH_RESET_TIMER:
+		rq->deadline = jiffies + rq->timeout;
+		blk_clear_rq_complete(rq);
+		blk_mq_add_timer(q, rq->deadline);
+		break;
+	case BLK_EH_NOT_HANDLED:
+		/*
+		 * LLD handles this for now but in the future
+		 * we can send a request msg to abort the command
+		 * and we can move more of the generic scsi eh code to
+		 * the blk layer.
+		 */
+		break;
+	default:
+		printk(KERN_ERR "block: bad eh return: %d\n", rq->errors);
+		break;
+	}
+}
+
+static void blk_mq_rq_timer(unsigned long data)
+{
+	struct request_queue *q = (struct request_queue *) data;
+	struct blk_mq_hw_ctx *hctx;
+	unsigned long next = 0;
+	int i, next_set = 0;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		unsigned int tag;
+
+		blk_mq_for_each_busy_tag(hctx->tags, tag) {
+			struct request *rq = hctx->tags->rqs[tag];
+
+			if (!test_bit(REQ_ATOM_STARTED, &rq->atomic_flags))
+				continue;
+			smp_rmb();
+
+			if (time_after_eq(jiffies, rq->deadline)) {
+				if (!blk_mark_rq_complete(rq))
+					blk_mq_rq_timed_out(rq);
+			} else if (!next_set || time_after(next, rq->deadline)) {
+				next = rq->deadline;
+				next_set = 1;
+			}
+		}
+	}
+
+	/* a reset or a newly started request may have armed it already */
+	if (next_set)
+		blk_mq_add_timer(q, next);
+}
+
+/*
+ * Run this hardware queue, pulling any software queues mapped to it in.
+ * Note that this function currently has various problems around ordering
+ * of IO. In particular, we'd like FIFO behaviour on handling existing
+ * items on the hctx->dispatch list. Ignore that for now.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit, queued;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	hctx->run++;
+
+	/*
+	 * Touch any software queue that has pending entries.
+	 */
+	for_each_set_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		clear_bit(bit, hctx->ctx_map);
+		ctx = hctx->ctxs[bit];
+		BUG_ON(bit != ctx->index_hw);
+
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock(&ctx->lock);
+	}
+
+	/*
+	 * If we have previous entries on our dispatch list, grab them
+	 * and stuff them at the front for more fair dispatch.
+	 */
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		if (!list_empty(&hctx->dispatch))
+			list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	/*
+	 * Now process all the entries, sending them to the driver.
+	 */
+	queued = 0;
+	while (!list_empty(&rq_list)) {
+		int ret;
+
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		switch (ret) {
+		case BLK_MQ_RQ_QUEUE_OK:
+			queued++;
+			break;
+		case BLK_MQ_RQ_QUEUE_BUSY:
+			/*
+			 * FIXME: we should have a mechanism to stop the queue
+			 * like blk_stop_queue, otherwise we will waste cpu
+			 * time
+			 */
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		default:
+			pr_err("blk-mq: bad return on queue: %d\n", ret);
+		case BLK_MQ_RQ_QUEUE_ERROR:
+			rq->errors = -EIO;
+			blk_mq_end_io(rq, rq->errors);
+			break;
+		}
+
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY)
+			break;
+	}
+
+	if (!queued)
+		hctx->dispatched[0]++;
+	else if (queued < (1 << (BLK_MQ_MAX_DISPATCH_ORDER - 1)))
+		hctx->dispatched[ilog2(queued) + 1]++;
+	else
+		hctx->dispatched[BLK_MQ_MAX_DISPATCH_ORDER - 1]++;
+
+	/*
+	 * Any items that need requeuing? Stuff them into hctx->dispatch,
+	 * that is where we will continue on next queue run.
+	 */
+	if (!list_empty(&rq_list)) {
+		spin_lock(&hctx->lock);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock(&hctx->lock);
+
+		/*
+		 * The driver may have restarted the queue before we got the
+		 * leftovers back on the dispatch list.  Don't let them
+		 * strand there.
+		 */
+		smp_mb();
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			blk_mq_run_hw_queue(hctx, true);
+	}
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch pending requests of a hardware queue
+ * @hctx:	hardware queue to run
+ * @async:	punt the dispatch to kblockd
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (!async)
+		__blk_mq_run_hw_queue(hctx);
+	else
+		kblockd_schedule_delayed_work(hctx->queue,
+					      &hctx->delayed_work, 0);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!blk_mq_hctx_has_pending(hctx) ||
+		    test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	cancel_delayed_work(&hctx->delayed_work);
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+	__blk_mq_run_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_start_hw_queue);
+
+void blk_mq_stop_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_stop_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queues);
+
+/**
+ * blk_mq_start_stopped_hw_queues - restart stopped hardware queues
+ * @q:		request queue
+ *
+ * Description:
+ *    Safe to call from the driver's completion (irq) path, the queues are
+ *    run from kblockd.
+ */
+void blk_mq_start_stopped_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+
+		clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+		smp_mb__after_clear_bit();
+		blk_mq_run_hw_queue(hctx, true);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void blk_mq_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, delayed_work.work);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
+				    struct request *rq, bool at_head)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+
+	trace_block_rq_insert(hctx->queue, rq);
+
+	if (at_head)
+		list_add(&rq->queuelist, &ctx->rq_list);
+	else
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+	blk_mq_hctx_mark_pending(hctx, ctx);
+}
+
+/**
+ * blk_mq_insert_request - queue a prepared request for dispatch
+ * @rq:		request to queue, allocated with blk_mq_alloc_request()
+ * @at_head:	insert at the head of the software queue
+ * @run_queue:	run the hardware queue afterwards
+ * @async:	if running the queue, do it from kblockd
+ */
+void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue,
+			   bool async)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct blk_mq_hw_ctx *hctx = blk_mq_ctx_to_hctx(ctx);
+
+	spin_lock(&ctx->lock);
+	__blk_mq_insert_request(hctx, rq, at_head);
+	spin_unlock(&ctx->lock);
+
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+/*
+ * Flush sequencing.  A request carrying both data and REQ_FLUSH/REQ_FUA
+ * which the device can't take in one go is broken down into a
+ * preflush, the data write and a postflush.  The steps are driven from
+ * kblockd so that the flush requests can wait for a tag.
+ */
+static unsigned int blk_mq_flush_policy(unsigned int fflags,
+					struct request *rq)
+{
+	unsigned int policy = 0;
+
+	if (blk_rq_sectors(rq))
+		policy |= REQ_FSEQ_DATA;
+
+	if (fflags & REQ_FLUSH) {
+		if (rq->cmd_flags & REQ_FLUSH)
+			policy |= REQ_FSEQ_PREFLUSH;
+		if (!(fflags & REQ_FUA) && (rq->cmd_flags & REQ_FUA))
+			policy |= REQ_FSEQ_POSTFLUSH;
+	}
+	return policy;
+}
+
+static void blk_mq_flush_complete_seq(struct request *rq, unsigned int seq,
+				      int error)
+{
+	struct request_queue *q = rq->q;
+	unsigned long flags;
+
+	BUG_ON(rq->flush.seq & seq);
+	rq->flush.seq |= seq;
+	if (unlikely(error)) {
+		rq->errors = error;
+		rq->flush.seq |= REQ_FSEQ_ACTIONS;
+	}
+
+	spin_lock_irqsave(&q->mq_flush_lock, flags);
+	list_add_tail(&rq->flush.list, &q->mq_flush_list);
+	spin_unlock_irqrestore(&q->mq_flush_lock, flags);
+
+	kblockd_schedule_work(q, &q->mq_flush_work);
+}
+
+static void blk_mq_flush_end_io(struct request *flush_rq, int error)
+{
+	struct request *rq = flush_rq->end_io_data;
+	unsigned int seq = 1 << ffz(rq->flush.seq);
+
+	blk_mq_free_request(flush_rq);
+
+	BUG_ON(seq != REQ_FSEQ_PREFLUSH && seq != REQ_FSEQ_POSTFLUSH);
+	blk_mq_flush_complete_seq(rq, seq, error);
+}
+
+static void blk_mq_issue_flush(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct request *flush_rq;
+
+	flush_rq = blk_mq_alloc_request(q, WRITE_FLUSH, GFP_NOIO);
+	if (unlikely(!flush_rq)) {
+		/* @q is dead */
+		rq->errors = -ENODEV;
+		rq->cmd_flags &= ~REQ_FLUSH_SEQ;
+		__blk_mq_end_io(rq, rq->errors);
+		return;
+	}
+
+	flush_rq->cmd_type = REQ_TYPE_FS;
+	/* accounted through the request it is flushing for */
+	flush_rq->cmd_flags &= ~REQ_IO_STAT;
+	flush_rq->rq_disk = rq->rq_disk;
+	flush_rq->end_io = blk_mq_flush_end_io;
+	flush_rq->end_io_data = rq;
+
+	blk_mq_insert_request(flush_rq, false, true, false);
+}
+
+static void blk_mq_flush_work(struct work_struct *work)
+{
+	struct request_queue *q;
+	struct request *rq, *n;
+	LIST_HEAD(list);
+
+	q = container_of(work, struct request_queue, mq_flush_work);
+
+	spin_lock_irq(&q->mq_flush_lock);
+	list_splice_init(&q->mq_flush_list, &list);
+	spin_unlock_irq(&q->mq_flush_lock);
+
+	list_for_each_entry_safe(rq, n, &list, flush.list) {
+		list_del_init(&rq->flush.list);
+
+		switch (1 << ffz(rq->flush.seq)) {
+		case REQ_FSEQ_PREFLUSH:
+		case REQ_FSEQ_POSTFLUSH:
+			blk_mq_issue_flush(rq);
+			break;
+		case REQ_FSEQ_DATA:
+			blk_mq_insert_request(rq, false, true, false);
+			break;
+		case REQ_FSEQ_DONE:
+			rq->cmd_flags &= ~REQ_FLUSH_SEQ;
+			__blk_mq_end_io(rq, rq->errors);
+			break;
+		default:
+			BUG();
+		}
+	}
+}
+
+static bool blk_mq_insert_flush(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	unsigned int fflags = q->flush_flags;	/* may change, cache */
+	unsigned int policy = blk_mq_flush_policy(fflags, rq);
+
+	/*
+	 * An empty flush translates into nothing if the device does not
+	 * advertise a write-back cache.
+	 */
+	if (!policy) {
+		__blk_mq_end_io(rq, 0);
+		return true;
+	}
+
+	/*
+	 * A single step can go to the driver as-is: either the data with
+	 * FUA the device understands, or a bare flush.
+	 */
+	if (policy == REQ_FSEQ_DATA || policy == REQ_FSEQ_PREFLUSH) {
+		if (policy == REQ_FSEQ_DATA)
+			rq->cmd_flags &= ~REQ_FLUSH;
+		if (!(fflags & REQ_FUA))
+			rq->cmd_flags &= ~REQ_FUA;
+		return false;
+	}
+
+	rq->cmd_flags &= ~REQ_FLUSH;
+	if (!(fflags & REQ_FUA))
+		rq->cmd_flags &= ~REQ_FUA;
+
+	memset(&rq->flush, 0, sizeof(rq->flush));
+	INIT_LIST_HEAD(&rq->flush.list);
+	rq->cmd_flags |= REQ_FLUSH_SEQ;
+	rq->errors = 0;
+
+	blk_mq_flush_complete_seq(rq, REQ_FSEQ_ACTIONS & ~policy, 0);
+	return true;
+}
+
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	struct request *rq;
+	int checked = 8;
+
+	list_for_each_entry_reverse(rq, &ctx->rq_list, queuelist) {
+		int el_ret;
+
+		if (!checked--)
+			break;
+
+		if (!blk_rq_merge_ok(rq, bio))
+			continue;
+
+		el_ret = blk_try_merge(rq, bio);
+		if (el_ret == ELEVATOR_BACK_MERGE) {
+			if (bio_attempt_back_merge(q, rq, bio)) {
+				ctx->rq_merged++;
+				return true;
+			}
+			break;
+		} else if (el_ret == ELEVATOR_FRONT_MERGE) {
+			if (bio_attempt_front_merge(q, rq, bio)) {
+				ctx->rq_merged++;
+				return true;
+			}
+			break;
+		}
+	}
+
+	return false;
+}
+
+static void blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	const bool is_sync = rw_is_sync(bio->bi_rw);
+	const bool is_flush_fua = bio->bi_rw & (REQ_FLUSH | REQ_FUA);
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct blk_plug *plug;
+	struct request *rq;
+	int rw_flags;
+
+	blk_queue_bounce(q, &bio);
+
+	ctx = blk_mq_get_ctx(q);
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	if (!is_flush_fua && (hctx->flags & BLK_MQ_F_SHOULD_MERGE) &&
+	    !blk_queue_nomerges(q)) {
+		bool merged;
+
+		spin_lock(&ctx->lock);
+		merged = blk_mq_attempt_merge(q, ctx, bio);
+		spin_unlock(&ctx->lock);
+
+		if (merged)
+			return;
+	}
+
+	if (unlikely(blk_queue_dead(q))) {
+		bio_endio(bio, -ENODEV);
+		return;
+	}
+
+	rw_flags = bio_data_dir(bio);
+	if (is_sync)
+		rw_flags |= REQ_SYNC;
+
+	trace_block_getrq(q, bio, rw_flags & 1);
+	rq = __blk_mq_alloc_request(q, hctx, ctx, rw_flags, GFP_NOIO);
+	hctx->queued++;
+
+	init_request_from_bio(rq, bio);
+	drive_stat_acct(rq, 1);
+
+	if (unlikely(is_flush_fua) && blk_mq_insert_flush(rq))
+		return;
+
+	plug = current->plug;
+	if (plug) {
+		if (list_empty(&plug->mq_list))
+			trace_block_plug(q);
+		list_add_tail(&rq->queuelist, &plug->mq_list);
+		return;
+	}
+
+	spin_lock(&ctx->lock);
+	__blk_mq_insert_request(hctx, rq, false);
+	spin_unlock(&ctx->lock);
+
+	blk_mq_run_hw_queue(hctx, !is_sync || is_flush_fua);
+}
+
+static int plug_ctx_cmp(void *priv, struct list_head *a, struct list_head *b)
+{
+	struct request *rqa = container_of(a, struct request, queuelist);
+	struct request *rqb = container_of(b, struct request, queuelist);
+
+	return !(rqa->mq_ctx < rqb->mq_ctx ||
+		 (rqa->mq_ctx == rqb->mq_ctx &&
+		  blk_rq_pos(rqa) < blk_rq_pos(rqb)));
+}
+
+static void blk_mq_insert_requests(struct blk_mq_ctx *ctx,
+				   struct list_head *list, unsigned int depth,
+				   bool from_schedule)
+{
+	struct blk_mq_hw_ctx *hctx = blk_mq_ctx_to_hctx(ctx);
+	struct request_queue *q = ctx->queue;
+
+	trace_block_unplug(q, depth, !from_schedule);
+
+	spin_lock(&ctx->lock);
+	while (!list_empty(list)) {
+		struct request *rq;
+
+		rq = list_first_entry(list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+		__blk_mq_insert_request(hctx, rq, false);
+	}
+	spin_unlock(&ctx->lock);
+
+	blk_mq_run_hw_queue(hctx, from_schedule);
+}
+
+/*
+ * Called from blk_flush_plug_list().  Requests are batched per software
+ * queue, so that each queue lock is taken and each hardware queue kicked
+ * once per plug.
+ */
+void blk_mq_flush_plug_list(struct blk_plug *plug, bool from_schedule)
+{
+	struct blk_mq_ctx *this_ctx;
+	unsigned int depth;
+	LIST_HEAD(list);
+	LIST_HEAD(ctx_list);
+
+	list_splice_init(&plug->mq_list, &list);
+	list_sort(NULL, &list, plug_ctx_cmp);
+
+	this_ctx = NULL;
+	depth = 0;
+
+	while (!list_empty(&list)) {
+		struct request *rq;
+
+		rq = list_first_entry(&list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+		BUG_ON(!rq->q);
+
+		if (rq->mq_ctx != this_ctx) {
+			if (this_ctx)
+				blk_mq_insert_requests(this_ctx, &ctx_list,
+						       depth, from_schedule);
+			this_ctx = rq->mq_ctx;
+			depth = 0;
+		}
+
+		depth++;
+		list_add_tail(&rq->queuelist, &ctx_list);
+	}
+
+	/*
+	 * If 'this_ctx' is set, we know we have entries to complete
+	 * on 'ctx_list'. Do those.
+	 */
+	if (this_ctx)
+		blk_mq_insert_requests(this_ctx, &ctx_list, depth,
+				       from_schedule);
+}
+
+/*
+ * Wait for all tags of @q to be released.  The caller has marked @q dead,
+ * so no new requests can come in.
+ */
+void blk_mq_drain_queue(struct request_queue *q)
+{
+	while (true) {
+		struct blk_mq_hw_ctx *hctx;
+		unsigned int busy = 0;
+		int i;
+
+		queue_for_each_hw_ctx(q, hctx, i)
+			busy += blk_mq_tags_busy(hctx->tags);
+
+		if (!busy)
+			break;
+
+		blk_mq_run_queues(q, false);
+		msleep(10);
+	}
+}
+
+void blk_mq_sync_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		cancel_delayed_work_sync(&hctx->delayed_work);
+	cancel_work_sync(&q->mq_flush_work);
+}
+
+static void blk_mq_free_rq_map(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < hctx->tags->nr_tags; i++)
+		kfree(hctx->tags->rqs[i]);
+
+	blk_mq_free_tags(hctx->tags);
+}
+
+static int blk_mq_init_rq_map(struct blk_mq_hw_ctx *hctx,
+			      unsigned int cmd_size)
+{
+	size_t rq_size = sizeof(struct request) + cmd_size;
+	unsigned int i;
+
+	hctx->tags = blk_mq_init_tags(hctx->queue_depth, hctx->numa_node);
+	if (!hctx->tags)
+		return -ENOMEM;
+
+	for (i = 0; i < hctx->queue_depth; i++) {
+		struct request *rq;
+
+		rq = kzalloc_node(rq_size, GFP_KERNEL, hctx->numa_node);
+		if (!rq) {
+			blk_mq_free_rq_map(hctx);
+			return -ENOMEM;
+		}
+
+		rq->tag = i;
+		hctx->tags->rqs[i] = rq;
+	}
+
+	return 0;
+}
+
+static void blk_mq_exit_hw_queues(struct request_queue *q,
+				  unsigned int nr_queue)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (i == nr_queue)
+			break;
+
+		if (q->mq_ops->exit_hctx)
+			q->mq_ops->exit_hctx(hctx, i);
+
+		blk_mq_free_rq_map(hctx);
+		kfree(hctx->ctxs);
+		kfree(hctx->ctx_map);
+	}
+}
+
+static int blk_mq_init_hw_queues(struct request_queue *q,
+				 struct blk_mq_reg *reg, void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		int node = hctx->numa_node;
+
+		if (node == NUMA_NO_NODE)
+			node = hctx->numa_node = reg->numa_node;
+
+		spin_lock_init(&hctx->lock);
+		INIT_LIST_HEAD(&hctx->dispatch);
+		INIT_DELAYED_WORK(&hctx->delayed_work, blk_mq_work_fn);
+		hctx->queue = q;
+		hctx->queue_num = i;
+		hctx->flags = reg->flags;
+		hctx->queue_depth = reg->queue_depth;
+
+		if (blk_mq_init_rq_map(hctx, reg->cmd_size))
+			break;
+
+		hctx->ctxs = kmalloc_node(nr_cpu_ids * sizeof(void *),
+					  GFP_KERNEL, node);
+		if (!hctx->ctxs)
+			goto free_rq_map;
+
+		hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+					     sizeof(long), GFP_KERNEL, node);
+		if (!hctx->ctx_map)
+			goto free_ctxs;
+
+		hctx->nr_ctx = 0;
+
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i))
+			goto free_ctx_map;
+
+		continue;
+
+free_ctx_map:
+		kfree(hctx->ctx_map);
+free_ctxs:
+		kfree(hctx->ctxs);
+free_rq_map:
+		blk_mq_free_rq_map(hctx);
+		break;
+	}
+
+	if (i == q->nr_hw_queues)
+		return 0;
+
+	/*
+	 * Init failed
+	 */
+	blk_mq_exit_hw_queues(q, i);
+	return 1;
+}
+
+static void blk_mq_init_cpu_queues(struct request_queue *q)
+{
+	unsigned int i;
+
+	for_each_possible_cpu(i) {
+		struct blk_mq_ctx *__ctx = per_cpu_ptr(q->queue_ctx, i);
+
+		memset(__ctx, 0, sizeof(*__ctx));
+		__ctx->cpu = i;
+		spin_lock_init(&__ctx->lock);
+		INIT_LIST_HEAD(&__ctx->rq_list);
+		__ctx->queue = q;
+	}
+}
+
+/*
+ * Spread the possible cpus evenly over the hardware queues, keeping
+ * consecutive cpu numbers (typically siblings and cores of one package)
+ * on the same queue.
+ */
+static int blk_mq_update_queue_map(unsigned int *map, unsigned int nr_queues)
+{
+	unsigned int i, nr_cpus = 0, queue = 0;
+
+	for_each_possible_cpu(i)
+		nr_cpus++;
+
+	for_each_possible_cpu(i) {
+		map[i] = queue * nr_queues / nr_cpus;
+		queue++;
+	}
+
+	return 0;
+}
+
+static void blk_mq_map_swqueue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		cpumask_clear(hctx->cpumask);
+		hctx->nr_ctx = 0;
+	}
+
+	/*
+	 * Map software to hardware queues
+	 */
+	for_each_possible_cpu(i) {
+		struct blk_mq_ctx *ctx = per_cpu_ptr(q->queue_ctx, i);
+
+		hctx = q->mq_ops->map_queue(q, i);
+		cpumask_set_cpu(i, hctx->cpumask);
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+}
+
+/**
+ * blk_mq_init_queue - create a multi-queue request queue
+ * @reg:	description of the hardware queues
+ * @driver_data: passed to ->init_hctx()
+ *
+ * Description:
+ *    Sets up a request_queue which bypasses the request_fn/elevator path:
+ *    bios are turned into requests on the submitting cpu and handed to
+ *    ->queue_rq() of the mapped hardware queue.  Returns an ERR_PTR on
+ *    failure.  Must be paired with blk_cleanup_queue().
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct blk_mq_hw_ctx **hctxs;
+	struct blk_mq_ctx *ctx;
+	struct request_queue *q;
+	int i;
+
+	if (!reg->nr_hw_queues ||
+	    !reg->ops->queue_rq || !reg->ops->map_queue ||
+	    !reg->queue_depth || reg->queue_depth > BLK_MQ_MAX_DEPTH)
+		return ERR_PTR(-EINVAL);
+
+	if (reg->nr_hw_queues > nr_cpu_ids)
+		reg->nr_hw_queues = nr_cpu_ids;
+
+	ctx = alloc_percpu(struct blk_mq_ctx);
+	if (!ctx)
+		return ERR_PTR(-ENOMEM);
+
+	hctxs = kzalloc_node(reg->nr_hw_queues * sizeof(*hctxs), GFP_KERNEL,
+			     reg->numa_node);
+	if (!hctxs)
+		goto err_percpu;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctxs[i] = kzalloc_node(sizeof(struct blk_mq_hw_ctx),
+					GFP_KERNEL, reg->numa_node);
+		if (!hctxs[i])
+			goto err_hctxs;
+
+		if (!zalloc_cpumask_var(&hctxs[i]->cpumask, GFP_KERNEL))
+			goto err_hctxs;
+
+		hctxs[i]->numa_node = NUMA_NO_NODE;
+		hctxs[i]->queue_num = i;
+	}
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		goto err_hctxs;
+
+	q->mq_map = kzalloc_node(nr_cpu_ids * sizeof(unsigned int),
+				 GFP_KERNEL, reg->numa_node);
+	if (!q->mq_map)
+		goto err_map;
+
+	blk_mq_update_queue_map(q->mq_map, reg->nr_hw_queues);
+
+	setup_timer(&q->timeout, blk_mq_rq_timer, (unsigned long) q);
+	blk_queue_rq_timeout(q, reg->timeout ? reg->timeout : 30 * HZ);
+
+	q->nr_queues = nr_cpu_ids;
+	q->nr_hw_queues = reg->nr_hw_queues;
+
+	q->queue_ctx = ctx;
+	q->queue_hw_ctx = hctxs;
+
+	q->mq_ops = reg->ops;
+	q->queue_flags |= QUEUE_FLAG_MQ_DEFAULT;
+
+	spin_lock_init(&q->mq_flush_lock);
+	INIT_LIST_HEAD(&q->mq_flush_list);
+	INIT_WORK(&q->mq_flush_work, blk_mq_flush_work);
+
+	/*
+	 * This also sets hw/phys segments, boundary and size
+	 */
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->nr_requests = reg->queue_depth;
+	q->sg_reserved_size = INT_MAX;
+
+	blk_mq_init_cpu_queues(q);
+
+	if (blk_mq_init_hw_queues(q, reg, driver_data))
+		goto err_flag;
+
+	blk_mq_map_swqueue(q);
+	return q;
+
+err_flag:
+	/* don't let blk_release_queue() tear down what never came up */
+	q->mq_ops = NULL;
+	kfree(q->mq_map);
+	q->mq_map = NULL;
+err_map:
+	blk_cleanup_queue(q);
+err_hctxs:
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		if (!hctxs[i])
+			break;
+		free_cpumask_var(hctxs[i]->cpumask);
+		kfree(hctxs[i]);
+	}
+	kfree(hctxs);
+err_percpu:
+	free_percpu(ctx);
+	return ERR_PTR(-ENOMEM);
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called from blk_release_queue() once the last reference to @q is gone.
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	blk_mq_sync_queue(q);
+	blk_mq_exit_hw_queues(q, q->nr_hw_queues);
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		free_cpumask_var(hctx->cpumask);
+		kfree(hctx);
+	}
+
+	kfree(q->queue_hw_ctx);
+	kfree(q->mq_map);
+	free_percpu(q->queue_ctx);
+
+	q->queue_hw_ctx = NULL;
+	q->mq_map = NULL;
+	q->queue_ctx = NULL;
+}
@@ -0,0 +1,60 @@
+#ifndef INT_BLK_MQ_H
+#define INT_BLK_MQ_H
+
+/*
+ * Per-cpu software staging queue.  Submitters insert here without touching
+ * any shared state, the mapped hardware context drains it on dispatch.
+ */
+struct blk_mq_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	rq_list;
+	}  ____cacheline_aligned_in_smp;
+
+	unsigned int		cpu;
+	unsigned int		index_hw;
+
+	/* tag allocation hint, keeps cpus apart in the tag space */
+	unsigned int		last_tag ____cacheline_aligned_in_smp;
+
+	/* incremented at dispatch time */
+	unsigned long		rq_dispatched[2];
+	unsigned long		rq_merged;
+
+	/* incremented at completion time */
+	unsigned long		____cacheline_aligned_in_smp rq_completed[2];
+
+	struct request_queue	*queue;
+};
+
+void blk_mq_drain_queue(struct request_queue *q);
+void blk_mq_free_queue(struct request_queue *q);
+void blk_mq_sync_queue(struct request_queue *q);
+void blk_mq_flush_plug_list(struct blk_plug *plug, bool from_schedule);
+
+/*
+ * Tag allocation, blk-mq-tag.c
+ */
+struct blk_mq_tags {
+	unsigned int		nr_tags;
+	unsigned long		*bitmap;
+	wait_queue_head_t	wait;
+
+	/* preallocated requests, indexed by tag */
+	struct request		**rqs;
+};
+
+#define BLK_MQ_TAG_FAIL		((unsigned int) -1)
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags, int node);
+void blk_mq_free_tags(struct blk_mq_tags *tags);
+unsigned int blk_mq_get_tag(struct blk_mq_tags *tags, unsigned int *hint,
+			    gfp_t gfp);
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag);
+bool blk_mq_has_free_tags(struct blk_mq_tags *tags);
+unsigned int blk_mq_tags_busy(struct blk_mq_tags *tags);
+
+#define blk_mq_for_each_busy_tag(tags, tag)				\
+	for_each_set_bit(tag, (tags)->bitmap, (tags)->nr_tags)
+
+#endif
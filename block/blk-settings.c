@@ -99,6 +99,23 @@ void blk_queue_lld_busy(struct request_queue *q, lld_busy_fn *fn)
 }
 EXPORT_SYMBOL_GPL(blk_queue_lld_busy);
 
+/**
+ * blk_queue_poll_fn - set driver completion polling function
+ * @q:		queue
+ * @fn:		function to reap completions without waiting for an interrupt
+ *
+ * Description:
+ *    Drivers that can check their completion queues from process context
+ *    set this to allow synchronous submitters to spin for completions,
+ *    see blk_poll().  Polling is off until enabled through the io_poll
+ *    sysfs attribute of the queue.
+ */
+void blk_queue_poll_fn(struct request_queue *q, poll_fn *fn)
+{
+	q->poll_fn = fn;
+}
+EXPORT_SYMBOL_GPL(blk_queue_poll_fn);
+
 /**
  * blk_set_default_limits - reset limits to default values
  * @lim:  the queue_limits structure to reset
@@ -2,6 +2,7 @@
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/hdreg.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
@@ -29,11 +30,6 @@ struct virtio_blk
 	/* The disk structure for the kernel. */
 	struct gendisk *disk;
 
-	/* Request tracking. */
-	struct list_head reqs;
-
-	mempool_t *pool;
-
 	/* Process context for config space updates */
 	struct work_struct config_work;
 
@@ -55,7 +51,6 @@ struct virtio_blk
 
 struct virtblk_req
 {
-	struct list_head list;
 	struct request *req;
 	struct virtio_blk_outhdr out_hdr;
 	struct virtio_scsi_inhdr in_hdr;
@@ -68,6 +63,7 @@ static void blk_done(struct virtqueue *vq)
 	struct virtblk_req *vbr;
 	unsigned int len;
 	unsigned long flags;
+	bool done = false;
 
 	spin_lock_irqsave(&vblk->lock, flags);
 	while ((vbr = virtqueue_get_buf(vblk->vq, &len)) != NULL) {
@@ -98,25 +94,26 @@ static void blk_done(struct virtqueue *vq)
 			break;
 		}
 
-		__blk_end_request_all(vbr->req, error);
-		list_del(&vbr->list);
-		mempool_free(vbr, vblk->pool);
+		blk_mq_end_io(vbr->req, error);
+		done = true;
 	}
-	/* In case queue is stopped waiting for more buffers. */
-	blk_start_queue(vblk->disk->queue);
 	spin_unlock_irqrestore(&vblk->lock, flags);
+
+	/* In case queue is stopped waiting for more buffers. */
+	if (done)
+		blk_mq_start_stopped_hw_queues(vblk->disk->queue);
 }
 
-static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
-		   struct request *req)
+static int virtio_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req)
 {
+	struct request_queue *q = hctx->queue;
+	struct virtio_blk *vblk = q->queuedata;
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
 	unsigned long num, out = 0, in = 0;
-	struct virtblk_req *vbr;
+	unsigned long flags;
+	bool notify;
 
-	vbr = mempool_alloc(vblk->pool, GFP_ATOMIC);
-	if (!vbr)
-		/* When another request finishes we'll try again. */
-		return false;
+	BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
 
 	vbr->req = req;
 
@@ -147,6 +144,10 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 		}
 	}
 
+	blk_mq_start_request(req);
+
+	/* The scatterlist is shared, it is protected by the vq lock. */
+	spin_lock_irqsave(&vblk->lock, flags);
 	sg_set_buf(&vblk->sg[out++], &vbr->out_hdr, sizeof(vbr->out_hdr));
 
 	/*
@@ -180,36 +181,34 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 	}
 
 	if (virtqueue_add_buf(vblk->vq, vblk->sg, out, in, vbr, GFP_ATOMIC)<0) {
-		mempool_free(vbr, vblk->pool);
-		return false;
+		/* When another request finishes we'll try again. */
+		virtqueue_kick(vblk->vq);
+		blk_mq_stop_hw_queue(hctx);
+		spin_unlock_irqrestore(&vblk->lock, flags);
+		return BLK_MQ_RQ_QUEUE_BUSY;
 	}
 
-	list_add_tail(&vbr->list, &vblk->reqs);
-	return true;
-}
-
-static void do_virtblk_request(struct request_queue *q)
-{
-	struct virtio_blk *vblk = q->queuedata;
-	struct request *req;
-	unsigned int issued = 0;
+	notify = virtqueue_kick_prepare(vblk->vq);
+	spin_unlock_irqrestore(&vblk->lock, flags);
 
-	while ((req = blk_peek_request(q)) != NULL) {
-		BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
+	if (notify)
+		virtqueue_notify(vblk->vq);
+	return BLK_MQ_RQ_QUEUE_OK;
+}
 
-		/* If this request fails, stop queue and wait for something to
-		   finish to restart it. */
-		if (!do_req(q, vblk, req)) {
-			blk_stop_queue(q);
-			break;
-		}
-		blk_start_request(req);
-		issued++;
-	}
+static struct blk_mq_ops virtio_mq_ops = {
+	.queue_rq	= virtio_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+};
 
-	if (issued)
-		virtqueue_kick(vblk->vq);
-}
+static struct blk_mq_reg virtio_mq_reg = {
+	.ops		= &virtio_mq_ops,
+	.nr_hw_queues	= 1,
+	.queue_depth	= 64,
+	.cmd_size	= sizeof(struct virtblk_req),
+	.numa_node	= NUMA_NO_NODE,
+	.flags		= BLK_MQ_F_SHOULD_MERGE,
+};
 
 /* return id (s/n) string for *disk to *id_str
  */
@@ -409,7 +408,6 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 		goto out_free_index;
 	}
 
-	INIT_LIST_HEAD(&vblk->reqs);
 	spin_lock_init(&vblk->lock);
 	vblk->vdev = vdev;
 	vblk->sg_elems = sg_elems;
@@ -422,24 +420,19 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 	if (err)
 		goto out_free_vblk;
 
-	vblk->pool = mempool_create_kmalloc_pool(1,sizeof(struct virtblk_req));
-	if (!vblk->pool) {
-		err = -ENOMEM;
-		goto out_free_vq;
-	}
-
 	/* FIXME: How many partitions?  How long is a piece of string? */
 	vblk->disk = alloc_disk(1 << PART_BITS);
 	if (!vblk->disk) {
 		err = -ENOMEM;
-		goto out_mempool;
+		goto out_free_vq;
 	}
 
-	q = vblk->disk->queue = blk_init_queue(do_virtblk_request, &vblk->lock);
-	if (!q) {
-		err = -ENOMEM;
+	q = blk_mq_init_queue(&virtio_mq_reg, vblk);
+	if (IS_ERR(q)) {
+		err = PTR_ERR(q);
 		goto out_put_disk;
 	}
+	vblk->disk->queue = q;
 
 	q->queuedata = vblk;
 
@@ -550,8 +543,6 @@ out_del_disk:
 	blk_cleanup_queue(vblk->disk->queue);
 out_put_disk:
 	put_disk(vblk->disk);
-out_mempool:
-	mempool_destroy(vblk->pool);
 out_free_vq:
 	vdev->config->del_vqs(vdev);
 out_free_vblk:
@@ -572,9 +563,6 @@ static void __devexit virtblk_remove(struct virtio_device *vdev)
 	vblk->config_enable = false;
 	mutex_unlock(&vblk->config_lock);
 
-	/* Nothing should be pending. */
-	BUG_ON(!list_empty(&vblk->reqs));
-
 	/* Stop all the virtqueues. */
 	vdev->config->reset(vdev);
 
@@ -583,7 +571,6 @@ static void __devexit virtblk_remove(struct virtio_device *vdev)
 	del_gendisk(vblk->disk);
 	blk_cleanup_queue(vblk->disk->queue);
 	put_disk(vblk->disk);
-	mempool_destroy(vblk->pool);
 	vdev->config->del_vqs(vdev);
 	kfree(vblk);
 	ida_simple_remove(&vd_index_ida, index);
@@ -604,9 +591,7 @@ static int virtblk_freeze(struct virtio_device *vdev)
 
 	flush_work(&vblk->config_work);
 
-	spin_lock_irq(vblk->disk->queue->queue_lock);
-	blk_stop_queue(vblk->disk->queue);
-	spin_unlock_irq(vblk->disk->queue->queue_lock);
+	blk_mq_stop_hw_queues(vblk->disk->queue);
 	blk_sync_queue(vblk->disk->queue);
 
 	vdev->config->del_vqs(vdev);
@@ -620,11 +605,8 @@ static int virtblk_restore(struct virtio_device *vdev)
 
 	vblk->config_enable = true;
 	ret = init_vq(vdev->priv);
-	if (!ret) {
-		spin_lock_irq(vblk->disk->queue->queue_lock);
-		blk_start_queue(vblk->disk->queue);
-		spin_unlock_irq(vblk->disk->queue->queue_lock);
-	}
+	if (!ret)
+		blk_mq_start_stopped_hw_queues(vblk->disk->queue);
 	return ret;
 }
 #endif
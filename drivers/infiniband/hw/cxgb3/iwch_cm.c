@@ -638,7 +638,7 @@ static int act_establish(struct t3cdev *tdev, struct sk_buff *skb, void *ctx)
 
 	PDBG("%s ep %p tid %d\n", __func__, ep, tid);
 
-	dst_confirm(ep->dst);
+	dst_confirm_neigh(ep->dst, &ep->com.remote_addr.sin_addr.s_addr);
 
 	/* setup the hwtid for this connection */
 	ep->hwtid = tid;
@@ -1101,7 +1101,7 @@ static int tx_ack(struct t3cdev *tdev, struct sk_buff *skb, void *ctx)
 
 	spin_lock_irqsave(&ep->com.lock, flags);
 	BUG_ON(credits != 1);
-	dst_confirm(ep->dst);
+	dst_confirm_neigh(ep->dst, &ep->com.remote_addr.sin_addr.s_addr);
 	if (!ep->mpa_skb) {
 		PDBG("%s rdma_init wr_ack ep %p state %u\n",
 			__func__, ep, ep->com.state);
@@ -1374,7 +1374,7 @@ static int pass_accept_req(struct t3cdev *tdev, struct sk_buff *skb, void *ctx)
 		goto reject;
 	}
 	dst = &rt->dst;
-	l2t = t3_l2t_get(tdev, dst, NULL);
+	l2t = t3_l2t_get(tdev, dst, NULL, &req->peer_ip);
 	if (!l2t) {
 		printk(KERN_ERR MOD "%s - failed to allocate l2t entry!\n",
 		       __func__);
@@ -1425,7 +1425,7 @@ static int pass_establish(struct t3cdev *tdev, struct sk_buff *skb, void *ctx)
 
 	set_emss(ep, ntohs(req->tcp_opt));
 
-	dst_confirm(ep->dst);
+	dst_confirm_neigh(ep->dst, &ep->com.remote_addr.sin_addr.s_addr);
 	state_set(&ep->com, MPA_REQ_WAIT);
 	start_ep_timer(ep);
 
@@ -1441,7 +1441,7 @@ static int peer_close(struct t3cdev *tdev, struct sk_buff *skb, void *ctx)
 	int release = 0;
 
 	PDBG("%s ep %p\n", __func__, ep);
-	dst_confirm(ep->dst);
+	dst_confirm_neigh(ep->dst, &ep->com.remote_addr.sin_addr.s_addr);
 
 	spin_lock_irqsave(&ep->com.lock, flags);
 	switch (ep->com.state) {
@@ -1607,7 +1607,7 @@ static int peer_abort(struct t3cdev *tdev, struct sk_buff *skb, void *ctx)
 		BUG_ON(1);
 		break;
 	}
-	dst_confirm(ep->dst);
+	dst_confirm_neigh(ep->dst, &ep->com.remote_addr.sin_addr.s_addr);
 	if (ep->com.state != ABORTING) {
 		__state_set(&ep->com, DEAD);
 		release = 1;
@@ -1942,7 +1942,8 @@ int iwch_connect(struct iw_cm_id *cm_id, struct iw_cm_conn_param *conn_param)
 		goto fail3;
 	}
 	ep->dst = &rt->dst;
-	ep->l2t = t3_l2t_get(ep->com.tdev, ep->dst, NULL);
+	ep->l2t = t3_l2t_get(ep->com.tdev, ep->dst, NULL,
+			     &cm_id->remote_addr.sin_addr.s_addr);
 	if (!ep->l2t) {
 		printk(KERN_ERR MOD "%s - cannot alloc l2e.\n", __func__);
 		err = -ENOMEM;
@@ -173,7 +173,8 @@ void iwch_ev_dispatch(struct cxio_rdev *rdev_p, struct sk_buff *skb)
 		 * Confirm the destination entry if this is a RECV completion.
 		 */
 		if (qhp->ep && SQ_TYPE(rsp_msg->cqe))
-			dst_confirm(qhp->ep->dst);
+			dst_confirm_neigh(qhp->ep->dst,
+					  &qhp->ep->com.remote_addr.sin_addr.s_addr);
 		spin_lock_irqsave(&chp->comp_handler_lock, flag);
 		(*chp->ibcq.comp_handler)(&chp->ibcq, chp->ibcq.cq_context);
 		spin_unlock_irqrestore(&chp->comp_handler_lock, flag);
@@ -766,7 +766,7 @@ static int act_establish(struct c4iw_dev *dev, struct sk_buff *skb)
 	PDBG("%s ep %p tid %u snd_isn %u rcv_isn %u\n", __func__, ep, tid,
 	     be32_to_cpu(req->snd_isn), be32_to_cpu(req->rcv_isn));
 
-	dst_confirm(ep->dst);
+	dst_confirm_neigh(ep->dst, &ep->com.remote_addr.sin_addr.s_addr);
 
 	/* setup the hwtid for this connection */
 	ep->hwtid = tid;
@@ -1712,7 +1712,7 @@ static int pass_establish(struct c4iw_dev *dev, struct sk_buff *skb)
 
 	set_emss(ep, ntohs(req->tcp_opt));
 
-	dst_confirm(ep->dst);
+	dst_confirm_neigh(ep->dst, &ep->com.remote_addr.sin_addr.s_addr);
 	state_set(&ep->com, MPA_REQ_WAIT);
 	start_ep_timer(ep);
 	send_flowc(ep, skb);
@@ -1733,7 +1733,7 @@ static int peer_close(struct c4iw_dev *dev, struct sk_buff *skb)
 
 	ep = lookup_tid(t, tid);
 	PDBG("%s ep %p tid %u\n", __func__, ep, ep->hwtid);
-	dst_confirm(ep->dst);
+	dst_confirm_neigh(ep->dst, &ep->com.remote_addr.sin_addr.s_addr);
 
 	mutex_lock(&ep->com.mutex);
 	switch (ep->com.state) {
@@ -1967,7 +1967,7 @@ static int peer_abort(struct c4iw_dev *dev, struct sk_buff *skb)
 		BUG_ON(1);
 		break;
 	}
-	dst_confirm(ep->dst);
+	dst_confirm_neigh(ep->dst, &ep->com.remote_addr.sin_addr.s_addr);
 	if (ep->com.state != ABORTING) {
 		__state_set(&ep->com, DEAD);
 		/* we don't release if we want to retry with mpa_v1 */
@@ -2095,7 +2095,7 @@ static int fw4_ack(struct c4iw_dev *dev, struct sk_buff *skb)
 		return 0;
 	}
 
-	dst_confirm(ep->dst);
+	dst_confirm_neigh(ep->dst, &ep->com.remote_addr.sin_addr.s_addr);
 	if (ep->mpa_skb) {
 		PDBG("%s last streaming msg ack ep %p tid %u state %u "
 		     "initiator %u freeing skb\n", __func__, ep, ep->hwtid,
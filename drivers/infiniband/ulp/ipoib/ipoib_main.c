@@ -710,12 +710,19 @@ static int ipoib_start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct ipoib_dev_priv *priv = netdev_priv(dev);
 	struct ipoib_neigh *neigh;
-	struct neighbour *n = NULL;
+	struct neighbour *n = NULL, *n_ref = NULL;
 	unsigned long flags;
 
 	rcu_read_lock();
 	if (likely(skb_dst(skb))) {
 		n = dst_get_neighbour_noref(skb_dst(skb));
+		/* IPv4 routes shared by an on-link nexthop have none bound */
+		if (!n && skb->protocol == htons(ETH_P_IP)) {
+			n = dst_neigh_lookup(skb_dst(skb), &ip_hdr(skb)->daddr);
+			if (IS_ERR(n))
+				n = NULL;
+			n_ref = n;
+		}
 		if (!n) {
 			++dev->stats.tx_dropped;
 			dev_kfree_skb_any(skb);
@@ -797,6 +804,8 @@ static int ipoib_start_xmit(struct sk_buff *skb, struct net_device *dev)
 		}
 	}
 unlock:
+	if (n_ref)
+		neigh_release(n_ref);
 	rcu_read_unlock();
 	return NETDEV_TX_OK;
 }
@@ -1522,6 +1522,7 @@ struct dm_bufio_client *dm_bufio_client_create(struct block_device *bdev, unsign
 	c->shrinker.shrink = shrink;
 	c->shrinker.seeks = 1;
 	c->shrinker.batch = 0;
+	c->shrinker.flags = 0;
 	register_shrinker(&c->shrinker);
 
 	return c;
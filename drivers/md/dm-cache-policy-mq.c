@@ -0,0 +1,883 @@
+/*
+ * Copyright (C) 2012 Red Hat. All rights reserved.
+ *
+ * This file is released under the GPL.
+ */
+
+#include "dm-cache-policy.h"
+#include "dm.h"
+
+#include <linux/hash.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache-policy-mq"
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Tracks whether the io is mostly sequential or random.  Sequential io
+ * is left on the origin; spinning disks are good at it and promoting it
+ * would just churn the cache.
+ */
+enum io_pattern {
+	PATTERN_SEQUENTIAL,
+	PATTERN_RANDOM
+};
+
+#define DEFAULT_SEQUENTIAL_THRESHOLD 512
+#define DEFAULT_RANDOM_THRESHOLD 4
+
+struct io_tracker {
+	enum io_pattern pattern;
+
+	unsigned nr_seq_samples;
+	unsigned nr_rand_samples;
+	unsigned thresholds[2];
+
+	sector_t next_start;
+};
+
+static void iot_init(struct io_tracker *t)
+{
+	t->pattern = PATTERN_RANDOM;
+	t->nr_seq_samples = 0;
+	t->nr_rand_samples = 0;
+	t->thresholds[PATTERN_SEQUENTIAL] = DEFAULT_SEQUENTIAL_THRESHOLD;
+	t->thresholds[PATTERN_RANDOM] = DEFAULT_RANDOM_THRESHOLD;
+	t->next_start = 0;
+}
+
+static void iot_update_stats(struct io_tracker *t, struct bio *bio)
+{
+	if (bio->bi_sector == t->next_start) {
+		t->nr_seq_samples++;
+		t->nr_rand_samples = 0;
+	} else {
+		t->nr_rand_samples++;
+		t->nr_seq_samples = 0;
+	}
+
+	t->next_start = bio->bi_sector + bio_sectors(bio);
+}
+
+static void iot_check_for_pattern_switch(struct io_tracker *t)
+{
+	switch (t->pattern) {
+	case PATTERN_SEQUENTIAL:
+		if (t->nr_rand_samples >= t->thresholds[PATTERN_RANDOM]) {
+			t->pattern = PATTERN_RANDOM;
+			t->nr_seq_samples = t->nr_rand_samples = 0;
+		}
+		break;
+
+	case PATTERN_RANDOM:
+		if (t->nr_seq_samples >= t->thresholds[PATTERN_SEQUENTIAL]) {
+			t->pattern = PATTERN_SEQUENTIAL;
+			t->nr_seq_samples = t->nr_rand_samples = 0;
+		}
+		break;
+	}
+}
+
+static void iot_examine_bio(struct io_tracker *t, struct bio *bio)
+{
+	iot_update_stats(t, bio);
+	iot_check_for_pattern_switch(t);
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * A multiqueue: entries are kept on one of NR_QUEUE_LEVELS lru lists
+ * chosen by the log2 of their hit count.  Popping takes the oldest entry
+ * from the least used level.
+ */
+#define NR_QUEUE_LEVELS 16u
+
+struct queue {
+	struct list_head qs[NR_QUEUE_LEVELS];
+};
+
+static void queue_init(struct queue *q)
+{
+	unsigned i;
+
+	for (i = 0; i < NR_QUEUE_LEVELS; i++)
+		INIT_LIST_HEAD(q->qs + i);
+}
+
+static void queue_push(struct queue *q, unsigned level, struct list_head *elt)
+{
+	list_add_tail(elt, q->qs + level);
+}
+
+static void queue_remove(struct list_head *elt)
+{
+	list_del(elt);
+}
+
+static struct list_head *queue_pop(struct queue *q)
+{
+	unsigned i;
+	struct list_head *r;
+
+	for (i = 0; i < NR_QUEUE_LEVELS; i++)
+		if (!list_empty(q->qs + i)) {
+			r = q->qs[i].next;
+			list_del(r);
+			return r;
+		}
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------*/
+
+struct entry {
+	struct hlist_node hlist;
+	struct list_head list;
+	dm_oblock_t oblock;
+	dm_cblock_t cblock;
+	bool in_cache:1;
+	bool dirty:1;
+	unsigned hit_count;
+	unsigned generation;
+};
+
+/*
+ * Hit counts are halved once per generation so old popularity fades.
+ * Rather than walk every entry, the decay is applied lazily whenever an
+ * entry is touched.
+ */
+#define MIN_GENERATION_PERIOD 1024u
+
+/*
+ * The hit count a block on the origin needs to collect before it is
+ * promoted, on top of the mq->promote_threshold.  Writes cost more to
+ * promote than reads since they dirty the cache block.
+ */
+#define READ_PROMOTE_THRESHOLD 4u
+#define WRITE_PROMOTE_THRESHOLD 8u
+
+struct mq_policy {
+	struct dm_cache_policy policy;
+
+	/* protects everything */
+	struct mutex lock;
+
+	dm_cblock_t cache_size;
+	struct io_tracker tracker;
+
+	/*
+	 * Entries for blocks on the origin that we're keeping an eye on,
+	 * and entries for the blocks in the cache, split by whether
+	 * they're dirty.
+	 */
+	struct queue pre_cache;
+	struct queue cache_clean;
+	struct queue cache_dirty;
+
+	/*
+	 * Preallocated entries, twice as many as cache blocks so the
+	 * pre_cache can track as many blocks as the cache holds.
+	 */
+	unsigned nr_entries;
+	unsigned nr_entries_allocated;
+	struct list_head free;
+	struct entry *entries;
+
+	/* which cache blocks are in use */
+	unsigned long *allocation_bitset;
+	unsigned nr_cblocks_allocated;
+	unsigned find_free_last_word;
+
+	unsigned generation;
+	unsigned generation_period;
+	unsigned nr_ticks;
+
+	/*
+	 * Raised to the hit count of the last demoted block, so a block
+	 * has to be at least as popular as the one it evicts.
+	 */
+	unsigned promote_threshold;
+
+	/* origin block -> entry */
+	unsigned hash_bits;
+	struct hlist_head *table;
+};
+
+static struct mq_policy *to_mq_policy(struct dm_cache_policy *p)
+{
+	return container_of(p, struct mq_policy, policy);
+}
+
+/*----------------------------------------------------------------*/
+
+static void hash_insert(struct mq_policy *mq, struct entry *e)
+{
+	unsigned h = hash_64(from_oblock(e->oblock), mq->hash_bits);
+
+	hlist_add_head(&e->hlist, mq->table + h);
+}
+
+static struct entry *hash_lookup(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	unsigned h = hash_64(from_oblock(oblock), mq->hash_bits);
+	struct hlist_head *bucket = mq->table + h;
+	struct hlist_node *tmp;
+	struct entry *e;
+
+	hlist_for_each_entry(e, tmp, bucket, hlist)
+		if (e->oblock == oblock) {
+			/* move to the front of the bucket */
+			hlist_del(&e->hlist);
+			hlist_add_head(&e->hlist, bucket);
+			return e;
+		}
+
+	return NULL;
+}
+
+static void hash_remove(struct entry *e)
+{
+	hlist_del(&e->hlist);
+}
+
+/*----------------------------------------------------------------*/
+
+static struct entry *alloc_entry(struct mq_policy *mq)
+{
+	struct entry *e;
+
+	if (list_empty(&mq->free))
+		return NULL;
+
+	e = list_entry(mq->free.next, struct entry, list);
+	list_del_init(&e->list);
+	INIT_HLIST_NODE(&e->hlist);
+	mq->nr_entries_allocated++;
+
+	return e;
+}
+
+static void free_entry(struct mq_policy *mq, struct entry *e)
+{
+	BUG_ON(!mq->nr_entries_allocated);
+	mq->nr_entries_allocated--;
+	list_add(&e->list, &mq->free);
+}
+
+static bool any_free_cblocks(struct mq_policy *mq)
+{
+	return mq->nr_cblocks_allocated < from_cblock(mq->cache_size);
+}
+
+static int alloc_cblock(struct mq_policy *mq, dm_cblock_t *result)
+{
+	unsigned long nr = from_cblock(mq->cache_size);
+	unsigned long b;
+
+	b = find_next_zero_bit(mq->allocation_bitset, nr,
+			       mq->find_free_last_word * BITS_PER_LONG);
+	if (b >= nr)
+		b = find_first_zero_bit(mq->allocation_bitset, nr);
+	if (b >= nr)
+		return -ENOSPC;
+
+	set_bit(b, mq->allocation_bitset);
+	mq->nr_cblocks_allocated++;
+	mq->find_free_last_word = b / BITS_PER_LONG;
+	*result = to_cblock(b);
+
+	return 0;
+}
+
+static void free_cblock(struct mq_policy *mq, dm_cblock_t cblock)
+{
+	BUG_ON(from_cblock(cblock) >= from_cblock(mq->cache_size));
+	BUG_ON(!test_bit(from_cblock(cblock), mq->allocation_bitset));
+
+	clear_bit(from_cblock(cblock), mq->allocation_bitset);
+	mq->nr_cblocks_allocated--;
+}
+
+/*----------------------------------------------------------------*/
+
+static unsigned queue_level(struct entry *e)
+{
+	return min((unsigned) ilog2(e->hit_count + 1), NR_QUEUE_LEVELS - 1u);
+}
+
+static struct queue *entry_queue(struct mq_policy *mq, struct entry *e)
+{
+	if (!e->in_cache)
+		return &mq->pre_cache;
+
+	return e->dirty ? &mq->cache_dirty : &mq->cache_clean;
+}
+
+/*
+ * Inserts the entry into the hash table and the appropriate queue.
+ */
+static void push(struct mq_policy *mq, struct entry *e)
+{
+	hash_insert(mq, e);
+	queue_push(entry_queue(mq, e), queue_level(e), &e->list);
+}
+
+/*
+ * Removes an entry from both the hash table and its queue.
+ */
+static void del(struct mq_policy *mq, struct entry *e)
+{
+	queue_remove(&e->list);
+	hash_remove(e);
+}
+
+/*
+ * Like del, except it removes the oldest entry of the least used level.
+ */
+static struct entry *pop(struct mq_policy *mq, struct queue *q)
+{
+	struct entry *e;
+	struct list_head *h = queue_pop(q);
+
+	if (!h)
+		return NULL;
+
+	e = container_of(h, struct entry, list);
+	hash_remove(e);
+
+	return e;
+}
+
+static void requeue_entry(struct mq_policy *mq, struct entry *e)
+{
+	queue_remove(&e->list);
+	queue_push(entry_queue(mq, e), queue_level(e), &e->list);
+}
+
+/*
+ * Applies any generations of decay the entry has missed.
+ */
+static void age_entry(struct mq_policy *mq, struct entry *e)
+{
+	unsigned delta = mq->generation - e->generation;
+
+	e->hit_count = delta >= 32 ? 0 : e->hit_count >> delta;
+	e->generation = mq->generation;
+}
+
+static void hit_entry(struct mq_policy *mq, struct entry *e)
+{
+	age_entry(mq, e);
+	e->hit_count++;
+	requeue_entry(mq, e);
+}
+
+static void tick(struct mq_policy *mq)
+{
+	if (++mq->nr_ticks >= mq->generation_period) {
+		mq->nr_ticks = 0;
+		mq->generation++;
+		mq->promote_threshold >>= 1;
+	}
+}
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Finds a cache block for promotion, demoting the least used clean block
+ * if the cache is full.  Returns false if there's nothing that can go.
+ */
+static bool find_cblock(struct mq_policy *mq, struct policy_result *result)
+{
+	struct entry *demoted;
+
+	if (any_free_cblocks(mq)) {
+		alloc_cblock(mq, &result->cblock);
+		result->op = POLICY_NEW;
+		return true;
+	}
+
+	demoted = pop(mq, &mq->cache_clean);
+	if (!demoted)
+		return false;
+
+	age_entry(mq, demoted);
+	mq->promote_threshold = demoted->hit_count;
+
+	result->op = POLICY_REPLACE;
+	result->old_oblock = demoted->oblock;
+	result->cblock = demoted->cblock;
+
+	/* keep an eye on the demoted block in case it comes back */
+	demoted->in_cache = false;
+	demoted->dirty = false;
+	push(mq, demoted);
+
+	return true;
+}
+
+static unsigned adjusted_promote_threshold(struct mq_policy *mq, int data_dir)
+{
+	return mq->promote_threshold +
+		(data_dir == WRITE ? WRITE_PROMOTE_THRESHOLD : READ_PROMOTE_THRESHOLD);
+}
+
+static bool should_promote(struct mq_policy *mq, struct entry *e,
+			   bool can_migrate, int data_dir)
+{
+	return can_migrate &&
+		mq->tracker.pattern == PATTERN_RANDOM &&
+		e->hit_count >= adjusted_promote_threshold(mq, data_dir);
+}
+
+static void promote(struct mq_policy *mq, struct entry *e,
+		    struct policy_result *result)
+{
+	if (!find_cblock(mq, result)) {
+		result->op = POLICY_MISS;
+		return;
+	}
+
+	del(mq, e);
+	e->in_cache = true;
+	e->dirty = false;
+	e->cblock = result->cblock;
+	push(mq, e);
+}
+
+/*
+ * Starts tracking a block we've not seen before, recycling the least
+ * used pre_cache entry if all are in use.
+ */
+static void insert_in_pre_cache(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	struct entry *e = alloc_entry(mq);
+
+	if (!e) {
+		e = pop(mq, &mq->pre_cache);
+		if (unlikely(!e)) {
+			DMWARN("couldn't pop from pre cache");
+			return;
+		}
+	}
+
+	e->oblock = oblock;
+	e->in_cache = false;
+	e->dirty = false;
+	e->hit_count = 1;
+	e->generation = mq->generation;
+	push(mq, e);
+}
+
+static void map(struct mq_policy *mq, dm_oblock_t oblock, bool can_migrate,
+		struct bio *bio, struct policy_result *result)
+{
+	struct entry *e = hash_lookup(mq, oblock);
+
+	if (e && e->in_cache) {
+		hit_entry(mq, e);
+		result->op = POLICY_HIT;
+		result->cblock = e->cblock;
+		return;
+	}
+
+	result->op = POLICY_MISS;
+
+	if (mq->tracker.pattern == PATTERN_SEQUENTIAL)
+		return;
+
+	if (!e) {
+		insert_in_pre_cache(mq, oblock);
+		return;
+	}
+
+	hit_entry(mq, e);
+	if (should_promote(mq, e, can_migrate, bio_data_dir(bio)))
+		promote(mq, e, result);
+}
+
+/*----------------------------------------------------------------*/
+
+static void mq_destroy(struct dm_cache_policy *p)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	vfree(mq->table);
+	vfree(mq->allocation_bitset);
+	vfree(mq->entries);
+	kfree(mq);
+}
+
+static int mq_map(struct dm_cache_policy *p, dm_oblock_t oblock,
+		  bool can_block, bool can_migrate,
+		  struct bio *bio, struct policy_result *result)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	if (can_block)
+		mutex_lock(&mq->lock);
+	else if (!mutex_trylock(&mq->lock))
+		return -EWOULDBLOCK;
+
+	iot_examine_bio(&mq->tracker, bio);
+	tick(mq);
+	map(mq, oblock, can_migrate, bio, result);
+
+	mutex_unlock(&mq->lock);
+
+	return 0;
+}
+
+static void __mq_set_clear_dirty(struct mq_policy *mq, dm_oblock_t oblock,
+				 bool set)
+{
+	struct entry *e = hash_lookup(mq, oblock);
+
+	/*
+	 * The core may race a write hit against the block being picked
+	 * for demotion; it puts the block back with force_mapping() and
+	 * sets it dirty again if so.
+	 */
+	if (!e || !e->in_cache)
+		return;
+
+	if (e->dirty == set)
+		return;
+
+	queue_remove(&e->list);
+	e->dirty = set;
+	queue_push(entry_queue(mq, e), queue_level(e), &e->list);
+}
+
+static void mq_set_dirty(struct dm_cache_policy *p, dm_oblock_t oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	mutex_lock(&mq->lock);
+	__mq_set_clear_dirty(mq, oblock, true);
+	mutex_unlock(&mq->lock);
+}
+
+static void mq_clear_dirty(struct dm_cache_policy *p, dm_oblock_t oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	mutex_lock(&mq->lock);
+	__mq_set_clear_dirty(mq, oblock, false);
+	mutex_unlock(&mq->lock);
+}
+
+static int mq_load_mapping(struct dm_cache_policy *p,
+			   dm_oblock_t oblock, dm_cblock_t cblock,
+			   bool dirty)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+	int r = 0;
+
+	mutex_lock(&mq->lock);
+
+	if (from_cblock(cblock) >= from_cblock(mq->cache_size) ||
+	    test_bit(from_cblock(cblock), mq->allocation_bitset)) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	e = alloc_entry(mq);
+	if (!e) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	set_bit(from_cblock(cblock), mq->allocation_bitset);
+	mq->nr_cblocks_allocated++;
+
+	e->oblock = oblock;
+	e->cblock = cblock;
+	e->in_cache = true;
+	e->dirty = dirty;
+	e->hit_count = 1;
+	e->generation = mq->generation;
+	push(mq, e);
+
+out:
+	mutex_unlock(&mq->lock);
+
+	return r;
+}
+
+static int walk_queue(struct queue *q, policy_walk_fn fn, void *context)
+{
+	int r;
+	unsigned level;
+	struct entry *e;
+
+	for (level = 0; level < NR_QUEUE_LEVELS; level++)
+		list_for_each_entry(e, q->qs + level, list) {
+			r = fn(context, e->cblock, e->oblock);
+			if (r)
+				return r;
+		}
+
+	return 0;
+}
+
+static int mq_walk_mappings(struct dm_cache_policy *p, policy_walk_fn fn,
+			    void *context)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	int r;
+
+	mutex_lock(&mq->lock);
+
+	r = walk_queue(&mq->cache_clean, fn, context);
+	if (!r)
+		r = walk_queue(&mq->cache_dirty, fn, context);
+
+	mutex_unlock(&mq->lock);
+
+	return r;
+}
+
+static void mq_remove_mapping(struct dm_cache_policy *p, dm_oblock_t oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+
+	mutex_lock(&mq->lock);
+
+	e = hash_lookup(mq, oblock);
+	BUG_ON(!e || !e->in_cache);
+
+	del(mq, e);
+	free_cblock(mq, e->cblock);
+	free_entry(mq, e);
+
+	mutex_unlock(&mq->lock);
+}
+
+static void mq_force_mapping(struct dm_cache_policy *p,
+			     dm_oblock_t current_oblock, dm_oblock_t new_oblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+
+	mutex_lock(&mq->lock);
+
+	/* drop any pre_cache entry the demotion left behind */
+	e = hash_lookup(mq, new_oblock);
+	if (e) {
+		BUG_ON(e->in_cache);
+		del(mq, e);
+		free_entry(mq, e);
+	}
+
+	e = hash_lookup(mq, current_oblock);
+	BUG_ON(!e || !e->in_cache);
+
+	del(mq, e);
+	e->oblock = new_oblock;
+	e->dirty = false;
+	push(mq, e);
+
+	mutex_unlock(&mq->lock);
+}
+
+static int mq_writeback_work(struct dm_cache_policy *p, dm_oblock_t *oblock,
+			     dm_cblock_t *cblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e;
+	int r = 0;
+
+	mutex_lock(&mq->lock);
+
+	e = pop(mq, &mq->cache_dirty);
+	if (!e) {
+		r = -ENODATA;
+		goto out;
+	}
+
+	*oblock = e->oblock;
+	*cblock = e->cblock;
+	e->dirty = false;
+	push(mq, e);
+
+out:
+	mutex_unlock(&mq->lock);
+
+	return r;
+}
+
+static dm_cblock_t mq_residency(struct dm_cache_policy *p)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	dm_cblock_t r;
+
+	mutex_lock(&mq->lock);
+	r = to_cblock(mq->nr_cblocks_allocated);
+	mutex_unlock(&mq->lock);
+
+	return r;
+}
+
+static int mq_status(struct dm_cache_policy *p, status_type_t type,
+		     char *result, unsigned maxlen)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	ssize_t sz = 0;
+
+	mutex_lock(&mq->lock);
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		DMEMIT("%u %u", mq->promote_threshold,
+		       mq->tracker.pattern == PATTERN_SEQUENTIAL);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("4 sequential_threshold %u random_threshold %u",
+		       mq->tracker.thresholds[PATTERN_SEQUENTIAL],
+		       mq->tracker.thresholds[PATTERN_RANDOM]);
+		break;
+	}
+
+	mutex_unlock(&mq->lock);
+
+	return 0;
+}
+
+static int mq_set_config_value(struct dm_cache_policy *p,
+			       const char *key, const char *value)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	enum io_pattern pattern;
+	unsigned long tmp;
+
+	if (!strcasecmp(key, "sequential_threshold"))
+		pattern = PATTERN_SEQUENTIAL;
+	else if (!strcasecmp(key, "random_threshold"))
+		pattern = PATTERN_RANDOM;
+	else
+		return -EINVAL;
+
+	if (kstrtoul(value, 10, &tmp) || !tmp || tmp > UINT_MAX)
+		return -EINVAL;
+
+	mutex_lock(&mq->lock);
+	mq->tracker.thresholds[pattern] = tmp;
+	mutex_unlock(&mq->lock);
+
+	return 0;
+}
+
+/*----------------------------------------------------------------*/
+
+static void init_policy_functions(struct mq_policy *mq)
+{
+	mq->policy.destroy = mq_destroy;
+	mq->policy.map = mq_map;
+	mq->policy.set_dirty = mq_set_dirty;
+	mq->policy.clear_dirty = mq_clear_dirty;
+	mq->policy.load_mapping = mq_load_mapping;
+	mq->policy.walk_mappings = mq_walk_mappings;
+	mq->policy.remove_mapping = mq_remove_mapping;
+	mq->policy.force_mapping = mq_force_mapping;
+	mq->policy.writeback_work = mq_writeback_work;
+	mq->policy.residency = mq_residency;
+	mq->policy.status = mq_status;
+	mq->policy.set_config_value = mq_set_config_value;
+}
+
+static struct dm_cache_policy *mq_create(dm_cblock_t cache_size,
+					 sector_t origin_size,
+					 sector_t cache_block_size)
+{
+	unsigned i, nr_buckets;
+	struct mq_policy *mq = kzalloc(sizeof(*mq), GFP_KERNEL);
+
+	if (!mq)
+		return NULL;
+
+	init_policy_functions(mq);
+	mutex_init(&mq->lock);
+	iot_init(&mq->tracker);
+
+	mq->cache_size = cache_size;
+	mq->generation_period = max(from_cblock(cache_size), MIN_GENERATION_PERIOD);
+
+	queue_init(&mq->pre_cache);
+	queue_init(&mq->cache_clean);
+	queue_init(&mq->cache_dirty);
+
+	INIT_LIST_HEAD(&mq->free);
+	mq->nr_entries = 2 * from_cblock(cache_size);
+	mq->entries = vzalloc(sizeof(*mq->entries) * mq->nr_entries);
+	if (!mq->entries)
+		goto bad_entries;
+
+	for (i = 0; i < mq->nr_entries; i++)
+		list_add(&mq->entries[i].list, &mq->free);
+
+	mq->allocation_bitset = vzalloc(BITS_TO_LONGS(from_cblock(cache_size)) *
+					sizeof(unsigned long));
+	if (!mq->allocation_bitset)
+		goto bad_bitset;
+
+	nr_buckets = roundup_pow_of_two(max(mq->nr_entries / 4u, 16u));
+	mq->hash_bits = ffs(nr_buckets) - 1;
+	mq->table = vzalloc(sizeof(*mq->table) * nr_buckets);
+	if (!mq->table)
+		goto bad_table;
+
+	for (i = 0; i < nr_buckets; i++)
+		INIT_HLIST_HEAD(mq->table + i);
+
+	return &mq->policy;
+
+bad_table:
+	vfree(mq->allocation_bitset);
+bad_bitset:
+	vfree(mq->entries);
+bad_entries:
+	kfree(mq);
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------*/
+
+static struct dm_cache_policy_type mq_policy_type = {
+	.name = "mq",
+	.owner = THIS_MODULE,
+	.create = mq_create
+};
+
+static int __init mq_init(void)
+{
+	int r = dm_cache_policy_register(&mq_policy_type);
+
+	if (!r)
+		DMINFO("version 1.0.0 loaded");
+	else
+		DMERR("register failed %d", r);
+
+	return r;
+}
+
+static void __exit mq_exit(void)
+{
+	dm_cache_policy_unregister(&mq_policy_type);
+}
+
+module_init(mq_init);
+module_exit(mq_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("mq cache policy");
@@ -0,0 +1,1790 @@
+/*
+ * Copyright (C) 2012 Red Hat. All rights reserved.
+ *
+ * This file is released under the GPL.
+ */
+
+#include "dm.h"
+#include "dm-bio-prison.h"
+#include "dm-bio-record.h"
+#include "dm-cache-metadata.h"
+#include "dm-cache-policy-internal.h"
+
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+#include <linux/init.h>
+#include <linux/mempool.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache"
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Tunable constants
+ */
+#define ENDIO_HOOK_POOL_SIZE 1024
+#define WRITETHROUGH_POOL_SIZE 64
+#define MIGRATION_POOL_SIZE 128
+#define PRISON_CELLS 1024
+#define COMMIT_PERIOD HZ
+
+/*
+ * Background writeback of dirty blocks may use at most this many
+ * migrations at once; the rest are left for promotions.
+ */
+#define WRITEBACK_MIGRATIONS (MIGRATION_POOL_SIZE / 4)
+
+/*
+ * The block size of the cache.  Small blocks mean more metadata and
+ * more copying overhead per byte cached, big ones waste cache space on
+ * cold data sitting next to hot.
+ */
+#define DATA_DEV_BLOCK_SIZE_MIN_SECTORS (32 * 1024 >> SECTOR_SHIFT)
+#define DATA_DEV_BLOCK_SIZE_MAX_SECTORS (1024 * 1024 * 1024 >> SECTOR_SHIFT)
+
+/*----------------------------------------------------------------*/
+
+/*
+ * Writeback: writes to cached blocks go to the cache only and the block
+ * is marked dirty, to be copied back to the origin later.
+ *
+ * Writethrough: writes to cached blocks go to the origin, and then to
+ * the cache, so the origin is always up to date.
+ */
+enum cache_mode {
+	CM_WRITEBACK,
+	CM_WRITETHROUGH
+};
+
+struct cache_features {
+	enum cache_mode mode;
+};
+
+struct cache_stats {
+	atomic_t read_hit;
+	atomic_t read_miss;
+	atomic_t write_hit;
+	atomic_t write_miss;
+	atomic_t demotion;
+	atomic_t promotion;
+	atomic_t writeback;
+};
+
+struct cache {
+	struct dm_target *ti;
+
+	/*
+	 * Metadata is written to this device.
+	 */
+	struct dm_dev *metadata_dev;
+
+	/*
+	 * The slower of the two data devices.  Typically a spindle.
+	 */
+	struct dm_dev *origin_dev;
+
+	/*
+	 * The faster of the two data devices.  Typically an SSD.
+	 */
+	struct dm_dev *cache_dev;
+
+	struct dm_cache_metadata *cmd;
+
+	/*
+	 * Size of the origin device in _complete_ blocks.  A partial
+	 * block at the end of the origin is never cached.
+	 */
+	dm_oblock_t origin_blocks;
+
+	/*
+	 * Size of the cache device in blocks.
+	 */
+	dm_cblock_t cache_size;
+
+	sector_t sectors_per_block;
+	int sectors_per_block_shift;
+
+	struct cache_features features;
+	struct dm_cache_policy *policy;
+
+	/*
+	 * Protects the lists that end_io and the kcopyd callback add to.
+	 */
+	spinlock_t lock;
+	struct bio_list deferred_bios;
+	struct bio_list deferred_writethrough_bios;
+	struct list_head quiesced_migrations;
+	struct list_head completed_migrations;
+
+	/*
+	 * Only touched by the worker.
+	 */
+	struct bio_list deferred_flush_bios;
+	struct list_head need_commit_migrations;
+
+	atomic_t nr_migrations;
+	wait_queue_head_t migration_wait;
+
+	/*
+	 * cache_size bits, set if the cache block holds data newer than
+	 * the origin.
+	 */
+	atomic_t nr_dirty;
+	unsigned long *dirty_bitset;
+
+	struct dm_kcopyd_client *copier;
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct delayed_work waker;
+	unsigned long last_commit_jiffies;
+
+	struct dm_bio_prison *prison;
+	struct dm_deferred_set *all_io_ds;
+
+	mempool_t *endio_hook_pool;
+	mempool_t *writethrough_pool;
+	mempool_t *migration_pool;
+	struct dm_cache_migration *next_migration;
+
+	bool loaded_mappings:1;
+	bool quiescing:1;
+
+	struct cache_stats stats;
+};
+
+struct dm_cache_endio_hook {
+	struct dm_deferred_entry *all_io_entry;
+};
+
+/*
+ * Writethrough write hits go to the origin first.  This records what's
+ * needed to reissue the bio to the cache when that completes.  Kept out
+ * of the endio hook since struct dm_bio_details is big.
+ */
+struct dm_cache_wt_hook {
+	struct cache *cache;
+	dm_cblock_t cblock;
+	bio_end_io_t *saved_bi_end_io;
+	void *saved_bi_private;
+	struct dm_bio_details details;
+};
+
+/*
+ * A migration copies a block between the origin and the cache.
+ *
+ * promote: origin -> cache, with an optional demotion of the clean
+ *          block that used to occupy the cache block.
+ * writeback: cache -> origin, cleaning a dirty block.
+ */
+struct dm_cache_migration {
+	struct list_head list;
+	struct cache *cache;
+
+	dm_oblock_t old_oblock;
+	dm_oblock_t new_oblock;
+	dm_cblock_t cblock;
+
+	bool err:1;
+	bool writeback:1;
+	bool demote:1;
+
+	struct dm_bio_prison_cell *old_ocell;
+	struct dm_bio_prison_cell *new_ocell;
+};
+
+/*----------------------------------------------------------------*/
+
+static void wake_worker(struct cache *cache)
+{
+	queue_work(cache->wq, &cache->worker);
+}
+
+static void build_key(dm_oblock_t oblock, struct dm_cell_key *key)
+{
+	key->virtual = 0;
+	key->dev = 0;
+	key->block = from_oblock(oblock);
+}
+
+static dm_oblock_t get_bio_block(struct cache *cache, struct bio *bio)
+{
+	return to_oblock(bio->bi_sector >> cache->sectors_per_block_shift);
+}
+
+static bool is_dirty(struct cache *cache, dm_cblock_t b)
+{
+	return test_bit(from_cblock(b), cache->dirty_bitset);
+}
+
+static void set_dirty(struct cache *cache, dm_oblock_t oblock, dm_cblock_t cblock)
+{
+	if (!test_and_set_bit(from_cblock(cblock), cache->dirty_bitset)) {
+		atomic_inc(&cache->nr_dirty);
+		policy_set_dirty(cache->policy, oblock);
+	}
+}
+
+/*
+ * The policy already considers a block clean once it has handed it out
+ * for writeback, so only the bitset needs clearing.
+ */
+static void clear_dirty(struct cache *cache, dm_cblock_t cblock)
+{
+	if (test_and_clear_bit(from_cblock(cblock), cache->dirty_bitset))
+		atomic_dec(&cache->nr_dirty);
+}
+
+static void inc_hit_counter(struct cache *cache, struct bio *bio)
+{
+	atomic_inc(bio_data_dir(bio) == READ ?
+		   &cache->stats.read_hit : &cache->stats.write_hit);
+}
+
+static void inc_miss_counter(struct cache *cache, struct bio *bio)
+{
+	atomic_inc(bio_data_dir(bio) == READ ?
+		   &cache->stats.read_miss : &cache->stats.write_miss);
+}
+
+/*----------------------------------------------------------------
+ * Remapping
+ *--------------------------------------------------------------*/
+static void remap_to_origin(struct cache *cache, struct bio *bio)
+{
+	bio->bi_bdev = cache->origin_dev->bdev;
+}
+
+static void remap_to_cache(struct cache *cache, struct bio *bio,
+			   dm_cblock_t cblock)
+{
+	sector_t bi_sector = bio->bi_sector;
+
+	bio->bi_bdev = cache->cache_dev->bdev;
+	bio->bi_sector = ((sector_t) from_cblock(cblock) << cache->sectors_per_block_shift) |
+			 (bi_sector & (cache->sectors_per_block - 1));
+}
+
+static void remap_to_cache_dirty(struct cache *cache, struct bio *bio,
+				 dm_oblock_t oblock, dm_cblock_t cblock)
+{
+	if (bio_data_dir(bio) == WRITE)
+		set_dirty(cache, oblock, cblock);
+
+	remap_to_cache(cache, bio, cblock);
+}
+
+static void writethrough_endio(struct bio *bio, int err)
+{
+	struct dm_cache_wt_hook *wt = bio->bi_private;
+	struct cache *cache = wt->cache;
+	dm_cblock_t cblock = wt->cblock;
+	unsigned long flags;
+
+	bio->bi_end_io = wt->saved_bi_end_io;
+	bio->bi_private = wt->saved_bi_private;
+
+	if (err) {
+		mempool_free(wt, cache->writethrough_pool);
+		bio_endio(bio, err);
+		return;
+	}
+
+	dm_bio_restore(&wt->details, bio);
+	mempool_free(wt, cache->writethrough_pool);
+	remap_to_cache(cache, bio, cblock);
+
+	/*
+	 * We can't issue this bio directly, since we're in interrupt
+	 * context.  So it gets put on a bio list for processing by the
+	 * worker thread.
+	 */
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_add(&cache->deferred_writethrough_bios, bio);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+/*
+ * The write is sent to the origin first; writethrough_endio() then
+ * sends it on to the cache.  Only when both have completed does the
+ * bio complete.
+ */
+static void remap_to_origin_then_cache(struct cache *cache, struct bio *bio,
+				       dm_cblock_t cblock)
+{
+	struct dm_cache_wt_hook *wt = mempool_alloc(cache->writethrough_pool, GFP_NOIO);
+
+	wt->cache = cache;
+	wt->cblock = cblock;
+	wt->saved_bi_end_io = bio->bi_end_io;
+	wt->saved_bi_private = bio->bi_private;
+	dm_bio_record(&wt->details, bio);
+
+	bio->bi_end_io = writethrough_endio;
+	bio->bi_private = wt;
+	remap_to_origin(cache, bio);
+}
+
+/*
+ * Remaps a bio the policy found in the cache.  The caller must hold the
+ * cell for the block, so the block can't be demoted underneath us.
+ */
+static void remap_hit(struct cache *cache, struct bio *bio,
+		      dm_oblock_t oblock, dm_cblock_t cblock)
+{
+	struct dm_cache_endio_hook *h = dm_get_mapinfo(bio)->ptr;
+
+	inc_hit_counter(cache, bio);
+	h->all_io_entry = dm_deferred_entry_inc(cache->all_io_ds);
+
+	if (bio_data_dir(bio) == WRITE &&
+	    cache->features.mode == CM_WRITETHROUGH)
+		remap_to_origin_then_cache(cache, bio, cblock);
+	else
+		remap_to_cache_dirty(cache, bio, oblock, cblock);
+}
+
+static void remap_miss(struct cache *cache, struct bio *bio)
+{
+	struct dm_cache_endio_hook *h = dm_get_mapinfo(bio)->ptr;
+
+	inc_miss_counter(cache, bio);
+	h->all_io_entry = dm_deferred_entry_inc(cache->all_io_ds);
+	remap_to_origin(cache, bio);
+}
+
+/*
+ * Bios that need the metadata committed first are held back until the
+ * worker next commits.
+ */
+static void issue(struct cache *cache, struct bio *bio)
+{
+	if (bio->bi_rw & (REQ_FLUSH | REQ_FUA))
+		bio_list_add(&cache->deferred_flush_bios, bio);
+	else
+		generic_make_request(bio);
+}
+
+static void defer_bio(struct cache *cache, struct bio *bio)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_add(&cache->deferred_bios, bio);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+/*
+ * Releases a cell, handing any bios that were held in it over to the
+ * worker.
+ */
+static void cell_defer(struct cache *cache, struct dm_bio_prison_cell *cell,
+		       bool holder)
+{
+	unsigned long flags;
+	struct bio_list bios;
+
+	bio_list_init(&bios);
+	if (holder)
+		dm_cell_release(cell, &bios);
+	else
+		dm_cell_release_no_holder(cell, &bios);
+
+	if (bio_list_empty(&bios))
+		return;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&cache->deferred_bios, &bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+/*----------------------------------------------------------------
+ * Migration processing
+ *--------------------------------------------------------------*/
+static int ensure_next_migration(struct cache *cache)
+{
+	if (cache->next_migration)
+		return 0;
+
+	cache->next_migration = mempool_alloc(cache->migration_pool, GFP_ATOMIC);
+
+	return cache->next_migration ? 0 : -ENOMEM;
+}
+
+static struct dm_cache_migration *get_next_migration(struct cache *cache)
+{
+	struct dm_cache_migration *mg = cache->next_migration;
+
+	BUG_ON(!mg);
+	cache->next_migration = NULL;
+
+	memset(mg, 0, sizeof(*mg));
+	mg->cache = cache;
+	atomic_inc(&cache->nr_migrations);
+
+	return mg;
+}
+
+static void free_migration(struct dm_cache_migration *mg)
+{
+	struct cache *cache = mg->cache;
+
+	mempool_free(mg, cache->migration_pool);
+
+	if (atomic_dec_and_test(&cache->nr_migrations))
+		wake_up(&cache->migration_wait);
+}
+
+static void release_migration_cells(struct dm_cache_migration *mg)
+{
+	struct cache *cache = mg->cache;
+
+	if (mg->old_ocell)
+		cell_defer(cache, mg->old_ocell, false);
+
+	if (mg->new_ocell)
+		cell_defer(cache, mg->new_ocell, true);
+}
+
+static void __queue_quiesced_migration(struct dm_cache_migration *mg)
+{
+	list_add_tail(&mg->list, &mg->cache->quiesced_migrations);
+}
+
+/*
+ * Nothing may touch the blocks involved while they're being copied.  The
+ * cells stop any new io; this waits for io that was mapped before the
+ * cells were taken.
+ */
+static void quiesce_migration(struct dm_cache_migration *mg)
+{
+	unsigned long flags;
+	struct cache *cache = mg->cache;
+
+	if (!dm_deferred_set_add_work(cache->all_io_ds, &mg->list)) {
+		spin_lock_irqsave(&cache->lock, flags);
+		__queue_quiesced_migration(mg);
+		spin_unlock_irqrestore(&cache->lock, flags);
+	}
+}
+
+static void promote(struct cache *cache, dm_oblock_t oblock,
+		    dm_cblock_t cblock, struct dm_bio_prison_cell *cell)
+{
+	struct dm_cache_migration *mg = get_next_migration(cache);
+
+	mg->new_oblock = oblock;
+	mg->cblock = cblock;
+	mg->new_ocell = cell;
+
+	quiesce_migration(mg);
+}
+
+static void demote_then_promote(struct cache *cache, dm_oblock_t old_oblock,
+				dm_oblock_t new_oblock, dm_cblock_t cblock,
+				struct dm_bio_prison_cell *old_ocell,
+				struct dm_bio_prison_cell *new_ocell)
+{
+	struct dm_cache_migration *mg = get_next_migration(cache);
+
+	mg->demote = true;
+	mg->old_oblock = old_oblock;
+	mg->new_oblock = new_oblock;
+	mg->cblock = cblock;
+	mg->old_ocell = old_ocell;
+	mg->new_ocell = new_ocell;
+
+	quiesce_migration(mg);
+}
+
+static void writeback(struct cache *cache, dm_oblock_t oblock,
+		      dm_cblock_t cblock, struct dm_bio_prison_cell *cell)
+{
+	struct dm_cache_migration *mg = get_next_migration(cache);
+
+	mg->writeback = true;
+	mg->old_oblock = oblock;
+	mg->cblock = cblock;
+	mg->old_ocell = cell;
+
+	quiesce_migration(mg);
+}
+
+static void migration_completed(struct dm_cache_migration *mg)
+{
+	unsigned long flags;
+	struct cache *cache = mg->cache;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	list_add_tail(&mg->list, &cache->completed_migrations);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+static void copy_complete(int read_err, unsigned long write_err, void *context)
+{
+	struct dm_cache_migration *mg = context;
+
+	if (read_err || write_err)
+		mg->err = true;
+
+	migration_completed(mg);
+}
+
+static void issue_copy(struct dm_cache_migration *mg)
+{
+	int r;
+	struct dm_io_region o_region, c_region;
+	struct cache *cache = mg->cache;
+
+	o_region.bdev = cache->origin_dev->bdev;
+	o_region.count = cache->sectors_per_block;
+
+	c_region.bdev = cache->cache_dev->bdev;
+	c_region.sector = (sector_t) from_cblock(mg->cblock) * cache->sectors_per_block;
+	c_region.count = cache->sectors_per_block;
+
+	if (mg->writeback) {
+		o_region.sector = from_oblock(mg->old_oblock) * cache->sectors_per_block;
+		r = dm_kcopyd_copy(cache->copier, &c_region, 1, &o_region, 0,
+				   copy_complete, mg);
+	} else {
+		o_region.sector = from_oblock(mg->new_oblock) * cache->sectors_per_block;
+		r = dm_kcopyd_copy(cache->copier, &o_region, 1, &c_region, 0,
+				   copy_complete, mg);
+	}
+
+	if (r < 0) {
+		DMERR_LIMIT("issuing migration failed");
+		mg->err = true;
+		migration_completed(mg);
+	}
+}
+
+static int commit(struct cache *cache, bool clean_shutdown)
+{
+	int r;
+	struct dm_cache_statistics stats;
+
+	stats.read_hits = atomic_read(&cache->stats.read_hit);
+	stats.read_misses = atomic_read(&cache->stats.read_miss);
+	stats.write_hits = atomic_read(&cache->stats.write_hit);
+	stats.write_misses = atomic_read(&cache->stats.write_miss);
+	dm_cache_metadata_set_stats(cache->cmd, &stats);
+
+	r = dm_cache_commit(cache->cmd, clean_shutdown);
+	if (r)
+		DMERR("%s: dm_cache_commit() failed, error = %d", __func__, r);
+	else
+		cache->last_commit_jiffies = jiffies;
+
+	return r;
+}
+
+/*
+ * A demotion whose metadata update failed before anything was copied.
+ * The old block is still intact in the cache, so put it back.
+ */
+static void abort_demotion(struct dm_cache_migration *mg)
+{
+	struct cache *cache = mg->cache;
+
+	policy_force_mapping(cache->policy, mg->new_oblock, mg->old_oblock);
+	if (dm_cache_insert_mapping(cache->cmd, mg->cblock, mg->old_oblock))
+		DMERR_LIMIT("couldn't restore mapping for block %llu",
+			    (unsigned long long) from_oblock(mg->old_oblock));
+
+	release_migration_cells(mg);
+	free_migration(mg);
+}
+
+/*
+ * The on-disk mapping of a demoted block must be gone before its cache
+ * block is overwritten, otherwise a crash mid-copy would leave the
+ * mapping pointing at the wrong data.  Demotions are batched so this
+ * costs at most one commit per pass of the worker.
+ */
+static void process_quiesced_migrations(struct cache *cache)
+{
+	int r;
+	bool demoted = false;
+	unsigned long flags;
+	struct list_head list;
+	struct dm_cache_migration *mg, *tmp;
+
+	INIT_LIST_HEAD(&list);
+	spin_lock_irqsave(&cache->lock, flags);
+	list_splice_init(&cache->quiesced_migrations, &list);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	list_for_each_entry_safe(mg, tmp, &list, list) {
+		if (!mg->demote)
+			continue;
+
+		r = dm_cache_remove_mapping(cache->cmd, mg->cblock);
+		if (r) {
+			list_del(&mg->list);
+			abort_demotion(mg);
+		} else
+			demoted = true;
+	}
+
+	if (demoted && commit(cache, false)) {
+		list_for_each_entry_safe(mg, tmp, &list, list) {
+			if (mg->demote) {
+				list_del(&mg->list);
+				abort_demotion(mg);
+			}
+		}
+	}
+
+	list_for_each_entry_safe(mg, tmp, &list, list) {
+		list_del(&mg->list);
+		if (mg->demote)
+			atomic_inc(&cache->stats.demotion);
+		issue_copy(mg);
+	}
+}
+
+static void complete_writeback(struct dm_cache_migration *mg)
+{
+	struct cache *cache = mg->cache;
+
+	if (mg->err) {
+		DMWARN_LIMIT("writeback of block %llu failed",
+			     (unsigned long long) from_oblock(mg->old_oblock));
+		policy_set_dirty(cache->policy, mg->old_oblock);
+	} else {
+		clear_dirty(cache, mg->cblock);
+		atomic_inc(&cache->stats.writeback);
+	}
+
+	release_migration_cells(mg);
+	free_migration(mg);
+}
+
+/*
+ * Drops a promotion that can't be completed.  Any demoted block has
+ * already been unmapped on disk, and its data may be partially
+ * overwritten, so the cache block is simply given up.
+ */
+static void fail_promotion(struct dm_cache_migration *mg)
+{
+	struct cache *cache = mg->cache;
+
+	policy_remove_mapping(cache->policy, mg->new_oblock);
+	release_migration_cells(mg);
+	free_migration(mg);
+}
+
+static void complete_promotion(struct dm_cache_migration *mg)
+{
+	int r;
+	struct cache *cache = mg->cache;
+
+	if (mg->err) {
+		DMWARN_LIMIT("promotion of block %llu failed",
+			     (unsigned long long) from_oblock(mg->new_oblock));
+		fail_promotion(mg);
+		return;
+	}
+
+	r = dm_cache_insert_mapping(cache->cmd, mg->cblock, mg->new_oblock);
+	if (r) {
+		DMERR_LIMIT("couldn't insert mapping for block %llu",
+			    (unsigned long long) from_oblock(mg->new_oblock));
+		fail_promotion(mg);
+		return;
+	}
+
+	list_add_tail(&mg->list, &cache->need_commit_migrations);
+}
+
+static void process_completed_migrations(struct cache *cache)
+{
+	unsigned long flags;
+	struct list_head list;
+	struct dm_cache_migration *mg, *tmp;
+
+	INIT_LIST_HEAD(&list);
+	spin_lock_irqsave(&cache->lock, flags);
+	list_splice_init(&cache->completed_migrations, &list);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	list_for_each_entry_safe(mg, tmp, &list, list) {
+		list_del(&mg->list);
+		if (mg->writeback)
+			complete_writeback(mg);
+		else
+			complete_promotion(mg);
+	}
+}
+
+/*
+ * The io held back by a promotion can be let go once the new mapping
+ * has been committed.
+ */
+static void process_committed_migrations(struct cache *cache, bool success)
+{
+	struct dm_cache_migration *mg, *tmp;
+
+	list_for_each_entry_safe(mg, tmp, &cache->need_commit_migrations, list) {
+		list_del(&mg->list);
+
+		if (success) {
+			atomic_inc(&cache->stats.promotion);
+			release_migration_cells(mg);
+			free_migration(mg);
+		} else {
+			dm_cache_remove_mapping(cache->cmd, mg->cblock);
+			fail_promotion(mg);
+		}
+	}
+}
+
+/*----------------------------------------------------------------
+ * bio processing
+ *--------------------------------------------------------------*/
+
+/*
+ * The policy wants to replace a cached block.  It only ever demotes
+ * clean blocks, but a write may have dirtied the block since the policy
+ * chose it, or io to it may be in progress.  In either case the block is
+ * put back and the promotion abandoned.
+ */
+static bool lock_demoted_block(struct cache *cache,
+			       struct policy_result *lookup_result,
+			       dm_oblock_t new_oblock,
+			       struct dm_bio_prison_cell **old_ocell)
+{
+	int r;
+	struct dm_cell_key key;
+
+	build_key(lookup_result->old_oblock, &key);
+	r = dm_bio_detain(cache->prison, &key, NULL, old_ocell);
+	if (!r && !is_dirty(cache, lookup_result->cblock))
+		return true;
+
+	if (!r)
+		cell_defer(cache, *old_ocell, false);
+
+	policy_force_mapping(cache->policy, new_oblock, lookup_result->old_oblock);
+	if (is_dirty(cache, lookup_result->cblock))
+		policy_set_dirty(cache->policy, lookup_result->old_oblock);
+
+	return false;
+}
+
+static void process_bio(struct cache *cache, struct bio *bio)
+{
+	int r;
+	bool release_cell = true;
+	dm_oblock_t block = get_bio_block(cache, bio);
+	struct dm_bio_prison_cell *old_ocell, *new_ocell;
+	struct policy_result lookup_result;
+	struct dm_cell_key key;
+	bool can_migrate;
+
+	if (from_oblock(block) >= from_oblock(cache->origin_blocks)) {
+		remap_to_origin(cache, bio);
+		issue(cache, bio);
+		return;
+	}
+
+	/*
+	 * Check to see if that block is currently migrating.
+	 */
+	build_key(block, &key);
+	r = dm_bio_detain(cache->prison, &key, bio, &new_ocell);
+	if (r > 0)
+		return;
+
+	can_migrate = !cache->quiescing && !ensure_next_migration(cache);
+
+	r = policy_map(cache->policy, block, true, can_migrate, bio, &lookup_result);
+	if (r) {
+		DMERR_LIMIT("%s: policy_map() failed, error = %d", __func__, r);
+		cell_defer(cache, new_ocell, false);
+		bio_io_error(bio);
+		return;
+	}
+
+	switch (lookup_result.op) {
+	case POLICY_HIT:
+		remap_hit(cache, bio, block, lookup_result.cblock);
+		issue(cache, bio);
+		break;
+
+	case POLICY_MISS:
+		remap_miss(cache, bio);
+		issue(cache, bio);
+		break;
+
+	case POLICY_NEW:
+		inc_miss_counter(cache, bio);
+		promote(cache, block, lookup_result.cblock, new_ocell);
+		release_cell = false;
+		break;
+
+	case POLICY_REPLACE:
+		if (!lock_demoted_block(cache, &lookup_result, block, &old_ocell)) {
+			remap_miss(cache, bio);
+			issue(cache, bio);
+			break;
+		}
+
+		inc_miss_counter(cache, bio);
+		demote_then_promote(cache, lookup_result.old_oblock, block,
+				    lookup_result.cblock, old_ocell, new_ocell);
+		release_cell = false;
+		break;
+	}
+
+	if (release_cell)
+		cell_defer(cache, new_ocell, false);
+}
+
+static void process_deferred_bios(struct cache *cache)
+{
+	unsigned long flags;
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&bios, &cache->deferred_bios);
+	bio_list_init(&cache->deferred_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = bio_list_pop(&bios))) {
+		/*
+		 * Empty flushes were remapped by cache_map().
+		 */
+		if (bio->bi_rw & REQ_FLUSH && !bio->bi_size)
+			issue(cache, bio);
+		else
+			process_bio(cache, bio);
+	}
+}
+
+static void process_deferred_writethrough_bios(struct cache *cache)
+{
+	unsigned long flags;
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&bios, &cache->deferred_writethrough_bios);
+	bio_list_init(&cache->deferred_writethrough_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = bio_list_pop(&bios)))
+		generic_make_request(bio);
+}
+
+static void writeback_some_dirty_blocks(struct cache *cache)
+{
+	int r;
+	dm_oblock_t oblock;
+	dm_cblock_t cblock;
+	struct dm_cell_key key;
+	struct dm_bio_prison_cell *old_ocell;
+
+	while (!cache->quiescing &&
+	       atomic_read(&cache->nr_migrations) < WRITEBACK_MIGRATIONS &&
+	       !ensure_next_migration(cache)) {
+		r = policy_writeback_work(cache->policy, &oblock, &cblock);
+		if (r)
+			break;
+
+		build_key(oblock, &key);
+		r = dm_bio_detain(cache->prison, &key, NULL, &old_ocell);
+		if (r > 0) {
+			/*
+			 * The block is busy; try again later.
+			 */
+			policy_set_dirty(cache->policy, oblock);
+			break;
+		}
+
+		writeback(cache, oblock, cblock, old_ocell);
+	}
+}
+
+static bool need_commit_due_to_time(struct cache *cache)
+{
+	return jiffies < cache->last_commit_jiffies ||
+	       jiffies > cache->last_commit_jiffies + COMMIT_PERIOD;
+}
+
+static void commit_and_issue(struct cache *cache)
+{
+	int r = 0;
+	struct bio *bio;
+
+	if ((!list_empty(&cache->need_commit_migrations) ||
+	     !bio_list_empty(&cache->deferred_flush_bios) ||
+	     need_commit_due_to_time(cache)) &&
+	    dm_cache_changed_this_transaction(cache->cmd))
+		r = commit(cache, false);
+
+	process_committed_migrations(cache, !r);
+
+	while ((bio = bio_list_pop(&cache->deferred_flush_bios))) {
+		if (r)
+			bio_io_error(bio);
+		else
+			generic_make_request(bio);
+	}
+}
+
+static void do_worker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(ws, struct cache, worker);
+
+	process_deferred_bios(cache);
+	process_deferred_writethrough_bios(cache);
+	writeback_some_dirty_blocks(cache);
+	process_quiesced_migrations(cache);
+	process_completed_migrations(cache);
+	commit_and_issue(cache);
+}
+
+/*
+ * We want to commit periodically so that not too much
+ * unwritten metadata builds up.
+ */
+static void do_waker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(to_delayed_work(ws), struct cache, waker);
+	wake_worker(cache);
+	queue_delayed_work(cache->wq, &cache->waker, COMMIT_PERIOD);
+}
+
+/*----------------------------------------------------------------
+ * Target methods
+ *--------------------------------------------------------------*/
+static void destroy(struct cache *cache)
+{
+	if (cache->next_migration)
+		mempool_free(cache->next_migration, cache->migration_pool);
+
+	if (cache->migration_pool)
+		mempool_destroy(cache->migration_pool);
+
+	if (cache->writethrough_pool)
+		mempool_destroy(cache->writethrough_pool);
+
+	if (cache->endio_hook_pool)
+		mempool_destroy(cache->endio_hook_pool);
+
+	if (cache->all_io_ds)
+		dm_deferred_set_destroy(cache->all_io_ds);
+
+	if (cache->prison)
+		dm_bio_prison_destroy(cache->prison);
+
+	if (cache->wq)
+		destroy_workqueue(cache->wq);
+
+	if (cache->copier && !IS_ERR(cache->copier))
+		dm_kcopyd_client_destroy(cache->copier);
+
+	vfree(cache->dirty_bitset);
+
+	if (cache->cmd)
+		dm_cache_metadata_close(cache->cmd);
+
+	if (cache->policy)
+		dm_cache_policy_destroy(cache->policy);
+
+	if (cache->metadata_dev)
+		dm_put_device(cache->ti, cache->metadata_dev);
+
+	if (cache->origin_dev)
+		dm_put_device(cache->ti, cache->origin_dev);
+
+	if (cache->cache_dev)
+		dm_put_device(cache->ti, cache->cache_dev);
+
+	kfree(cache);
+}
+
+static void cache_dtr(struct dm_target *ti)
+{
+	destroy(ti->private);
+}
+
+static sector_t get_dev_size(struct dm_dev *dev)
+{
+	return i_size_read(dev->bdev->bd_inode) >> SECTOR_SHIFT;
+}
+
+static int parse_devices(struct cache *cache, struct dm_arg_set *as,
+			 char **error)
+{
+	int r;
+	sector_t metadata_dev_size;
+	char b[BDEVNAME_SIZE];
+
+	r = dm_get_device(cache->ti, dm_shift_arg(as), FMODE_READ | FMODE_WRITE,
+			  &cache->metadata_dev);
+	if (r) {
+		*error = "Error opening metadata device";
+		return r;
+	}
+
+	metadata_dev_size = get_dev_size(cache->metadata_dev);
+	if (metadata_dev_size > DM_CACHE_METADATA_MAX_SECTORS_WARNING)
+		DMWARN("Metadata device %s is larger than %u sectors: excess space will not be used.",
+		       bdevname(cache->metadata_dev->bdev, b),
+		       DM_CACHE_METADATA_MAX_SECTORS);
+
+	r = dm_get_device(cache->ti, dm_shift_arg(as), FMODE_READ | FMODE_WRITE,
+			  &cache->cache_dev);
+	if (r) {
+		*error = "Error opening cache device";
+		return r;
+	}
+
+	r = dm_get_device(cache->ti, dm_shift_arg(as), FMODE_READ | FMODE_WRITE,
+			  &cache->origin_dev);
+	if (r) {
+		*error = "Error opening origin device";
+		return r;
+	}
+
+	if (cache->ti->len > get_dev_size(cache->origin_dev)) {
+		*error = "Device size larger than cached device";
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int parse_block_size(struct cache *cache, struct dm_arg_set *as,
+			    char **error)
+{
+	unsigned long block_size;
+	sector_t cache_blocks;
+
+	if (kstrtoul(dm_shift_arg(as), 10, &block_size) || !block_size ||
+	    block_size < DATA_DEV_BLOCK_SIZE_MIN_SECTORS ||
+	    block_size > DATA_DEV_BLOCK_SIZE_MAX_SECTORS ||
+	    !is_power_of_2(block_size)) {
+		*error = "Invalid data block size";
+		return -EINVAL;
+	}
+
+	cache->sectors_per_block = block_size;
+	cache->sectors_per_block_shift = ffs(block_size) - 1;
+
+	cache_blocks = get_dev_size(cache->cache_dev) >> cache->sectors_per_block_shift;
+	if (!cache_blocks) {
+		*error = "Cache device is smaller than a block";
+		return -EINVAL;
+	}
+
+	if (cache_blocks > UINT_MAX) {
+		*error = "Cache device has too many blocks for this block size";
+		return -EINVAL;
+	}
+
+	cache->cache_size = to_cblock(cache_blocks);
+	cache->origin_blocks = to_oblock(cache->ti->len >> cache->sectors_per_block_shift);
+
+	return 0;
+}
+
+static int parse_features(struct cache *cache, struct dm_arg_set *as,
+			  char **error)
+{
+	int r;
+	unsigned argc;
+	const char *arg;
+
+	static struct dm_arg _args[] = {
+		{0, 1, "Invalid number of cache feature arguments"},
+	};
+
+	cache->features.mode = CM_WRITEBACK;
+
+	r = dm_read_arg_group(_args, as, &argc, error);
+	if (r)
+		return -EINVAL;
+
+	while (argc--) {
+		arg = dm_shift_arg(as);
+
+		if (!strcasecmp(arg, "writeback"))
+			cache->features.mode = CM_WRITEBACK;
+
+		else if (!strcasecmp(arg, "writethrough"))
+			cache->features.mode = CM_WRITETHROUGH;
+
+		else {
+			*error = "Unrecognised cache feature requested";
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int parse_policy(struct cache *cache, struct dm_arg_set *as,
+			char **error)
+{
+	int r;
+	unsigned argc;
+	const char *key, *value;
+
+	static struct dm_arg _args[] = {
+		{0, 1024, "Invalid number of policy arguments"},
+	};
+
+	cache->policy = dm_cache_policy_create(dm_shift_arg(as), cache->cache_size,
+					       cache->ti->len, cache->sectors_per_block);
+	if (!cache->policy) {
+		*error = "Error creating cache's policy";
+		return -ENOMEM;
+	}
+
+	r = dm_read_arg_group(_args, as, &argc, error);
+	if (r)
+		return -EINVAL;
+
+	if (argc & 1) {
+		*error = "Policy arguments must be key value pairs";
+		return -EINVAL;
+	}
+
+	while (argc) {
+		key = dm_shift_arg(as);
+		value = dm_shift_arg(as);
+		argc -= 2;
+
+		r = policy_set_config_value(cache->policy, key, value);
+		if (r) {
+			*error = "Error setting cache policy's config value";
+			return r;
+		}
+	}
+
+	return 0;
+}
+
+static int create_cache_objects(struct cache *cache, char **error)
+{
+	struct dm_cache_metadata *cmd;
+
+	cmd = dm_cache_metadata_open(cache->metadata_dev->bdev,
+				     cache->sectors_per_block);
+	if (IS_ERR(cmd)) {
+		*error = "Error creating metadata object";
+		return PTR_ERR(cmd);
+	}
+	cache->cmd = cmd;
+
+	cache->dirty_bitset = vzalloc(BITS_TO_LONGS(from_cblock(cache->cache_size)) *
+				      sizeof(unsigned long));
+	if (!cache->dirty_bitset) {
+		*error = "Error allocating cache dirty bitset";
+		return -ENOMEM;
+	}
+
+	cache->copier = dm_kcopyd_client_create();
+	if (IS_ERR(cache->copier)) {
+		*error = "Error creating cache's kcopyd client";
+		return PTR_ERR(cache->copier);
+	}
+
+	cache->wq = alloc_ordered_workqueue("dm-" DM_MSG_PREFIX, WQ_MEM_RECLAIM);
+	if (!cache->wq) {
+		*error = "Error creating cache's workqueue";
+		return -ENOMEM;
+	}
+
+	cache->prison = dm_bio_prison_create(PRISON_CELLS);
+	if (!cache->prison) {
+		*error = "Error creating cache's bio prison";
+		return -ENOMEM;
+	}
+
+	cache->all_io_ds = dm_deferred_set_create();
+	if (!cache->all_io_ds) {
+		*error = "Error creating cache's all io deferred set";
+		return -ENOMEM;
+	}
+
+	cache->endio_hook_pool =
+		mempool_create_kmalloc_pool(ENDIO_HOOK_POOL_SIZE,
+					    sizeof(struct dm_cache_endio_hook));
+	if (!cache->endio_hook_pool) {
+		*error = "Error creating cache's endio_hook mempool";
+		return -ENOMEM;
+	}
+
+	cache->writethrough_pool =
+		mempool_create_kmalloc_pool(WRITETHROUGH_POOL_SIZE,
+					    sizeof(struct dm_cache_wt_hook));
+	if (!cache->writethrough_pool) {
+		*error = "Error creating cache's writethrough mempool";
+		return -ENOMEM;
+	}
+
+	cache->migration_pool =
+		mempool_create_kmalloc_pool(MIGRATION_POOL_SIZE,
+					    sizeof(struct dm_cache_migration));
+	if (!cache->migration_pool) {
+		*error = "Error creating cache's migration mempool";
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * Construct a cache device mapping.
+ *
+ * cache <metadata dev> <cache dev> <origin dev> <block size>
+ *       <#feature args> [<feature arg>]*
+ *       <policy> <#policy args> [<policy arg>]*
+ *
+ * metadata dev    : fast device holding the persistent metadata
+ * cache dev	   : fast device holding cached data blocks
+ * origin dev	   : slow device holding original data blocks
+ * block size	   : cache unit size in sectors
+ *
+ * #feature args   : number of feature arguments passed
+ * feature args    : writethrough.  (The default is writeback.)
+ *
+ * policy	   : the replacement policy to use
+ * #policy args    : an even number of policy arguments corresponding
+ *		     to key/value pairs passed to the policy
+ * policy args	   : key/value pairs passed to the policy
+ *		     E.g. 'sequential_threshold 1024'
+ */
+static int cache_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	int r;
+	struct cache *cache;
+	struct dm_arg_set as;
+
+	if (argc < 7) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	as.argc = argc;
+	as.argv = argv;
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache) {
+		ti->error = "Error allocating memory for cache";
+		return -ENOMEM;
+	}
+
+	cache->ti = ti;
+	spin_lock_init(&cache->lock);
+	bio_list_init(&cache->deferred_bios);
+	bio_list_init(&cache->deferred_writethrough_bios);
+	bio_list_init(&cache->deferred_flush_bios);
+	INIT_LIST_HEAD(&cache->quiesced_migrations);
+	INIT_LIST_HEAD(&cache->completed_migrations);
+	INIT_LIST_HEAD(&cache->need_commit_migrations);
+	atomic_set(&cache->nr_migrations, 0);
+	init_waitqueue_head(&cache->migration_wait);
+	atomic_set(&cache->nr_dirty, 0);
+	INIT_WORK(&cache->worker, do_worker);
+	INIT_DELAYED_WORK(&cache->waker, do_waker);
+	cache->last_commit_jiffies = jiffies;
+
+	atomic_set(&cache->stats.read_hit, 0);
+	atomic_set(&cache->stats.read_miss, 0);
+	atomic_set(&cache->stats.write_hit, 0);
+	atomic_set(&cache->stats.write_miss, 0);
+	atomic_set(&cache->stats.demotion, 0);
+	atomic_set(&cache->stats.promotion, 0);
+	atomic_set(&cache->stats.writeback, 0);
+
+	r = parse_devices(cache, &as, &ti->error);
+	if (r)
+		goto bad;
+
+	r = parse_block_size(cache, &as, &ti->error);
+	if (r)
+		goto bad;
+
+	r = parse_features(cache, &as, &ti->error);
+	if (r)
+		goto bad;
+
+	if (!as.argc) {
+		ti->error = "Cache policy not specified";
+		r = -EINVAL;
+		goto bad;
+	}
+
+	r = parse_policy(cache, &as, &ti->error);
+	if (r)
+		goto bad;
+
+	if (as.argc) {
+		ti->error = "Too many arguments";
+		r = -EINVAL;
+		goto bad;
+	}
+
+	r = create_cache_objects(cache, &ti->error);
+	if (r)
+		goto bad;
+
+	ti->split_io = cache->sectors_per_block;
+
+	/*
+	 * One flush for the origin, one for the cache.
+	 */
+	ti->num_flush_requests = 2;
+	ti->private = cache;
+
+	return 0;
+
+bad:
+	destroy(cache);
+	return r;
+}
+
+static struct dm_cache_endio_hook *hook_bio(struct cache *cache, struct bio *bio)
+{
+	struct dm_cache_endio_hook *h = mempool_alloc(cache->endio_hook_pool, GFP_NOIO);
+
+	h->all_io_entry = NULL;
+
+	return h;
+}
+
+static int cache_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	int r;
+	struct cache *cache = ti->private;
+	unsigned request_nr = map_context->target_request_nr;
+	dm_oblock_t block;
+	struct dm_cell_key key;
+	struct dm_bio_prison_cell *cell;
+	struct policy_result lookup_result;
+
+	map_context->ptr = hook_bio(cache, bio);
+
+	if (bio->bi_rw & REQ_FLUSH && !bio->bi_size) {
+		if (request_nr)
+			bio->bi_bdev = cache->cache_dev->bdev;
+		else
+			remap_to_origin(cache, bio);
+
+		defer_bio(cache, bio);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	bio->bi_sector = dm_target_offset(ti, bio->bi_sector);
+	block = get_bio_block(cache, bio);
+
+	if (bio->bi_rw & (REQ_FLUSH | REQ_FUA)) {
+		defer_bio(cache, bio);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	if (from_oblock(block) >= from_oblock(cache->origin_blocks)) {
+		/*
+		 * This can only occur if the io goes to a partial block at
+		 * the end of the origin device.  We don't cache these.
+		 */
+		remap_to_origin(cache, bio);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	/*
+	 * Check to see if that block is currently migrating.
+	 */
+	build_key(block, &key);
+	r = dm_bio_detain(cache->prison, &key, bio, &cell);
+	if (r > 0)
+		return DM_MAPIO_SUBMITTED;
+
+	r = policy_map(cache->policy, block, false, false, bio, &lookup_result);
+	if (r == -EWOULDBLOCK) {
+		cell_defer(cache, cell, true);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	if (r) {
+		DMERR_LIMIT("%s: policy_map() failed, error = %d", __func__, r);
+		goto bad;
+	}
+
+	switch (lookup_result.op) {
+	case POLICY_HIT:
+		remap_hit(cache, bio, block, lookup_result.cblock);
+		break;
+
+	case POLICY_MISS:
+		/*
+		 * The block may have just been picked for demotion by the
+		 * worker, in which case its cache copy is still mapped on
+		 * disk and may yet be reinstated.  Reads are fine, since
+		 * only clean blocks are demoted, but writes to the origin
+		 * are left to the worker, which serialises them against
+		 * demotions.
+		 */
+		if (bio_data_dir(bio) == WRITE) {
+			cell_defer(cache, cell, true);
+			return DM_MAPIO_SUBMITTED;
+		}
+
+		remap_miss(cache, bio);
+		break;
+
+	default:
+		DMERR_LIMIT("%s: erroring bio: unknown policy op: %u", __func__,
+			    (unsigned) lookup_result.op);
+		goto bad;
+	}
+
+	cell_defer(cache, cell, false);
+
+	return DM_MAPIO_REMAPPED;
+
+bad:
+	cell_defer(cache, cell, false);
+	mempool_free(map_context->ptr, cache->endio_hook_pool);
+	return -EIO;
+}
+
+static int cache_end_io(struct dm_target *ti, struct bio *bio,
+			int error, union map_info *map_context)
+{
+	unsigned long flags;
+	struct list_head work;
+	struct cache *cache = ti->private;
+	struct dm_cache_endio_hook *h = map_context->ptr;
+
+	if (h->all_io_entry) {
+		INIT_LIST_HEAD(&work);
+		dm_deferred_entry_dec(h->all_io_entry, &work);
+
+		if (!list_empty(&work)) {
+			spin_lock_irqsave(&cache->lock, flags);
+			list_splice_tail(&work, &cache->quiesced_migrations);
+			spin_unlock_irqrestore(&cache->lock, flags);
+
+			wake_worker(cache);
+		}
+	}
+
+	mempool_free(h, cache->endio_hook_pool);
+
+	return 0;
+}
+
+static int save_dirty_flag(void *context, dm_cblock_t cblock, dm_oblock_t oblock)
+{
+	struct cache *cache = context;
+
+	return dm_cache_set_dirty(cache->cmd, cblock, is_dirty(cache, cblock));
+}
+
+/*
+ * Dirty flags are only kept up to date on disk over a clean shutdown.
+ */
+static void sync_metadata(struct cache *cache)
+{
+	int r;
+
+	r = policy_walk_mappings(cache->policy, save_dirty_flag, cache);
+	if (r) {
+		DMERR("could not write dirty bits");
+		commit(cache, false);
+		return;
+	}
+
+	commit(cache, true);
+}
+
+static void cache_postsuspend(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	cache->quiescing = true;
+	cancel_delayed_work(&cache->waker);
+
+	wait_event(cache->migration_wait, !atomic_read(&cache->nr_migrations));
+	flush_workqueue(cache->wq);
+
+	if (cache->loaded_mappings)
+		sync_metadata(cache);
+}
+
+static int load_mapping(void *context, dm_oblock_t oblock, dm_cblock_t cblock,
+			bool dirty)
+{
+	int r;
+	struct cache *cache = context;
+
+	if (from_oblock(oblock) >= from_oblock(cache->origin_blocks)) {
+		DMERR("cached block %llu is beyond the end of the origin",
+		      (unsigned long long) from_oblock(oblock));
+		return -EINVAL;
+	}
+
+	r = policy_load_mapping(cache->policy, oblock, cblock, dirty);
+	if (r)
+		return r;
+
+	if (dirty) {
+		set_bit(from_cblock(cblock), cache->dirty_bitset);
+		atomic_inc(&cache->nr_dirty);
+	}
+
+	return 0;
+}
+
+/*
+ * The constructor may have opened the metadata while a previous table
+ * was still live and committing to it, so it is opened afresh before the
+ * mappings are read.
+ */
+static int reopen_metadata(struct cache *cache)
+{
+	struct dm_cache_metadata *cmd;
+
+	cmd = dm_cache_metadata_open(cache->metadata_dev->bdev,
+				     cache->sectors_per_block);
+	if (IS_ERR(cmd))
+		return PTR_ERR(cmd);
+
+	dm_cache_metadata_close(cache->cmd);
+	cache->cmd = cmd;
+
+	return 0;
+}
+
+static int load_metadata(struct cache *cache)
+{
+	int r;
+	struct dm_cache_statistics stats;
+
+	r = reopen_metadata(cache);
+	if (r) {
+		DMERR("could not reopen metadata");
+		return r;
+	}
+
+	if (from_cblock(dm_cache_size(cache->cmd)) != from_cblock(cache->cache_size)) {
+		r = dm_cache_resize(cache->cmd, cache->cache_size);
+		if (r) {
+			DMERR("could not resize cache metadata");
+			return r;
+		}
+	}
+
+	r = dm_cache_load_mappings(cache->cmd, load_mapping, cache);
+	if (r) {
+		DMERR("could not load cache mappings");
+		return r;
+	}
+
+	dm_cache_metadata_get_stats(cache->cmd, &stats);
+	atomic_set(&cache->stats.read_hit, stats.read_hits);
+	atomic_set(&cache->stats.read_miss, stats.read_misses);
+	atomic_set(&cache->stats.write_hit, stats.write_hits);
+	atomic_set(&cache->stats.write_miss, stats.write_misses);
+
+	cache->loaded_mappings = true;
+
+	return 0;
+}
+
+static int cache_preresume(struct dm_target *ti)
+{
+	int r;
+	struct cache *cache = ti->private;
+
+	if (!cache->loaded_mappings) {
+		r = load_metadata(cache);
+		if (r)
+			return r;
+	}
+
+	/*
+	 * Clear the clean shutdown flag before any new io can dirty a
+	 * block: after a crash from here on the dirty flags on disk can't
+	 * be trusted.
+	 */
+	return commit(cache, false);
+}
+
+static void cache_resume(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	cache->quiescing = false;
+	do_waker(&cache->waker.work);
+}
+
+/*
+ * Status format:
+ *
+ * <used metadata blocks>/<total metadata blocks>
+ * <used cache blocks>/<total cache blocks>
+ * <#read hits> <#read misses> <#write hits> <#write misses>
+ * <#demotions> <#promotions> <#writebacks> <#dirty>
+ * <policy status>*
+ */
+static int cache_status(struct dm_target *ti, status_type_t type,
+			char *result, unsigned maxlen)
+{
+	int r;
+	ssize_t sz = 0;
+	dm_block_t nr_free_blocks_metadata = 0;
+	dm_block_t nr_blocks_metadata = 0;
+	char buf[BDEVNAME_SIZE];
+	struct cache *cache = ti->private;
+	dm_cblock_t residency;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		r = dm_cache_get_free_metadata_block_count(cache->cmd,
+							   &nr_free_blocks_metadata);
+		if (r)
+			return r;
+
+		r = dm_cache_get_metadata_dev_size(cache->cmd, &nr_blocks_metadata);
+		if (r)
+			return r;
+
+		residency = policy_residency(cache->policy);
+
+		DMEMIT("%llu/%llu %u/%u %u %u %u %u %u %u %u %u ",
+		       (unsigned long long)(nr_blocks_metadata - nr_free_blocks_metadata),
+		       (unsigned long long)nr_blocks_metadata,
+		       (unsigned) from_cblock(residency),
+		       (unsigned) from_cblock(cache->cache_size),
+		       (unsigned) atomic_read(&cache->stats.read_hit),
+		       (unsigned) atomic_read(&cache->stats.read_miss),
+		       (unsigned) atomic_read(&cache->stats.write_hit),
+		       (unsigned) atomic_read(&cache->stats.write_miss),
+		       (unsigned) atomic_read(&cache->stats.demotion),
+		       (unsigned) atomic_read(&cache->stats.promotion),
+		       (unsigned) atomic_read(&cache->stats.writeback),
+		       (unsigned) atomic_read(&cache->nr_dirty));
+		break;
+
+	case STATUSTYPE_TABLE:
+		format_dev_t(buf, cache->metadata_dev->bdev->bd_dev);
+		DMEMIT("%s ", buf);
+		format_dev_t(buf, cache->cache_dev->bdev->bd_dev);
+		DMEMIT("%s ", buf);
+		format_dev_t(buf, cache->origin_dev->bdev->bd_dev);
+		DMEMIT("%s ", buf);
+
+		DMEMIT("%llu 1 %s %s ",
+		       (unsigned long long) cache->sectors_per_block,
+		       cache->features.mode == CM_WRITETHROUGH ?
+		       "writethrough" : "writeback",
+		       dm_cache_policy_get_name(cache->policy));
+		break;
+	}
+
+	return policy_status(cache->policy, type, result + sz, maxlen - sz);
+}
+
+/*
+ * Supports <key> <value>.
+ *
+ * The key value pair is passed on to the policy.
+ */
+static int cache_message(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct cache *cache = ti->private;
+
+	if (argc != 2)
+		return -EINVAL;
+
+	return policy_set_config_value(cache->policy, argv[0], argv[1]);
+}
+
+static int cache_iterate_devices(struct dm_target *ti,
+				 iterate_devices_callout_fn fn, void *data)
+{
+	int r;
+	struct cache *cache = ti->private;
+
+	r = fn(ti, cache->cache_dev, 0, get_dev_size(cache->cache_dev), data);
+	if (!r)
+		r = fn(ti, cache->origin_dev, 0, ti->len, data);
+
+	return r;
+}
+
+static void cache_io_hints(struct dm_target *ti, struct queue_limits *limits)
+{
+	struct cache *cache = ti->private;
+
+	blk_limits_io_min(limits, 0);
+	blk_limits_io_opt(limits, cache->sectors_per_block << SECTOR_SHIFT);
+}
+
+/*----------------------------------------------------------------*/
+
+static struct target_type cache_target = {
+	.name = "cache",
+	.version = {1, 0, 0},
+	.module = THIS_MODULE,
+	.ctr = cache_ctr,
+	.dtr = cache_dtr,
+	.map = cache_map,
+	.end_io = cache_end_io,
+	.postsuspend = cache_postsuspend,
+	.preresume = cache_preresume,
+	.resume = cache_resume,
+	.status = cache_status,
+	.message = cache_message,
+	.iterate_devices = cache_iterate_devices,
+	.io_hints = cache_io_hints,
+};
+
+static int __init dm_cache_init(void)
+{
+	int r;
+
+	r = dm_register_target(&cache_target);
+	if (r) {
+		DMERR("cache target registration failed: %d", r);
+		return r;
+	}
+
+	return 0;
+}
+
+static void __exit dm_cache_exit(void)
+{
+	dm_unregister_target(&cache_target);
+}
+
+module_init(dm_cache_init);
+module_exit(dm_cache_exit);
+
+MODULE_DESCRIPTION(DM_NAME " cache target");
+MODULE_LICENSE("GPL");
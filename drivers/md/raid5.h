@@ -3,6 +3,7 @@
 
 #include <linux/raid/xor.h>
 #include <linux/dmaengine.h>
+#include <linux/workqueue.h>
 
 /*
  *
@@ -198,6 +199,9 @@ struct stripe_head {
 	struct hlist_node	hash;
 	struct list_head	lru;	      /* inactive_list or handle_list */
 	struct r5conf		*raid_conf;
+	struct r5worker_group	*group;	      /* worker group whose handle_list
+					       * holds us, or NULL */
+	int			cpu;	      /* cpu the stripe was set up on */
 	short			generation;	/* increments with every
 						 * reshape */
 	sector_t		sector;		/* sector of this row */
@@ -238,6 +242,24 @@ struct stripe_head {
 	} dev[1]; /* allocated with extra space depending of RAID geometry */
 };
 
+/*
+ * Worker threads that handle stripes in parallel with raid5d.  Stripes
+ * are queued to the group of the node they were set up on, and the
+ * workers of that group pick them up in batches.
+ */
+struct r5worker {
+	struct work_struct	work;
+	struct r5worker_group	*group;
+	bool			working;
+};
+
+struct r5worker_group {
+	struct list_head	handle_list;
+	struct r5conf		*conf;
+	struct r5worker		*workers;
+	int			stripes_cnt;
+};
+
 /* stripe_head_state - collects and tracks the dynamic state of a stripe_head
  *     for handle_stripe.
  */
@@ -399,6 +421,14 @@ struct r5conf {
 	int			bypass_threshold; /* preread nice */
 	struct list_head	*last_hold; /* detect hold_list promotions */
 
+	/* Stripe handling can be spread over a group of worker threads
+	 * per NUMA node.  With worker_cnt_per_group == 0 everything is
+	 * handled by raid5d through handle_list as before.
+	 */
+	struct r5worker_group	*worker_groups;
+	int			group_cnt;
+	int			worker_cnt_per_group;
+
 	atomic_t		reshape_stripes; /* stripes with pending writes for reshape */
 	/* unfortunately we need two cache names as we temporarily have
 	 * two caches.
@@ -299,7 +299,7 @@ static inline void reuse_entry(struct l2t_entry *e, struct neighbour *neigh)
 }
 
 struct l2t_entry *t3_l2t_get(struct t3cdev *cdev, struct dst_entry *dst,
-			     struct net_device *dev)
+			     struct net_device *dev, const void *daddr)
 {
 	struct l2t_entry *e = NULL;
 	struct neighbour *neigh;
@@ -310,10 +310,10 @@ struct l2t_entry *t3_l2t_get(struct t3cdev *cdev, struct dst_entry *dst,
 	int ifidx;
 	int smt_idx;
 
-	rcu_read_lock();
-	neigh = dst_get_neighbour_noref(dst);
-	if (!neigh)
-		goto done_rcu;
+	/* on-link routes are shared and have no neighbour bound */
+	neigh = dst_neigh_lookup(dst, daddr);
+	if (IS_ERR(neigh))
+		return NULL;
 
 	addr = *(u32 *) neigh->primary_key;
 	ifidx = neigh->dev->ifindex;
@@ -325,7 +325,7 @@ struct l2t_entry *t3_l2t_get(struct t3cdev *cdev, struct dst_entry *dst,
 
 	d = L2DATA(cdev);
 	if (!d)
-		goto done_rcu;
+		goto done_release;
 
 	hash = arp_hash(addr, ifidx, d);
 
@@ -359,8 +359,8 @@ struct l2t_entry *t3_l2t_get(struct t3cdev *cdev, struct dst_entry *dst,
 	}
 done_unlock:
 	write_unlock_bh(&d->lock);
-done_rcu:
-	rcu_read_unlock();
+done_release:
+	neigh_release(neigh);
 	return e;
 }
 
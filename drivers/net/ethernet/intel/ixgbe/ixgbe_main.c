@@ -45,6 +45,7 @@
 #include <linux/if.h>
 #include <linux/if_vlan.h>
 #include <linux/prefetch.h>
+#include <linux/filter.h>
 #include <scsi/fc/fc_fcoe.h>
 
 #include "ixgbe.h"
@@ -1389,7 +1390,12 @@ static void ixgbe_rx_skb(struct ixgbe_q_vector *q_vector,
 {
 	struct ixgbe_adapter *adapter = q_vector->adapter;
 
-	if (!(adapter->flags & IXGBE_FLAG_IN_NETPOLL))
+	skb_mark_napi_id(skb, &q_vector->napi);
+
+	/* a busy polling socket wants the packet now, not a GRO batch */
+	if (ixgbe_qv_busy_polling(q_vector))
+		netif_receive_skb(skb);
+	else if (!(adapter->flags & IXGBE_FLAG_IN_NETPOLL))
 		napi_gro_receive(&q_vector->napi, skb);
 	else
 		netif_rx(skb);
@@ -1582,6 +1588,65 @@ static void ixgbe_reuse_rx_page(struct ixgbe_ring *rx_ring,
 	get_page(new_buff->page);
 }
 
+/**
+ * ixgbe_recycle_rx_buffer - store an unused buffer back on the ring
+ * @rx_ring: rx descriptor ring to store buffers on
+ * @old_buff: buffer whose frame was dropped before an skb was built
+ *
+ * No skb ever referenced the buffer, so the same half page is handed
+ * back to the adapter as is, without touching the page count
+ **/
+static void ixgbe_recycle_rx_buffer(struct ixgbe_ring *rx_ring,
+				    struct ixgbe_rx_buffer *old_buff)
+{
+	struct ixgbe_rx_buffer *new_buff;
+	u16 nta = rx_ring->next_to_alloc;
+
+	new_buff = &rx_ring->rx_buffer_info[nta];
+
+	/* update, and store next to alloc */
+	nta++;
+	rx_ring->next_to_alloc = (nta < rx_ring->count) ? nta : 0;
+
+	/* transfer page from old buffer to new buffer */
+	new_buff->page = old_buff->page;
+	new_buff->dma = old_buff->dma;
+	new_buff->page_offset = old_buff->page_offset;
+
+	/* sync the buffer for use by the device */
+	dma_sync_single_range_for_device(rx_ring->dev, new_buff->dma,
+					 new_buff->page_offset,
+					 ixgbe_rx_bufsz(rx_ring),
+					 DMA_FROM_DEVICE);
+}
+
+/**
+ * ixgbe_run_xdp - Run the XDP filter on a frame still in its Rx buffer
+ * @rx_ring: rx descriptor ring the frame was received on
+ * @rx_buffer: buffer holding the whole frame
+ * @rx_desc: EOP descriptor containing the length of the frame
+ * @fp: XDP filter of the netdev
+ *
+ * Returns the XDP_* verdict of the filter
+ **/
+static u32 ixgbe_run_xdp(struct ixgbe_ring *rx_ring,
+			 struct ixgbe_rx_buffer *rx_buffer,
+			 union ixgbe_adv_rx_desc *rx_desc,
+			 struct sk_filter *fp)
+{
+	struct xdp_buff xdp;
+
+	dma_sync_single_range_for_cpu(rx_ring->dev, rx_buffer->dma,
+				      rx_buffer->page_offset,
+				      ixgbe_rx_bufsz(rx_ring),
+				      DMA_FROM_DEVICE);
+
+	xdp.data = page_address(rx_buffer->page) + rx_buffer->page_offset;
+	xdp.data_end = xdp.data + le16_to_cpu(rx_desc->wb.upper.length);
+
+	return xdp_run_filter(fp, &xdp);
+}
+
 /**
  * ixgbe_add_rx_frag - Add contents of Rx buffer to sk_buff
  * @rx_ring: rx descriptor ring to transact packets on
@@ -1616,11 +1681,11 @@ static void ixgbe_add_rx_frag(struct ixgbe_ring *rx_ring,
  * expensive overhead for IOMMU access this provides a means of avoiding
  * it by maintaining the mapping of the page to the syste.
  *
- * Returns true if all work is completed without reaching budget
+ * Returns amount of work completed
  **/
-static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
-			       struct ixgbe_ring *rx_ring,
-			       int budget)
+static int ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
+			      struct ixgbe_ring *rx_ring,
+			      const int budget)
 {
 	unsigned int total_rx_bytes = 0, total_rx_packets = 0;
 #ifdef IXGBE_FCOE
@@ -1628,12 +1693,17 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 	int ddp_bytes = 0;
 #endif /* IXGBE_FCOE */
 	u16 cleaned_count = ixgbe_desc_unused(rx_ring);
+	struct sk_filter *xdp_fp;
 
-	do {
+	rcu_read_lock();
+	xdp_fp = rcu_dereference(rx_ring->netdev->xdp_filter);
+
+	while (likely(total_rx_packets < budget)) {
 		struct ixgbe_rx_buffer *rx_buffer;
 		union ixgbe_adv_rx_desc *rx_desc;
 		struct sk_buff *skb;
 		struct page *page;
+		u32 act = XDP_PASS;
 		u16 ntc;
 
 		/* return some buffers to hardware, one at a time is too slow */
@@ -1671,6 +1741,29 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 			prefetch(page_addr + L1_CACHE_BYTES);
 #endif
 
+			/* frames that fit one buffer meet XDP before the skb */
+			if (xdp_fp &&
+			    ixgbe_test_staterr(rx_desc, IXGBE_RXD_STAT_EOP) &&
+			    !ixgbe_test_staterr(rx_desc,
+						IXGBE_RXDADV_ERR_FRAME_ERR_MASK))
+				act = ixgbe_run_xdp(rx_ring, rx_buffer, rx_desc,
+						    xdp_fp);
+
+			if (act != XDP_PASS && act != XDP_TX) {
+				/* same accounting as netif_receive_xdp() */
+				atomic_long_inc(&rx_ring->netdev->rx_dropped);
+
+				/* hand the untouched buffer back to the ring */
+				ixgbe_recycle_rx_buffer(rx_ring, rx_buffer);
+				rx_buffer->dma = 0;
+				rx_buffer->page = NULL;
+				cleaned_count++;
+
+				/* EOP is set, this only advances next_to_clean */
+				ixgbe_is_non_eop(rx_ring, rx_desc, NULL);
+				continue;
+			}
+
 			/* allocate a skb to store the frags */
 			skb = netdev_alloc_skb_ip_align(rx_ring->netdev,
 							IXGBE_RX_HDR_SIZE);
@@ -1738,27 +1831,31 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 
 		/* probably a little skewed due to removing CRC */
 		total_rx_bytes += skb->len;
-		total_rx_packets++;
 
 		/* populate checksum, timestamp, VLAN, and protocol */
 		ixgbe_process_skb_fields(rx_ring, rx_desc, skb);
 
 #ifdef IXGBE_FCOE
 		/* if ddp, not passing to ULD unless for FCP_RSP or error */
-		if (ixgbe_rx_is_fcoe(adapter, rx_desc)) {
+		if (act == XDP_PASS && ixgbe_rx_is_fcoe(adapter, rx_desc)) {
 			ddp_bytes = ixgbe_fcoe_ddp(adapter, rx_desc, skb);
 			if (!ddp_bytes) {
 				dev_kfree_skb_any(skb);
+				total_rx_packets++;
 				continue;
 			}
 		}
 
 #endif /* IXGBE_FCOE */
-		ixgbe_rx_skb(q_vector, skb);
+		if (unlikely(act == XDP_TX))
+			netif_xdp_tx(skb);
+		else
+			ixgbe_rx_skb(q_vector, skb);
 
 		/* update budget accounting */
-		budget--;
-	} while (likely(budget));
+		total_rx_packets++;
+	}
+	rcu_read_unlock();
 
 #ifdef IXGBE_FCOE
 	/* include DDPed FCoE data */
@@ -1785,9 +1882,37 @@ static bool ixgbe_clean_rx_irq(struct ixgbe_q_vector *q_vector,
 	if (cleaned_count)
 		ixgbe_alloc_rx_buffers(rx_ring, cleaned_count);
 
-	return !!budget;
+	return total_rx_packets;
 }
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* must be called with local_bh_disable()d */
+static int ixgbe_busy_poll_recv(struct napi_struct *napi)
+{
+	struct ixgbe_q_vector *q_vector =
+			container_of(napi, struct ixgbe_q_vector, napi);
+	struct ixgbe_adapter *adapter = q_vector->adapter;
+	struct ixgbe_ring  *ring;
+	int found = 0;
+
+	if (test_bit(__IXGBE_DOWN, &adapter->state))
+		return LL_FLUSH_FAILED;
+
+	if (!ixgbe_qv_lock_poll(q_vector))
+		return LL_FLUSH_BUSY;
+
+	ixgbe_for_each_ring(ring, q_vector->rx) {
+		found = ixgbe_clean_rx_irq(q_vector, ring, 4);
+		if (found)
+			break;
+	}
+
+	ixgbe_qv_unlock_poll(q_vector);
+
+	return found;
+}
+#endif	/* CONFIG_NET_RX_BUSY_POLL */
+
 /**
  * ixgbe_configure_msix - Configure MSI-X hardware
  * @adapter: board private structure
@@ -2346,9 +2471,18 @@ int ixgbe_poll(struct napi_struct *napi, int budget)
 	else
 		per_ring_budget = budget;
 
-	ixgbe_for_each_ring(ring, q_vector->rx)
-		clean_complete &= ixgbe_clean_rx_irq(q_vector, ring,
-						     per_ring_budget);
+	/* Exit if we are called by netpoll or busy polling is active */
+	if (!ixgbe_qv_lock_napi(q_vector))
+		return budget;
+
+	ixgbe_for_each_ring(ring, q_vector->rx) {
+		int cleaned = ixgbe_clean_rx_irq(q_vector, ring,
+						 per_ring_budget);
+
+		clean_complete &= (cleaned < per_ring_budget);
+	}
+
+	ixgbe_qv_unlock_napi(q_vector);
 
 	/* If all work not completed, return budget and keep polling */
 	if (!clean_complete)
@@ -3514,6 +3648,7 @@ static void ixgbe_napi_enable_all(struct ixgbe_adapter *adapter)
 
 	for (q_idx = 0; q_idx < q_vectors; q_idx++) {
 		q_vector = adapter->q_vector[q_idx];
+		ixgbe_qv_init_lock(q_vector);
 		napi_enable(&q_vector->napi);
 	}
 }
@@ -3531,6 +3666,10 @@ static void ixgbe_napi_disable_all(struct ixgbe_adapter *adapter)
 	for (q_idx = 0; q_idx < q_vectors; q_idx++) {
 		q_vector = adapter->q_vector[q_idx];
 		napi_disable(&q_vector->napi);
+		while (!ixgbe_qv_disable(q_vector)) {
+			pr_info("QV %d locked\n", q_idx);
+			usleep_range(1000, 20000);
+		}
 	}
 }
 
@@ -4720,6 +4859,11 @@ static int ixgbe_change_mtu(struct net_device *netdev, int new_mtu)
 	    (max_frame > MAXIMUM_ETHERNET_VLAN_SIZE))
 			return -EINVAL;
 
+	/* XDP filters only see frames that fit in a single Rx buffer */
+	if (rtnl_dereference(netdev->xdp_filter) &&
+	    (max_frame + VLAN_HLEN > PAGE_SIZE / 2))
+		return -EINVAL;
+
 	e_info(probe, "changing MTU from %d to %d\n", netdev->mtu, new_mtu);
 
 	/* must set new MTU before calling down or up */
@@ -6622,11 +6766,47 @@ static netdev_features_t ixgbe_fix_features(struct net_device *netdev,
 	/* Turn off LRO if not RSC capable */
 	if (!(adapter->flags2 & IXGBE_FLAG2_RSC_CAPABLE))
 		features &= ~NETIF_F_LRO;
+
+	/* XDP filters can't look at coalesced frames */
+	if (rtnl_dereference(netdev->xdp_filter))
+		features &= ~NETIF_F_LRO;
 	
 
 	return features;
 }
 
+/**
+ * ixgbe_xdp_filter - Check that an XDP filter can be attached
+ * @netdev: network interface device structure
+ * @fp: filter about to be attached, or NULL when it is detached
+ *
+ * The filter runs on frames still sitting in a single Rx buffer, so
+ * refuse it while frames may span buffers: with RSC coalescing them or
+ * with an MTU beyond the smallest buffer size.
+ *
+ * Returns 0 on success, negative on failure
+ **/
+static int ixgbe_xdp_filter(struct net_device *netdev, struct sk_filter *fp)
+{
+	struct ixgbe_adapter *adapter = netdev_priv(netdev);
+	int max_frame = netdev->mtu + ETH_HLEN + ETH_FCS_LEN + VLAN_HLEN;
+
+	if (!fp)
+		return 0;
+
+	if (max_frame > PAGE_SIZE / 2) {
+		e_err(probe, "MTU too large for XDP\n");
+		return -EINVAL;
+	}
+
+	if (adapter->flags2 & IXGBE_FLAG2_RSC_ENABLED) {
+		e_err(probe, "LRO must be disabled to use XDP\n");
+		return -EBUSY;
+	}
+
+	return 0;
+}
+
 static int ixgbe_set_features(struct net_device *netdev,
 			      netdev_features_t features)
 {
@@ -6706,6 +6886,9 @@ static const struct net_device_ops ixgbe_netdev_ops = {
 #ifdef CONFIG_NET_POLL_CONTROLLER
 	.ndo_poll_controller	= ixgbe_netpoll,
 #endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	.ndo_busy_poll		= ixgbe_busy_poll_recv,
+#endif
 #ifdef IXGBE_FCOE
 	.ndo_fcoe_ddp_setup = ixgbe_fcoe_ddp_get,
 	.ndo_fcoe_ddp_target = ixgbe_fcoe_ddp_target,
@@ -6717,6 +6900,7 @@ static const struct net_device_ops ixgbe_netdev_ops = {
 #endif /* IXGBE_FCOE */
 	.ndo_set_features = ixgbe_set_features,
 	.ndo_fix_features = ixgbe_fix_features,
+	.ndo_xdp_filter = ixgbe_xdp_filter,
 };
 
 static void __devinit ixgbe_probe_vf(struct ixgbe_adapter *adapter,
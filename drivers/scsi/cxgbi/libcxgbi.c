@@ -494,12 +494,14 @@ static struct cxgbi_sock *cxgbi_check_route(struct sockaddr *dst_addr)
 		goto err_out;
 	}
 	dst = &rt->dst;
-	n = dst_get_neighbour_noref(dst);
-	if (!n) {
+	/* on-link routes are shared and have no neighbour bound */
+	n = dst_neigh_lookup(dst, &daddr->sin_addr.s_addr);
+	if (IS_ERR(n)) {
 		err = -ENODEV;
 		goto rel_rt;
 	}
 	ndev = n->dev;
+	neigh_release(n);
 
 	if (rt->rt_flags & (RTCF_MULTICAST | RTCF_BROADCAST)) {
 		pr_info("multi-cast route %pI4, port %u, dev %s.\n",
@@ -513,7 +515,7 @@ static struct cxgbi_sock *cxgbi_check_route(struct sockaddr *dst_addr)
 		ndev = ip_dev_find(&init_net, daddr->sin_addr.s_addr);
 		mtu = ndev->mtu;
 		pr_info("rt dev %s, loopback -> %s, mtu %u.\n",
-			n->dev->name, ndev->name, mtu);
+			dst->dev->name, ndev->name, mtu);
 	}
 
 	cdev = cxgbi_device_find_by_netdev(ndev, &port);
@@ -556,7 +558,7 @@ void cxgbi_sock_established(struct cxgbi_sock *csk, unsigned int snd_isn,
 			unsigned int opt)
 {
 	csk->write_seq = csk->snd_nxt = csk->snd_una = snd_isn;
-	dst_confirm(csk->dst);
+	dst_confirm_neigh(csk->dst, &csk->daddr.sin_addr.s_addr);
 	smp_mb();
 	cxgbi_sock_set_state(csk, CTP_ESTABLISHED);
 }
@@ -603,7 +605,7 @@ static void need_active_close(struct cxgbi_sock *csk)
 	log_debug(1 << CXGBI_DBG_SOCK, "csk 0x%p,%u,0x%lx,%u.\n",
 		csk, (csk)->state, (csk)->flags, (csk)->tid);
 	spin_lock_bh(&csk->lock);
-	dst_confirm(csk->dst);
+	dst_confirm_neigh(csk->dst, &csk->daddr.sin_addr.s_addr);
 	data_lost = skb_queue_len(&csk->receive_queue);
 	__skb_queue_purge(&csk->receive_queue);
 
@@ -792,7 +794,7 @@ void cxgbi_sock_rcv_wr_ack(struct cxgbi_sock *csk, unsigned int credits,
 
 		if (csk->snd_una != snd_una) {
 			csk->snd_una = snd_una;
-			dst_confirm(csk->dst);
+			dst_confirm_neigh(csk->dst, &csk->daddr.sin_addr.s_addr);
 		}
 	}
 
@@ -0,0 +1,199 @@
+/*
+ * Compressed RAM block device: compression streams
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+
+#include "zcomp.h"
+
+/*
+ * Backends listed in the comp_algorithm sysfs node.  Any other
+ * compressor known to the crypto API is accepted as well.
+ */
+static const char * const backends[] = {
+	"lzo",
+	"deflate",
+	NULL
+};
+
+bool zcomp_available_algorithm(const char *comp)
+{
+	return crypto_has_comp(comp, 0, 0);
+}
+
+/* show available compressors, with the selected one in [] */
+ssize_t zcomp_available_show(const char *comp, char *buf)
+{
+	bool known = false;
+	ssize_t sz = 0;
+	int i;
+
+	for (i = 0; backends[i]; i++) {
+		if (!strcmp(comp, backends[i])) {
+			known = true;
+			sz += scnprintf(buf + sz, PAGE_SIZE - sz - 2,
+					"[%s] ", backends[i]);
+		} else if (crypto_has_comp(backends[i], 0, 0)) {
+			sz += scnprintf(buf + sz, PAGE_SIZE - sz - 2,
+					"%s ", backends[i]);
+		}
+	}
+
+	if (!known)
+		sz += scnprintf(buf + sz, PAGE_SIZE - sz - 2, "[%s] ", comp);
+
+	sz += scnprintf(buf + sz, PAGE_SIZE - sz, "\n");
+	return sz;
+}
+
+static void zcomp_strm_free(struct zcomp_strm *zstrm)
+{
+	if (zstrm->tfm && !IS_ERR(zstrm->tfm))
+		crypto_free_comp(zstrm->tfm);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+static struct zcomp_strm *zcomp_strm_alloc(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_KERNEL);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->tfm = crypto_alloc_comp(comp->name, 0, 0);
+	zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (IS_ERR(zstrm->tfm) || !zstrm->buffer) {
+		zcomp_strm_free(zstrm);
+		return NULL;
+	}
+
+	return zstrm;
+}
+
+/*
+ * Get an idle compression stream, sleeping until one is released if
+ * all of them are busy.
+ */
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	for (;;) {
+		spin_lock(&comp->strm_lock);
+		if (!list_empty(&comp->idle_strm)) {
+			zstrm = list_entry(comp->idle_strm.next,
+					   struct zcomp_strm, list);
+			list_del(&zstrm->list);
+			spin_unlock(&comp->strm_lock);
+			return zstrm;
+		}
+		spin_unlock(&comp->strm_lock);
+
+		wait_event(comp->strm_wait, !list_empty(&comp->idle_strm));
+	}
+}
+
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm)
+{
+	spin_lock(&comp->strm_lock);
+	list_add(&zstrm->list, &comp->idle_strm);
+	spin_unlock(&comp->strm_lock);
+
+	if (waitqueue_active(&comp->strm_wait))
+		wake_up(&comp->strm_wait);
+}
+
+/*
+ * Compress one page from @src into the stream buffer.  On success
+ * *dst_len holds the compressed length.
+ */
+int zcomp_compress(struct zcomp_strm *zstrm, const unsigned char *src,
+		   size_t *dst_len)
+{
+	unsigned int dlen = PAGE_SIZE * 2;
+	int ret;
+
+	ret = crypto_comp_compress(zstrm->tfm, src, PAGE_SIZE,
+				   zstrm->buffer, &dlen);
+	*dst_len = dlen;
+	return ret;
+}
+
+int zcomp_decompress(struct zcomp_strm *zstrm, const unsigned char *src,
+		     size_t src_len, unsigned char *dst)
+{
+	unsigned int dlen = PAGE_SIZE;
+	int ret;
+
+	ret = crypto_comp_decompress(zstrm->tfm, src, src_len, dst, &dlen);
+	if (!ret && dlen != PAGE_SIZE)
+		ret = -EINVAL;
+	return ret;
+}
+
+void zcomp_destroy(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	while (!list_empty(&comp->idle_strm)) {
+		zstrm = list_entry(comp->idle_strm.next,
+				   struct zcomp_strm, list);
+		list_del(&zstrm->list);
+		zcomp_strm_free(zstrm);
+	}
+	kfree(comp);
+}
+
+/*
+ * Set up @max_strm compression streams for the @comp compressor.
+ *
+ * All streams are allocated here rather than on demand: the write
+ * path runs on behalf of reclaim, where setting up a crypto
+ * transform (and possibly loading its module) is not an option.
+ */
+struct zcomp *zcomp_create(const char *comp, int max_strm)
+{
+	struct zcomp *zcomp;
+	struct zcomp_strm *zstrm;
+	int i;
+
+	if (!zcomp_available_algorithm(comp))
+		return ERR_PTR(-EINVAL);
+
+	zcomp = kzalloc(sizeof(*zcomp), GFP_KERNEL);
+	if (!zcomp)
+		return ERR_PTR(-ENOMEM);
+
+	strlcpy(zcomp->name, comp, sizeof(zcomp->name));
+	INIT_LIST_HEAD(&zcomp->idle_strm);
+	spin_lock_init(&zcomp->strm_lock);
+	init_waitqueue_head(&zcomp->strm_wait);
+	zcomp->max_strm = max_strm;
+
+	for (i = 0; i < max_strm; i++) {
+		zstrm = zcomp_strm_alloc(zcomp);
+		if (!zstrm) {
+			zcomp_destroy(zcomp);
+			return ERR_PTR(-ENOMEM);
+		}
+		list_add(&zstrm->list, &zcomp->idle_strm);
+	}
+
+	return zcomp;
+}
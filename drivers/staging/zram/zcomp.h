@@ -0,0 +1,59 @@
+/*
+ * Compressed RAM block device: compression streams
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+#include <linux/crypto.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+#define ZCOMP_DEFAULT_ALGORITHM	"lzo"
+
+struct zcomp_strm {
+	/* crypto API compression context */
+	struct crypto_comp *tfm;
+	/*
+	 * compressed data buffer: two pages, since a compressor may
+	 * expand an incompressible page beyond PAGE_SIZE
+	 */
+	void *buffer;
+	struct list_head list;
+};
+
+/*
+ * A fixed-size set of compression streams.  Each writer (and reader)
+ * takes a stream of its own for the duration of one page, so up to
+ * max_strm pages are compressed in parallel.
+ */
+struct zcomp {
+	struct list_head idle_strm;
+	spinlock_t strm_lock;		/* protects idle_strm */
+	wait_queue_head_t strm_wait;	/* waiters for an idle stream */
+	int max_strm;
+	char name[CRYPTO_MAX_ALG_NAME];
+};
+
+bool zcomp_available_algorithm(const char *comp);
+ssize_t zcomp_available_show(const char *comp, char *buf);
+
+struct zcomp *zcomp_create(const char *comp, int max_strm);
+void zcomp_destroy(struct zcomp *comp);
+
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm);
+
+int zcomp_compress(struct zcomp_strm *zstrm, const unsigned char *src,
+		   size_t *dst_len);
+int zcomp_decompress(struct zcomp_strm *zstrm, const unsigned char *src,
+		     size_t src_len, unsigned char *dst);
+
+#endif /* _ZCOMP_H_ */
@@ -29,7 +29,8 @@
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/err.h>
+#include <linux/cpumask.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -182,175 +183,149 @@ static void handle_zero_page(struct bio_vec *bvec)
 	flush_dcache_page(page);
 }
 
-static void handle_uncompressed_page(struct zram *zram, struct bio_vec *bvec,
-				     u32 index, int offset)
+static inline int is_partial_io(struct bio_vec *bvec)
 {
-	struct page *page = bvec->bv_page;
-	unsigned char *user_mem, *cmem;
+	return bvec->bv_len != PAGE_SIZE;
+}
 
-	user_mem = kmap_atomic(page);
-	cmem = kmap_atomic(zram->table[index].handle);
+/*
+ * Decompress the page at @index into @mem.  Caller provides the
+ * compression stream since it must be taken before any atomic
+ * mapping is set up.
+ */
+static int zram_decompress_page(struct zram *zram, struct zcomp_strm *zstrm,
+				char *mem, u32 index)
+{
+	int ret = 0;
+	void *handle;
+	unsigned char *cmem;
 
-	memcpy(user_mem + bvec->bv_offset, cmem + offset, bvec->bv_len);
-	kunmap_atomic(cmem);
-	kunmap_atomic(user_mem);
+	read_lock(&zram->tb_lock);
+	handle = zram->table[index].handle;
 
-	flush_dcache_page(page);
-}
+	if (!handle || zram_test_flag(zram, index, ZRAM_ZERO)) {
+		read_unlock(&zram->tb_lock);
+		memset(mem, 0, PAGE_SIZE);
+		return 0;
+	}
 
-static inline int is_partial_io(struct bio_vec *bvec)
-{
-	return bvec->bv_len != PAGE_SIZE;
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		cmem = kmap_atomic(handle);
+		memcpy(mem, cmem, PAGE_SIZE);
+		kunmap_atomic(cmem);
+	} else {
+		cmem = zs_map_object(zram->mem_pool, handle);
+		ret = zcomp_decompress(zstrm, cmem + sizeof(struct zobj_header),
+				       zram->table[index].size, mem);
+		zs_unmap_object(zram->mem_pool, handle);
+	}
+	read_unlock(&zram->tb_lock);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return ret;
+	}
+
+	return 0;
 }
 
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
 	int ret;
-	size_t clen;
 	struct page *page;
-	struct zobj_header *zheader;
-	unsigned char *user_mem, *cmem, *uncmem = NULL;
+	struct zcomp_strm *zstrm;
+	unsigned char *user_mem, *uncmem = NULL;
 
 	page = bvec->bv_page;
 
-	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-		handle_zero_page(bvec);
-		return 0;
-	}
-
-	/* Requested page is not present in compressed area */
-	if (unlikely(!zram->table[index].handle)) {
-		pr_debug("Read before write: sector=%lu, size=%u",
-			 (ulong)(bio->bi_sector), bio->bi_size);
+	read_lock(&zram->tb_lock);
+	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
+	    unlikely(!zram->table[index].handle)) {
+		if (!zram->table[index].handle &&
+		    !zram_test_flag(zram, index, ZRAM_ZERO))
+			pr_debug("Read before write: sector=%lu, size=%u",
+				 (ulong)(bio->bi_sector), bio->bi_size);
+		read_unlock(&zram->tb_lock);
 		handle_zero_page(bvec);
 		return 0;
 	}
-
-	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		handle_uncompressed_page(zram, bvec, index, offset);
-		return 0;
-	}
+	read_unlock(&zram->tb_lock);
 
 	if (is_partial_io(bvec)) {
 		/* Use  a temporary buffer to decompress the page */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
 		if (!uncmem) {
 			pr_info("Error allocating temp memory!\n");
 			return -ENOMEM;
 		}
 	}
 
+	zstrm = zcomp_strm_find(zram->comp);
 	user_mem = kmap_atomic(page);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
-	clen = PAGE_SIZE;
 
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
-
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    uncmem, &clen);
+	ret = zram_decompress_page(zram, zstrm, uncmem, index);
 
 	if (is_partial_io(bvec)) {
-		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
-		       bvec->bv_len);
+		if (!ret)
+			memcpy(user_mem + bvec->bv_offset, uncmem + offset,
+			       bvec->bv_len);
 		kfree(uncmem);
 	}
 
-	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
 	kunmap_atomic(user_mem);
+	zcomp_strm_release(zram->comp, zstrm);
 
-	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
-		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
-		zram_stat64_inc(zram, &zram->stats.failed_reads);
+	if (ret)
 		return ret;
-	}
 
 	flush_dcache_page(page);
 
 	return 0;
 }
 
-static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
-{
-	int ret;
-	size_t clen = PAGE_SIZE;
-	struct zobj_header *zheader;
-	unsigned char *cmem;
-
-	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
-	    !zram->table[index].handle) {
-		memset(mem, 0, PAGE_SIZE);
-		return 0;
-	}
-
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
-
-	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		memcpy(mem, cmem, PAGE_SIZE);
-		kunmap_atomic(cmem);
-		return 0;
-	}
-
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    mem, &clen);
-	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
-
-	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
-		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
-		zram_stat64_inc(zram, &zram->stats.failed_reads);
-		return ret;
-	}
-
-	return 0;
-}
-
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
 	int ret;
-	u32 store_offset;
 	size_t clen;
 	void *handle;
 	struct zobj_header *zheader;
 	struct page *page, *page_store;
+	struct zcomp_strm *zstrm;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
+	bool uncompressed = false;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
+
+	/*
+	 * Every writer works in a compression stream of its own, so
+	 * writes to different pages compress in parallel.  The table is
+	 * only locked to publish the result.
+	 */
+	zstrm = zcomp_strm_find(zram->comp);
 
 	if (is_partial_io(bvec)) {
 		/*
 		 * This is a partial IO. We need to read the full page
 		 * before to write the changes.
 		 */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
 		if (!uncmem) {
 			pr_info("Error allocating temp memory!\n");
 			ret = -ENOMEM;
 			goto out;
 		}
-		ret = zram_read_before_write(zram, uncmem, index);
-		if (ret) {
-			kfree(uncmem);
+		ret = zram_decompress_page(zram, zstrm, uncmem, index);
+		if (ret)
 			goto out;
-		}
 	}
 
-	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
-	 */
-	if (zram->table[index].handle ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
-
 	user_mem = kmap_atomic(page);
 
 	if (is_partial_io(bvec))
@@ -361,22 +336,22 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 
 	if (page_zero_filled(uncmem)) {
 		kunmap_atomic(user_mem);
-		if (is_partial_io(bvec))
-			kfree(uncmem);
+		write_lock(&zram->tb_lock);
+		zram_free_page(zram, index);
 		zram_stat_inc(&zram->stats.pages_zero);
 		zram_set_flag(zram, index, ZRAM_ZERO);
+		write_unlock(&zram->tb_lock);
 		ret = 0;
 		goto out;
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
+	ret = zcomp_compress(zstrm, uncmem, &clen);
 
 	kunmap_atomic(user_mem);
-	if (is_partial_io(bvec))
-			kfree(uncmem);
+	if (!is_partial_io(bvec))
+		uncmem = NULL;
 
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Compression failed! err=%d\n", ret);
 		goto out;
 	}
@@ -396,12 +371,17 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			goto out;
 		}
 
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
+		uncompressed = true;
 		handle = page_store;
-		src = kmap_atomic(page);
 		cmem = kmap_atomic(page_store);
+		if (uncmem) {
+			memcpy(cmem, uncmem, PAGE_SIZE);
+		} else {
+			src = kmap_atomic(page);
+			memcpy(cmem, src, PAGE_SIZE);
+			kunmap_atomic(src);
+		}
+		kunmap_atomic(cmem);
 		goto memstore;
 	}
 
@@ -414,37 +394,46 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	}
 	cmem = zs_map_object(zram->mem_pool, handle);
 
-memstore:
 #if 0
 	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
+	zheader = (struct zobj_header *)cmem;
+	zheader->table_idx = index;
+	cmem += sizeof(*zheader);
 #endif
 
-	memcpy(cmem, src, clen);
+	memcpy(cmem, zstrm->buffer, clen);
+	zs_unmap_object(zram->mem_pool, handle);
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		kunmap_atomic(cmem);
-		kunmap_atomic(src);
-	} else {
-		zs_unmap_object(zram->mem_pool, handle);
-	}
+memstore:
+	zcomp_strm_release(zram->comp, zstrm);
+	zstrm = NULL;
+
+	/*
+	 * Free memory associated with this sector only now, so that a
+	 * failed write leaves the old contents in place.
+	 */
+	write_lock(&zram->tb_lock);
+	zram_free_page(zram, index);
 
 	zram->table[index].handle = handle;
 	zram->table[index].size = clen;
+	if (uncompressed) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	}
 
 	/* Update stats */
 	zram_stat64_add(zram, &zram->stats.compr_size, clen);
 	zram_stat_inc(&zram->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_inc(&zram->stats.good_compress);
-
-	return 0;
+	write_unlock(&zram->tb_lock);
 
 out:
+	if (zstrm)
+		zcomp_strm_release(zram->comp, zstrm);
+	if (is_partial_io(bvec))
+		kfree(uncmem);
 	if (ret)
 		zram_stat64_inc(zram, &zram->stats.failed_writes);
 	return ret;
@@ -453,19 +442,10 @@ out:
 static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 			int offset, struct bio *bio, int rw)
 {
-	int ret;
-
-	if (rw == READ) {
-		down_read(&zram->lock);
-		ret = zram_bvec_read(zram, bvec, index, offset, bio);
-		up_read(&zram->lock);
-	} else {
-		down_write(&zram->lock);
-		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
-	}
+	if (rw == READ)
+		return zram_bvec_read(zram, bvec, index, offset, bio);
 
-	return ret;
+	return zram_bvec_write(zram, bvec, index, offset);
 }
 
 static void update_position(u32 *index, int *offset, struct bio_vec *bvec)
@@ -583,12 +563,10 @@ void __zram_reset_device(struct zram *zram)
 
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free compression streams */
+	if (zram->comp)
+		zcomp_destroy(zram->comp);
+	zram->comp = NULL;
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
@@ -635,18 +613,12 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail_no_table;
-	}
-
-	zram->compress_buffer =
-		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	zram->comp = zcomp_create(zram->compressor, zram->max_comp_streams);
+	if (IS_ERR(zram->comp)) {
+		pr_err("Cannot initialise %s compressing backend\n",
+			zram->compressor);
+		ret = PTR_ERR(zram->comp);
+		zram->comp = NULL;
 		goto fail_no_table;
 	}
 
@@ -692,7 +664,9 @@ static void zram_slot_free_notify(struct block_device *bdev,
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->tb_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->tb_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -705,10 +679,15 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	init_rwsem(&zram->lock);
+	rwlock_init(&zram->tb_lock);
 	init_rwsem(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
 
+	/* one compression stream per online cpu unless told otherwise */
+	zram->max_comp_streams = num_online_cpus();
+	strlcpy(zram->compressor, ZCOMP_DEFAULT_ALGORITHM,
+		sizeof(zram->compressor));
+
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
 		pr_err("Error allocating disk queue for device %d\n",
@@ -18,7 +18,9 @@
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
 
-#include "../zsmalloc/zsmalloc.h"
+#include <linux/zsmalloc.h>
+
+#include "zcomp.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -103,12 +105,10 @@ struct zram_stats {
 
 struct zram {
 	struct zs_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zcomp *comp;	/* compression streams */
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	rwlock_t tb_lock;	/* protect table entries and 32-bit stats */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -119,6 +119,8 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	int max_comp_streams;
+	char compressor[CRYPTO_MAX_ALG_NAME];
 
 	struct zram_stats stats;
 };
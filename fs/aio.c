@@ -84,6 +84,23 @@ static int __init aio_setup(void)
 }
 __initcall(aio_setup);
 
+/*
+ * Unmap the ring from userspace.  Must run in the context's own mm while
+ * it is still alive, before io_destroy() returns: the final free is
+ * deferred, and by then the address range may have been reused.
+ */
+static void aio_unmap_ring(struct kioctx *ctx)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+
+	down_write(&ctx->mm->mmap_sem);
+	if (info->mmap_size) {
+		do_munmap(ctx->mm, info->mmap_base, info->mmap_size);
+		info->mmap_size = 0;
+	}
+	up_write(&ctx->mm->mmap_sem);
+}
+
 static void aio_free_ring(struct kioctx *ctx)
 {
 	struct aio_ring_info *info = &ctx->ring_info;
@@ -92,11 +109,9 @@ static void aio_free_ring(struct kioctx *ctx)
 	for (i=0; i<info->nr_pages; i++)
 		put_page(info->ring_pages[i]);
 
-	if (info->mmap_size) {
-		down_write(&ctx->mm->mmap_sem);
-		do_munmap(ctx->mm, info->mmap_base, info->mmap_size);
-		up_write(&ctx->mm->mmap_sem);
-	}
+	/* still mapped only if ioctx_alloc() failed half way */
+	if (info->mmap_size)
+		aio_unmap_ring(ctx);
 
 	if (info->ring_pages && info->ring_pages != info->internal_pages)
 		kfree(info->ring_pages);
@@ -202,12 +217,13 @@ static void ctx_rcu_free(struct rcu_head *head)
 	kmem_cache_free(kioctx_cachep, ctx);
 }
 
-/* __put_ioctx
+/* free_ioctx
  *	Called when the last user of an aio context has gone away,
  *	and the struct needs to be freed.
  */
-static void __put_ioctx(struct kioctx *ctx)
+static void free_ioctx(struct work_struct *work)
 {
+	struct kioctx *ctx = container_of(work, struct kioctx, free_work);
 	unsigned nr_events = ctx->max_reqs;
 	BUG_ON(ctx->reqs_active);
 
@@ -221,20 +237,25 @@ static void __put_ioctx(struct kioctx *ctx)
 		aio_nr -= nr_events;
 		spin_unlock(&aio_nr_lock);
 	}
-	pr_debug("__put_ioctx: freeing %p\n", ctx);
+	percpu_ref_exit(&ctx->users);
+	pr_debug("free_ioctx: freeing %p\n", ctx);
 	call_rcu(&ctx->rcu_head, ctx_rcu_free);
 }
 
-static inline int try_get_ioctx(struct kioctx *kioctx)
+/*
+ * The last put can happen from the RCU callback of percpu_ref_kill(),
+ * so punt the teardown, which sleeps, to a work item.
+ */
+static void free_ioctx_ref(struct percpu_ref *ref)
 {
-	return atomic_inc_not_zero(&kioctx->users);
+	struct kioctx *ctx = container_of(ref, struct kioctx, users);
+
+	schedule_work(&ctx->free_work);
 }
 
 static inline void put_ioctx(struct kioctx *kioctx)
 {
-	BUG_ON(atomic_read(&kioctx->users) <= 0);
-	if (unlikely(atomic_dec_and_test(&kioctx->users)))
-		__put_ioctx(kioctx);
+	percpu_ref_put(&kioctx->users);
 }
 
 /* ioctx_alloc
@@ -264,7 +285,12 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	mm = ctx->mm = current->mm;
 	atomic_inc(&mm->mm_count);
 
-	atomic_set(&ctx->users, 2);
+	/* the initial ref is dropped by io_destroy() or exit_aio() */
+	if (percpu_ref_init(&ctx->users, free_ioctx_ref))
+		goto out_freemm;
+	/* and this one by the io_setup() caller */
+	percpu_ref_get(&ctx->users);
+
 	spin_lock_init(&ctx->ctx_lock);
 	spin_lock_init(&ctx->ring_info.ring_lock);
 	init_waitqueue_head(&ctx->wait);
@@ -272,6 +298,7 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	INIT_LIST_HEAD(&ctx->active_reqs);
 	INIT_LIST_HEAD(&ctx->run_list);
 	INIT_DELAYED_WORK(&ctx->wq, aio_kick_handler);
+	INIT_WORK(&ctx->free_work, free_ioctx);
 
 	if (aio_setup_ring(ctx) < 0)
 		goto out_freectx;
@@ -299,6 +326,8 @@ out_cleanup:
 	err = -EAGAIN;
 	aio_free_ring(ctx);
 out_freectx:
+	percpu_ref_exit(&ctx->users);
+out_freemm:
 	mmdrop(mm);
 	kmem_cache_free(kioctx_cachep, ctx);
 	dprintk("aio: error allocating ioctx %d\n", err);
@@ -384,12 +413,18 @@ void exit_aio(struct mm_struct *mm)
 
 		kill_ctx(ctx);
 
-		if (1 != atomic_read(&ctx->users))
+		if (1 != percpu_ref_read(&ctx->users))
 			printk(KERN_DEBUG
-				"exit_aio:ioctx still alive: %d %d %d\n",
-				atomic_read(&ctx->users), ctx->dead,
+				"exit_aio:ioctx still alive: %u %d %d\n",
+				percpu_ref_read(&ctx->users), ctx->dead,
 				ctx->reqs_active);
-		put_ioctx(ctx);
+		/*
+		 * We don't need to bother with munmap() here: exit_mmap(mm)
+		 * is coming and it'll unmap everything.  And the deferred
+		 * free_ioctx() must not touch the mm once it is gone.
+		 */
+		ctx->ring_info.mmap_size = 0;
+		percpu_ref_kill(&ctx->users);
 	}
 }
 
@@ -418,6 +453,7 @@ static struct kiocb *__aio_get_req(struct kioctx *ctx)
 	req->ki_cancel = NULL;
 	req->ki_retry = NULL;
 	req->ki_dtor = NULL;
+	req->ki_complete = NULL;
 	req->private = NULL;
 	req->ki_iovec = NULL;
 	INIT_LIST_HEAD(&req->ki_run_list);
@@ -652,11 +688,12 @@ static struct kioctx *lookup_ioctx(unsigned long ctx_id)
 	hlist_for_each_entry_rcu(ctx, n, &mm->ioctx_list, list) {
 		/*
 		 * RCU protects us against accessing freed memory but
-		 * we have to be careful not to get a reference when the
-		 * reference count already dropped to 0 (ctx->dead test
-		 * is unreliable because of races).
+		 * we have to be careful not to get a reference once the
+		 * context has been killed (ctx->dead test is unreliable
+		 * because of races).
 		 */
-		if (ctx->user_id == ctx_id && !ctx->dead && try_get_ioctx(ctx)){
+		if (ctx->user_id == ctx_id && !ctx->dead &&
+		    percpu_ref_tryget_live(&ctx->users)) {
 			ret = ctx;
 			break;
 		}
@@ -971,6 +1008,15 @@ int aio_complete(struct kiocb *iocb, long res, long res2)
 		return 1;
 	}
 
+	/*
+	 * Async iocbs submitted through io_uring don't belong to a kioctx,
+	 * their owner posts the completion itself.
+	 */
+	if (iocb->ki_complete) {
+		iocb->ki_complete(iocb, res, res2);
+		return 1;
+	}
+
 	info = &ctx->ring_info;
 
 	/* add a completion event to the ring buffer.
@@ -1260,9 +1306,10 @@ static void io_destroy(struct kioctx *ioctx)
 
 	dprintk("aio_release(%p)\n", ioctx);
 	if (likely(!was_dead))
-		put_ioctx(ioctx);	/* twice for the list */
+		percpu_ref_kill(&ioctx->users);	/* drop the list's ref */
 
 	kill_ctx(ioctx);
+	aio_unmap_ring(ioctx);
 
 	/*
 	 * Wake up any waiters.  The setting of ctx->dead must be seen
@@ -131,6 +131,10 @@ struct dio {
 	struct bio *bio_list;		/* singly linked via bi_private */
 	struct task_struct *waiter;	/* waiting task (NULL if none) */
 
+	/* completion polling, for synchronous IO only */
+	struct request_queue *poll_q;	/* queue of the last bio, if polled */
+	ktime_t submit_time;		/* when the last bio was submitted */
+
 	/* AIO related stuff */
 	struct kiocb *iocb;		/* kiocb */
 	ssize_t result;                 /* IO result */
@@ -423,6 +427,15 @@ static inline void dio_bio_submit(struct dio *dio, struct dio_submit *sdio)
 	if (dio->is_async && dio->rw == READ)
 		bio_set_pages_dirty(bio);
 
+	if (!dio->is_async) {
+		struct request_queue *q = bdev_get_queue(bio->bi_bdev);
+
+		if (blk_queue_poll(q)) {
+			dio->poll_q = q;
+			dio->submit_time = ktime_get();
+		}
+	}
+
 	if (sdio->submit_io)
 		sdio->submit_io(dio->rw, bio, dio->inode,
 			       sdio->logical_offset_in_bio);
@@ -466,7 +479,8 @@ static struct bio *dio_await_one(struct dio *dio)
 		__set_current_state(TASK_UNINTERRUPTIBLE);
 		dio->waiter = current;
 		spin_unlock_irqrestore(&dio->bio_lock, flags);
-		io_schedule();
+		if (!dio->poll_q || !blk_poll(dio->poll_q, dio->submit_time))
+			io_schedule();
 		/* wake up sets us TASK_RUNNING */
 		spin_lock_irqsave(&dio->bio_lock, flags);
 		dio->waiter = NULL;
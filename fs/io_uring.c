@@ -0,0 +1,1482 @@
+/*
+ * fs/io_uring.c
+ *
+ * Shared application/kernel submission and completion ring pairs, for
+ * supporting fast/efficient IO without a system call per request.
+ *
+ * The application fills in submission queue entries (sqes) and bumps the
+ * sq ring tail, the kernel consumes them and moves the sq ring head.  For
+ * the cq ring it's the other way around: the kernel fills in completion
+ * queue entries (cqes) and moves the tail, the application reaps them and
+ * moves the head.
+ *
+ * A note on the read/write ordering memory barriers that are matched
+ * between the application and kernel side.  When the application reads
+ * the cq ring tail, it must use an appropriate smp_rmb() to order with
+ * the smp_wmb() the kernel uses before writing the tail.  It also needs
+ * a smp_mb() before updating the cq head (ordering the entry load(s)
+ * with the head store), pairing with the implicit barrier through a
+ * control dependency in io_get_cqring().  Likewise, the application must
+ * use an appropriate smp_wmb() both before writing the sqe array, and
+ * before writing the sq tail, pairing with the smp_rmb() the kernel does
+ * in io_get_sqring().
+ *
+ * There is no way to ask a filesystem for IO that is guaranteed not to
+ * block, so requests that can complete without sleeping are issued
+ * inline from io_uring_enter(2): O_DIRECT reads and writes go down the
+ * regular async kiocb path, and buffered reads whose pages are all
+ * cached and uptodate are copied directly.  Everything else is handed to
+ * a per-ring workqueue which issues it synchronously on behalf of the
+ * submitter, borrowing its mm and credentials.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/syscalls.h>
+#include <linux/compat.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/fdtable.h>
+#include <linux/fsnotify.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/mmu_context.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/blkdev.h>
+#include <linux/anon_inodes.h>
+#include <linux/poll.h>
+#include <linux/aio.h>
+#include <linux/uio.h>
+#include <linux/cred.h>
+#include <linux/io_uring.h>
+
+#include <asm/uaccess.h>
+
+#include "read_write.h"
+
+#define IORING_MAX_ENTRIES	4096
+
+/*
+ * Buffered reads spanning more than this many cached pages are punted to
+ * the workqueue rather than copied inline, to bound the time spent in
+ * io_uring_enter(2) on behalf of a single sqe.
+ */
+#define IORING_MAX_INLINE_PAGES	32
+
+struct io_uring {
+	u32 head ____cacheline_aligned_in_smp;
+	u32 tail ____cacheline_aligned_in_smp;
+};
+
+struct io_sq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			dropped;
+	u32			flags;
+	u32			array[];
+};
+
+struct io_cq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			overflow;
+	struct io_uring_cqe	cqes[];
+};
+
+struct io_ring_ctx {
+	struct {
+		atomic_t		refs;
+		unsigned int		flags;
+		bool			compat;
+		struct completion	ctx_done;
+	} ____cacheline_aligned_in_smp;
+
+	/* SQ ring */
+	struct {
+		struct io_sq_ring	*sq_ring;
+		unsigned		cached_sq_head;
+		unsigned		sq_entries;
+		unsigned		sq_mask;
+		unsigned long		sq_thread_idle;
+		struct io_uring_sqe	*sq_sqes;
+	} ____cacheline_aligned_in_smp;
+
+	/* IO offload */
+	struct workqueue_struct	*sqo_wq;
+	struct task_struct	*sqo_thread;	/* if using sq thread polling */
+	struct task_struct	*sqo_task;	/* whose file table we use */
+	struct mm_struct	*sqo_mm;
+	wait_queue_head_t	sqo_wait;
+	const struct cred	*creds;
+
+	/* CQ ring */
+	struct {
+		struct io_cq_ring	*cq_ring;
+		unsigned		cached_cq_tail;
+		unsigned		cq_entries;
+		unsigned		cq_mask;
+		wait_queue_head_t	cq_wait;
+	} ____cacheline_aligned_in_smp;
+
+	struct {
+		spinlock_t		completion_lock;
+		/* armed poll requests, for cancellation */
+		struct list_head	cancel_list;
+	} ____cacheline_aligned_in_smp;
+
+	/* serializes sq ring consumption */
+	struct mutex		uring_lock;
+};
+
+struct io_poll_iocb {
+	struct file		*file;
+	wait_queue_head_t	*head;
+	__u32			events;
+	bool			done;
+	bool			canceled;
+	wait_queue_t		wait;
+};
+
+/*
+ * Requests are referenced once by the submission path and once by the
+ * completion path, whichever drops the last reference frees it.
+ */
+struct io_kiocb {
+	union {
+		struct kiocb		rw;
+		struct io_poll_iocb	poll;
+	};
+
+	struct io_ring_ctx	*ctx;
+	struct file		*file;
+	struct list_head	list;
+	atomic_t		refs;
+	u8			opcode;
+	u32			fsync_flags;
+	u64			user_data;
+	loff_t			pos;
+	size_t			len;
+
+	unsigned long		nr_segs;
+	struct iovec		*iov;
+	struct iovec		fast_iov[UIO_FASTIOV];
+
+	struct work_struct	work;
+};
+
+struct io_poll_table {
+	poll_table		pt;
+	struct io_kiocb		*req;
+	int			error;
+};
+
+static struct kmem_cache *req_cachep;
+
+static const struct file_operations io_uring_fops;
+
+static void io_ring_drop_ctx_refs(struct io_ring_ctx *ctx, unsigned refs)
+{
+	if (atomic_sub_and_test(refs, &ctx->refs))
+		complete(&ctx->ctx_done);
+}
+
+static struct io_kiocb *io_get_req(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	req = kmem_cache_alloc(req_cachep, GFP_KERNEL);
+	if (!req)
+		return NULL;
+
+	atomic_inc(&ctx->refs);
+	req->ctx = ctx;
+	req->file = NULL;
+	req->iov = NULL;
+	/* one for submission, one for completion */
+	atomic_set(&req->refs, 2);
+	return req;
+}
+
+static void __io_free_req(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+
+	if (req->iov && req->iov != req->fast_iov)
+		kfree(req->iov);
+	if (req->file)
+		fput(req->file);
+	kmem_cache_free(req_cachep, req);
+	io_ring_drop_ctx_refs(ctx, 1);
+}
+
+static void io_free_req_work(struct work_struct *work)
+{
+	__io_free_req(container_of(work, struct io_kiocb, work));
+}
+
+static void io_put_req(struct io_kiocb *req)
+{
+	if (atomic_dec_and_test(&req->refs))
+		__io_free_req(req);
+}
+
+/*
+ * Completions may come in from irq context or with a waitqueue lock held,
+ * where the final fput() of the file isn't allowed.  Defer it then.
+ */
+static void io_put_req_atomic(struct io_kiocb *req)
+{
+	if (!atomic_dec_and_test(&req->refs))
+		return;
+
+	if (req->file) {
+		if (!fput_atomic(req->file)) {
+			INIT_WORK(&req->work, io_free_req_work);
+			schedule_work(&req->work);
+			return;
+		}
+		req->file = NULL;
+	}
+	__io_free_req(req);
+}
+
+static struct io_uring_cqe *io_get_cqring(struct io_ring_ctx *ctx)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	unsigned tail;
+
+	tail = ctx->cached_cq_tail;
+	/* See comment at the top of this file */
+	smp_rmb();
+	if (tail - ACCESS_ONCE(ring->r.head) == ctx->cq_entries)
+		return NULL;
+
+	ctx->cached_cq_tail++;
+	return &ring->cqes[tail & ctx->cq_mask];
+}
+
+static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 user_data,
+				 long res)
+{
+	struct io_uring_cqe *cqe;
+
+	/*
+	 * If we can't get a cq entry, userspace overflowed the
+	 * submission (by quite a lot). Increment the overflow count in
+	 * the ring.
+	 */
+	cqe = io_get_cqring(ctx);
+	if (cqe) {
+		cqe->user_data = user_data;
+		cqe->res = res;
+		cqe->flags = 0;
+	} else {
+		unsigned overflow = ACCESS_ONCE(ctx->cq_ring->overflow);
+
+		ACCESS_ONCE(ctx->cq_ring->overflow) = overflow + 1;
+	}
+}
+
+static void io_commit_cqring(struct io_ring_ctx *ctx)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+
+	if (ctx->cached_cq_tail != ACCESS_ONCE(ring->r.tail)) {
+		/* order cqe stores with ring update */
+		smp_wmb();
+		ACCESS_ONCE(ring->r.tail) = ctx->cached_cq_tail;
+	}
+}
+
+static void io_cqring_ev_posted(struct io_ring_ctx *ctx)
+{
+	/* order the tail store against the waitqueue check */
+	smp_mb();
+	if (waitqueue_active(&ctx->cq_wait))
+		wake_up(&ctx->cq_wait);
+}
+
+static void io_cqring_add_event(struct io_ring_ctx *ctx, u64 user_data,
+				long res)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	io_cqring_fill_event(ctx, user_data, res);
+	io_commit_cqring(ctx);
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	io_cqring_ev_posted(ctx);
+}
+
+static unsigned io_cqring_events(struct io_cq_ring *ring)
+{
+	return ACCESS_ONCE(ring->r.tail) - ACCESS_ONCE(ring->r.head);
+}
+
+/*
+ * Look up a file for an sqe.  The sq poll thread doesn't have a file
+ * table of its own, it uses the one of the task that set up the ring.
+ */
+static struct file *io_file_get(struct io_ring_ctx *ctx, int fd)
+{
+	struct files_struct *files;
+	struct file *file = NULL;
+
+	if (current != ctx->sqo_thread) {
+		file = fget(fd);
+	} else {
+		task_lock(ctx->sqo_task);
+		files = ctx->sqo_task->files;
+		if (files) {
+			rcu_read_lock();
+			file = fcheck_files(files, fd);
+			if (file && ((file->f_mode & FMODE_PATH) ||
+			    !atomic_long_inc_not_zero(&file->f_count)))
+				file = NULL;
+			rcu_read_unlock();
+		}
+		task_unlock(ctx->sqo_task);
+	}
+
+	/* a ring can't be pinned by requests against itself */
+	if (file && file->f_op == &io_uring_fops) {
+		fput(file);
+		file = NULL;
+	}
+	return file;
+}
+
+static struct mm_struct *io_ring_get_mm(struct io_ring_ctx *ctx)
+{
+	struct mm_struct *mm = ctx->sqo_mm;
+
+	if (!atomic_inc_not_zero(&mm->mm_users))
+		return NULL;
+	return mm;
+}
+
+static void io_complete_rw(struct kiocb *kiocb, long res, long res2)
+{
+	struct io_kiocb *req = container_of(kiocb, struct io_kiocb, rw);
+
+	io_cqring_add_event(req->ctx, req->user_data, res);
+	io_put_req_atomic(req);
+}
+
+static int io_prep_rw(struct io_kiocb *req, const struct io_uring_sqe *sqe,
+		      int rw)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	void __user *uvec = (void __user *) (unsigned long) sqe->addr;
+	fmode_t mode = rw == READ ? FMODE_READ : FMODE_WRITE;
+	ssize_t ret;
+
+	if (sqe->rw_flags)
+		return -EINVAL;
+
+	req->file = io_file_get(ctx, sqe->fd);
+	if (!req->file)
+		return -EBADF;
+	if (!(req->file->f_mode & mode) || !req->file->f_op)
+		return -EBADF;
+
+#ifdef CONFIG_COMPAT
+	if (ctx->compat)
+		ret = compat_rw_copy_check_uvector(rw, uvec, sqe->len,
+						   UIO_FASTIOV, req->fast_iov,
+						   &req->iov, 1);
+	else
+#endif
+		ret = rw_copy_check_uvector(rw, uvec, sqe->len, UIO_FASTIOV,
+					    req->fast_iov, &req->iov, 1);
+	if (ret < 0)
+		return ret;
+
+	req->nr_segs = sqe->len;
+	req->len = ret;
+	req->pos = sqe->off;
+	return 0;
+}
+
+static ssize_t io_do_sync_rw(struct io_kiocb *req)
+{
+	int rw = req->opcode == IORING_OP_READV ? READ : WRITE;
+	struct file *file = req->file;
+	loff_t pos = req->pos;
+	ssize_t ret;
+
+	if (!req->len)
+		return 0;
+
+	ret = rw_verify_area(rw, file, &pos, req->len);
+	if (ret < 0)
+		return ret;
+
+	if (rw == READ) {
+		if (file->f_op->aio_read)
+			ret = do_sync_readv_writev(file, req->iov, req->nr_segs,
+					req->len, &pos, file->f_op->aio_read);
+		else if (file->f_op->read)
+			ret = do_loop_readv_writev(file, req->iov, req->nr_segs,
+					&pos, file->f_op->read);
+		else
+			ret = -EINVAL;
+		if (ret > 0)
+			fsnotify_access(file);
+	} else {
+		if (file->f_op->aio_write)
+			ret = do_sync_readv_writev(file, req->iov, req->nr_segs,
+					req->len, &pos, file->f_op->aio_write);
+		else if (file->f_op->write)
+			ret = do_loop_readv_writev(file, req->iov, req->nr_segs,
+					&pos, (io_fn_t) file->f_op->write);
+		else
+			ret = -EINVAL;
+		if (ret > 0)
+			fsnotify_modify(file);
+	}
+	return ret;
+}
+
+/*
+ * O_DIRECT on regular files and block devices is issued through the
+ * async kiocb interface, the same way io_submit(2) does it.
+ */
+static bool io_rw_can_issue_async(struct io_kiocb *req)
+{
+	struct file *file = req->file;
+	umode_t mode = file->f_path.dentry->d_inode->i_mode;
+
+	if (!(file->f_flags & O_DIRECT))
+		return false;
+	if (!S_ISREG(mode) && !S_ISBLK(mode))
+		return false;
+	if (req->opcode == IORING_OP_READV)
+		return file->f_op->aio_read != NULL;
+	return file->f_op->aio_write != NULL;
+}
+
+static ssize_t io_rw_issue_async(struct io_kiocb *req)
+{
+	struct kiocb *kiocb = &req->rw;
+	struct file *file = req->file;
+	loff_t pos = req->pos;
+	ssize_t ret;
+
+	ret = rw_verify_area(req->opcode == IORING_OP_READV ? READ : WRITE,
+			     file, &pos, req->len);
+	if (ret < 0)
+		return ret;
+
+	kiocb->ki_flags = 0;
+	kiocb->ki_users = 1;
+	kiocb->ki_key = 0;
+	kiocb->ki_filp = file;
+	kiocb->ki_ctx = NULL;
+	kiocb->ki_cancel = NULL;
+	kiocb->ki_retry = NULL;
+	kiocb->ki_dtor = NULL;
+	kiocb->ki_complete = io_complete_rw;
+	kiocb->ki_obj.user = NULL;
+	kiocb->ki_user_data = req->user_data;
+	kiocb->ki_pos = pos;
+	kiocb->private = NULL;
+	kiocb->ki_opcode = req->opcode;
+	kiocb->ki_nbytes = kiocb->ki_left = req->len;
+	kiocb->ki_iovec = req->iov;
+	kiocb->ki_nr_segs = req->nr_segs;
+	kiocb->ki_cur_seg = 0;
+	kiocb->ki_eventfd = NULL;
+	INIT_LIST_HEAD(&kiocb->ki_run_list);
+	INIT_LIST_HEAD(&kiocb->ki_list);
+
+	if (req->opcode == IORING_OP_READV)
+		return file->f_op->aio_read(kiocb, req->iov, req->nr_segs, pos);
+	return file->f_op->aio_write(kiocb, req->iov, req->nr_segs, pos);
+}
+
+/*
+ * Check whether a buffered read can be satisfied from the page cache
+ * without waiting for IO.
+ */
+static bool io_rw_cached(struct io_kiocb *req)
+{
+	struct file *file = req->file;
+	struct address_space *mapping = file->f_mapping;
+	pgoff_t index, end;
+
+	if (req->opcode != IORING_OP_READV)
+		return false;
+	if (!S_ISREG(file->f_path.dentry->d_inode->i_mode) ||
+	    !mapping->a_ops->readpage)
+		return false;
+	if (!req->len)
+		return true;
+
+	index = req->pos >> PAGE_CACHE_SHIFT;
+	end = (req->pos + req->len - 1) >> PAGE_CACHE_SHIFT;
+	if (end - index >= IORING_MAX_INLINE_PAGES)
+		return false;
+
+	for (; index <= end; index++) {
+		struct page *page;
+		bool uptodate;
+
+		page = find_get_page(mapping, index);
+		if (!page)
+			return false;
+		uptodate = PageUptodate(page);
+		page_cache_release(page);
+		if (!uptodate)
+			return false;
+	}
+	return true;
+}
+
+static void io_sq_wq_submit_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct io_ring_ctx *ctx = req->ctx;
+	const struct cred *old_cred;
+	struct mm_struct *mm;
+	mm_segment_t old_fs;
+	long ret;
+
+	old_cred = override_creds(ctx->creds);
+
+	if (req->opcode == IORING_OP_FSYNC) {
+		loff_t end = req->len ? req->pos + req->len - 1 : LLONG_MAX;
+
+		ret = vfs_fsync_range(req->file, req->pos, end,
+				      req->fsync_flags & IORING_FSYNC_DATASYNC);
+	} else {
+		mm = io_ring_get_mm(ctx);
+		if (mm) {
+			old_fs = get_fs();
+			set_fs(USER_DS);
+			use_mm(mm);
+			ret = io_do_sync_rw(req);
+			unuse_mm(mm);
+			set_fs(old_fs);
+			mmput(mm);
+		} else {
+			ret = -EFAULT;
+		}
+	}
+
+	revert_creds(old_cred);
+
+	io_cqring_add_event(ctx, req->user_data, ret);
+	io_put_req(req);
+}
+
+static void io_queue_async_work(struct io_kiocb *req)
+{
+	INIT_WORK(&req->work, io_sq_wq_submit_work);
+	queue_work(req->ctx->sqo_wq, &req->work);
+}
+
+static int io_rw(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	int rw = req->opcode == IORING_OP_READV ? READ : WRITE;
+	ssize_t ret;
+
+	ret = io_prep_rw(req, sqe, rw);
+	if (ret)
+		return ret;
+
+	if (io_rw_can_issue_async(req)) {
+		ret = io_rw_issue_async(req);
+		if (ret != -EIOCBQUEUED)
+			io_complete_rw(&req->rw, ret, 0);
+	} else if (io_rw_cached(req)) {
+		ret = io_do_sync_rw(req);
+		io_cqring_add_event(req->ctx, req->user_data, ret);
+		io_put_req(req);
+	} else {
+		io_queue_async_work(req);
+	}
+	return 0;
+}
+
+static int io_fsync(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	if (sqe->addr)
+		return -EINVAL;
+	if (sqe->fsync_flags & ~IORING_FSYNC_DATASYNC)
+		return -EINVAL;
+
+	req->file = io_file_get(req->ctx, sqe->fd);
+	if (!req->file)
+		return -EBADF;
+
+	req->fsync_flags = sqe->fsync_flags;
+	req->pos = sqe->off;
+	req->len = sqe->len;
+	io_queue_async_work(req);
+	return 0;
+}
+
+static void io_poll_complete(struct io_ring_ctx *ctx, struct io_kiocb *req,
+			     __u32 mask)
+{
+	req->poll.done = true;
+	io_cqring_fill_event(ctx, req->user_data, mask);
+	io_commit_cqring(ctx);
+}
+
+static void io_poll_remove_one(struct io_kiocb *req)
+{
+	struct io_poll_iocb *poll = &req->poll;
+
+	spin_lock(&poll->head->lock);
+	ACCESS_ONCE(poll->canceled) = true;
+	if (!list_empty(&poll->wait.task_list)) {
+		list_del_init(&poll->wait.task_list);
+		queue_work(req->ctx->sqo_wq, &req->work);
+	}
+	spin_unlock(&poll->head->lock);
+
+	list_del_init(&req->list);
+}
+
+static void io_poll_remove_all(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	spin_lock_irq(&ctx->completion_lock);
+	while (!list_empty(&ctx->cancel_list)) {
+		req = list_first_entry(&ctx->cancel_list, struct io_kiocb,
+				       list);
+		io_poll_remove_one(req);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+}
+
+/*
+ * Find a running poll command that matches one specified in sqe->addr,
+ * and remove it if found.
+ */
+static int io_poll_remove(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_kiocb *poll_req, *next;
+	int ret = -ENOENT;
+
+	if (sqe->ioprio || sqe->off || sqe->len || sqe->poll_events)
+		return -EINVAL;
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_for_each_entry_safe(poll_req, next, &ctx->cancel_list, list) {
+		if (sqe->addr == poll_req->user_data) {
+			io_poll_remove_one(poll_req);
+			ret = 0;
+			break;
+		}
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+
+	io_cqring_add_event(ctx, sqe->user_data, ret);
+	io_put_req(req);
+	return 0;
+}
+
+static void io_poll_complete_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct io_poll_iocb *poll = &req->poll;
+	struct io_ring_ctx *ctx = req->ctx;
+	poll_table pt;
+	__u32 mask = 0;
+
+	init_poll_funcptr(&pt, NULL);
+	if (!ACCESS_ONCE(poll->canceled))
+		mask = poll->file->f_op->poll(poll->file, &pt) & poll->events;
+
+	/*
+	 * Note that io_poll_remove_one() deletes the request from the cancel
+	 * list under the completion lock.  Take it here too to synchronize
+	 * with that, and re-arm the wait if the wakeup wasn't for us.
+	 */
+	spin_lock_irq(&ctx->completion_lock);
+	if (!mask && !ACCESS_ONCE(poll->canceled)) {
+		/* a wakeup may complete and free it once it is queued again */
+		atomic_inc(&req->refs);
+		add_wait_queue(poll->head, &poll->wait);
+		spin_unlock_irq(&ctx->completion_lock);
+
+		/*
+		 * A wakeup that came in after ->poll() but before the entry
+		 * was queued again is lost, so look once more.  If the event
+		 * is there and nobody took the entry off the queue meanwhile,
+		 * complete it here.
+		 */
+		mask = poll->file->f_op->poll(poll->file, &pt) & poll->events;
+		if (!mask) {
+			io_put_req(req);
+			return;
+		}
+
+		spin_lock_irq(&ctx->completion_lock);
+		spin_lock(&poll->head->lock);
+		if (list_empty(&poll->wait.task_list)) {
+			/* woken or canceled, that path completes it */
+			spin_unlock(&poll->head->lock);
+			spin_unlock_irq(&ctx->completion_lock);
+			io_put_req(req);
+			return;
+		}
+		list_del_init(&poll->wait.task_list);
+		spin_unlock(&poll->head->lock);
+		atomic_dec(&req->refs);
+	}
+	list_del_init(&req->list);
+	io_poll_complete(ctx, req, mask);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	io_cqring_ev_posted(ctx);
+	io_put_req(req);
+}
+
+static int io_poll_wake(wait_queue_t *wait, unsigned mode, int sync,
+			void *key)
+{
+	struct io_poll_iocb *poll = container_of(wait, struct io_poll_iocb,
+						 wait);
+	struct io_kiocb *req = container_of(poll, struct io_kiocb, poll);
+	struct io_ring_ctx *ctx = req->ctx;
+	unsigned long mask = (unsigned long) key;
+	unsigned long flags;
+
+	/* for instances that support it check for an event match first: */
+	if (mask && !(mask & poll->events))
+		return 0;
+
+	list_del_init(&poll->wait.task_list);
+
+	if (mask && spin_trylock_irqsave(&ctx->completion_lock, flags)) {
+		list_del(&req->list);
+		io_poll_complete(ctx, req, mask);
+		spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+		io_cqring_ev_posted(ctx);
+		io_put_req_atomic(req);
+	} else {
+		queue_work(ctx->sqo_wq, &req->work);
+	}
+
+	return 1;
+}
+
+static void io_poll_queue_proc(struct file *file, wait_queue_head_t *head,
+			       poll_table *p)
+{
+	struct io_poll_table *pt = container_of(p, struct io_poll_table, pt);
+
+	if (unlikely(pt->req->poll.head)) {
+		pt->error = -EINVAL;
+		return;
+	}
+
+	pt->error = 0;
+	pt->req->poll.head = head;
+	add_wait_queue(head, &pt->req->poll.wait);
+}
+
+static int io_poll_add(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+	struct io_poll_iocb *poll = &req->poll;
+	struct io_ring_ctx *ctx = req->ctx;
+	struct io_poll_table ipt;
+	bool cancel = false;
+	__u32 mask;
+
+	if (sqe->addr || sqe->ioprio || sqe->off || sqe->len)
+		return -EINVAL;
+
+	req->file = io_file_get(ctx, sqe->fd);
+	if (!req->file)
+		return -EBADF;
+	if (!req->file->f_op || !req->file->f_op->poll)
+		return -EBADF;
+
+	INIT_WORK(&req->work, io_poll_complete_work);
+	poll->file = req->file;
+	poll->events = sqe->poll_events | POLLERR | POLLHUP;
+	poll->head = NULL;
+	poll->done = false;
+	poll->canceled = false;
+
+	init_poll_funcptr(&ipt.pt, io_poll_queue_proc);
+	ipt.pt._key = poll->events;
+	ipt.req = req;
+	ipt.error = -EINVAL; /* same as no support for polling */
+
+	/* initialized the list so that we can do list_empty checks */
+	INIT_LIST_HEAD(&poll->wait.task_list);
+	init_waitqueue_func_entry(&poll->wait, io_poll_wake);
+
+	INIT_LIST_HEAD(&req->list);
+
+	mask = poll->file->f_op->poll(poll->file, &ipt.pt) & poll->events;
+
+	spin_lock_irq(&ctx->completion_lock);
+	if (likely(poll->head)) {
+		spin_lock(&poll->head->lock);
+		if (unlikely(list_empty(&poll->wait.task_list))) {
+			if (ipt.error)
+				cancel = true;
+			ipt.error = 0;
+			mask = 0;
+		}
+		if (mask || ipt.error)
+			list_del_init(&poll->wait.task_list);
+		else if (cancel)
+			ACCESS_ONCE(poll->canceled) = true;
+		else if (!poll->done) /* actually waiting for an event */
+			list_add_tail(&req->list, &ctx->cancel_list);
+		spin_unlock(&poll->head->lock);
+	}
+	if (mask) { /* no async, we'd stolen it */
+		ipt.error = 0;
+		io_poll_complete(ctx, req, mask);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+
+	if (mask) {
+		io_cqring_ev_posted(ctx);
+		io_put_req(req);
+	}
+	return ipt.error;
+}
+
+/*
+ * Start one sqe.  Returns 0 if the request was issued, in which case its
+ * completion has been or will be posted, or a negative error if it was
+ * never started.
+ */
+static int io_submit_sqe(struct io_ring_ctx *ctx, struct io_kiocb *req,
+			 const struct io_uring_sqe *sqe, bool has_user)
+{
+	/* none of the sqe flags are supported yet */
+	if (unlikely(sqe->flags))
+		return -EINVAL;
+
+	req->opcode = sqe->opcode;
+	req->user_data = sqe->user_data;
+
+	switch (sqe->opcode) {
+	case IORING_OP_NOP:
+		io_cqring_add_event(ctx, sqe->user_data, 0);
+		io_put_req(req);
+		return 0;
+	case IORING_OP_READV:
+	case IORING_OP_WRITEV:
+		if (unlikely(!has_user))
+			return -EFAULT;
+		if (unlikely(sqe->ioprio))
+			return -EINVAL;
+		return io_rw(req, sqe);
+	case IORING_OP_FSYNC:
+		if (unlikely(sqe->ioprio))
+			return -EINVAL;
+		return io_fsync(req, sqe);
+	case IORING_OP_POLL_ADD:
+		return io_poll_add(req, sqe);
+	case IORING_OP_POLL_REMOVE:
+		return io_poll_remove(req, sqe);
+	default:
+		return -EINVAL;
+	}
+}
+
+static void io_commit_sqring(struct io_ring_ctx *ctx)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+
+	if (ctx->cached_sq_head != ACCESS_ONCE(ring->r.head)) {
+		/*
+		 * Ensure any loads from the SQEs are done at this point,
+		 * since once we write the new head, the application could
+		 * write new data to them.
+		 */
+		smp_mb();
+		ACCESS_ONCE(ring->r.head) = ctx->cached_sq_head;
+	}
+}
+
+/*
+ * Fetch an sqe, if one is available.  Invalid indices in the sq array are
+ * skipped and accounted in the dropped counter.
+ */
+static const struct io_uring_sqe *io_get_sqring(struct io_ring_ctx *ctx)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+	unsigned head;
+
+	head = ctx->cached_sq_head;
+	/* See comment at the top of this file */
+	smp_rmb();
+	while (head != ACCESS_ONCE(ring->r.tail)) {
+		unsigned idx = ACCESS_ONCE(ring->array[head & ctx->sq_mask]);
+
+		ctx->cached_sq_head = ++head;
+		if (likely(idx < ctx->sq_entries))
+			return &ctx->sq_sqes[idx];
+
+		/* drop invalid entries */
+		ACCESS_ONCE(ring->dropped) = ACCESS_ONCE(ring->dropped) + 1;
+	}
+
+	return NULL;
+}
+
+static unsigned io_sqring_entries(struct io_ring_ctx *ctx)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+
+	/* See comment at the top of this file */
+	smp_rmb();
+	return ACCESS_ONCE(ring->r.tail) - ctx->cached_sq_head;
+}
+
+static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned to_submit,
+			  bool has_user)
+{
+	int submitted = 0;
+
+	while (submitted < to_submit) {
+		const struct io_uring_sqe *s;
+		struct io_uring_sqe sqe;
+		struct io_kiocb *req;
+		int ret;
+
+		req = io_get_req(ctx);
+		if (unlikely(!req)) {
+			if (!submitted)
+				submitted = -EAGAIN;
+			break;
+		}
+
+		s = io_get_sqring(ctx);
+		if (!s) {
+			__io_free_req(req);
+			break;
+		}
+
+		/* the application may scribble over the shared copy */
+		memcpy(&sqe, s, sizeof(sqe));
+
+		ret = io_submit_sqe(ctx, req, &sqe, has_user);
+		if (ret) {
+			io_cqring_add_event(ctx, sqe.user_data, ret);
+			__io_free_req(req);
+		} else {
+			io_put_req(req);
+		}
+		submitted++;
+	}
+
+	io_commit_sqring(ctx);
+	return submitted;
+}
+
+static int io_sq_thread(void *data)
+{
+	struct io_ring_ctx *ctx = data;
+	struct mm_struct *cur_mm = NULL;
+	const struct cred *old_cred;
+	mm_segment_t old_fs;
+	DEFINE_WAIT(wait);
+	unsigned long timeout;
+
+	old_fs = get_fs();
+	set_fs(USER_DS);
+	old_cred = override_creds(ctx->creds);
+
+	timeout = jiffies + ctx->sq_thread_idle;
+	while (!kthread_should_stop()) {
+		unsigned to_submit;
+
+		to_submit = io_sqring_entries(ctx);
+		if (!to_submit) {
+			/*
+			 * Drop the mm while we spin, the application may be
+			 * trying to exit.
+			 */
+			if (cur_mm) {
+				unuse_mm(cur_mm);
+				mmput(cur_mm);
+				cur_mm = NULL;
+			}
+
+			if (!time_after(jiffies, timeout)) {
+				cond_resched();
+				continue;
+			}
+
+			prepare_to_wait(&ctx->sqo_wait, &wait,
+					TASK_INTERRUPTIBLE);
+
+			/* Tell userspace we may need a wakeup call */
+			ctx->sq_ring->flags |= IORING_SQ_NEED_WAKEUP;
+			smp_mb();
+
+			to_submit = io_sqring_entries(ctx);
+			if (!to_submit) {
+				if (kthread_should_stop()) {
+					finish_wait(&ctx->sqo_wait, &wait);
+					break;
+				}
+				schedule();
+				finish_wait(&ctx->sqo_wait, &wait);
+
+				ctx->sq_ring->flags &= ~IORING_SQ_NEED_WAKEUP;
+				smp_wmb();
+				timeout = jiffies + ctx->sq_thread_idle;
+				continue;
+			}
+			finish_wait(&ctx->sqo_wait, &wait);
+
+			ctx->sq_ring->flags &= ~IORING_SQ_NEED_WAKEUP;
+			smp_wmb();
+		}
+
+		if (!cur_mm) {
+			cur_mm = io_ring_get_mm(ctx);
+			if (cur_mm)
+				use_mm(cur_mm);
+		}
+
+		mutex_lock(&ctx->uring_lock);
+		io_submit_sqes(ctx, to_submit, cur_mm != NULL);
+		mutex_unlock(&ctx->uring_lock);
+
+		timeout = jiffies + ctx->sq_thread_idle;
+	}
+
+	if (cur_mm) {
+		unuse_mm(cur_mm);
+		mmput(cur_mm);
+	}
+
+	revert_creds(old_cred);
+	set_fs(old_fs);
+	return 0;
+}
+
+/*
+ * Wait until events become available, if we don't already have some. The
+ * application must reap them itself, as they reside on the shared cq ring.
+ */
+static int io_cqring_wait(struct io_ring_ctx *ctx, unsigned min_events,
+			  const sigset_t __user *sig, size_t sigsz)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	sigset_t ksigmask, sigsaved;
+	int ret;
+
+	if (io_cqring_events(ring) >= min_events)
+		return 0;
+
+	if (sig) {
+		if (sigsz != sizeof(sigset_t))
+			return -EINVAL;
+		if (copy_from_user(&ksigmask, sig, sizeof(ksigmask)))
+			return -EFAULT;
+		sigdelsetmask(&ksigmask, sigmask(SIGKILL) | sigmask(SIGSTOP));
+		sigprocmask(SIG_SETMASK, &ksigmask, &sigsaved);
+	}
+
+	ret = wait_event_interruptible(ctx->cq_wait,
+				       io_cqring_events(ring) >= min_events);
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+
+	if (sig) {
+#ifdef HAVE_SET_RESTORE_SIGMASK
+		if (ret == -EINTR) {
+			memcpy(&current->saved_sigmask, &sigsaved,
+			       sizeof(sigsaved));
+			set_restore_sigmask();
+		} else
+#endif
+			sigprocmask(SIG_SETMASK, &sigsaved, NULL);
+	}
+
+	return ret;
+}
+
+static void io_sq_thread_stop(struct io_ring_ctx *ctx)
+{
+	if (ctx->sqo_thread) {
+		kthread_stop(ctx->sqo_thread);
+		ctx->sqo_thread = NULL;
+	}
+}
+
+static int io_sq_offload_start(struct io_ring_ctx *ctx,
+			       struct io_uring_params *p)
+{
+	int ret;
+
+	init_waitqueue_head(&ctx->sqo_wait);
+
+	ctx->sqo_wq = alloc_workqueue("io_ring-wq", WQ_UNBOUND,
+				      2 * num_online_cpus());
+	if (!ctx->sqo_wq)
+		return -ENOMEM;
+
+	if (!(ctx->flags & IORING_SETUP_SQPOLL))
+		return 0;
+
+	ctx->sq_thread_idle = msecs_to_jiffies(p->sq_thread_idle);
+	if (!ctx->sq_thread_idle)
+		ctx->sq_thread_idle = HZ;
+
+	ctx->sqo_thread = kthread_create(io_sq_thread, ctx, "io_uring-sq");
+	if (IS_ERR(ctx->sqo_thread)) {
+		ret = PTR_ERR(ctx->sqo_thread);
+		ctx->sqo_thread = NULL;
+		return ret;
+	}
+	if (ctx->flags & IORING_SETUP_SQ_AFF)
+		kthread_bind(ctx->sqo_thread, p->sq_thread_cpu);
+	wake_up_process(ctx->sqo_thread);
+	return 0;
+}
+
+static void *io_mem_alloc(size_t size)
+{
+	gfp_t gfp_flags = GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN | __GFP_COMP;
+
+	return (void *) __get_free_pages(gfp_flags, get_order(size));
+}
+
+static void io_mem_free(void *ptr, size_t size)
+{
+	if (ptr)
+		free_pages((unsigned long) ptr, get_order(size));
+}
+
+static size_t io_sq_ring_size(unsigned entries)
+{
+	return sizeof(struct io_sq_ring) + entries * sizeof(u32);
+}
+
+static size_t io_cq_ring_size(unsigned entries)
+{
+	return sizeof(struct io_cq_ring) + entries * sizeof(struct io_uring_cqe);
+}
+
+static int io_allocate_scq_urings(struct io_ring_ctx *ctx,
+				  struct io_uring_params *p)
+{
+	struct io_sq_ring *sq_ring;
+	struct io_cq_ring *cq_ring;
+
+	sq_ring = io_mem_alloc(io_sq_ring_size(p->sq_entries));
+	if (!sq_ring)
+		return -ENOMEM;
+	ctx->sq_ring = sq_ring;
+	sq_ring->ring_mask = p->sq_entries - 1;
+	sq_ring->ring_entries = p->sq_entries;
+	ctx->sq_mask = sq_ring->ring_mask;
+	ctx->sq_entries = sq_ring->ring_entries;
+
+	ctx->sq_sqes = io_mem_alloc(p->sq_entries * sizeof(struct io_uring_sqe));
+	if (!ctx->sq_sqes)
+		return -ENOMEM;
+
+	cq_ring = io_mem_alloc(io_cq_ring_size(p->cq_entries));
+	if (!cq_ring)
+		return -ENOMEM;
+	ctx->cq_ring = cq_ring;
+	cq_ring->ring_mask = p->cq_entries - 1;
+	cq_ring->ring_entries = p->cq_entries;
+	ctx->cq_mask = cq_ring->ring_mask;
+	ctx->cq_entries = cq_ring->ring_entries;
+	return 0;
+}
+
+static void io_ring_ctx_free(struct io_ring_ctx *ctx)
+{
+	if (ctx->sqo_wq)
+		destroy_workqueue(ctx->sqo_wq);
+	if (ctx->sqo_task)
+		put_task_struct(ctx->sqo_task);
+	if (ctx->sqo_mm)
+		mmdrop(ctx->sqo_mm);
+	if (ctx->creds)
+		put_cred(ctx->creds);
+
+	io_mem_free(ctx->sq_ring, io_sq_ring_size(ctx->sq_entries));
+	io_mem_free(ctx->sq_sqes,
+		    ctx->sq_entries * sizeof(struct io_uring_sqe));
+	io_mem_free(ctx->cq_ring, io_cq_ring_size(ctx->cq_entries));
+	kfree(ctx);
+}
+
+static void io_ring_ctx_wait_and_kill(struct io_ring_ctx *ctx)
+{
+	io_sq_thread_stop(ctx);
+	io_poll_remove_all(ctx);
+
+	io_ring_drop_ctx_refs(ctx, 1);
+	wait_for_completion(&ctx->ctx_done);
+	io_ring_ctx_free(ctx);
+}
+
+static int io_uring_release(struct inode *inode, struct file *file)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+
+	file->private_data = NULL;
+	io_ring_ctx_wait_and_kill(ctx);
+	return 0;
+}
+
+static unsigned int io_uring_poll(struct file *file, poll_table *wait)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &ctx->cq_wait, wait);
+	/* See comment at the top of this file */
+	smp_rmb();
+	if (ACCESS_ONCE(ctx->sq_ring->r.tail) - ctx->cached_sq_head !=
+	    ctx->sq_entries)
+		mask |= POLLOUT | POLLWRNORM;
+	if (ACCESS_ONCE(ctx->cq_ring->r.head) != ctx->cached_cq_tail)
+		mask |= POLLIN | POLLRDNORM;
+
+	return mask;
+}
+
+static int io_uring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	loff_t offset = (loff_t) vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long sz = vma->vm_end - vma->vm_start;
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned long pfn;
+	struct page *page;
+	void *ptr;
+
+	switch (offset) {
+	case IORING_OFF_SQ_RING:
+		ptr = ctx->sq_ring;
+		break;
+	case IORING_OFF_SQES:
+		ptr = ctx->sq_sqes;
+		break;
+	case IORING_OFF_CQ_RING:
+		ptr = ctx->cq_ring;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	page = virt_to_head_page(ptr);
+	if (sz > (PAGE_SIZE << compound_order(page)))
+		return -EINVAL;
+
+	pfn = virt_to_phys(ptr) >> PAGE_SHIFT;
+	return remap_pfn_range(vma, vma->vm_start, pfn, sz, vma->vm_page_prot);
+}
+
+SYSCALL_DEFINE6(io_uring_enter, unsigned int, fd, u32, to_submit,
+		u32, min_complete, u32, flags, const sigset_t __user *, sig,
+		size_t, sigsz)
+{
+	struct io_ring_ctx *ctx;
+	long ret = -EBADF;
+	int submitted = 0;
+	struct file *f;
+
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+		return -EINVAL;
+
+	f = fget(fd);
+	if (!f)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (f->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = f->private_data;
+
+	/*
+	 * For SQ polling, the thread will do all submissions and completions.
+	 * Just return the requested submit count, and wake the thread if
+	 * we were asked to.
+	 */
+	ret = 0;
+	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		if (flags & IORING_ENTER_SQ_WAKEUP)
+			wake_up(&ctx->sqo_wait);
+		submitted = to_submit;
+	} else if (to_submit) {
+		to_submit = min(to_submit, ctx->sq_entries);
+
+		mutex_lock(&ctx->uring_lock);
+		submitted = io_submit_sqes(ctx, to_submit, true);
+		mutex_unlock(&ctx->uring_lock);
+	}
+
+	if (flags & IORING_ENTER_GETEVENTS) {
+		min_complete = min(min_complete, ctx->cq_entries);
+		ret = io_cqring_wait(ctx, min_complete, sig, sigsz);
+	}
+
+out_fput:
+	fput(f);
+	return submitted ? submitted : ret;
+}
+
+static const struct file_operations io_uring_fops = {
+	.release	= io_uring_release,
+	.mmap		= io_uring_mmap,
+	.poll		= io_uring_poll,
+	.llseek		= noop_llseek,
+};
+
+static struct io_ring_ctx *io_ring_ctx_alloc(struct io_uring_params *p)
+{
+	struct io_ring_ctx *ctx;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return NULL;
+
+	ctx->flags = p->flags;
+	ctx->compat = is_compat_task();
+	atomic_set(&ctx->refs, 1);
+	init_completion(&ctx->ctx_done);
+	init_waitqueue_head(&ctx->cq_wait);
+	spin_lock_init(&ctx->completion_lock);
+	INIT_LIST_HEAD(&ctx->cancel_list);
+	mutex_init(&ctx->uring_lock);
+	return ctx;
+}
+
+static int io_uring_create(unsigned entries, struct io_uring_params *p,
+			   struct io_uring_params __user *params)
+{
+	struct io_ring_ctx *ctx;
+	int ret;
+
+	if (!entries || entries > IORING_MAX_ENTRIES)
+		return -EINVAL;
+
+	/*
+	 * Use twice as many entries for the CQ ring. It's possible for the
+	 * application to drive a higher depth than the size of the SQ ring,
+	 * since the sqes are only used at submission time. This allows for
+	 * some flexibility in overcommitting a bit.
+	 */
+	p->sq_entries = roundup_pow_of_two(entries);
+	p->cq_entries = 2 * p->sq_entries;
+
+	ctx = io_ring_ctx_alloc(p);
+	if (!ctx)
+		return -ENOMEM;
+
+	atomic_inc(&current->mm->mm_count);
+	ctx->sqo_mm = current->mm;
+	get_task_struct(current);
+	ctx->sqo_task = current;
+	ctx->creds = get_current_cred();
+
+	ret = io_allocate_scq_urings(ctx, p);
+	if (ret)
+		goto err;
+
+	ret = io_sq_offload_start(ctx, p);
+	if (ret)
+		goto err;
+
+	memset(&p->sq_off, 0, sizeof(p->sq_off));
+	p->sq_off.head = offsetof(struct io_sq_ring, r.head);
+	p->sq_off.tail = offsetof(struct io_sq_ring, r.tail);
+	p->sq_off.ring_mask = offsetof(struct io_sq_ring, ring_mask);
+	p->sq_off.ring_entries = offsetof(struct io_sq_ring, ring_entries);
+	p->sq_off.flags = offsetof(struct io_sq_ring, flags);
+	p->sq_off.dropped = offsetof(struct io_sq_ring, dropped);
+	p->sq_off.array = offsetof(struct io_sq_ring, array);
+
+	memset(&p->cq_off, 0, sizeof(p->cq_off));
+	p->cq_off.head = offsetof(struct io_cq_ring, r.head);
+	p->cq_off.tail = offsetof(struct io_cq_ring, r.tail);
+	p->cq_off.ring_mask = offsetof(struct io_cq_ring, ring_mask);
+	p->cq_off.ring_entries = offsetof(struct io_cq_ring, ring_entries);
+	p->cq_off.overflow = offsetof(struct io_cq_ring, overflow);
+	p->cq_off.cqes = offsetof(struct io_cq_ring, cqes);
+
+	ret = -EFAULT;
+	if (copy_to_user(params, p, sizeof(*p)))
+		goto err;
+
+	ret = anon_inode_getfd("[io_uring]", &io_uring_fops, ctx,
+			       O_RDWR | O_CLOEXEC);
+	if (ret < 0)
+		goto err;
+	return ret;
+err:
+	io_ring_ctx_wait_and_kill(ctx);
+	return ret;
+}
+
+/*
+ * Sets up an aio uring context, and returns the fd. Applications asks for a
+ * ring size, we return the actual sq/cq ring sizes (among other things) in the
+ * params structure passed in.
+ */
+static long io_uring_setup(u32 entries, struct io_uring_params __user *params)
+{
+	struct io_uring_params p;
+	int i;
+
+	if (copy_from_user(&p, params, sizeof(p)))
+		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(p.resv); i++) {
+		if (p.resv[i])
+			return -EINVAL;
+	}
+
+	if (p.flags & ~(IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF))
+		return -EINVAL;
+
+	if (p.flags & IORING_SETUP_SQ_AFF) {
+		if (!(p.flags & IORING_SETUP_SQPOLL))
+			return -EINVAL;
+		if (p.sq_thread_cpu >= nr_cpu_ids ||
+		    !cpu_online(p.sq_thread_cpu))
+			return -EINVAL;
+	}
+
+	if ((p.flags & IORING_SETUP_SQPOLL) && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	return io_uring_create(entries, &p, params);
+}
+
+SYSCALL_DEFINE2(io_uring_setup, u32, entries,
+		struct io_uring_params __user *, params)
+{
+	return io_uring_setup(entries, params);
+}
+
+static int __init io_uring_init(void)
+{
+	req_cachep = KMEM_CACHE(io_kiocb, SLAB_HWCACHE_ALIGN | SLAB_PANIC);
+	return 0;
+}
+__initcall(io_uring_init);
@@ -51,6 +51,8 @@ static int prune_super(struct shrinker *shrink, struct shrink_control *sc)
 	struct super_block *sb;
 	int	fs_objects = 0;
 	int	total_objects;
+	int	dentries;
+	int	inodes;
 
 	sb = container_of(shrink, struct super_block, s_shrink);
 
@@ -67,18 +69,14 @@ static int prune_super(struct shrinker *shrink, struct shrink_control *sc)
 	if (sb->s_op && sb->s_op->nr_cached_objects)
 		fs_objects = sb->s_op->nr_cached_objects(sb);
 
-	total_objects = sb->s_nr_dentry_unused +
-			sb->s_nr_inodes_unused + fs_objects + 1;
+	dentries = list_lru_count_node(&sb->s_dentry_lru, sc->nid);
+	inodes = list_lru_count_node(&sb->s_inode_lru, sc->nid);
+	total_objects = dentries + inodes + fs_objects + 1;
 
 	if (sc->nr_to_scan) {
-		int	dentries;
-		int	inodes;
-
 		/* proportion the scan between the caches */
-		dentries = (sc->nr_to_scan * sb->s_nr_dentry_unused) /
-							total_objects;
-		inodes = (sc->nr_to_scan * sb->s_nr_inodes_unused) /
-							total_objects;
+		dentries = (sc->nr_to_scan * dentries) / total_objects;
+		inodes = (sc->nr_to_scan * inodes) / total_objects;
 		if (fs_objects)
 			fs_objects = (sc->nr_to_scan * fs_objects) /
 							total_objects;
@@ -86,15 +84,16 @@ static int prune_super(struct shrinker *shrink, struct shrink_control *sc)
 		 * prune the dcache first as the icache is pinned by it, then
 		 * prune the icache, followed by the filesystem specific caches
 		 */
-		prune_dcache_sb(sb, dentries);
-		prune_icache_sb(sb, inodes);
+		prune_dcache_sb(sb, dentries, sc->nid);
+		prune_icache_sb(sb, inodes, sc->nid);
 
 		if (fs_objects && sb->s_op->free_cached_objects) {
 			sb->s_op->free_cached_objects(sb, fs_objects);
 			fs_objects = sb->s_op->nr_cached_objects(sb);
 		}
-		total_objects = sb->s_nr_dentry_unused +
-				sb->s_nr_inodes_unused + fs_objects;
+		total_objects = list_lru_count_node(&sb->s_dentry_lru, sc->nid) +
+				list_lru_count_node(&sb->s_inode_lru, sc->nid) +
+				fs_objects;
 	}
 
 	total_objects = (total_objects / 100) * sysctl_vfs_cache_pressure;
@@ -140,9 +139,11 @@ static struct super_block *alloc_super(struct file_system_type *type)
 		INIT_HLIST_NODE(&s->s_instances);
 		INIT_HLIST_BL_HEAD(&s->s_anon);
 		INIT_LIST_HEAD(&s->s_inodes);
-		INIT_LIST_HEAD(&s->s_dentry_lru);
-		INIT_LIST_HEAD(&s->s_inode_lru);
-		spin_lock_init(&s->s_inode_lru_lock);
+		if (list_lru_init(&s->s_dentry_lru))
+			goto err_out;
+		if (list_lru_init(&s->s_inode_lru))
+			goto err_out_dentry_lru;
+
 		INIT_LIST_HEAD(&s->s_mounts);
 		init_rwsem(&s->s_umount);
 		mutex_init(&s->s_lock);
@@ -185,9 +186,20 @@ static struct super_block *alloc_super(struct file_system_type *type)
 		s->s_shrink.seeks = DEFAULT_SEEKS;
 		s->s_shrink.shrink = prune_super;
 		s->s_shrink.batch = 1024;
+		s->s_shrink.flags = SHRINKER_NUMA_AWARE;
 	}
 out:
 	return s;
+
+err_out_dentry_lru:
+	list_lru_destroy(&s->s_dentry_lru);
+err_out:
+#ifdef CONFIG_SMP
+	free_percpu(s->s_files);
+#endif
+	security_sb_free(s);
+	kfree(s);
+	return NULL;
 }
 
 /**
@@ -201,6 +213,8 @@ static inline void destroy_super(struct super_block *s)
 #ifdef CONFIG_SMP
 	free_percpu(s->s_files);
 #endif
+	list_lru_destroy(&s->s_dentry_lru);
+	list_lru_destroy(&s->s_inode_lru);
 	security_sb_free(s);
 	WARN_ON(!list_empty(&s->s_mounts));
 	kfree(s->s_subtype);
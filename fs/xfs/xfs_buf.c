@@ -97,13 +97,13 @@ xfs_buf_lru_add(
 {
 	struct xfs_buftarg *btp = bp->b_target;
 
-	spin_lock(&btp->bt_lru_lock);
-	if (list_empty(&bp->b_lru)) {
-		atomic_inc(&bp->b_hold);
-		list_add_tail(&bp->b_lru, &btp->bt_lru);
-		btp->bt_lru_nr++;
-	}
-	spin_unlock(&btp->bt_lru_lock);
+	/*
+	 * Take the reference before the buffer becomes visible on the LRU so
+	 * that the shrinker can never drop a reference we don't hold yet.
+	 */
+	atomic_inc(&bp->b_hold);
+	if (!list_lru_add(&btp->bt_lru, &bp->b_lru))
+		atomic_dec(&bp->b_hold);
 }
 
 /*
@@ -113,7 +113,7 @@ xfs_buf_lru_add(
  * b_lru_ref counts left on the inode under the pag->pag_buf_lock. it is there
  * to optimise the shrinker removing the buffer from the LRU and calling
  * xfs_buf_free(). i.e. it removes an unnecessary round trip on the
- * bt_lru_lock.
+ * LRU list lock.
  */
 STATIC void
 xfs_buf_lru_del(
@@ -124,12 +124,7 @@ xfs_buf_lru_del(
 	if (list_empty(&bp->b_lru))
 		return;
 
-	spin_lock(&btp->bt_lru_lock);
-	if (!list_empty(&bp->b_lru)) {
-		list_del_init(&bp->b_lru);
-		btp->bt_lru_nr--;
-	}
-	spin_unlock(&btp->bt_lru_lock);
+	list_lru_del(&btp->bt_lru, &bp->b_lru);
 }
 
 /*
@@ -150,13 +145,8 @@ xfs_buf_stale(
 	if (!list_empty(&bp->b_lru)) {
 		struct xfs_buftarg *btp = bp->b_target;
 
-		spin_lock(&btp->bt_lru_lock);
-		if (!list_empty(&bp->b_lru)) {
-			list_del_init(&bp->b_lru);
-			btp->bt_lru_nr--;
+		if (list_lru_del(&btp->bt_lru, &bp->b_lru))
 			atomic_dec(&bp->b_hold);
-		}
-		spin_unlock(&btp->bt_lru_lock);
 	}
 	ASSERT(atomic_read(&bp->b_hold) >= 1);
 }
@@ -1347,6 +1337,32 @@ xfs_buf_iomove(
  *	Handling of buffer targets (buftargs).
  */
 
+static enum lru_status
+xfs_buftarg_wait_rele(
+	struct list_head	*item,
+	spinlock_t		*lru_lock,
+	void			*arg)
+{
+	struct xfs_buf		*bp = container_of(item, struct xfs_buf, b_lru);
+
+	if (atomic_read(&bp->b_hold) > 1) {
+		/* need to wait */
+		spin_unlock(lru_lock);
+		delay(100);
+	} else {
+		/*
+		 * clear the LRU reference count so the buffer doesn't get
+		 * ignored in xfs_buf_rele().
+		 */
+		atomic_set(&bp->b_lru_ref, 0);
+		spin_unlock(lru_lock);
+		xfs_buf_rele(bp);
+	}
+
+	spin_lock(lru_lock);
+	return LRU_RETRY;
+}
+
 /*
  * Wait for any bufs with callbacks that have been submitted but have not yet
  * returned. These buffers will have an elevated hold count, so wait on those
@@ -1356,27 +1372,37 @@ void
 xfs_wait_buftarg(
 	struct xfs_buftarg	*btp)
 {
-	struct xfs_buf		*bp;
+	while (list_lru_count(&btp->bt_lru))
+		list_lru_walk(&btp->bt_lru, xfs_buftarg_wait_rele,
+			      NULL, LONG_MAX);
+}
 
-restart:
-	spin_lock(&btp->bt_lru_lock);
-	while (!list_empty(&btp->bt_lru)) {
-		bp = list_first_entry(&btp->bt_lru, struct xfs_buf, b_lru);
-		if (atomic_read(&bp->b_hold) > 1) {
-			spin_unlock(&btp->bt_lru_lock);
-			delay(100);
-			goto restart;
-		}
-		/*
-		 * clear the LRU reference count so the buffer doesn't get
-		 * ignored in xfs_buf_rele().
-		 */
-		atomic_set(&bp->b_lru_ref, 0);
-		spin_unlock(&btp->bt_lru_lock);
-		xfs_buf_rele(bp);
-		spin_lock(&btp->bt_lru_lock);
-	}
-	spin_unlock(&btp->bt_lru_lock);
+static enum lru_status
+xfs_buftarg_isolate(
+	struct list_head	*item,
+	spinlock_t		*lru_lock,
+	void			*arg)
+{
+	struct xfs_buf		*bp = container_of(item, struct xfs_buf, b_lru);
+
+	/*
+	 * Decrement the b_lru_ref count unless the value is already
+	 * zero. If the value is already zero, we need to reclaim the
+	 * buffer, otherwise it gets another trip through the LRU.
+	 */
+	if (!atomic_add_unless(&bp->b_lru_ref, -1, 0))
+		return LRU_ROTATE;
+
+	/*
+	 * remove the buffer from the LRU now to avoid needing another
+	 * lock round trip inside xfs_buf_rele(), and drop the LRU's
+	 * reference outside the list lock.
+	 */
+	list_del_init(&bp->b_lru);
+	spin_unlock(lru_lock);
+	xfs_buf_rele(bp);
+	spin_lock(lru_lock);
+	return LRU_REMOVED_RETRY;
 }
 
 int
@@ -1386,46 +1412,13 @@ xfs_buftarg_shrink(
 {
 	struct xfs_buftarg	*btp = container_of(shrink,
 					struct xfs_buftarg, bt_shrinker);
-	struct xfs_buf		*bp;
-	int nr_to_scan = sc->nr_to_scan;
-	LIST_HEAD(dispose);
-
-	if (!nr_to_scan)
-		return btp->bt_lru_nr;
-
-	spin_lock(&btp->bt_lru_lock);
-	while (!list_empty(&btp->bt_lru)) {
-		if (nr_to_scan-- <= 0)
-			break;
+	unsigned long		nr_to_scan = sc->nr_to_scan;
 
-		bp = list_first_entry(&btp->bt_lru, struct xfs_buf, b_lru);
+	if (nr_to_scan)
+		list_lru_walk_node(&btp->bt_lru, sc->nid, xfs_buftarg_isolate,
+				   NULL, &nr_to_scan);
 
-		/*
-		 * Decrement the b_lru_ref count unless the value is already
-		 * zero. If the value is already zero, we need to reclaim the
-		 * buffer, otherwise it gets another trip through the LRU.
-		 */
-		if (!atomic_add_unless(&bp->b_lru_ref, -1, 0)) {
-			list_move_tail(&bp->b_lru, &btp->bt_lru);
-			continue;
-		}
-
-		/*
-		 * remove the buffer from the LRU now to avoid needing another
-		 * lock round trip inside xfs_buf_rele().
-		 */
-		list_move(&bp->b_lru, &dispose);
-		btp->bt_lru_nr--;
-	}
-	spin_unlock(&btp->bt_lru_lock);
-
-	while (!list_empty(&dispose)) {
-		bp = list_first_entry(&dispose, struct xfs_buf, b_lru);
-		list_del_init(&bp->b_lru);
-		xfs_buf_rele(bp);
-	}
-
-	return btp->bt_lru_nr;
+	return list_lru_count_node(&btp->bt_lru, sc->nid);
 }
 
 void
@@ -1440,6 +1433,7 @@ xfs_free_buftarg(
 		xfs_blkdev_issue_flush(btp);
 
 	kthread_stop(btp->bt_task);
+	list_lru_destroy(&btp->bt_lru);
 	kmem_free(btp);
 }
 
@@ -1523,17 +1517,20 @@ xfs_alloc_buftarg(
 	if (!btp->bt_bdi)
 		goto error;
 
-	INIT_LIST_HEAD(&btp->bt_lru);
-	spin_lock_init(&btp->bt_lru_lock);
-	if (xfs_setsize_buftarg_early(btp, bdev))
+	if (list_lru_init(&btp->bt_lru))
 		goto error;
+	if (xfs_setsize_buftarg_early(btp, bdev))
+		goto error_lru;
 	if (xfs_alloc_delwri_queue(btp, fsname))
-		goto error;
+		goto error_lru;
 	btp->bt_shrinker.shrink = xfs_buftarg_shrink;
 	btp->bt_shrinker.seeks = DEFAULT_SEEKS;
+	btp->bt_shrinker.flags = SHRINKER_NUMA_AWARE;
 	register_shrinker(&btp->bt_shrinker);
 	return btp;
 
+error_lru:
+	list_lru_destroy(&btp->bt_lru);
 error:
 	kmem_free(btp);
 	return NULL;
@@ -6,6 +6,7 @@
 #include <linux/aio_abi.h>
 #include <linux/uio.h>
 #include <linux/rcupdate.h>
+#include <linux/percpu-refcount.h>
 
 #include <linux/atomic.h>
 
@@ -95,6 +96,8 @@ struct kiocb {
 	int			(*ki_cancel)(struct kiocb *, struct io_event *);
 	ssize_t			(*ki_retry)(struct kiocb *);
 	void			(*ki_dtor)(struct kiocb *);
+	/* completion for kiocbs not owned by a kioctx, see aio_complete() */
+	void			(*ki_complete)(struct kiocb *, long, long);
 
 	union {
 		void __user		*user;
@@ -138,6 +141,7 @@ struct kiocb {
 		(x)->ki_cancel = NULL;			\
 		(x)->ki_retry = NULL;			\
 		(x)->ki_dtor = NULL;			\
+		(x)->ki_complete = NULL;		\
 		(x)->ki_obj.tsk = tsk;			\
 		(x)->ki_user_data = 0;                  \
 	} while (0)
@@ -177,7 +181,7 @@ struct aio_ring_info {
 };
 
 struct kioctx {
-	atomic_t		users;
+	struct percpu_ref	users;
 	int			dead;
 	struct mm_struct	*mm;
 
@@ -200,6 +204,9 @@ struct kioctx {
 
 	struct delayed_work	wq;
 
+	/* Frees the context once the last ref is gone */
+	struct work_struct	free_work;
+
 	struct rcu_head		rcu_head;
 };
 
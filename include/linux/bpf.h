@@ -0,0 +1,152 @@
+/*
+ * BPF maps: key/value stores shared between BPF filters and user space
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#ifndef _LINUX_BPF_H
+#define _LINUX_BPF_H
+
+#include <linux/types.h>
+
+/* BPF syscall commands */
+enum bpf_cmd {
+	/* create a map and return a file descriptor that refers to it */
+	BPF_MAP_CREATE,
+
+	/* look up an element by key, copying its value to user space */
+	BPF_MAP_LOOKUP_ELEM,
+
+	/* create or update an element (key/value pair) */
+	BPF_MAP_UPDATE_ELEM,
+
+	/* find and delete an element by key */
+	BPF_MAP_DELETE_ELEM,
+
+	/* return the key following the given one, or the first key if the
+	 * given one is not found, to iterate over the map
+	 */
+	BPF_MAP_GET_NEXT_KEY,
+};
+
+enum bpf_map_type {
+	BPF_MAP_TYPE_UNSPEC,
+	BPF_MAP_TYPE_HASH,
+	BPF_MAP_TYPE_ARRAY,
+	BPF_MAP_TYPE_PERCPU_HASH,
+	BPF_MAP_TYPE_PERCPU_ARRAY,
+};
+
+/* flags for BPF_MAP_UPDATE_ELEM */
+#define BPF_ANY		0 /* create new element or update existing */
+#define BPF_NOEXIST	1 /* create new element if it didn't exist */
+#define BPF_EXIST	2 /* update existing element */
+
+/*
+ * Per-CPU maps exchange values with user space as one value per
+ * possible CPU, each padded to a multiple of 8 bytes.
+ */
+union bpf_attr {
+	struct { /* BPF_MAP_CREATE */
+		__u32	map_type;	/* one of enum bpf_map_type */
+		__u32	key_size;	/* size of key in bytes */
+		__u32	value_size;	/* size of value in bytes */
+		__u32	max_entries;	/* max number of entries in a map */
+	};
+
+	struct { /* BPF_MAP_*_ELEM and BPF_MAP_GET_NEXT_KEY */
+		__u32		map_fd;
+		__aligned_u64	key;
+		union {
+			__aligned_u64 value;
+			__aligned_u64 next_key;
+		};
+		__u64		flags;
+	};
+} __attribute__((aligned(8)));
+
+#ifdef __KERNEL__
+
+#include <linux/atomic.h>
+#include <linux/cpumask.h>
+#include <linux/err.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/workqueue.h>
+
+struct bpf_map;
+
+/* map is generic key/value storage optionally accessible by filters */
+struct bpf_map_ops {
+	/* called from the syscall, in process context */
+	struct bpf_map *(*map_alloc)(union bpf_attr *attr);
+	void (*map_free)(struct bpf_map *map);
+	int (*map_get_next_key)(struct bpf_map *map, void *key,
+				void *next_key);
+
+	/* called from the syscall and from filters, under rcu_read_lock()
+	 *
+	 * map_lookup_elem() of a per-CPU map returns the __percpu pointer
+	 * to the value.  map_update_elem() takes a value in the user
+	 * space layout, or NULL for an all-zero value.
+	 */
+	void *(*map_lookup_elem)(struct bpf_map *map, void *key);
+	int (*map_update_elem)(struct bpf_map *map, void *key, void *value,
+			       u64 flags);
+	int (*map_delete_elem)(struct bpf_map *map, void *key);
+};
+
+struct bpf_map {
+	atomic_t refcnt;
+	enum bpf_map_type map_type;
+	u32 key_size;
+	u32 value_size;
+	u32 max_entries;
+	bool percpu;
+	const struct bpf_map_ops *ops;
+	struct work_struct work;
+};
+
+struct bpf_map_type_list {
+	struct list_head list_node;
+	const struct bpf_map_ops *ops;
+	enum bpf_map_type type;
+};
+
+/* size of the value of a (per-CPU) map as seen by user space */
+static inline u32 bpf_map_value_size(const struct bpf_map *map)
+{
+	if (map->percpu)
+		return round_up(map->value_size, 8) * num_possible_cpus();
+	return map->value_size;
+}
+
+#ifdef CONFIG_BPF_SYSCALL
+extern void bpf_register_map_type(struct bpf_map_type_list *tl);
+extern struct bpf_map *bpf_map_get(u32 ufd);
+extern void bpf_map_put(struct bpf_map *map);
+
+/* accessors for filters, on maps with u32 keys and u64 values */
+extern u64 bpf_map_read_u64(struct bpf_map *map, u32 key);
+extern void bpf_map_add_u64(struct bpf_map *map, u32 key, u64 delta);
+#else
+static inline struct bpf_map *bpf_map_get(u32 ufd)
+{
+	return ERR_PTR(-EINVAL);
+}
+static inline void bpf_map_put(struct bpf_map *map)
+{
+}
+static inline u64 bpf_map_read_u64(struct bpf_map *map, u32 key)
+{
+	return 0;
+}
+static inline void bpf_map_add_u64(struct bpf_map *map, u32 key, u64 delta)
+{
+}
+#endif /* CONFIG_BPF_SYSCALL */
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_BPF_H */
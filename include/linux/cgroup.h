@@ -16,6 +16,8 @@
 #include <linux/prio_heap.h>
 #include <linux/rwsem.h>
 #include <linux/idr.h>
+#include <linux/percpu-refcount.h>
+#include <linux/workqueue.h>
 
 #ifdef CONFIG_CGROUPS
 
@@ -71,25 +73,23 @@ struct cgroup_subsys_state {
 	 * css_tryget() and and css_put().
 	 */
 
-	atomic_t refcnt;
+	struct percpu_ref refcnt;
 
 	unsigned long flags;
 	/* ID for this css, if possible */
 	struct css_id __rcu *id;
+
+	/* Used to put @cgroup->dentry on the last css_put() */
+	struct work_struct dput_work;
 };
 
 /* bits in struct cgroup_subsys_state flags field */
 enum {
 	CSS_ROOT, /* This CSS is the root of the subsystem */
 	CSS_REMOVED, /* This CSS is dead */
+	CSS_CLEARING, /* rmdir is checking this CSS for stray references */
 };
 
-/* Caller must verify that the css is not for root cgroup */
-static inline void __css_get(struct cgroup_subsys_state *css, int count)
-{
-	atomic_add(count, &css->refcnt);
-}
-
 /*
  * Call css_get() to hold a reference on the css; it can be used
  * for a reference obtained via:
@@ -101,7 +101,7 @@ static inline void css_get(struct cgroup_subsys_state *css)
 {
 	/* We don't need to reference count the root state */
 	if (!test_bit(CSS_ROOT, &css->flags))
-		__css_get(css, 1);
+		percpu_ref_get(&css->refcnt);
 }
 
 static inline bool css_is_removed(struct cgroup_subsys_state *css)
@@ -109,6 +109,8 @@ static inline bool css_is_removed(struct cgroup_subsys_state *css)
 	return test_bit(CSS_REMOVED, &css->flags);
 }
 
+extern void __css_put(struct cgroup_subsys_state *css, int count);
+
 /*
  * Call css_tryget() to take a reference on a css if your existing
  * (known-valid) reference isn't already ref-counted. Returns false if
@@ -119,10 +121,17 @@ static inline bool css_tryget(struct cgroup_subsys_state *css)
 {
 	if (test_bit(CSS_ROOT, &css->flags))
 		return true;
-	while (!atomic_inc_not_zero(&css->refcnt)) {
-		if (test_bit(CSS_REMOVED, &css->flags))
-			return false;
-		cpu_relax();
+	if (!percpu_ref_tryget(&css->refcnt))
+		return false;
+	/*
+	 * rmdir sets CSS_CLEARING before it looks at the refcount, and the
+	 * refcount is atomic by then, so either rmdir sees our ref and
+	 * backs off, or we see the bit here.  A tryget racing with an rmdir
+	 * which ends up failing may thus fail too.
+	 */
+	if (unlikely(test_bit(CSS_CLEARING, &css->flags))) {
+		__css_put(css, 1);
+		return false;
 	}
 	return true;
 }
@@ -132,7 +141,6 @@ static inline bool css_tryget(struct cgroup_subsys_state *css)
  * css_get() or css_tryget()
  */
 
-extern void __css_put(struct cgroup_subsys_state *css, int count);
 static inline void css_put(struct cgroup_subsys_state *css)
 {
 	if (!test_bit(CSS_ROOT, &css->flags))
@@ -110,6 +110,23 @@ extern void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd);
 #endif
 extern int hugepage_madvise(struct vm_area_struct *vma,
 			    unsigned long *vm_flags, int advice);
+extern int huge_pmd_file_suitable(struct vm_area_struct *vma,
+				  unsigned long address, unsigned int flags);
+extern int do_huge_pmd_file_fault(struct vm_area_struct *vma,
+				  unsigned long address, pmd_t *pmd,
+				  unsigned int flags);
+extern void split_huge_file_pmd(struct vm_area_struct *vma,
+				unsigned long address, pmd_t *pmd);
+extern pmd_t *page_check_address_file_pmd(struct page *page,
+					  struct mm_struct *mm,
+					  unsigned long address);
+extern int page_file_pmd_referenced(struct page *page,
+				    struct vm_area_struct *vma,
+				    unsigned long address, pmd_t *pmd);
+extern int split_huge_file_page_address(struct page *page,
+					struct vm_area_struct *vma,
+					unsigned long address);
+extern void split_huge_file_vma(struct vm_area_struct *vma);
 extern void __vma_adjust_trans_huge(struct vm_area_struct *vma,
 				    unsigned long start,
 				    unsigned long end,
@@ -131,7 +148,8 @@ static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
 					 unsigned long end,
 					 long adjust_next)
 {
-	if (!vma->anon_vma || vma->vm_ops)
+	/* only ->pmd_fault maps page cache with huge pmds */
+	if (vma->vm_ops ? !vma->vm_ops->pmd_fault : !vma->anon_vma)
 		return;
 	__vma_adjust_trans_huge(vma, start, end, adjust_next);
 }
@@ -189,6 +207,31 @@ static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
 					 long adjust_next)
 {
 }
+static inline void split_huge_file_pmd(struct vm_area_struct *vma,
+				       unsigned long address, pmd_t *pmd)
+{
+}
+static inline pmd_t *page_check_address_file_pmd(struct page *page,
+						 struct mm_struct *mm,
+						 unsigned long address)
+{
+	return NULL;
+}
+static inline int page_file_pmd_referenced(struct page *page,
+					   struct vm_area_struct *vma,
+					   unsigned long address, pmd_t *pmd)
+{
+	return 0;
+}
+static inline int split_huge_file_page_address(struct page *page,
+					       struct vm_area_struct *vma,
+					       unsigned long address)
+{
+	return 0;
+}
+static inline void split_huge_file_vma(struct vm_area_struct *vma)
+{
+}
 static inline int pmd_trans_huge_lock(pmd_t *pmd,
 				      struct vm_area_struct *vma)
 {
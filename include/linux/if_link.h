@@ -138,6 +138,7 @@ enum {
 	IFLA_GROUP,		/* Group the device belongs to */
 	IFLA_NET_NS_FD,
 	IFLA_EXT_MASK,		/* Extended info mask, VFs, etc */
+	IFLA_XDP,
 	__IFLA_MAX
 };
 
@@ -391,4 +392,26 @@ struct ifla_port_vsi {
 	__u8 pad[3];
 };
 
+/* XDP section
+ *
+ *	Nested layout of set/get msg is:
+ *
+ *		[IFLA_XDP]
+ *			[IFLA_XDP_INSNS]
+ *			[IFLA_XDP_ATTACHED]
+ *
+ * IFLA_XDP_INSNS carries an array of struct sock_filter run on every
+ * received frame before the stack sees it, an empty array detaches the
+ * program.  IFLA_XDP_ATTACHED is only reported by the kernel.
+ */
+
+enum {
+	IFLA_XDP_UNSPEC,
+	IFLA_XDP_INSNS,
+	IFLA_XDP_ATTACHED,
+	__IFLA_XDP_MAX,
+};
+
+#define IFLA_XDP_MAX (__IFLA_XDP_MAX - 1)
+
 #endif /* _LINUX_IF_LINK_H */
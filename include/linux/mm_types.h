@@ -385,6 +385,17 @@ struct mm_struct {
 #ifdef CONFIG_TRANSPARENT_HUGEPAGE
 	pgtable_t pmd_huge_pte; /* protected by page_table_lock */
 #endif
+#ifdef CONFIG_NUMA_BALANCING
+	/*
+	 * numa_next_scan is the next time the address space is sampled
+	 * for NUMA hinting faults; only the thread that advances it gets
+	 * to do the scan.  numa_scan_offset is where that scan resumes,
+	 * and numa_scan_seq counts completed passes over the address space.
+	 */
+	unsigned long numa_next_scan;
+	unsigned long numa_scan_offset;
+	int numa_scan_seq;
+#endif
 #ifdef CONFIG_CPUMASK_OFFSTACK
 	struct cpumask cpumask_allocation;
 #endif
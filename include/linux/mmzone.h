@@ -107,6 +107,9 @@ enum zone_stat_item {
 	NR_SHMEM,		/* shmem pages (included tmpfs/GEM pages) */
 	NR_DIRTIED,		/* page dirtyings since bootup */
 	NR_WRITTEN,		/* page writings since bootup */
+	WORKINGSET_REFAULT,
+	WORKINGSET_ACTIVATE,
+	WORKINGSET_NODERECLAIM,
 #ifdef CONFIG_NUMA
 	NUMA_HIT,		/* allocated in intended node */
 	NUMA_MISS,		/* allocated in non intended node */
@@ -194,13 +197,27 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/*
+ * The pcp lists cache pages of every order up to PAGE_ALLOC_COSTLY_ORDER,
+ * one list per order and migrate type.
+ */
+#define NR_PCP_ORDERS		(PAGE_ALLOC_COSTLY_ORDER + 1)
+#define NR_PCP_LISTS		(MIGRATE_PCPTYPES * NR_PCP_ORDERS)
+
+/* per_cpu_pages->flags */
+#define PCPF_FREE_HIGH		0x01	/* drained at high since last refill */
+#define PCPF_REFILLED		0x02	/* refilled since last drain at high */
+
 struct per_cpu_pages {
-	int count;		/* number of pages in the list */
+	int count;		/* number of base pages in the lists */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
+	int high_min;		/* bounds for auto-tuning of high */
+	int high_max;
+	int flags;		/* PCPF_* */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/* Lists of pages, one per order and migrate type */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
 struct per_cpu_pageset {
@@ -379,6 +396,9 @@ struct zone {
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	unsigned long		flags;		   /* zone flags, see below */
 
+	/* Evictions & activations on the inactive file list */
+	atomic_long_t		inactive_age;
+
 	/* Zone statistics */
 	atomic_long_t		vm_stat[NR_VM_ZONE_STAT_ITEMS];
 
@@ -666,6 +686,12 @@ typedef struct pglist_data {
 	struct task_struct *kswapd;
 	int kswapd_max_order;
 	enum zone_type classzone_idx;
+#ifdef CONFIG_NUMA_BALANCING
+	/* Rate limiting of NUMA hinting fault migrations into this node */
+	spinlock_t numabalancing_migrate_lock;
+	unsigned long numabalancing_migrate_next_window;
+	unsigned long numabalancing_migrate_nr_pages;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
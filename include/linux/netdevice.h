@@ -222,6 +222,7 @@ extern struct static_key rps_needed;
 struct neighbour;
 struct neigh_parms;
 struct sk_buff;
+struct sk_filter;
 
 struct netdev_hw_addr {
 	struct list_head	list;
@@ -349,12 +350,17 @@ struct napi_struct {
 	struct list_head	dev_list;
 	struct sk_buff		*gro_list;
 	struct sk_buff		*skb;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	struct hlist_node	napi_hash_node;
+	unsigned int		napi_id;
+#endif
 };
 
 enum {
 	NAPI_STATE_SCHED,	/* Poll is scheduled */
 	NAPI_STATE_DISABLE,	/* Disable pending */
 	NAPI_STATE_NPSVC,	/* Netpoll - don't dequeue from poll_list */
+	NAPI_STATE_HASHED,	/* In NAPI hash, see napi_hash_add() */
 };
 
 enum gro_result {
@@ -819,6 +825,13 @@ struct netdev_fcoe_hbainfo {
  *
  * void (*ndo_poll_controller)(struct net_device *dev);
  *
+ * int (*ndo_busy_poll)(struct napi_struct *napi);
+ *	Called from process context, with bottom halves disabled, to poll
+ *	the rx queues of a napi context for packets that a busy polling
+ *	socket is waiting for.  Returns the number of packets received,
+ *	LL_FLUSH_BUSY if the queues are being handled by regular napi
+ *	polling right now, or LL_FLUSH_FAILED if polling isn't possible.
+ *
  *	SR-IOV management functions.
  * int (*ndo_set_vf_mac)(struct net_device *dev, int vf, u8* mac);
  * int (*ndo_set_vf_vlan)(struct net_device *dev, int vf, u16 vlan, u8 qos);
@@ -905,6 +918,12 @@ struct netdev_fcoe_hbainfo {
  *	feature set might be less than what was returned by ndo_fix_features()).
  *	Must return >0 or -errno if it changed dev->features itself.
  *
+ * int (*ndo_xdp_filter)(struct net_device *dev, struct sk_filter *fp);
+ *	Called under RTNL before the XDP filter @fp, or NULL, replaces
+ *	dev->xdp_filter.  Drivers that run the filter from their own rx
+ *	path implement it to refuse configurations they can't handle;
+ *	for other devices __netif_receive_skb() runs the filter.
+ *
  */
 struct net_device_ops {
 	int			(*ndo_init)(struct net_device *dev);
@@ -944,6 +963,9 @@ struct net_device_ops {
 	int			(*ndo_netpoll_setup)(struct net_device *dev,
 						     struct netpoll_info *info);
 	void			(*ndo_netpoll_cleanup)(struct net_device *dev);
+#endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	int			(*ndo_busy_poll)(struct napi_struct *napi);
 #endif
 	int			(*ndo_set_vf_mac)(struct net_device *dev,
 						  int queue, u8 *mac);
@@ -1000,6 +1022,8 @@ struct net_device_ops {
 						    netdev_features_t features);
 	int			(*ndo_set_features)(struct net_device *dev,
 						    netdev_features_t features);
+	int			(*ndo_xdp_filter)(struct net_device *dev,
+						  struct sk_filter *fp);
 	int			(*ndo_neigh_construct)(struct neighbour *n);
 	void			(*ndo_neigh_destroy)(struct neighbour *n);
 };
@@ -1185,6 +1209,7 @@ struct net_device {
 
 	rx_handler_func_t __rcu	*rx_handler;
 	void __rcu		*rx_handler_data;
+	struct sk_filter __rcu	*xdp_filter;
 
 	struct netdev_queue __rcu *ingress_queue;
 
@@ -1465,6 +1490,37 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
  */
 void netif_napi_del(struct napi_struct *napi);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/**
+ *	napi_hash_add - add a NAPI to global hashtable
+ *	@napi: napi context
+ *
+ *	Generate a new napi_id and store @napi under it in the napi hash,
+ *	so that busy polling sockets can find it.  The napi context must
+ *	only be freed after an RCU grace period following napi_hash_del().
+ */
+void napi_hash_add(struct napi_struct *napi);
+
+/**
+ *	napi_hash_del - remove a NAPI from global table
+ *	@napi: napi context
+ *
+ *	Warning: caller must observe an RCU grace period before freeing
+ *	memory containing @napi.
+ */
+void napi_hash_del(struct napi_struct *napi);
+
+struct napi_struct *napi_by_id(unsigned int napi_id);
+#else
+static inline void napi_hash_add(struct napi_struct *napi)
+{
+}
+
+static inline void napi_hash_del(struct napi_struct *napi)
+{
+}
+#endif
+
 struct napi_gro_cb {
 	/* Virtual address of skb_shinfo(skb)->frags[0].page + offset. */
 	void *frag0;
@@ -2140,6 +2196,8 @@ extern int netdev_rx_handler_register(struct net_device *dev,
 				      rx_handler_func_t *rx_handler,
 				      void *rx_handler_data);
 extern void netdev_rx_handler_unregister(struct net_device *dev);
+extern int dev_change_xdp_filter(struct net_device *dev, struct sk_filter *fp);
+extern void netif_xdp_tx(struct sk_buff *skb);
 
 extern bool		dev_valid_name(const char *name);
 extern int		dev_ioctl(struct net *net, unsigned int cmd, void __user *);
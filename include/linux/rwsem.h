@@ -17,6 +17,7 @@
 #include <linux/atomic.h>
 
 struct rw_semaphore;
+struct mcs_spinlock;
 
 #ifdef CONFIG_RWSEM_GENERIC_SPINLOCK
 #include <linux/rwsem-spinlock.h> /* use a generic implementation */
@@ -26,6 +27,15 @@ struct rw_semaphore {
 	long			count;
 	raw_spinlock_t		wait_lock;
 	struct list_head	wait_list;
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+	/*
+	 * Write owner, set while the lock is write held, and the MCS
+	 * queue of writers spinning on it.  Both are only hints for the
+	 * optimistic spinning in the slowpath.
+	 */
+	struct task_struct	*owner;
+	struct mcs_spinlock	*mcs_lock;
+#endif
 #ifdef CONFIG_DEBUG_LOCK_ALLOC
 	struct lockdep_map	dep_map;
 #endif
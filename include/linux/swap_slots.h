@@ -0,0 +1,22 @@
+#ifndef _LINUX_SWAP_SLOTS_H
+#define _LINUX_SWAP_SLOTS_H
+
+#include <linux/swap.h>
+
+#define SWAP_SLOTS_CACHE_SIZE			64
+/*
+ * The caches only pay off, and only stay fair to other cpus, while
+ * there is plenty of free swap: start using them above the first
+ * threshold (per online cpu), drain them all below the second.
+ */
+#define THRESHOLD_ACTIVATE_SWAP_SLOTS_CACHE	(5*SWAP_SLOTS_CACHE_SIZE)
+#define THRESHOLD_DEACTIVATE_SWAP_SLOTS_CACHE	(2*SWAP_SLOTS_CACHE_SIZE)
+
+extern bool swap_slot_cache_enabled;
+
+extern void enable_swap_slots_cache(void);
+extern void disable_swap_slots_cache_lock(void);
+extern void reenable_swap_slots_cache_unlock(void);
+extern void free_swap_slot(swp_entry_t entry);
+
+#endif /* _LINUX_SWAP_SLOTS_H */
@@ -0,0 +1,114 @@
+/*
+ * busy_poll.h	Low latency receive: poll a device queue from process context
+ *
+ * A socket remembers the NAPI context that last delivered a packet to it.
+ * When the application blocks on an empty receive queue, instead of
+ * sleeping until interrupt, softirq and wakeup have run, it can spin on
+ * that NAPI context through the driver's ndo_busy_poll() for a bounded
+ * amount of time, and pick up the packet as soon as it hits the ring.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#ifndef _LINUX_NET_BUSY_POLL_H
+#define _LINUX_NET_BUSY_POLL_H
+
+#include <linux/netdevice.h>
+#include <linux/sched.h>
+#include <net/sock.h>
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+
+extern unsigned int sysctl_net_busy_read __read_mostly;
+extern unsigned int sysctl_net_busy_poll __read_mostly;
+
+/* return values from ndo_busy_poll */
+#define LL_FLUSH_FAILED		-1	/* permanent failure, stop polling */
+#define LL_FLUSH_BUSY		-2	/* NAPI owns the queue right now */
+
+static inline bool net_busy_loop_on(void)
+{
+	return sysctl_net_busy_poll;
+}
+
+/*
+ * We only care that the time spent spinning is bounded on average, not
+ * about precision, so a cheap cpu local clock in ~usecs is good enough.
+ */
+static inline unsigned long busy_loop_current_time(void)
+{
+	return (unsigned long)(local_clock() >> 10);
+}
+
+/* in epoll we use the global sysctl_net_busy_poll budget */
+static inline bool busy_loop_timeout(unsigned long start_time)
+{
+	unsigned long bp_usec = ACCESS_ONCE(sysctl_net_busy_poll);
+
+	return time_after(busy_loop_current_time(), start_time + bp_usec);
+}
+
+/* for sockets the per socket SO_BUSY_POLL value is used */
+static inline bool sk_busy_loop_timeout(struct sock *sk,
+					unsigned long start_time)
+{
+	unsigned long bp_usec = ACCESS_ONCE(sk->sk_ll_usec);
+
+	return time_after(busy_loop_current_time(), start_time + bp_usec);
+}
+
+static inline bool sk_can_busy_loop(struct sock *sk)
+{
+	return sk->sk_ll_usec && sk->sk_napi_id &&
+	       !need_resched() && !signal_pending(current);
+}
+
+extern void napi_busy_loop(unsigned int napi_id,
+			   bool (*loop_end)(void *, unsigned long),
+			   void *loop_end_arg);
+extern bool sk_busy_loop(struct sock *sk, int nonblock);
+
+/* used in the NIC receive handler to mark the skb */
+static inline void skb_mark_napi_id(struct sk_buff *skb,
+				    struct napi_struct *napi)
+{
+	skb->napi_id = napi->napi_id;
+}
+
+/* used in the protocol handler to propagate the napi_id to the socket */
+static inline void sk_mark_napi_id(struct sock *sk, struct sk_buff *skb)
+{
+	sk->sk_napi_id = skb->napi_id;
+}
+
+#else /* CONFIG_NET_RX_BUSY_POLL */
+
+static inline bool net_busy_loop_on(void)
+{
+	return false;
+}
+
+static inline bool sk_can_busy_loop(struct sock *sk)
+{
+	return false;
+}
+
+static inline bool sk_busy_loop(struct sock *sk, int nonblock)
+{
+	return false;
+}
+
+static inline void skb_mark_napi_id(struct sk_buff *skb,
+				    struct napi_struct *napi)
+{
+}
+
+static inline void sk_mark_napi_id(struct sock *sk, struct sk_buff *skb)
+{
+}
+
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+#endif /* _LINUX_NET_BUSY_POLL_H */
@@ -400,6 +400,25 @@ static inline void dst_confirm(struct dst_entry *dst)
 	}
 }
 
+/*
+ * Like dst_confirm(), for dsts that may be shared by several neighbours
+ * and have none bound: @daddr is the destination the traffic went to.
+ */
+static inline void dst_confirm_neigh(struct dst_entry *dst, const void *daddr)
+{
+	if (dst) {
+		struct neighbour *n;
+
+		rcu_read_lock();
+		n = dst_get_neighbour_noref(dst);
+		if (n)
+			neigh_confirm(n);
+		else if (dst->ops->confirm_neigh)
+			dst->ops->confirm_neigh(dst, daddr);
+		rcu_read_unlock();
+	}
+}
+
 static inline struct neighbour *dst_neigh_lookup(const struct dst_entry *dst, const void *daddr)
 {
 	return dst->ops->neigh_lookup(dst, daddr);
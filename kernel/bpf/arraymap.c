@@ -0,0 +1,215 @@
+/*
+ * kernel/bpf/arraymap.c
+ *
+ * Array BPF maps.  Keys are u32 indexes and every element exists from
+ * the moment the map is created, so lookups never allocate or lock and
+ * elements can't be deleted.  Per-CPU arrays keep one copy of each
+ * value per possible CPU.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#include <linux/bpf.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/percpu.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/init.h>
+
+struct bpf_array {
+	struct bpf_map map;
+	u32 elem_size;
+	union {
+		char value[0] __aligned(8);
+		void __percpu *pptrs[0] __aligned(8);
+	};
+};
+
+static void array_map_free(struct bpf_map *map);
+
+/* Called from syscall */
+static struct bpf_map *array_map_alloc(union bpf_attr *attr)
+{
+	bool percpu = attr->map_type == BPF_MAP_TYPE_PERCPU_ARRAY;
+	struct bpf_array *array;
+	u32 elem_size, array_size;
+	u32 i;
+
+	/* check sanity of attributes */
+	if (attr->max_entries == 0 || attr->key_size != 4 ||
+	    attr->value_size == 0)
+		return ERR_PTR(-EINVAL);
+
+	elem_size = round_up(attr->value_size, 8);
+	if (percpu && elem_size > PCPU_MIN_UNIT_SIZE)
+		return ERR_PTR(-E2BIG);
+
+	/* check round_up into zero and u32 overflow */
+	if (elem_size == 0 ||
+	    attr->max_entries > (UINT_MAX - PAGE_SIZE - sizeof(*array)) /
+				(percpu ? sizeof(void *) : elem_size))
+		return ERR_PTR(-ENOMEM);
+
+	/* per-CPU values are all allocated up front, bound what that costs */
+	if (percpu && (u64) attr->max_entries * elem_size *
+		      num_possible_cpus() >= UINT_MAX - PAGE_SIZE)
+		return ERR_PTR(-E2BIG);
+
+	array_size = sizeof(*array);
+	if (percpu)
+		array_size += attr->max_entries * sizeof(void *);
+	else
+		array_size += attr->max_entries * elem_size;
+
+	/* allocate all map elements and zero-initialize them */
+	array = kzalloc(array_size, GFP_USER | __GFP_NOWARN);
+	if (!array) {
+		array = vzalloc(array_size);
+		if (!array)
+			return ERR_PTR(-ENOMEM);
+	}
+
+	/* copy mandatory map attributes */
+	array->map.key_size = attr->key_size;
+	array->map.value_size = attr->value_size;
+	array->map.max_entries = attr->max_entries;
+	array->map.percpu = percpu;
+	array->elem_size = elem_size;
+
+	if (!percpu)
+		return &array->map;
+
+	for (i = 0; i < attr->max_entries; i++) {
+		array->pptrs[i] = __alloc_percpu(elem_size, 8);
+		if (!array->pptrs[i]) {
+			array_map_free(&array->map);
+			return ERR_PTR(-ENOMEM);
+		}
+		cond_resched();
+	}
+
+	return &array->map;
+}
+
+/* Called from syscall or from filters */
+static void *array_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	u32 index = *(u32 *)key;
+
+	if (index >= array->map.max_entries)
+		return NULL;
+
+	if (map->percpu)
+		return (void __force *) array->pptrs[index];
+	return array->value + array->elem_size * index;
+}
+
+/* Called from syscall */
+static int array_map_get_next_key(struct bpf_map *map, void *key, void *next_key)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	u32 index = *(u32 *)key;
+	u32 *next = (u32 *)next_key;
+
+	if (index >= array->map.max_entries) {
+		*next = 0;
+		return 0;
+	}
+
+	if (index == array->map.max_entries - 1)
+		return -ENOENT;
+
+	*next = index + 1;
+	return 0;
+}
+
+/* Called from syscall or from filters */
+static int array_map_update_elem(struct bpf_map *map, void *key, void *value,
+				 u64 map_flags)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	u32 index = *(u32 *)key;
+	int cpu, off = 0;
+
+	if (index >= array->map.max_entries)
+		/* all elements were pre-allocated, cannot insert a new one */
+		return -E2BIG;
+
+	if (map_flags == BPF_NOEXIST)
+		/* all elements already exist */
+		return -EEXIST;
+
+	if (!map->percpu) {
+		if (value)
+			memcpy(array->value + array->elem_size * index,
+			       value, map->value_size);
+		else
+			memset(array->value + array->elem_size * index,
+			       0, map->value_size);
+		return 0;
+	}
+
+	/* the user space layout pads every CPU's copy to 8 bytes too */
+	for_each_possible_cpu(cpu) {
+		void *ptr = per_cpu_ptr(array->pptrs[index], cpu);
+
+		if (value)
+			memcpy(ptr, value + off, map->value_size);
+		else
+			memset(ptr, 0, map->value_size);
+		off += array->elem_size;
+	}
+	return 0;
+}
+
+/* Called from syscall or from filters */
+static int array_map_delete_elem(struct bpf_map *map, void *key)
+{
+	return -EINVAL;
+}
+
+/* Called when map->refcnt goes to zero, either from workqueue or from syscall */
+static void array_map_free(struct bpf_map *map)
+{
+	struct bpf_array *array = container_of(map, struct bpf_array, map);
+	u32 i;
+
+	if (map->percpu)
+		for (i = 0; i < map->max_entries; i++)
+			free_percpu(array->pptrs[i]);
+
+	if (is_vmalloc_addr(array))
+		vfree(array);
+	else
+		kfree(array);
+}
+
+static const struct bpf_map_ops array_ops = {
+	.map_alloc = array_map_alloc,
+	.map_free = array_map_free,
+	.map_get_next_key = array_map_get_next_key,
+	.map_lookup_elem = array_map_lookup_elem,
+	.map_update_elem = array_map_update_elem,
+	.map_delete_elem = array_map_delete_elem,
+};
+
+static struct bpf_map_type_list array_type __read_mostly = {
+	.ops = &array_ops,
+	.type = BPF_MAP_TYPE_ARRAY,
+};
+
+static struct bpf_map_type_list array_percpu_type __read_mostly = {
+	.ops = &array_ops,
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+};
+
+static int __init register_array_map(void)
+{
+	bpf_register_map_type(&array_type);
+	bpf_register_map_type(&array_percpu_type);
+	return 0;
+}
+late_initcall(register_array_map);
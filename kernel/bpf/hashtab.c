@@ -0,0 +1,566 @@
+/*
+ * kernel/bpf/hashtab.c
+ *
+ * Hash table BPF maps.  Lookups walk RCU protected bucket lists without
+ * taking any lock, updates and deletes serialize on a per-map spinlock
+ * since they can come from softirq context as well as from the syscall.
+ *
+ * Per-CPU hash maps keep one copy of each value per possible CPU.  Their
+ * elements are preallocated when the map is created, as per-CPU memory
+ * can't be allocated from the softirq context filters run in.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/jhash.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/rculist.h>
+#include <linux/sched.h>
+#include <linux/log2.h>
+#include <linux/init.h>
+
+struct bpf_htab {
+	struct bpf_map map;
+	struct hlist_head *buckets;
+	spinlock_t lock;
+	u32 count;	/* number of elements in this hashtable */
+	u32 n_buckets;	/* number of hash buckets */
+	u32 elem_size;	/* size of each element in bytes */
+	u32 key_size;	/* key size rounded up to 8 bytes */
+	struct hlist_head freelist; /* preallocated per-CPU elements */
+};
+
+/* each htab element is struct htab_elem + key + value */
+struct htab_elem {
+	struct hlist_node hash_node;
+	struct rcu_head rcu;
+	struct bpf_htab *htab;
+	u32 hash;
+	char key[0] __aligned(8);
+};
+
+static inline void *htab_elem_value(struct bpf_htab *htab,
+				    struct htab_elem *l)
+{
+	return l->key + htab->key_size;
+}
+
+static inline void __percpu *htab_elem_pptr(struct bpf_htab *htab,
+					    struct htab_elem *l)
+{
+	return *(void __percpu **) htab_elem_value(htab, l);
+}
+
+static void htab_free_elem(struct bpf_htab *htab, struct htab_elem *l)
+{
+	if (htab->map.percpu)
+		free_percpu(htab_elem_pptr(htab, l));
+	kfree(l);
+}
+
+static void htab_free_buckets(struct bpf_htab *htab)
+{
+	if (is_vmalloc_addr(htab->buckets))
+		vfree(htab->buckets);
+	else
+		kfree(htab->buckets);
+}
+
+static int htab_prealloc_percpu(struct bpf_htab *htab)
+{
+	struct htab_elem *l;
+	void __percpu *pptr;
+	u32 i;
+
+	for (i = 0; i < htab->map.max_entries; i++) {
+		l = kzalloc(htab->elem_size, GFP_USER | __GFP_NOWARN);
+		if (!l)
+			return -ENOMEM;
+		pptr = __alloc_percpu(round_up(htab->map.value_size, 8), 8);
+		if (!pptr) {
+			kfree(l);
+			return -ENOMEM;
+		}
+		l->htab = htab;
+		*(void __percpu **) htab_elem_value(htab, l) = pptr;
+		hlist_add_head(&l->hash_node, &htab->freelist);
+		cond_resched();
+	}
+	return 0;
+}
+
+static void htab_map_free(struct bpf_map *map);
+
+/* Called from syscall */
+static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
+{
+	struct bpf_htab *htab;
+	u32 value_size;
+	u64 cost;
+	int err, i;
+
+	htab = kzalloc(sizeof(*htab), GFP_USER);
+	if (!htab)
+		return ERR_PTR(-ENOMEM);
+
+	/* mandatory map attributes */
+	htab->map.key_size = attr->key_size;
+	htab->map.value_size = attr->value_size;
+	htab->map.max_entries = attr->max_entries;
+	htab->map.percpu = attr->map_type == BPF_MAP_TYPE_PERCPU_HASH;
+	INIT_HLIST_HEAD(&htab->freelist);
+	spin_lock_init(&htab->lock);
+
+	/* check sanity of attributes.
+	 * value_size == 0 may be allowed in the future to use map as a set
+	 */
+	err = -EINVAL;
+	if (htab->map.max_entries == 0 || htab->map.key_size == 0 ||
+	    htab->map.value_size == 0)
+		goto free_htab;
+
+	/* hash table size must be power of 2 */
+	err = -E2BIG;
+	if (htab->map.max_entries > 1U << 31)
+		goto free_htab;
+	htab->n_buckets = roundup_pow_of_two(htab->map.max_entries);
+
+	if (htab->map.key_size > MAX_BPF_STACK)
+		/* keys are hashed and compared on every lookup, keep them
+		 * within what a filter could build on its stack
+		 */
+		goto free_htab;
+
+	if (htab->map.percpu) {
+		if (round_up(htab->map.value_size, 8) > PCPU_MIN_UNIT_SIZE)
+			goto free_htab;
+		value_size = sizeof(void __percpu *);
+	} else {
+		if (htab->map.value_size >= KMALLOC_MAX_SIZE -
+		    MAX_BPF_STACK - sizeof(struct htab_elem))
+			/* if value_size is bigger, the user space won't be
+			 * able to access the elements via bpf syscall
+			 */
+			goto free_htab;
+		value_size = round_up(htab->map.value_size, 8);
+	}
+
+	htab->key_size = round_up(htab->map.key_size, 8);
+	htab->elem_size = sizeof(struct htab_elem) + htab->key_size +
+			  value_size;
+
+	/* prevent zero size kmalloc and check for u32 overflow */
+	if (htab->n_buckets == 0 ||
+	    htab->n_buckets > UINT_MAX / sizeof(struct hlist_head))
+		goto free_htab;
+
+	/* per-CPU elements are all allocated up front, bound what that costs */
+	if (htab->map.percpu) {
+		cost = (u64) htab->n_buckets * sizeof(struct hlist_head) +
+		       (u64) htab->map.max_entries * (htab->elem_size +
+		       (u64) round_up(htab->map.value_size, 8) *
+		       num_possible_cpus());
+		if (cost >= UINT_MAX - PAGE_SIZE)
+			goto free_htab;
+	}
+
+	err = -ENOMEM;
+	htab->buckets = kmalloc(htab->n_buckets * sizeof(struct hlist_head),
+				GFP_USER | __GFP_NOWARN);
+	if (!htab->buckets) {
+		htab->buckets = vmalloc(htab->n_buckets *
+					sizeof(struct hlist_head));
+		if (!htab->buckets)
+			goto free_htab;
+	}
+
+	for (i = 0; i < htab->n_buckets; i++)
+		INIT_HLIST_HEAD(&htab->buckets[i]);
+
+	if (htab->map.percpu && htab_prealloc_percpu(htab)) {
+		htab_map_free(&htab->map);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	return &htab->map;
+
+free_htab:
+	kfree(htab);
+	return ERR_PTR(err);
+}
+
+static inline u32 htab_map_hash(const void *key, u32 key_len)
+{
+	return jhash(key, key_len, 0);
+}
+
+static inline struct hlist_head *select_bucket(struct bpf_htab *htab, u32 hash)
+{
+	return &htab->buckets[hash & (htab->n_buckets - 1)];
+}
+
+static struct htab_elem *lookup_elem_raw(struct hlist_head *head, u32 hash,
+					 void *key, u32 key_size)
+{
+	struct hlist_node *n;
+	struct htab_elem *l;
+
+	hlist_for_each_entry_rcu(l, n, head, hash_node)
+		if (l->hash == hash && !memcmp(&l->key, key, key_size))
+			return l;
+
+	return NULL;
+}
+
+/* Called from syscall or from filters */
+static void *htab_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
+	struct hlist_head *head;
+	struct htab_elem *l;
+	u32 hash, key_size;
+
+	/* Must be called with rcu_read_lock. */
+	WARN_ON_ONCE(!rcu_read_lock_held());
+
+	key_size = map->key_size;
+
+	hash = htab_map_hash(key, key_size);
+
+	head = select_bucket(htab, hash);
+
+	l = lookup_elem_raw(head, hash, key, key_size);
+
+	if (!l)
+		return NULL;
+	if (map->percpu)
+		return (void __force *) htab_elem_pptr(htab, l);
+	return htab_elem_value(htab, l);
+}
+
+/* Called from syscall */
+static int htab_map_get_next_key(struct bpf_map *map, void *key, void *next_key)
+{
+	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
+	struct hlist_node *next;
+	struct hlist_head *head;
+	struct htab_elem *l, *next_l;
+	u32 hash, key_size;
+	int i;
+
+	WARN_ON_ONCE(!rcu_read_lock_held());
+
+	key_size = map->key_size;
+
+	hash = htab_map_hash(key, key_size);
+
+	head = select_bucket(htab, hash);
+
+	/* lookup the key */
+	l = lookup_elem_raw(head, hash, key, key_size);
+
+	if (!l) {
+		i = 0;
+		goto find_first_elem;
+	}
+
+	/* key was found, get next key in the same bucket */
+	next = rcu_dereference_raw(hlist_next_rcu(&l->hash_node));
+	if (next) {
+		/* if next elem in this hash list is non-zero, just return it */
+		next_l = hlist_entry(next, struct htab_elem, hash_node);
+		memcpy(next_key, next_l->key, key_size);
+		return 0;
+	}
+
+	/* no more elements in this hash list, go to the next bucket */
+	i = hash & (htab->n_buckets - 1);
+	i++;
+
+find_first_elem:
+	/* iterate over buckets */
+	for (; i < htab->n_buckets; i++) {
+		head = select_bucket(htab, i);
+
+		/* pick first element in the bucket */
+		next = rcu_dereference_raw(hlist_first_rcu(head));
+		if (next) {
+			/* if it's not empty, just return it */
+			next_l = hlist_entry(next, struct htab_elem, hash_node);
+			memcpy(next_key, next_l->key, key_size);
+			return 0;
+		}
+	}
+
+	/* iterated over all buckets and all elements */
+	return -ENOENT;
+}
+
+static int check_flags(struct htab_elem *l_old, u64 map_flags)
+{
+	if (l_old && map_flags == BPF_NOEXIST)
+		/* elem already exists */
+		return -EEXIST;
+
+	if (!l_old && map_flags == BPF_EXIST)
+		/* elem doesn't exist, cannot update it */
+		return -ENOENT;
+
+	return 0;
+}
+
+/* copy a user space layout value, or zeroes, to every CPU's copy */
+static void htab_percpu_fill(struct bpf_htab *htab, void __percpu *pptr,
+			     void *value)
+{
+	u32 size = round_up(htab->map.value_size, 8);
+	int cpu, off = 0;
+
+	for_each_possible_cpu(cpu) {
+		if (value)
+			memcpy(per_cpu_ptr(pptr, cpu), value + off,
+			       htab->map.value_size);
+		else
+			memset(per_cpu_ptr(pptr, cpu), 0,
+			       htab->map.value_size);
+		off += size;
+	}
+}
+
+static int htab_percpu_update_elem(struct bpf_htab *htab, void *key,
+				   u32 hash, void *value, u64 map_flags)
+{
+	struct hlist_head *head = select_bucket(htab, hash);
+	struct htab_elem *l_old, *l_new;
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&htab->lock, flags);
+
+	l_old = lookup_elem_raw(head, hash, key, htab->map.key_size);
+
+	ret = check_flags(l_old, map_flags);
+	if (ret)
+		goto out;
+
+	if (l_old) {
+		/* per-CPU values are updated in place, concurrent readers
+		 * may see a mix of old and new bytes just like they would
+		 * with a concurrent filter update
+		 */
+		htab_percpu_fill(htab, htab_elem_pptr(htab, l_old), value);
+		goto out;
+	}
+
+	if (hlist_empty(&htab->freelist)) {
+		ret = -E2BIG;
+		goto out;
+	}
+
+	l_new = hlist_entry(htab->freelist.first, struct htab_elem, hash_node);
+	hlist_del(&l_new->hash_node);
+
+	memcpy(l_new->key, key, htab->map.key_size);
+	l_new->hash = hash;
+	htab_percpu_fill(htab, htab_elem_pptr(htab, l_new), value);
+
+	/* add new element to the head of the list, so that concurrent
+	 * search will find it before old elem
+	 */
+	hlist_add_head_rcu(&l_new->hash_node, head);
+	htab->count++;
+out:
+	spin_unlock_irqrestore(&htab->lock, flags);
+	return ret;
+}
+
+/* Called from syscall or from filters */
+static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
+				u64 map_flags)
+{
+	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
+	struct htab_elem *l_new, *l_old;
+	struct hlist_head *head;
+	unsigned long flags;
+	u32 key_size, hash;
+	int ret;
+
+	WARN_ON_ONCE(!rcu_read_lock_held());
+
+	key_size = map->key_size;
+	hash = htab_map_hash(key, key_size);
+
+	if (map->percpu)
+		return htab_percpu_update_elem(htab, key, hash, value,
+					       map_flags);
+
+	/* allocate new element outside of lock */
+	l_new = kmalloc(htab->elem_size, GFP_ATOMIC | __GFP_NOWARN);
+	if (!l_new)
+		return -ENOMEM;
+
+	l_new->hash = hash;
+	memcpy(l_new->key, key, key_size);
+	if (value)
+		memcpy(htab_elem_value(htab, l_new), value, map->value_size);
+	else
+		memset(htab_elem_value(htab, l_new), 0, map->value_size);
+
+	head = select_bucket(htab, hash);
+
+	/* bpf_map_update_elem() can be called in_irq() */
+	spin_lock_irqsave(&htab->lock, flags);
+
+	l_old = lookup_elem_raw(head, hash, key, key_size);
+
+	ret = check_flags(l_old, map_flags);
+	if (ret)
+		goto err;
+
+	if (!l_old && unlikely(htab->count >= map->max_entries)) {
+		/* if elem with this 'key' doesn't exist and we've reached
+		 * max_entries limit, fail insertion of new elem
+		 */
+		ret = -E2BIG;
+		goto err;
+	}
+
+	/* add new element to the head of the list, so that concurrent
+	 * search will find it before old elem
+	 */
+	hlist_add_head_rcu(&l_new->hash_node, head);
+	if (l_old) {
+		hlist_del_rcu(&l_old->hash_node);
+		kfree_rcu(l_old, rcu);
+	} else {
+		htab->count++;
+	}
+	spin_unlock_irqrestore(&htab->lock, flags);
+
+	return 0;
+err:
+	spin_unlock_irqrestore(&htab->lock, flags);
+	kfree(l_new);
+	return ret;
+}
+
+/* RCU callback giving a deleted per-CPU element back to the freelist */
+static void htab_percpu_elem_recycle(struct rcu_head *head)
+{
+	struct htab_elem *l = container_of(head, struct htab_elem, rcu);
+	struct bpf_htab *htab = l->htab;
+	unsigned long flags;
+
+	spin_lock_irqsave(&htab->lock, flags);
+	hlist_add_head(&l->hash_node, &htab->freelist);
+	spin_unlock_irqrestore(&htab->lock, flags);
+}
+
+/* Called from syscall or from filters */
+static int htab_map_delete_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
+	struct hlist_head *head;
+	struct htab_elem *l;
+	unsigned long flags;
+	u32 hash, key_size;
+	int ret = -ENOENT;
+
+	WARN_ON_ONCE(!rcu_read_lock_held());
+
+	key_size = map->key_size;
+
+	hash = htab_map_hash(key, key_size);
+	head = select_bucket(htab, hash);
+
+	spin_lock_irqsave(&htab->lock, flags);
+
+	l = lookup_elem_raw(head, hash, key, key_size);
+
+	if (l) {
+		hlist_del_rcu(&l->hash_node);
+		htab->count--;
+		if (map->percpu)
+			call_rcu(&l->rcu, htab_percpu_elem_recycle);
+		else
+			kfree_rcu(l, rcu);
+		ret = 0;
+	}
+
+	spin_unlock_irqrestore(&htab->lock, flags);
+	return ret;
+}
+
+static void delete_all_elements(struct bpf_htab *htab)
+{
+	struct hlist_node *n, *tmp;
+	struct htab_elem *l;
+	int i;
+
+	for (i = 0; i < htab->n_buckets; i++) {
+		struct hlist_head *head = select_bucket(htab, i);
+
+		hlist_for_each_entry_safe(l, n, tmp, head, hash_node) {
+			hlist_del_rcu(&l->hash_node);
+			htab->count--;
+			htab_free_elem(htab, l);
+		}
+	}
+
+	hlist_for_each_entry_safe(l, n, tmp, &htab->freelist, hash_node) {
+		hlist_del(&l->hash_node);
+		htab_free_elem(htab, l);
+	}
+}
+
+/* Called when map->refcnt goes to zero, either from workqueue or from syscall */
+static void htab_map_free(struct bpf_map *map)
+{
+	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
+
+	/* No filter or syscall can reach the map anymore, but deleted
+	 * per-CPU elements may still be on their way back to the freelist.
+	 */
+	rcu_barrier();
+
+	/* some of kfree_rcu() callbacks for elements of this map may not
+	 * have executed. It's ok. Proceed to free residual elements and
+	 * map itself
+	 */
+	delete_all_elements(htab);
+	htab_free_buckets(htab);
+	kfree(htab);
+}
+
+static const struct bpf_map_ops htab_ops = {
+	.map_alloc = htab_map_alloc,
+	.map_free = htab_map_free,
+	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_elem = htab_map_lookup_elem,
+	.map_update_elem = htab_map_update_elem,
+	.map_delete_elem = htab_map_delete_elem,
+};
+
+static struct bpf_map_type_list htab_type __read_mostly = {
+	.ops = &htab_ops,
+	.type = BPF_MAP_TYPE_HASH,
+};
+
+static struct bpf_map_type_list htab_percpu_type __read_mostly = {
+	.ops = &htab_ops,
+	.type = BPF_MAP_TYPE_PERCPU_HASH,
+};
+
+static int __init register_htab_map(void)
+{
+	bpf_register_map_type(&htab_type);
+	bpf_register_map_type(&htab_percpu_type);
+	return 0;
+}
+late_initcall(register_htab_map);
@@ -0,0 +1,48 @@
+/*
+ * kernel/bpf/helpers.c
+ *
+ * Map accessors for socket filters.  Classic filters see maps with u32
+ * keys and u64 values, which covers packet counters and lookup tables.
+ * Callers hold rcu_read_lock(), as filters always run under it.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#include <linux/bpf.h>
+#include <linux/percpu.h>
+#include <linux/atomic.h>
+
+/* Return the value of @key, this CPU's copy of it for per-CPU maps. */
+u64 bpf_map_read_u64(struct bpf_map *map, u32 key)
+{
+	void *value = map->ops->map_lookup_elem(map, &key);
+
+	if (!value)
+		return 0;
+	if (map->percpu)
+		return this_cpu_read(*(u64 __percpu *) value);
+	return atomic64_read((atomic64_t *) value);
+}
+
+/*
+ * Add @delta to the value of @key, creating a zeroed element first if
+ * the map doesn't have one yet.  Other CPUs may race to create the same
+ * element, only one of them wins and all of them add to it.
+ */
+void bpf_map_add_u64(struct bpf_map *map, u32 key, u64 delta)
+{
+	void *value = map->ops->map_lookup_elem(map, &key);
+
+	if (unlikely(!value)) {
+		map->ops->map_update_elem(map, &key, NULL, BPF_NOEXIST);
+		value = map->ops->map_lookup_elem(map, &key);
+		if (!value)
+			return;
+	}
+
+	if (map->percpu)
+		this_cpu_add(*(u64 __percpu *) value, delta);
+	else
+		atomic64_add(delta, (atomic64_t *) value);
+}
@@ -845,8 +845,10 @@ static void cgroup_diput(struct dentry *dentry, struct inode *inode)
 		/*
 		 * Release the subsystem state objects.
 		 */
-		for_each_subsys(cgrp->root, ss)
+		for_each_subsys(cgrp->root, ss) {
+			percpu_ref_exit(&cgrp->subsys[ss->subsys_id]->refcnt);
 			ss->destroy(cgrp);
+		}
 
 		cgrp->root->number_of_cgroups--;
 		mutex_unlock(&cgroup_mutex);
@@ -3670,18 +3672,53 @@ static int cgroup_populate_dir(struct cgroup *cgrp)
 	return 0;
 }
 
-static void init_cgroup_css(struct cgroup_subsys_state *css,
+/*
+ * Each css holds a ref on the cgroup dentry.  rmdir only marks a css
+ * CSS_REMOVED once it is down to its base ref (see
+ * cgroup_clear_css_refs()), so the final put normally comes from rmdir
+ * itself.  css_release() punts to css_dput_fn(), and once every css has
+ * dropped its dentry ref, cgroup_diput() calls ->destroy().
+ */
+static void css_dput_fn(struct work_struct *work)
+{
+	struct cgroup_subsys_state *css =
+		container_of(work, struct cgroup_subsys_state, dput_work);
+	struct dentry *dentry = css->cgroup->dentry;
+	struct super_block *sb = dentry->d_sb;
+
+	atomic_inc(&sb->s_active);
+	dput(dentry);
+	deactivate_super(sb);
+}
+
+static void css_release(struct percpu_ref *ref)
+{
+	struct cgroup_subsys_state *css =
+		container_of(ref, struct cgroup_subsys_state, refcnt);
+
+	schedule_work(&css->dput_work);
+}
+
+static int init_cgroup_css(struct cgroup_subsys_state *css,
 			       struct cgroup_subsys *ss,
 			       struct cgroup *cgrp)
 {
 	css->cgroup = cgrp;
-	atomic_set(&css->refcnt, 1);
 	css->flags = 0;
 	css->id = NULL;
-	if (cgrp == dummytop)
-		set_bit(CSS_ROOT, &css->flags);
+	INIT_WORK(&css->dput_work, css_dput_fn);
 	BUG_ON(cgrp->subsys[ss->subsys_id]);
 	cgrp->subsys[ss->subsys_id] = css;
+
+	/*
+	 * The root state is never reference counted, and may be set up
+	 * before the percpu allocator is available.
+	 */
+	if (cgrp == dummytop) {
+		set_bit(CSS_ROOT, &css->flags);
+		return 0;
+	}
+	return percpu_ref_init(&css->refcnt, css_release);
 }
 
 static void cgroup_lock_hierarchy(struct cgroupfs_root *root)
@@ -3764,7 +3801,9 @@ static long cgroup_create(struct cgroup *parent, struct dentry *dentry,
 			err = PTR_ERR(css);
 			goto err_destroy;
 		}
-		init_cgroup_css(css, ss, cgrp);
+		err = init_cgroup_css(css, ss, cgrp);
+		if (err)
+			goto err_destroy;
 		if (ss->use_id) {
 			err = alloc_css_id(ss, parent, cgrp);
 			if (err)
@@ -3784,6 +3823,10 @@ static long cgroup_create(struct cgroup *parent, struct dentry *dentry,
 	if (err < 0)
 		goto err_remove;
 
+	/* each css holds a ref to the cgroup's dentry */
+	for_each_subsys(root, ss)
+		dget(dentry);
+
 	/* The cgroup directory was pre-locked for us */
 	BUG_ON(!mutex_is_locked(&cgrp->dentry->d_inode->i_mutex));
 
@@ -3805,8 +3848,12 @@ static long cgroup_create(struct cgroup *parent, struct dentry *dentry,
  err_destroy:
 
 	for_each_subsys(root, ss) {
-		if (cgrp->subsys[ss->subsys_id])
+		struct cgroup_subsys_state *css = cgrp->subsys[ss->subsys_id];
+
+		if (css) {
+			percpu_ref_exit(&css->refcnt);
 			ss->destroy(cgrp);
+		}
 	}
 
 	mutex_unlock(&cgroup_mutex);
@@ -3826,6 +3873,14 @@ static int cgroup_mkdir(struct inode *dir, struct dentry *dentry, umode_t mode)
 	return cgroup_create(c_parent, dentry, mode | S_IFDIR);
 }
 
+/* Only exact once the refs have been killed, see percpu_ref_read() */
+static inline unsigned css_refcnt(struct cgroup_subsys_state *css)
+{
+	if (test_bit(CSS_ROOT, &css->flags))
+		return 1;
+	return percpu_ref_read(&css->refcnt);
+}
+
 static int cgroup_has_css_refs(struct cgroup *cgrp)
 {
 	/* Check the reference count on each subsystem. Since we
@@ -3855,8 +3910,11 @@ static int cgroup_has_css_refs(struct cgroup *cgrp)
 		 * and the css deleted. But a false-positive doesn't
 		 * matter, since it can only happen if the cgroup
 		 * has been deleted and hence no longer needs the
-		 * release agent to be called anyway. */
-		if (css && (atomic_read(&css->refcnt) > 1))
+		 * release agent to be called anyway.  The same goes
+		 * for the approximate percpu count of a live css: a
+		 * false negative only makes the release agent try an
+		 * rmdir, which checks again. */
+		if (css && css_refcnt(css) > 1)
 			return 1;
 	}
 	return 0;
@@ -3866,52 +3924,51 @@ static int cgroup_has_css_refs(struct cgroup *cgrp)
  * Atomically mark all (or else none) of the cgroup's CSS objects as
  * CSS_REMOVED. Return true on success, or false if the cgroup has
  * busy subsystems. Call with cgroup_mutex held
+ *
+ * The percpu refcounts can only be read exactly in atomic mode, so pin
+ * each css, kill its base ref and wait for the kills to complete.  With
+ * CSS_CLEARING set, a count of 1 means that only our pin is left.  If
+ * any css is busy, the kills are undone and the refs go back to percpu
+ * mode.  Otherwise dropping the pins releases the css's.
  */
-
 static int cgroup_clear_css_refs(struct cgroup *cgrp)
 {
 	struct cgroup_subsys *ss;
-	unsigned long flags;
 	bool failed = false;
-	local_irq_save(flags);
+
 	for_each_subsys(cgrp->root, ss) {
 		struct cgroup_subsys_state *css = cgrp->subsys[ss->subsys_id];
-		int refcnt;
-		while (1) {
-			/* We can only remove a CSS with a refcnt==1 */
-			refcnt = atomic_read(&css->refcnt);
-			if (refcnt > 1) {
-				failed = true;
-				goto done;
-			}
-			BUG_ON(!refcnt);
-			/*
-			 * Drop the refcnt to 0 while we check other
-			 * subsystems. This will cause any racing
-			 * css_tryget() to spin until we set the
-			 * CSS_REMOVED bits or abort
-			 */
-			if (atomic_cmpxchg(&css->refcnt, refcnt, 0) == refcnt)
-				break;
-			cpu_relax();
+
+		percpu_ref_get(&css->refcnt);
+		percpu_ref_kill(&css->refcnt);
+	}
+	rcu_barrier_sched();
+
+	for_each_subsys(cgrp->root, ss)
+		set_bit(CSS_CLEARING, &cgrp->subsys[ss->subsys_id]->flags);
+	/* pairs with the implied barrier of a successful css_tryget() */
+	smp_mb();
+
+	for_each_subsys(cgrp->root, ss) {
+		/* We can only remove a CSS with a refcnt==1 */
+		if (css_refcnt(cgrp->subsys[ss->subsys_id]) > 1) {
+			failed = true;
+			break;
 		}
 	}
- done:
+
 	for_each_subsys(cgrp->root, ss) {
 		struct cgroup_subsys_state *css = cgrp->subsys[ss->subsys_id];
+
 		if (failed) {
-			/*
-			 * Restore old refcnt if we previously managed
-			 * to clear it from 1 to 0
-			 */
-			if (!atomic_read(&css->refcnt))
-				atomic_set(&css->refcnt, 1);
+			percpu_ref_resurrect(&css->refcnt);
+			clear_bit(CSS_CLEARING, &css->flags);
 		} else {
 			/* Commit the fact that the CSS is removed */
 			set_bit(CSS_REMOVED, &css->flags);
 		}
+		percpu_ref_put(&css->refcnt);
 	}
-	local_irq_restore(flags);
 	return !failed;
 }
 
@@ -3965,8 +4022,9 @@ again:
 		mutex_unlock(&cgroup_mutex);
 		return -EBUSY;
 	}
-	prepare_to_wait(&cgroup_rmdir_waitq, &wait, TASK_INTERRUPTIBLE);
+	/* cgroup_clear_css_refs() sleeps, so only queue up afterwards */
 	if (!cgroup_clear_css_refs(cgrp)) {
+		prepare_to_wait(&cgroup_rmdir_waitq, &wait, TASK_INTERRUPTIBLE);
 		mutex_unlock(&cgroup_mutex);
 		/*
 		 * Because someone may call cgroup_wakeup_rmdir_waiter() before
@@ -3981,7 +4039,6 @@ again:
 		goto again;
 	}
 	/* NO css_tryget() can success after here. */
-	finish_wait(&cgroup_rmdir_waitq, &wait);
 	clear_bit(CGRP_WAIT_ON_RMDIR, &cgrp->flags);
 
 	raw_spin_lock(&release_list_lock);
@@ -4688,18 +4745,20 @@ static void check_for_release(struct cgroup *cgrp)
 void __css_put(struct cgroup_subsys_state *css, int count)
 {
 	struct cgroup *cgrp = css->cgroup;
-	int val;
+
 	rcu_read_lock();
-	val = atomic_sub_return(count, &css->refcnt);
-	if (val == 1) {
-		if (notify_on_release(cgrp)) {
-			set_bit(CGRP_RELEASABLE, &cgrp->flags);
-			check_for_release(cgrp);
-		}
-		cgroup_wakeup_rmdir_waiter(cgrp);
+	percpu_ref_put_many(&css->refcnt, count);
+	/*
+	 * A percpu put can't tell whether the css just became idle, so let
+	 * check_for_release() and a waiting rmdir look at every put.
+	 */
+	if (unlikely(notify_on_release(cgrp))) {
+		set_bit(CGRP_RELEASABLE, &cgrp->flags);
+		check_for_release(cgrp);
 	}
+	if (unlikely(test_bit(CGRP_WAIT_ON_RMDIR, &cgrp->flags)))
+		cgroup_wakeup_rmdir_waiter(cgrp);
 	rcu_read_unlock();
-	WARN_ON_ONCE(val < 1);
 }
 EXPORT_SYMBOL_GPL(__css_put);
 
@@ -4818,7 +4877,7 @@ unsigned short css_id(struct cgroup_subsys_state *css)
 	 * on this or this is under rcu_read_lock(). Once css->id is allocated,
 	 * it's unchanged until freed.
 	 */
-	cssid = rcu_dereference_check(css->id, atomic_read(&css->refcnt));
+	cssid = rcu_dereference_check(css->id, css_refcnt(css));
 
 	if (cssid)
 		return cssid->id;
@@ -4830,7 +4889,7 @@ unsigned short css_depth(struct cgroup_subsys_state *css)
 {
 	struct css_id *cssid;
 
-	cssid = rcu_dereference_check(css->id, atomic_read(&css->refcnt));
+	cssid = rcu_dereference_check(css->id, css_refcnt(css));
 
 	if (cssid)
 		return cssid->depth;
@@ -196,6 +196,7 @@ void __put_task_struct(struct task_struct *tsk)
 	security_task_free(tsk);
 	exit_creds(tsk);
 	delayacct_tsk_free(tsk);
+	task_numa_free(tsk);
 	put_signal_struct(tsk->signal);
 
 	if (!profile_handoff_task(tsk))
@@ -501,6 +502,11 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p)
 	mm->cached_hole_size = ~0UL;
 	mm_init_aio(mm);
 	mm_init_owner(mm, p);
+#ifdef CONFIG_NUMA_BALANCING
+	mm->numa_next_scan = 0;
+	mm->numa_scan_offset = 0;
+	mm->numa_scan_seq = 0;
+#endif
 
 	if (likely(!mm_alloc_pgd(mm))) {
 		mm->def_flags = 0;
@@ -1277,7 +1283,9 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 #endif
 
 	/* Perform scheduler related setup. Assign this task to a CPU. */
-	sched_fork(p);
+	retval = sched_fork(p);
+	if (retval)
+		goto bad_fork_cleanup_policy;
 
 	retval = perf_event_init_task(p);
 	if (retval)
@@ -0,0 +1,368 @@
+/*
+ * Module-based torture test facility for locking
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Based on kernel/rcutorture.c.
+ *
+ * Hammers one spinlock from a number of kthreads, checking for mutual
+ * exclusion and reporting the acquisition rate and its spread across
+ * the threads.  Loading it on kernels built with and without
+ * CONFIG_QUEUED_SPINLOCKS compares queued and ticket spinlocks.
+ */
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/err.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/atomic.h>
+#include <linux/moduleparam.h>
+#include <linux/delay.h>
+#include <linux/random.h>
+#include <linux/jiffies.h>
+#include <linux/slab.h>
+
+MODULE_LICENSE("GPL");
+
+static int nwriters_stress = -1; /* # writer threads, defaults to 2*ncpus */
+static int stat_interval = 60;	/* Interval between stats, in seconds. */
+				/*  Zero means "only at end of test". */
+static int shortdelay_us = 2;	/* Short hold time, in microseconds. */
+static int longdelay_ms;	/* Occasional long hold time, in ms, 0=off. */
+static bool verbose;		/* Print more debug info. */
+static char *torture_type = "spin_lock"; /* What lock to torture. */
+
+module_param(nwriters_stress, int, 0444);
+MODULE_PARM_DESC(nwriters_stress, "Number of write-locking stress-test threads");
+module_param(stat_interval, int, 0644);
+MODULE_PARM_DESC(stat_interval, "Number of seconds between stats printk()s");
+module_param(shortdelay_us, int, 0444);
+MODULE_PARM_DESC(shortdelay_us, "Short hold time (us), zero to disable");
+module_param(longdelay_ms, int, 0444);
+MODULE_PARM_DESC(longdelay_ms, "Occasional long hold time (ms), zero to disable");
+module_param(verbose, bool, 0444);
+MODULE_PARM_DESC(verbose, "Enable verbose debugging printk()s");
+module_param(torture_type, charp, 0444);
+MODULE_PARM_DESC(torture_type, "Type of lock to torture (spin_lock, spin_lock_irq)");
+
+#define TORTURE_FLAG "-torture:"
+#define VERBOSE_PRINTK_STRING(s) \
+	do { if (verbose) printk(KERN_ALERT "%s" TORTURE_FLAG s "\n", torture_type); } while (0)
+
+static char printk_buf[256];
+
+static int nrealwriters_stress;
+static struct task_struct **writer_tasks;
+static struct task_struct *stats_task;
+
+static int lock_is_write_held;
+static atomic_t n_lock_torture_errors;
+static unsigned long lock_torture_start;
+
+struct lock_writer_stress_stats {
+	long n_write_lock_acquired;
+};
+static struct lock_writer_stress_stats *lwsa;
+
+/*
+ * Operations vector for selecting different types of tests.
+ */
+struct lock_torture_ops {
+	int (*writelock)(void);
+	void (*write_delay)(void);
+	void (*writeunlock)(void);
+	char *name;
+};
+
+static struct lock_torture_ops *cur_ops;
+
+static DEFINE_SPINLOCK(torture_spinlock);
+
+static int torture_spin_lock_write_lock(void) __acquires(torture_spinlock)
+{
+	spin_lock(&torture_spinlock);
+	return 0;
+}
+
+static void torture_spin_lock_write_delay(void)
+{
+	/*
+	 * We want a short delay mostly to emulate likely code, and
+	 * we want a long delay occasionally to force massive contention.
+	 */
+	if (longdelay_ms &&
+	    !(random32() % (nrealwriters_stress * 2000 * longdelay_ms)))
+		mdelay(longdelay_ms);
+	if (shortdelay_us &&
+	    !(random32() % (nrealwriters_stress * 2 * shortdelay_us)))
+		udelay(shortdelay_us);
+}
+
+static void torture_spin_lock_write_unlock(void) __releases(torture_spinlock)
+{
+	spin_unlock(&torture_spinlock);
+}
+
+static struct lock_torture_ops spin_lock_ops = {
+	.writelock	= torture_spin_lock_write_lock,
+	.write_delay	= torture_spin_lock_write_delay,
+	.writeunlock	= torture_spin_lock_write_unlock,
+	.name		= "spin_lock"
+};
+
+static unsigned long torture_spinlock_flags;
+
+static int torture_spin_lock_write_lock_irq(void)
+__acquires(torture_spinlock)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&torture_spinlock, flags);
+	torture_spinlock_flags = flags;
+	return 0;
+}
+
+static void torture_lock_spin_write_unlock_irq(void)
+__releases(torture_spinlock)
+{
+	spin_unlock_irqrestore(&torture_spinlock, torture_spinlock_flags);
+}
+
+static struct lock_torture_ops spin_lock_irq_ops = {
+	.writelock	= torture_spin_lock_write_lock_irq,
+	.write_delay	= torture_spin_lock_write_delay,
+	.writeunlock	= torture_lock_spin_write_unlock_irq,
+	.name		= "spin_lock_irq"
+};
+
+/*
+ * Lock torture writer kthread.  Repeatedly acquires and releases
+ * the lock, checking for duplicate acquisitions.
+ */
+static int lock_torture_writer(void *arg)
+{
+	struct lock_writer_stress_stats *lwsp = arg;
+
+	VERBOSE_PRINTK_STRING("lock_torture_writer task started");
+	set_user_nice(current, 19);
+
+	do {
+		cur_ops->writelock();
+		if (WARN_ON_ONCE(lock_is_write_held))
+			atomic_inc(&n_lock_torture_errors);
+		lock_is_write_held = 1;
+		lwsp->n_write_lock_acquired++;
+		cur_ops->write_delay();
+		lock_is_write_held = 0;
+		cur_ops->writeunlock();
+		cond_resched();
+	} while (!kthread_should_stop());
+	VERBOSE_PRINTK_STRING("lock_torture_writer task stopping");
+	return 0;
+}
+
+/*
+ * Create a lock-torture-statistics message in the specified buffer.
+ */
+static void lock_torture_printk(char *page)
+{
+	bool fail = false;
+	int i;
+	long max = 0;
+	long min = lwsa[0].n_write_lock_acquired;
+	long long sum = 0;
+	unsigned long secs;
+	u64 rate;
+
+	for (i = 0; i < nrealwriters_stress; i++) {
+		if (lwsa[i].n_write_lock_acquired == 0)
+			fail = true;
+		sum += lwsa[i].n_write_lock_acquired;
+		if (max < lwsa[i].n_write_lock_acquired)
+			max = lwsa[i].n_write_lock_acquired;
+		if (min > lwsa[i].n_write_lock_acquired)
+			min = lwsa[i].n_write_lock_acquired;
+	}
+	secs = (jiffies - lock_torture_start) / HZ;
+	rate = secs ? div_u64(sum, secs) : 0;
+	page += sprintf(page, "%s%s ", torture_type, TORTURE_FLAG);
+	page += sprintf(page,
+			"%s lock: Writes:  Total: %lld  Max/Min: %ld/%ld %s  Rate: %llu/s  Fail: %d %s\n",
+			IS_ENABLED(CONFIG_QUEUED_SPINLOCKS) ? "queued" : "ticket",
+			sum, max, min, max / 2 > min ? "???" : "",
+			rate,
+			atomic_read(&n_lock_torture_errors),
+			fail ? "!!!" : "");
+	if (fail)
+		atomic_inc(&n_lock_torture_errors);
+}
+
+/*
+ * Print torture statistics.  Caller must ensure that there is only one
+ * call to this function at a given time!!!  This is normally accomplished
+ * by relying on the module system to only have one copy of the module
+ * loaded, and then by giving the lock_torture_stats kthread full control
+ * (or the init/cleanup functions when lock_torture_stats thread is not
+ * running).
+ */
+static void lock_torture_stats_print(void)
+{
+	lock_torture_printk(printk_buf);
+	printk(KERN_ALERT "%s", printk_buf);
+}
+
+/*
+ * Periodically prints torture statistics, if periodic statistics printing
+ * was specified via the stat_interval module parameter.
+ */
+static int lock_torture_stats(void *arg)
+{
+	VERBOSE_PRINTK_STRING("lock_torture_stats task started");
+	do {
+		schedule_timeout_interruptible(stat_interval * HZ);
+		lock_torture_stats_print();
+	} while (!kthread_should_stop());
+	VERBOSE_PRINTK_STRING("lock_torture_stats task stopping");
+	return 0;
+}
+
+static inline void
+lock_torture_print_module_parms(struct lock_torture_ops *cur_ops,
+				const char *tag)
+{
+	printk(KERN_ALERT "%s" TORTURE_FLAG
+	       "--- %s: nwriters_stress=%d stat_interval=%d verbose=%d "
+	       "shortdelay_us=%d longdelay_ms=%d\n",
+	       torture_type, tag, nrealwriters_stress, stat_interval, verbose,
+	       shortdelay_us, longdelay_ms);
+}
+
+static void lock_torture_cleanup(void)
+{
+	int i;
+
+	if (writer_tasks) {
+		for (i = 0; i < nrealwriters_stress; i++) {
+			if (writer_tasks[i]) {
+				VERBOSE_PRINTK_STRING("Stopping lock_torture_writer task");
+				kthread_stop(writer_tasks[i]);
+			}
+			writer_tasks[i] = NULL;
+		}
+		kfree(writer_tasks);
+		writer_tasks = NULL;
+	}
+
+	if (stats_task) {
+		VERBOSE_PRINTK_STRING("Stopping lock_torture_stats task");
+		kthread_stop(stats_task);
+	}
+	stats_task = NULL;
+
+	/* Wait for all end-of-test stats to be printed. */
+	lock_torture_stats_print();
+
+	if (atomic_read(&n_lock_torture_errors))
+		lock_torture_print_module_parms(cur_ops,
+						"End of test: FAILURE");
+	else
+		lock_torture_print_module_parms(cur_ops,
+						"End of test: SUCCESS");
+	kfree(lwsa);
+	lwsa = NULL;
+}
+
+static int __init lock_torture_init(void)
+{
+	int i;
+	int firsterr = 0;
+	static struct lock_torture_ops *torture_ops[] = {
+		&spin_lock_ops, &spin_lock_irq_ops,
+	};
+
+	/* Process args and tell the world that the torturer is on the job. */
+	for (i = 0; i < ARRAY_SIZE(torture_ops); i++) {
+		cur_ops = torture_ops[i];
+		if (strcmp(torture_type, cur_ops->name) == 0)
+			break;
+	}
+	if (i == ARRAY_SIZE(torture_ops)) {
+		printk(KERN_ALERT "lock-torture: invalid torture type: \"%s\"\n",
+		       torture_type);
+		printk(KERN_ALERT "lock-torture types:");
+		for (i = 0; i < ARRAY_SIZE(torture_ops); i++)
+			printk(KERN_ALERT " %s", torture_ops[i]->name);
+		printk(KERN_ALERT "\n");
+		return -EINVAL;
+	}
+
+	if (nwriters_stress >= 0)
+		nrealwriters_stress = nwriters_stress;
+	else
+		nrealwriters_stress = 2 * num_online_cpus();
+	if (nrealwriters_stress == 0)
+		return -EINVAL;
+	lock_torture_print_module_parms(cur_ops, "Start of test");
+
+	/* Initialize the statistics so that each run gets its own numbers. */
+
+	lock_is_write_held = 0;
+	atomic_set(&n_lock_torture_errors, 0);
+	lwsa = kzalloc(sizeof(*lwsa) * nrealwriters_stress, GFP_KERNEL);
+	if (lwsa == NULL) {
+		VERBOSE_PRINTK_STRING("lwsa: Out of memory");
+		return -ENOMEM;
+	}
+	lock_torture_start = jiffies;
+
+	/* Start up the kthreads. */
+
+	writer_tasks = kzalloc(nrealwriters_stress * sizeof(writer_tasks[0]),
+			       GFP_KERNEL);
+	if (writer_tasks == NULL) {
+		VERBOSE_PRINTK_STRING("writer_tasks: Out of memory");
+		firsterr = -ENOMEM;
+		goto unwind;
+	}
+	for (i = 0; i < nrealwriters_stress; i++) {
+		VERBOSE_PRINTK_STRING("Creating lock_torture_writer task");
+		writer_tasks[i] = kthread_run(lock_torture_writer, &lwsa[i],
+					      "lock_torture_writer");
+		if (IS_ERR(writer_tasks[i])) {
+			firsterr = PTR_ERR(writer_tasks[i]);
+			VERBOSE_PRINTK_STRING("Failed to create writer");
+			writer_tasks[i] = NULL;
+			goto unwind;
+		}
+	}
+	if (stat_interval > 0) {
+		VERBOSE_PRINTK_STRING("Creating lock_torture_stats task");
+		stats_task = kthread_run(lock_torture_stats, NULL,
+					 "lock_torture_stats");
+		if (IS_ERR(stats_task)) {
+			firsterr = PTR_ERR(stats_task);
+			VERBOSE_PRINTK_STRING("Failed to create stats");
+			stats_task = NULL;
+			goto unwind;
+		}
+	}
+	return 0;
+
+unwind:
+	lock_torture_cleanup();
+	return firsterr;
+}
+
+module_init(lock_torture_init);
+module_exit(lock_torture_cleanup);
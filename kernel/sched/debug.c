@@ -403,6 +403,22 @@ static int __init init_sched_debug_procfs(void)
 
 __initcall(init_sched_debug_procfs);
 
+static void print_numa_stats(struct seq_file *m, struct task_struct *p)
+{
+#ifdef CONFIG_NUMA_BALANCING
+	unsigned long *faults = p->numa_faults;
+	int node;
+
+	if (!faults)
+		return;
+
+	for_each_online_node(node) {
+		SEQ_printf(m, "numa_faults node=%d recent=%lu total=%lu\n",
+			   node, faults[node], faults[nr_node_ids + node]);
+	}
+#endif
+}
+
 void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 {
 	unsigned long nr_switches;
@@ -485,6 +501,11 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 	P(se.load.weight);
 	P(policy);
 	P(prio);
+#ifdef CONFIG_NUMA_BALANCING
+	P(numa_scan_seq);
+	P(numa_scan_period);
+	P(numa_preferred_nid);
+#endif
 #undef PN
 #undef __PN
 #undef P
@@ -499,6 +520,8 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 		SEQ_printf(m, "%-35s:%21Ld\n",
 			   "clock-delta", (long long)(t1-t0));
 	}
+
+	print_numa_stats(m, p);
 }
 
 void proc_sched_set_task(struct task_struct *p)
@@ -26,6 +26,7 @@
 #include <linux/slab.h>
 #include <linux/profile.h>
 #include <linux/interrupt.h>
+#include <linux/mempolicy.h>
 
 #include <trace/events/sched.h>
 
@@ -772,6 +773,288 @@ update_stats_curr_start(struct cfs_rq *cfs_rq, struct sched_entity *se)
 	se->exec_start = rq_of(cfs_rq)->clock_task;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Automatic NUMA balancing.
+ *
+ * Every scan period a task walks the next chunk of its address space
+ * and makes the ptes it finds PROT_NONE (change_prot_numa()).  The next
+ * access to such a page takes a NUMA hinting fault, which tells us from
+ * which node the memory is being used: do_numa_page() migrates pages
+ * the memory policy says are misplaced towards the faulting node, and
+ * reports back to task_numa_fault().  From the per-node fault counts
+ * we derive the task's preferred node, which the load balancer then
+ * favours when it moves the task around.
+ */
+int sysctl_numa_balancing = IS_ENABLED(CONFIG_NUMA_BALANCING_DEFAULT_ENABLED);
+
+/*
+ * Bounds on the time between two scans of a task's address space, in ms.
+ * The period adapts between them depending on whether the sampled pages
+ * turn out to be misplaced.
+ */
+unsigned int sysctl_numa_balancing_scan_period_min = 100;
+unsigned int sysctl_numa_balancing_scan_period_max = 100*50;
+
+/* Portion of address space to scan in MB */
+unsigned int sysctl_numa_balancing_scan_size = 256;
+
+/* Scan @scan_size MB every @scan_period after an initial @scan_delay in ms */
+unsigned int sysctl_numa_balancing_scan_delay = 1000;
+
+static int __init setup_numabalancing(char *str)
+{
+	int ret = 0;
+
+	if (!strcmp(str, "enable")) {
+		sysctl_numa_balancing = 1;
+		ret = 1;
+	} else if (!strcmp(str, "disable")) {
+		sysctl_numa_balancing = 0;
+		ret = 1;
+	}
+	if (!ret)
+		pr_warn("Unable to parse numa_balancing=\n");
+
+	return ret;
+}
+__setup("numa_balancing=", setup_numabalancing);
+
+/*
+ * Try to run @p on its preferred node right away.  Only an idle cpu
+ * there is taken, anything else is left to the load balancer, which
+ * is biased towards the preferred node.
+ */
+static void task_numa_migrate(struct task_struct *p)
+{
+	int nid = p->numa_preferred_nid;
+	int cpu;
+
+	for_each_cpu_and(cpu, cpumask_of_node(nid), tsk_cpus_allowed(p)) {
+		if (cpu_active(cpu) && idle_cpu(cpu)) {
+			migrate_task_to(p, cpu);
+			return;
+		}
+	}
+}
+
+/*
+ * Once per pass over the address space, pick the node that saw most of
+ * the recent faults as the preferred one, and age the statistics so
+ * that old behaviour fades out.
+ */
+static void task_numa_placement(struct task_struct *p)
+{
+	int seq, nid, max_nid = -1;
+	unsigned long max_faults = 0;
+
+	seq = ACCESS_ONCE(p->mm->numa_scan_seq);
+	if (p->numa_scan_seq == seq)
+		return;
+	p->numa_scan_seq = seq;
+
+	for_each_online_node(nid) {
+		unsigned long faults = p->numa_faults[nid];
+
+		if (faults > max_faults) {
+			max_faults = faults;
+			max_nid = nid;
+		}
+		p->numa_faults[nid] = faults / 2;
+	}
+
+	if (max_nid == -1)
+		return;
+
+	p->numa_preferred_nid = max_nid;
+	if (cpu_to_node(task_cpu(p)) != max_nid)
+		task_numa_migrate(p);
+}
+
+/*
+ * Got a NUMA hinting fault on @pages pages that now live on @node.
+ * @migrated tells whether the fault moved them there.
+ */
+void task_numa_fault(int node, int pages, bool migrated)
+{
+	struct task_struct *p = current;
+
+	if (!sysctl_numa_balancing || !p->mm)
+		return;
+
+	/* Allocate buffer to track faults on a per-node basis */
+	if (unlikely(!p->numa_faults)) {
+		int size = sizeof(*p->numa_faults) * 2 * nr_node_ids;
+
+		p->numa_faults = kzalloc(size, GFP_KERNEL|__GFP_NOWARN);
+		if (!p->numa_faults)
+			return;
+	}
+
+	/*
+	 * Scan faster while pages are still being moved around, and back
+	 * off once everything we sample is already where it belongs.
+	 */
+	if (migrated)
+		p->numa_scan_period = max(sysctl_numa_balancing_scan_period_min,
+					  p->numa_scan_period / 2);
+	else
+		p->numa_scan_period = min(sysctl_numa_balancing_scan_period_max,
+					  p->numa_scan_period +
+					  jiffies_to_msecs(10));
+
+	task_numa_placement(p);
+
+	p->numa_faults[node] += pages;
+	p->numa_faults[nr_node_ids + node] += pages;
+}
+
+void task_numa_free(struct task_struct *p)
+{
+	kfree(p->numa_faults);
+	p->numa_faults = NULL;
+}
+
+static void reset_ptenuma_scan(struct mm_struct *mm)
+{
+	ACCESS_ONCE(mm->numa_scan_seq)++;
+	mm->numa_scan_offset = 0;
+}
+
+/*
+ * The expensive part of numa migration is done from tracehook_notify_resume(),
+ * on the way back to user space, where the task can take mmap_sem and
+ * sleep.  Only one thread of an address space scans at a time.
+ */
+void task_numa_work(void)
+{
+	unsigned long migrate, next_scan, now = jiffies;
+	struct task_struct *p = current;
+	struct mm_struct *mm = p->mm;
+	struct vm_area_struct *vma;
+	unsigned long start, end;
+	long pages;
+
+	p->numa_work_pending = 0;
+
+	if (!mm || (p->flags & PF_EXITING))
+		return;
+
+	/*
+	 * The first scan of an address space is delayed, so that short
+	 * lived tasks never pay for it.
+	 */
+	if (!mm->numa_next_scan)
+		mm->numa_next_scan = now +
+			msecs_to_jiffies(sysctl_numa_balancing_scan_delay);
+
+	migrate = mm->numa_next_scan;
+	if (time_before(now, migrate))
+		return;
+
+	if (p->numa_scan_period == 0)
+		p->numa_scan_period = sysctl_numa_balancing_scan_period_min;
+
+	/*
+	 * Claim this scan period; if another thread got here first, it
+	 * does the work.
+	 */
+	next_scan = now + msecs_to_jiffies(p->numa_scan_period);
+	if (cmpxchg(&mm->numa_next_scan, migrate, next_scan) != migrate)
+		return;
+
+	pages = sysctl_numa_balancing_scan_size;
+	pages <<= 20 - PAGE_SHIFT; /* MB in pages */
+	if (!pages)
+		return;
+
+	down_read(&mm->mmap_sem);
+	start = mm->numa_scan_offset;
+	vma = find_vma(mm, start);
+	if (!vma) {
+		reset_ptenuma_scan(mm);
+		start = 0;
+		vma = mm->mmap;
+	}
+	for (; vma; vma = vma->vm_next) {
+		if (!vma_migratable(vma))
+			continue;
+
+		/* Nothing to sample in an inaccessible vma */
+		if (!(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+			continue;
+
+		do {
+			start = max(start, vma->vm_start);
+			end = ALIGN(start + (pages << PAGE_SHIFT), PMD_SIZE);
+			end = min(end, vma->vm_end);
+			change_prot_numa(vma, start, end);
+			pages -= (end - start) >> PAGE_SHIFT;
+
+			start = end;
+			if (pages <= 0)
+				goto out;
+		} while (end != vma->vm_end);
+	}
+
+out:
+	/*
+	 * It is possible to reach the end of the VMA list but the last
+	 * few VMAs are not guaranteed to be migratable. If they are not,
+	 * we would find the !migratable VMA on the next scan but not
+	 * reset the scanner to the start so check it now.
+	 */
+	if (vma)
+		mm->numa_scan_offset = start;
+	else
+		reset_ptenuma_scan(mm);
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Drive the periodic memory faults.
+ */
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+	u64 period, now;
+
+	if (!sysctl_numa_balancing)
+		return;
+
+	/*
+	 * We don't care about NUMA placement if we don't have memory.
+	 */
+	if (!curr->mm || (curr->flags & PF_EXITING) || curr->numa_work_pending)
+		return;
+
+	/*
+	 * Using runtime rather than walltime has the dual advantage that
+	 * we (mostly) drive the selection from busy threads and that the
+	 * task needs to have done some actual work before we bother with
+	 * NUMA placement.
+	 */
+	now = curr->se.sum_exec_runtime;
+	period = (u64)curr->numa_scan_period * NSEC_PER_MSEC;
+
+	if (now - curr->node_stamp > period) {
+		if (!curr->node_stamp)
+			curr->numa_scan_period =
+				sysctl_numa_balancing_scan_period_min;
+		curr->node_stamp = now;
+
+		if (!time_before(jiffies, curr->mm->numa_next_scan)) {
+			/* curr is running here, no need to kick it */
+			curr->numa_work_pending = 1;
+			set_tsk_thread_flag(curr, TIF_NOTIFY_RESUME);
+		}
+	}
+}
+#else
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /**************************************************
  * Scheduling class queueing methods:
  */
@@ -3134,6 +3417,48 @@ task_hot(struct task_struct *p, u64 now, struct sched_domain *sd)
 	return delta < (s64)sysctl_sched_migration_cost;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/* Returns true if the destination node is the task's preferred node */
+static bool migrate_improves_locality(struct task_struct *p, struct lb_env *env)
+{
+	int src_nid, dst_nid;
+
+	if (!sysctl_numa_balancing || !p->numa_faults)
+		return false;
+
+	src_nid = cpu_to_node(env->src_cpu);
+	dst_nid = cpu_to_node(env->dst_cpu);
+
+	return src_nid != dst_nid && dst_nid == p->numa_preferred_nid;
+}
+
+/* Returns true if the task would be moved off its preferred node */
+static bool migrate_degrades_locality(struct task_struct *p, struct lb_env *env)
+{
+	int src_nid, dst_nid;
+
+	if (!sysctl_numa_balancing || !p->numa_faults)
+		return false;
+
+	src_nid = cpu_to_node(env->src_cpu);
+	dst_nid = cpu_to_node(env->dst_cpu);
+
+	return src_nid != dst_nid && src_nid == p->numa_preferred_nid;
+}
+#else
+static inline bool migrate_improves_locality(struct task_struct *p,
+					     struct lb_env *env)
+{
+	return false;
+}
+
+static inline bool migrate_degrades_locality(struct task_struct *p,
+					     struct lb_env *env)
+{
+	return false;
+}
+#endif
+
 /*
  * can_migrate_task - may task p from runqueue rq be migrated to this_cpu?
  */
@@ -3160,11 +3485,27 @@ int can_migrate_task(struct task_struct *p, struct lb_env *env)
 
 	/*
 	 * Aggressive migration if:
-	 * 1) task is cache cold, or
-	 * 2) too many balance attempts have failed.
+	 * 1) destination numa is preferred
+	 * 2) task is cache cold, or
+	 * 3) too many balance attempts have failed.
+	 *
+	 * Moving a task off its preferred node counts as cache hot.
 	 */
 
 	tsk_cache_hot = task_hot(p, env->src_rq->clock_task, env->sd);
+	if (!tsk_cache_hot)
+		tsk_cache_hot = migrate_degrades_locality(p, env);
+
+	if (migrate_improves_locality(p, env)) {
+#ifdef CONFIG_SCHEDSTATS
+		if (tsk_cache_hot) {
+			schedstat_inc(env->sd, lb_hot_gained[env->idle]);
+			schedstat_inc(p, se.statistics.nr_forced_migrations);
+		}
+#endif
+		return 1;
+	}
+
 	if (!tsk_cache_hot ||
 		env->sd->nr_balance_failed > env->sd->cache_nice_tries) {
 #ifdef CONFIG_SCHEDSTATS
@@ -5166,6 +5507,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	task_tick_numa(rq, curr);
 }
 
 /*
@@ -0,0 +1,511 @@
+/*
+ * Testsuite for BPF interpreter and BPF JIT compiler
+ *
+ * Every test is a classic BPF filter together with a packet and the
+ * expected return values for several packet lengths.  The filter is run
+ * through the classic interpreter, sk_run_filter(), and through the
+ * internal BPF program sk_unattached_filter_create() translates it to,
+ * which is either interpreted or JITed, and both have to agree.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/filter.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#define MAX_SUBTESTS	3
+#define MAX_DATA	64
+#define MAX_INSNS	16
+
+#define SKB_MARK	0x12345678
+#define SKB_QUEUE	17
+#define SKB_RXHASH	0x11111111
+#define SKB_PKTTYPE	PACKET_OTHERHOST
+
+static int runs = 1000;
+module_param(runs, int, 0444);
+MODULE_PARM_DESC(runs, "Number of timed runs of each filter");
+
+struct bpf_test {
+	const char *descr;
+	struct sock_filter insns[MAX_INSNS];
+	unsigned int len;
+	__u8 data[MAX_DATA];
+	struct {
+		int data_size;
+		__u32 result;
+	} test[MAX_SUBTESTS];
+};
+
+/* Ethernet + IPv4 + TCP to port 22 */
+#define TCP_SSH_PACKET							\
+	{ 0x00, 0x11, 0x22, 0x33, 0x44, 0x55,				\
+	  0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb,				\
+	  0x08, 0x00,							\
+	  0x45, 0x00, 0x00, 0x28, 0x00, 0x00, 0x40, 0x00,		\
+	  0x40, 0x06, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,		\
+	  0x0a, 0x00, 0x00, 0x02,					\
+	  0x12, 0x34, 0x00, 0x16 }
+
+static struct bpf_test tests[] = {
+	{
+		"TAX",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 1),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 2),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_NEG, 0), /* A == -3 */
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_LEN, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0), /* X == len - 3 */
+			BPF_STMT(BPF_LD | BPF_B | BPF_IND, 1),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 11,
+		{ 10, 20, 30, 40, 50 },
+		{ { 2, 10 }, { 3, 20 }, { 4, 30 } },
+	},
+	{
+		"TXA",
+		{
+			BPF_STMT(BPF_LDX | BPF_LEN, 0),
+			BPF_STMT(BPF_MISC | BPF_TXA, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0) /* A == len * 2 */
+		}, 4,
+		{ 10, 20, 30, 40, 50 },
+		{ { 1, 2 }, { 3, 6 }, { 4, 8 } },
+	},
+	{
+		"ADD_SUB_MUL_K",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 1),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 2),
+			BPF_STMT(BPF_LDX | BPF_IMM, 3),
+			BPF_STMT(BPF_ALU | BPF_SUB | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 0xffffffff),
+			BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 3),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 7,
+		{ 0 },
+		{ { 0, 0xfffffffd } },
+	},
+	{
+		"DIV_KX",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 8),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 2),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 0xffffffff),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 0xffffffff),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 0x70000000),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 10,
+		{ 0 },
+		{ { 0, 0x40000001 } },
+	},
+	{
+		"DIV_X_ZERO",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 10),
+			BPF_STMT(BPF_LDX | BPF_IMM, 0),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_K, 5)
+		}, 4,
+		{ 0 },
+		{ { 0, 0 } },
+	},
+	{
+		"AND_OR_LSH_K",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 0xff),
+			BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xf0),
+			BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 27),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 0xf),
+			BPF_STMT(BPF_ALU | BPF_OR | BPF_K, 0xf0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 8,
+		{ 0 },
+		{ { 0, 0x800000ff }, { 1, 0x800000ff } },
+	},
+	{
+		"LSH_RSH_X",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 0x80000000),
+			BPF_STMT(BPF_LDX | BPF_IMM, 31),
+			BPF_STMT(BPF_ALU | BPF_RSH | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 3),
+			BPF_STMT(BPF_ALU | BPF_LSH | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 7,
+		{ 0 },
+		{ { 0, 6 } },
+	},
+	{
+		"JUMPS_LARGE_K",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 0x90000000),
+			BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 0x80000000, 0, 5),
+			BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 0x90000001, 4, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 0xffffffff),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xffffffff, 0, 2),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x80000000, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+			BPF_STMT(BPF_RET | BPF_K, 0)
+		}, 8,
+		{ 0 },
+		{ { 0, 1 } },
+	},
+	{
+		"JUMPS_X",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 0x70000000),
+			BPF_STMT(BPF_LDX | BPF_IMM, 0x80000000),
+			BPF_JUMP(BPF_JMP | BPF_JGT | BPF_X, 0, 1, 0),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_X, 0, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 2),
+			BPF_STMT(BPF_RET | BPF_K, 3)
+		}, 6,
+		{ 0 },
+		{ { 0, 3 } },
+	},
+	{
+		"JA_SAME_TARGET",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 1),
+			BPF_STMT(BPF_JMP | BPF_JA, 1),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 1, 1, 1),
+			BPF_STMT(BPF_RET | BPF_K, 2),
+			BPF_STMT(BPF_RET | BPF_K, 3)
+		}, 6,
+		{ 0 },
+		{ { 0, 3 } },
+	},
+	{
+		"MEM_SCRATCH",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 100),
+			BPF_STMT(BPF_ST, 0),
+			BPF_STMT(BPF_LDX | BPF_IMM, 5),
+			BPF_STMT(BPF_STX, 15),
+			BPF_STMT(BPF_LD | BPF_IMM, 0),
+			BPF_STMT(BPF_LD | BPF_MEM, 0),
+			BPF_STMT(BPF_LDX | BPF_MEM, 15),
+			BPF_STMT(BPF_ALU | BPF_SUB | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 9,
+		{ 0 },
+		{ { 0, 95 } },
+	},
+	{
+		"LD_ABS",
+		{
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 1),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 3),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 8,
+		{ 1, 2, 3, 4, 5, 6, 7, 8 },
+		{ { 7, 0x0405080b }, { 6, 0 } },
+	},
+	{
+		"LD_IND",
+		{
+			BPF_STMT(BPF_LDX | BPF_IMM, 2),
+			BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_H | BPF_IND, 1),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 5,
+		{ 1, 2, 3, 4, 5, 6, 7, 8 },
+		{ { 8, 0x0506 }, { 5, 0 } },
+	},
+	{
+		"LDX_MSH",
+		{
+			BPF_STMT(BPF_LD | BPF_IMM, 7),
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 4,
+		{ 0x45 },
+		{ { 1, 27 } },
+	},
+	{
+		"LD_NET_LL_OFF",
+		{
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 9),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_LL_OFF + 12),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 5,
+		TCP_SSH_PACKET,
+		{ { 38, 14 }, { 10, 0 } },
+	},
+	{
+		"LD_PROTOCOL_PKTTYPE",
+		{
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				 SKF_AD_OFF + SKF_AD_PROTOCOL),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				 SKF_AD_OFF + SKF_AD_PKTTYPE),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 5,
+		{ 0 },
+		{ { 0, ETH_P_IP + SKB_PKTTYPE } },
+	},
+	{
+		"LD_MARK_QUEUE_RXHASH",
+		{
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				 SKF_AD_OFF + SKF_AD_MARK),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				 SKF_AD_OFF + SKF_AD_QUEUE),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				 SKF_AD_OFF + SKF_AD_RXHASH),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 8,
+		{ 0 },
+		{ { 0, SKB_MARK + SKB_QUEUE + SKB_RXHASH } },
+	},
+	{
+		"LD_IFINDEX_NO_DEV",
+		{
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				 SKF_AD_OFF + SKF_AD_IFINDEX),
+			BPF_STMT(BPF_RET | BPF_K, 1)
+		}, 2,
+		{ 0 },
+		{ { 0, 0 } },
+	},
+	{
+		"LD_HATYPE_NO_DEV",
+		{
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				 SKF_AD_OFF + SKF_AD_HATYPE),
+			BPF_STMT(BPF_RET | BPF_K, 1)
+		}, 2,
+		{ 0 },
+		{ { 0, 0 } },
+	},
+	{
+		"LD_CPU",
+		{
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				 SKF_AD_OFF + SKF_AD_CPU),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+				 SKF_AD_OFF + SKF_AD_CPU),
+			BPF_STMT(BPF_ALU | BPF_SUB | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 5,
+		{ 0 },
+		{ { 0, 0 } },
+	},
+	{
+		"LD_NLATTR",
+		{
+			BPF_STMT(BPF_LDX | BPF_IMM, 2),
+			BPF_STMT(BPF_MISC | BPF_TXA, 0),
+			BPF_STMT(BPF_LDX | BPF_IMM, 3),
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS,
+				 SKF_AD_OFF + SKF_AD_NLATTR),
+			BPF_STMT(BPF_RET | BPF_A, 0)
+		}, 5,
+#ifdef __BIG_ENDIAN
+		{ 0xff, 0xff, 0, 4, 0, 2, 0, 4, 0, 3 },
+#else
+		{ 0xff, 0xff, 4, 0, 2, 0, 4, 0, 3, 0 },
+#endif
+		{ { 4, 0 }, { 20, 6 } },
+	},
+	{
+		"TCP_DST_PORT_22",
+		{
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 8),
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 6),
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 4, 0),
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+			BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 22, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 0xffff),
+			BPF_STMT(BPF_RET | BPF_K, 0)
+		}, 11,
+		TCP_SSH_PACKET,
+		{ { 38, 0xffff }, { 36, 0 }, { 14, 0 } },
+	},
+};
+
+static struct sk_buff *populate_skb(const __u8 *data, int size)
+{
+	struct sk_buff *skb;
+
+	skb = alloc_skb(MAX_DATA, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	memcpy(__skb_put(skb, size), data, size);
+
+	/* Initialize a fake skb with test pattern. */
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, ETH_HLEN);
+	skb->protocol = htons(ETH_P_IP);
+	skb->pkt_type = SKB_PKTTYPE;
+	skb->mark = SKB_MARK;
+	skb->queue_mapping = SKB_QUEUE;
+	skb->rxhash = SKB_RXHASH;
+	skb->dev = NULL;
+
+	return skb;
+}
+
+static void __run_one(struct sk_buff *skb, struct sk_filter *fp,
+		     struct sock_filter *classic, u32 *ret_classic,
+		     u32 *ret_int, u64 *ns_classic, u64 *ns_int)
+{
+	ktime_t start;
+	int i;
+
+	preempt_disable();
+	*ret_classic = sk_run_filter(skb, classic);
+	*ret_int = SK_RUN_FILTER(fp, skb);
+
+	start = ktime_get();
+	for (i = 0; i < runs; i++)
+		sk_run_filter(skb, classic);
+	*ns_classic = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	start = ktime_get();
+	for (i = 0; i < runs; i++)
+		SK_RUN_FILTER(fp, skb);
+	*ns_int = ktime_to_ns(ktime_sub(ktime_get(), start));
+	preempt_enable();
+}
+
+static int run_one(struct bpf_test *test)
+{
+	struct sock_fprog fprog = {
+		.len = test->len,
+		.filter = (struct sock_filter __force __user *) test->insns,
+	};
+	struct sock_filter classic[MAX_INSNS];
+	struct sk_filter *fp;
+	int err_cnt = 0, err, i;
+
+	err = sk_unattached_filter_create(&fp, &fprog);
+	if (err) {
+		pr_cont("FAIL to attach err=%d len=%d\n", err, test->len);
+		return 1;
+	}
+
+	/* sk_chk_filter() rewrites the opcodes, so check a private copy */
+	memcpy(classic, test->insns, sizeof(classic));
+	err = sk_chk_filter(classic, test->len);
+	if (err) {
+		pr_cont("FAIL classic check err=%d\n", err);
+		sk_unattached_filter_destroy(fp);
+		return 1;
+	}
+
+	pr_cont("jited:%u ", fp->jited);
+
+	for (i = 0; i < MAX_SUBTESTS; i++) {
+		u32 ret_classic, ret_int;
+		u64 ns_classic, ns_int;
+		struct sk_buff *skb;
+
+		/* unused subtest slots are all zero */
+		if (i > 0 && test->test[i].data_size == 0 &&
+		    test->test[i].result == 0)
+			break;
+
+		skb = populate_skb(test->data, test->test[i].data_size);
+		if (!skb) {
+			pr_cont("FAIL to allocate skb\n");
+			err_cnt++;
+			break;
+		}
+
+		__run_one(skb, fp, classic, &ret_classic, &ret_int,
+			  &ns_classic, &ns_int);
+		kfree_skb(skb);
+
+		if (runs > 0)
+			pr_cont("%llu/%llu ns ", div_u64(ns_classic, runs),
+				div_u64(ns_int, runs));
+
+		if (ret_classic != test->test[i].result ||
+		    ret_int != test->test[i].result) {
+			pr_cont("ret classic %u internal %u != %u ",
+				ret_classic, ret_int, test->test[i].result);
+			err_cnt++;
+		}
+	}
+
+	sk_unattached_filter_destroy(fp);
+	return err_cnt;
+}
+
+static __init int test_bpf_init(void)
+{
+	int i, err_cnt = 0, pass_cnt = 0;
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		int err;
+
+		pr_info("#%d %s ", i, tests[i].descr);
+		err = run_one(&tests[i]);
+		if (err) {
+			pr_cont("FAIL (%d times)\n", err);
+			err_cnt++;
+		} else {
+			pr_cont("PASS\n");
+			pass_cnt++;
+		}
+	}
+
+	pr_info("Summary: %d PASSED, %d FAILED\n", pass_cnt, err_cnt);
+	return err_cnt ? -EINVAL : 0;
+}
+
+static void __exit test_bpf_exit(void)
+{
+}
+
+module_init(test_bpf_init);
+module_exit(test_bpf_exit);
+MODULE_LICENSE("GPL");
@@ -0,0 +1,312 @@
+/*
+ * Microbenchmark for the IPv4 FIB trie lookup
+ *
+ * A private FIB table is filled with pseudo-random prefixes whose lengths
+ * roughly follow those of a full Internet routing table, and
+ * fib_table_lookup() is timed over a set of destinations about half of
+ * which fall inside one of the inserted prefixes.  A sample of lookups is
+ * checked against a linear longest prefix match over the inserted
+ * prefixes, before and after removing part of them.  The routes point at
+ * the loopback device and are removed again before the module finishes
+ * loading.
+ *
+ * fib_table_insert() and fib_table_delete() treat the table like any
+ * other: every route change is announced over rtnetlink and flushes the
+ * IPv4 routes and inetpeer entries of init_net.  Don't load this on a
+ * machine whose routing matters.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/random.h>
+#include <linux/rtnetlink.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/inetdevice.h>
+#include <net/net_namespace.h>
+#include <net/ip_fib.h>
+
+/* The table is never linked into the namespace, the id only shows up
+ * in the route notifications.
+ */
+#define FIB_TEST_TABLE	0xfff0
+#define FIB_TEST_DADDRS	65536
+#define FIB_TEST_CHECKS	256
+
+static int prefixes = 500000;
+module_param(prefixes, int, 0444);
+MODULE_PARM_DESC(prefixes, "Number of prefixes inserted into the table");
+
+static int lookups = 1 << 22;
+module_param(lookups, int, 0444);
+MODULE_PARM_DESC(lookups, "Number of timed lookups");
+
+/* Share of each prefix length, in percent */
+static const struct {
+	u8 plen;
+	u8 share;
+} fib_test_plens[] = {
+	{  8,  1 }, { 12,  1 }, { 14,  1 }, { 16,  2 }, { 17,  1 },
+	{ 18,  2 }, { 19,  3 }, { 20,  5 }, { 21,  5 }, { 22, 12 },
+	{ 23, 10 }, { 24, 55 }, { 28,  1 }, { 32,  1 },
+};
+
+static u8 fib_test_plen(void)
+{
+	u32 r = random32() % 100;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(fib_test_plens) - 1; i++) {
+		if (r < fib_test_plens[i].share)
+			break;
+		r -= fib_test_plens[i].share;
+	}
+	return fib_test_plens[i].plen;
+}
+
+/*
+ * Prefixes removed before the second check.  This only depends on the
+ * prefix, so that duplicates in dst[]/plen[] agree.
+ */
+static bool fib_test_removed(__be32 dst, u8 plen)
+{
+	return ntohl(dst) & (1U << (32 - plen));
+}
+
+/* A random destination, inside one of the first @n prefixes if @hit */
+static __be32 fib_test_daddr(const __be32 *dst, const u8 *plen, int n,
+			     bool hit)
+{
+	int j;
+
+	if (!hit)
+		return htonl(random32());
+
+	j = random32() % n;
+	return dst[j] | (htonl(random32()) & ~inet_make_mask(plen[j]));
+}
+
+static void fib_test_init_cfg(struct fib_config *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->fc_protocol = RTPROT_BOOT;
+	cfg->fc_scope = RT_SCOPE_LINK;
+	cfg->fc_type = RTN_UNICAST;
+	cfg->fc_table = FIB_TEST_TABLE;
+	cfg->fc_oif = init_net.loopback_dev->ifindex;
+	cfg->fc_nlflags = NLM_F_CREATE;
+	cfg->fc_nlinfo.nl_net = &init_net;
+}
+
+/* Returns the number of distinct prefixes inserted, or a negative errno */
+static int __init fib_test_fill(struct fib_table *tb, __be32 *dst, u8 *plen)
+{
+	struct fib_config cfg;
+	int i, err, inserted = 0;
+	ktime_t start;
+	u64 ns;
+
+	fib_test_init_cfg(&cfg);
+
+	start = ktime_get();
+	rtnl_lock();
+	for (i = 0; i < prefixes; i++) {
+		plen[i] = fib_test_plen();
+		dst[i] = htonl(random32()) & inet_make_mask(plen[i]);
+
+		cfg.fc_dst = dst[i];
+		cfg.fc_dst_len = plen[i];
+		err = fib_table_insert(tb, &cfg);
+		if (err == -EEXIST)
+			continue;
+		if (err) {
+			rtnl_unlock();
+			pr_err("inserting %pI4/%u failed: %d\n",
+			       &dst[i], plen[i], err);
+			return err;
+		}
+		inserted++;
+
+		if (!(i % 1024)) {
+			rtnl_unlock();
+			cond_resched();
+			rtnl_lock();
+		}
+	}
+	rtnl_unlock();
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	pr_info("inserted %d prefixes in %llu ms\n",
+		inserted, div_u64(ns, NSEC_PER_MSEC));
+	return inserted;
+}
+
+/* Delete all of the first @n prefixes, or only the fib_test_removed() ones */
+static void __init fib_test_delete(struct fib_table *tb, const __be32 *dst,
+				   const u8 *plen, int n, bool all)
+{
+	struct fib_config cfg;
+	int i;
+
+	fib_test_init_cfg(&cfg);
+
+	rtnl_lock();
+	for (i = 0; i < n; i++) {
+		if (!all && !fib_test_removed(dst[i], plen[i]))
+			continue;
+		cfg.fc_dst = dst[i];
+		cfg.fc_dst_len = plen[i];
+		/* duplicates are already gone and fail with -ESRCH */
+		fib_table_delete(tb, &cfg);
+
+		if (!(i % 1024)) {
+			rtnl_unlock();
+			cond_resched();
+			rtnl_lock();
+		}
+	}
+	rtnl_unlock();
+}
+
+/* Longest of the first @n prefixes matching @daddr, -1 if none does */
+static int __init fib_test_lpm(__be32 daddr, const __be32 *dst,
+			       const u8 *plen, int n, bool removed)
+{
+	int i, best = -1;
+
+	for (i = 0; i < n; i++) {
+		if (plen[i] <= best)
+			continue;
+		if ((daddr ^ dst[i]) & inet_make_mask(plen[i]))
+			continue;
+		if (removed && fib_test_removed(dst[i], plen[i]))
+			continue;
+		best = plen[i];
+	}
+	return best;
+}
+
+/*
+ * Check a sample of lookups against a linear search, @removed tells
+ * whether the fib_test_removed() prefixes have been deleted already.
+ */
+static int __init fib_test_check(struct fib_table *tb, const __be32 *dst,
+				 const u8 *plen, int n, bool removed)
+{
+	struct flowi4 fl4 = { .flowi4_scope = RT_SCOPE_UNIVERSE };
+	struct fib_result res;
+	int i, want, got, errors = 0;
+
+	for (i = 0; i < FIB_TEST_CHECKS; i++) {
+		fl4.daddr = fib_test_daddr(dst, plen, n, i & 1);
+		want = fib_test_lpm(fl4.daddr, dst, plen, n, removed);
+		if (fib_table_lookup(tb, &fl4, &res, FIB_LOOKUP_NOREF))
+			got = -1;
+		else
+			got = res.prefixlen;
+
+		if (got != want && errors++ < 10)
+			pr_err("lookup of %pI4 matched /%d instead of /%d\n",
+			       &fl4.daddr, got, want);
+		cond_resched();
+	}
+
+	if (errors) {
+		pr_err("%d of %d lookups failed the check\n",
+		       errors, FIB_TEST_CHECKS);
+		return -EINVAL;
+	}
+	pr_info("%d lookups agree with a linear search\n", FIB_TEST_CHECKS);
+	return 0;
+}
+
+static void __init fib_test_lookup(struct fib_table *tb, const __be32 *dst,
+				   const u8 *plen, int n)
+{
+	struct flowi4 fl4 = { .flowi4_scope = RT_SCOPE_UNIVERSE };
+	struct fib_result res;
+	__be32 *daddr;
+	unsigned int hits = 0;
+	ktime_t start;
+	u64 ns;
+	int i;
+
+	daddr = vmalloc(FIB_TEST_DADDRS * sizeof(*daddr));
+	if (!daddr) {
+		pr_err("cannot allocate destinations\n");
+		return;
+	}
+
+	for (i = 0; i < FIB_TEST_DADDRS; i++)
+		daddr[i] = fib_test_daddr(dst, plen, n, i & 1);
+
+	start = ktime_get();
+	for (i = 0; i < lookups; i++) {
+		fl4.daddr = daddr[i & (FIB_TEST_DADDRS - 1)];
+		if (!fib_table_lookup(tb, &fl4, &res, FIB_LOOKUP_NOREF))
+			hits++;
+
+		if ((i & (FIB_TEST_DADDRS - 1)) == FIB_TEST_DADDRS - 1)
+			cond_resched();
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	pr_info("%d lookups in %llu ms, %u matched: %llu lookups/sec, %llu ns/lookup\n",
+		lookups, div_u64(ns, NSEC_PER_MSEC), hits,
+		ns ? div64_u64((u64)lookups * NSEC_PER_SEC, ns) : 0,
+		div_u64(ns, lookups));
+
+	vfree(daddr);
+}
+
+static __init int test_fib_trie_init(void)
+{
+	struct fib_table *tb;
+	__be32 *dst;
+	u8 *plen;
+	int err = -ENOMEM;
+
+	if (prefixes <= 0 || lookups <= 0)
+		return -EINVAL;
+
+	/* zeroed, so that entries never filled in delete nothing */
+	dst = vzalloc(prefixes * sizeof(*dst));
+	plen = vzalloc(prefixes * sizeof(*plen));
+	tb = fib_trie_table(FIB_TEST_TABLE);
+	if (!dst || !plen || !tb)
+		goto out;
+
+	err = fib_test_fill(tb, dst, plen);
+	if (err > 0)
+		err = fib_test_check(tb, dst, plen, prefixes, false);
+	if (!err) {
+		fib_test_lookup(tb, dst, plen, prefixes);
+
+		fib_test_delete(tb, dst, plen, prefixes, false);
+		err = fib_test_check(tb, dst, plen, prefixes, true);
+	}
+
+	fib_test_delete(tb, dst, plen, prefixes, true);
+out:
+	if (tb)
+		fib_free_table(tb);
+	vfree(plen);
+	vfree(dst);
+	return err;
+}
+
+static void __exit test_fib_trie_exit(void)
+{
+}
+
+module_init(test_fib_trie_init);
+module_exit(test_fib_trie_exit);
+MODULE_LICENSE("GPL");
@@ -17,6 +17,7 @@
 #include <linux/khugepaged.h>
 #include <linux/freezer.h>
 #include <linux/mman.h>
+#include <linux/pagemap.h>
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
 #include "internal.h"
@@ -781,6 +782,12 @@ int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		goto out;
 	}
 	src_page = pmd_page(pmd);
+	if (!PageAnon(src_page)) {
+		/* page cache: the child faults it in again */
+		pte_free(dst_mm, pgtable);
+		ret = 0;
+		goto out_unlock;
+	}
 	VM_BUG_ON(!PageHead(src_page));
 	get_page(src_page);
 	page_dup_rmap(src_page);
@@ -819,6 +826,336 @@ pgtable_t get_pmd_huge_pte(struct mm_struct *mm)
 	return pgtable;
 }
 
+/*
+ * Page cache isn't made of compound pages: a huge pmd of a file maps
+ * HPAGE_PMD_NR ordinary pages, that the filesystem allocated as one
+ * naturally aligned and physically contiguous block.  Each of them is
+ * referenced and mapped as if by its own pte.  So the pmd can be split
+ * back into ptes at any time without touching the pages, and everything
+ * that works on single pages (reclaim, truncation, migration, mlock) only
+ * has to split the pmd first.
+ */
+int huge_pmd_file_suitable(struct vm_area_struct *vma, unsigned long address,
+			   unsigned int flags)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return 0;
+	/* mlock and remap_file_pages work on ptes */
+	if (vma->vm_flags & (VM_LOCKED | VM_NONLINEAR))
+		return 0;
+	/* private mappings copy on write from ptes */
+	if ((flags & FAULT_FLAG_WRITE) && !(vma->vm_flags & VM_SHARED))
+		return 0;
+	return !(linear_page_index(vma, haddr) & (HPAGE_PMD_NR - 1));
+}
+
+/*
+ * Map the block of page cache around @address with a huge pmd, if all of
+ * it is cached, uptodate and physically contiguous.  Returns
+ * VM_FAULT_FALLBACK if it has to be mapped with ptes.
+ */
+int do_huge_pmd_file_fault(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, unsigned int flags)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *head = NULL, *page;
+	pgtable_t pgtable;
+	pgoff_t index, size;
+	pmd_t entry;
+	int i, ret = VM_FAULT_FALLBACK;
+
+	if (!huge_pmd_file_suitable(vma, address, flags))
+		return VM_FAULT_FALLBACK;
+
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable))
+		return VM_FAULT_OOM;
+
+	/*
+	 * Only trylock the pages, like __collapse_huge_page_isolate():
+	 * sleeping on one page lock while holding others could deadlock.
+	 */
+	index = linear_page_index(vma, haddr);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page = find_get_page(mapping, index + i);
+		if (!page)
+			goto out;
+		if (!i)
+			head = page;
+		if (page != head + i ||
+		    (page_to_pfn(head) & (HPAGE_PMD_NR - 1)) ||
+		    !trylock_page(page)) {
+			page_cache_release(page);
+			goto out;
+		}
+		if (page->mapping != mapping || !PageUptodate(page) ||
+		    PageHWPoison(page)) {
+			unlock_page(page);
+			page_cache_release(page);
+			goto out;
+		}
+	}
+
+	/* The pages are locked: truncation can't remove them now */
+	size = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1) >>
+		PAGE_CACHE_SHIFT;
+	if (index + HPAGE_PMD_NR > size)
+		goto out;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		ret = 0;
+		goto out;
+	}
+	entry = mk_pmd(head, vma->vm_page_prot);
+	if (flags & FAULT_FLAG_WRITE)
+		entry = maybe_pmd_mkwrite(pmd_mkdirty(entry), vma);
+	entry = pmd_mkhuge(entry);
+	for (page = head; page < head + HPAGE_PMD_NR; page++)
+		page_add_file_rmap(page);
+	set_pmd_at(mm, haddr, pmd, entry);
+	prepare_pmd_huge_pte(pgtable, mm);
+	add_mm_counter(mm, MM_FILEPAGES, HPAGE_PMD_NR);
+	mm->nr_ptes++;
+	spin_unlock(&mm->page_table_lock);
+	count_vm_event(THP_FILE_MAPPED);
+
+	/* The page references now belong to the pmd */
+	for (page = head; page < head + HPAGE_PMD_NR; page++)
+		unlock_page(page);
+	return 0;
+
+out:
+	while (--i >= 0) {
+		unlock_page(head + i);
+		page_cache_release(head + i);
+	}
+	pte_free(mm, pgtable);
+	return ret;
+}
+
+static void __split_huge_file_pmd(struct vm_area_struct *vma,
+				  unsigned long haddr, pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *page = pmd_page(*pmd);
+	pgtable_t pgtable;
+	pmd_t _pmd;
+	int i;
+
+	assert_spin_locked(&mm->page_table_lock);
+
+	pgtable = get_pmd_huge_pte(mm);
+	pmd_populate(mm, &_pmd, pgtable);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		unsigned long addr = haddr + i * PAGE_SIZE;
+		pte_t *pte, entry;
+
+		entry = mk_pte(page + i, vma->vm_page_prot);
+		/*
+		 * The pmd isn't cleared atomically below, so the cpu could
+		 * still set its dirty bit: treat a writable pmd as dirty.
+		 */
+		if (pmd_write(*pmd) || pmd_dirty(*pmd))
+			entry = pte_mkdirty(entry);
+		if (pmd_write(*pmd))
+			entry = pte_mkwrite(entry);
+		else
+			entry = pte_wrprotect(entry);
+		if (!pmd_young(*pmd))
+			entry = pte_mkold(entry);
+		pte = pte_offset_map(&_pmd, addr);
+		BUG_ON(!pte_none(*pte));
+		set_pte_at(mm, addr, pte, entry);
+		pte_unmap(pte);
+	}
+
+	smp_wmb(); /* make ptes visible before pmd */
+	/*
+	 * Don't let small and huge TLB entries for the same address be
+	 * loaded at once, see __split_huge_page_map().
+	 */
+	set_pmd_at(mm, haddr, pmd, pmd_mknotpresent(*pmd));
+	flush_tlb_range(vma, haddr, haddr + HPAGE_PMD_SIZE);
+	pmd_populate(mm, pmd, pgtable);
+}
+
+/*
+ * Replace a huge pmd of page cache with ptes to the same pages.  Only
+ * needs the page_table_lock, so it can be used under the i_mmap_mutex and
+ * without the mmap_sem.  Does nothing to other pmds.
+ */
+void split_huge_file_pmd(struct vm_area_struct *vma, unsigned long address,
+			 pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) && !PageAnon(pmd_page(*pmd)))
+		__split_huge_file_pmd(vma, address & HPAGE_PMD_MASK, pmd);
+	spin_unlock(&mm->page_table_lock);
+}
+
+/*
+ * Returns the huge pmd through which @mm maps the page cache page @page
+ * at @address, with the page_table_lock held, or NULL.
+ */
+pmd_t *page_check_address_file_pmd(struct page *page, struct mm_struct *mm,
+				   unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	pmd = pmd_offset(pud, address);
+	if (!pmd_trans_huge(*pmd))
+		return NULL;
+
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) &&
+	    pmd_pfn(*pmd) + ((address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT) ==
+	    page_to_pfn(page))
+		return pmd;
+	spin_unlock(&mm->page_table_lock);
+	return NULL;
+}
+
+/*
+ * The young bit of a huge pmd of page cache covers all of its pages, as
+ * seen by page_referenced_one().  Report it for every page, but clear it
+ * only when the first page of the block is checked: the pages then age
+ * together, instead of reclaim splitting the pmd as soon as one page
+ * looks unused.  Called with the page_table_lock held.
+ */
+int page_file_pmd_referenced(struct page *page, struct vm_area_struct *vma,
+			     unsigned long address, pmd_t *pmd)
+{
+	if (!pmd_young(*pmd))
+		return 0;
+	if (page_to_pfn(page) == pmd_pfn(*pmd))
+		pmdp_clear_flush_young_notify(vma, address & HPAGE_PMD_MASK,
+					      pmd);
+	return 1;
+}
+
+/*
+ * Split the huge pmd through which @vma maps the page cache page @page
+ * at @address, for rmap walks that work on ptes.  Returns 1 if there was
+ * one.
+ */
+int split_huge_file_page_address(struct page *page, struct vm_area_struct *vma,
+				 unsigned long address)
+{
+	pmd_t *pmd;
+
+	pmd = page_check_address_file_pmd(page, vma->vm_mm, address);
+	if (!pmd)
+		return 0;
+	__split_huge_file_pmd(vma, address & HPAGE_PMD_MASK, pmd);
+	spin_unlock(&vma->vm_mm->page_table_lock);
+	return 1;
+}
+
+/* Split all huge pmds of page cache in @vma, the mmap_sem is held */
+void split_huge_file_vma(struct vm_area_struct *vma)
+{
+	unsigned long addr;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	for (addr = ALIGN(vma->vm_start, HPAGE_PMD_SIZE);
+	     addr + HPAGE_PMD_SIZE <= vma->vm_end; addr += HPAGE_PMD_SIZE) {
+		pgd = pgd_offset(vma->vm_mm, addr);
+		if (!pgd_present(*pgd))
+			continue;
+		pud = pud_offset(pgd, addr);
+		if (!pud_present(*pud))
+			continue;
+		pmd = pmd_offset(pud, addr);
+		if (pmd_trans_huge(*pmd))
+			split_huge_file_pmd(vma, addr, pmd);
+	}
+}
+
+/*
+ * split_huge_page_pmd() only knows the mm: find the vma of the pmd
+ * through the page's mapping.  Must not be called with the i_mmap_mutex
+ * held, those callers use split_huge_file_pmd().
+ */
+static void split_huge_file_page_pmd(struct mm_struct *mm, pmd_t *pmd,
+				     struct page *page)
+{
+	struct address_space *mapping = page->mapping;
+	struct vm_area_struct *vma;
+	struct prio_tree_iter iter;
+	pgoff_t pgoff = page->index;
+
+	/* Truncation splits the pmds before it removes the pages */
+	if (!mapping)
+		return;
+
+	mutex_lock(&mapping->i_mmap_mutex);
+	vma_prio_tree_foreach(vma, &iter, &mapping->i_mmap, pgoff, pgoff) {
+		unsigned long address;
+
+		if (vma->vm_mm != mm)
+			continue;
+		address = vma->vm_start +
+			((pgoff - vma->vm_pgoff) << PAGE_SHIFT);
+		if (address & ~HPAGE_PMD_MASK)
+			continue;
+		if (page_check_address_pmd(page, mm, address,
+					   PAGE_CHECK_ADDRESS_PMD_FLAG) == pmd) {
+			split_huge_file_pmd(vma, address, pmd);
+			break;
+		}
+	}
+	mutex_unlock(&mapping->i_mmap_mutex);
+}
+
+static void zap_huge_file_pmd(struct mmu_gather *tlb,
+			      struct vm_area_struct *vma, pmd_t *pmd,
+			      unsigned long addr, pgtable_t pgtable)
+{
+	struct mm_struct *mm = tlb->mm;
+	struct page *page;
+	pmd_t orig;
+	int i;
+
+	orig = pmdp_get_and_clear(mm, addr, pmd);
+	tlb_remove_pmd_tlb_entry(tlb, pmd, addr);
+	page = pmd_page(orig);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_remove_rmap(page + i);
+	add_mm_counter(mm, MM_FILEPAGES, -HPAGE_PMD_NR);
+	mm->nr_ptes--;
+	spin_unlock(&mm->page_table_lock);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++, page++) {
+		if (pmd_dirty(orig))
+			set_page_dirty(page);
+		if (pmd_young(orig) && likely(!VM_SequentialReadHint(vma)))
+			mark_page_accessed(page);
+		tlb_remove_page(tlb, page);
+	}
+	pte_free(mm, pgtable);
+}
+
 static int do_huge_pmd_wp_page_fallback(struct mm_struct *mm,
 					struct vm_area_struct *vma,
 					unsigned long address,
@@ -919,6 +1256,12 @@ int do_huge_pmd_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	struct page *page, *new_page;
 	unsigned long haddr;
 
+	if (vma->vm_ops) {
+		/* page cache is copied on write from ptes */
+		split_huge_file_pmd(vma, address, pmd);
+		return 0;
+	}
+
 	VM_BUG_ON(!vma->anon_vma);
 	spin_lock(&mm->page_table_lock);
 	if (unlikely(!pmd_same(*pmd, orig_pmd)))
@@ -1003,7 +1346,7 @@ struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 		goto out;
 
 	page = pmd_page(*pmd);
-	VM_BUG_ON(!PageHead(page));
+	VM_BUG_ON(PageAnon(page) && !PageHead(page));
 	if (flags & FOLL_TOUCH) {
 		pmd_t _pmd;
 		/*
@@ -1018,7 +1361,7 @@ struct page *follow_trans_huge_pmd(struct mm_struct *mm,
 		set_pmd_at(mm, addr & HPAGE_PMD_MASK, pmd, _pmd);
 	}
 	page += (addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
-	VM_BUG_ON(!PageCompound(page));
+	VM_BUG_ON(PageAnon(pmd_page(*pmd)) && !PageCompound(page));
 	if (flags & FOLL_GET)
 		get_page_foll(page);
 
@@ -1036,6 +1379,10 @@ int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
 		pgtable_t pgtable;
 		pgtable = get_pmd_huge_pte(tlb->mm);
 		page = pmd_page(*pmd);
+		if (!PageAnon(page)) {
+			zap_huge_file_pmd(tlb, vma, pmd, addr, pgtable);
+			return 1;
+		}
 		pmd_clear(pmd);
 		tlb_remove_pmd_tlb_entry(tlb, pmd, addr);
 		page_remove_rmap(page);
@@ -1079,6 +1426,7 @@ int move_huge_pmd(struct vm_area_struct *vma, struct vm_area_struct *new_vma,
 	pmd_t pmd;
 
 	struct mm_struct *mm = vma->vm_mm;
+	struct address_space *mapping = NULL;
 
 	if ((old_addr & ~HPAGE_PMD_MASK) ||
 	    (new_addr & ~HPAGE_PMD_MASK) ||
@@ -1095,6 +1443,14 @@ int move_huge_pmd(struct vm_area_struct *vma, struct vm_area_struct *new_vma,
 		goto out;
 	}
 
+	/*
+	 * Like move_ptes(), keep truncation from missing a huge pmd of page
+	 * cache on its way between the two vmas.
+	 */
+	if (vma->vm_file) {
+		mapping = vma->vm_file->f_mapping;
+		mutex_lock(&mapping->i_mmap_mutex);
+	}
 	ret = __pmd_trans_huge_lock(old_pmd, vma);
 	if (ret == 1) {
 		pmd = pmdp_get_and_clear(mm, old_addr, old_pmd);
@@ -1102,6 +1458,8 @@ int move_huge_pmd(struct vm_area_struct *vma, struct vm_area_struct *new_vma,
 		set_pmd_at(mm, new_addr, new_pmd, pmd);
 		spin_unlock(&mm->page_table_lock);
 	}
+	if (mapping)
+		mutex_unlock(&mapping->i_mmap_mutex);
 out:
 	return ret;
 }
@@ -2381,15 +2739,19 @@ void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
 	get_page(page);
 	spin_unlock(&mm->page_table_lock);
 
-	split_huge_page(page);
+	if (PageAnon(page))
+		split_huge_page(page);
+	else
+		split_huge_file_page_pmd(mm, pmd, page);
 
 	put_page(page);
 	BUG_ON(pmd_trans_huge(*pmd));
 }
 
-static void split_huge_page_address(struct mm_struct *mm,
+static void split_huge_page_address(struct vm_area_struct *vma,
 				    unsigned long address)
 {
+	struct mm_struct *mm = vma->vm_mm;
 	pgd_t *pgd;
 	pud_t *pud;
 	pmd_t *pmd;
@@ -2409,9 +2771,13 @@ static void split_huge_page_address(struct mm_struct *mm,
 		return;
 	/*
 	 * Caller holds the mmap_sem write mode, so a huge pmd cannot
-	 * materialize from under us.
+	 * materialize from under us.  It also holds the i_mmap_mutex of
+	 * a file vma, so split those pmds in place.
 	 */
-	split_huge_page_pmd(mm, pmd);
+	if (vma->vm_ops)
+		split_huge_file_pmd(vma, address, pmd);
+	else
+		split_huge_page_pmd(mm, pmd);
 }
 
 void __vma_adjust_trans_huge(struct vm_area_struct *vma,
@@ -2427,7 +2793,7 @@ void __vma_adjust_trans_huge(struct vm_area_struct *vma,
 	if (start & ~HPAGE_PMD_MASK &&
 	    (start & HPAGE_PMD_MASK) >= vma->vm_start &&
 	    (start & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= vma->vm_end)
-		split_huge_page_address(vma->vm_mm, start);
+		split_huge_page_address(vma, start);
 
 	/*
 	 * If the new end address isn't hpage aligned and it could
@@ -2437,7 +2803,7 @@ void __vma_adjust_trans_huge(struct vm_area_struct *vma,
 	if (end & ~HPAGE_PMD_MASK &&
 	    (end & HPAGE_PMD_MASK) >= vma->vm_start &&
 	    (end & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= vma->vm_end)
-		split_huge_page_address(vma->vm_mm, end);
+		split_huge_page_address(vma, end);
 
 	/*
 	 * If we're also updating the vma->vm_next->vm_start, if the new
@@ -2451,6 +2817,6 @@ void __vma_adjust_trans_huge(struct vm_area_struct *vma,
 		if (nstart & ~HPAGE_PMD_MASK &&
 		    (nstart & HPAGE_PMD_MASK) >= next->vm_start &&
 		    (nstart & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= next->vm_end)
-			split_huge_page_address(next->vm_mm, nstart);
+			split_huge_page_address(next, nstart);
 	}
 }
@@ -23,6 +23,7 @@
 #include <linux/mmu_notifier.h>
 #include <linux/migrate.h>
 #include <linux/perf_event.h>
+#include <linux/ksm.h>
 #include <asm/uaccess.h>
 #include <asm/pgtable.h>
 #include <asm/cacheflush.h>
@@ -141,6 +142,119 @@ static void change_protection(struct vm_area_struct *vma,
 	flush_tlb_range(vma, start, end);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+static unsigned long change_pte_range_numa(struct vm_area_struct *vma,
+		pmd_t *pmd, unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pgprot_t prot_none = vma_prot_none(vma);
+	unsigned long pages = 0;
+	struct page *page;
+	pte_t *pte, ptent;
+	spinlock_t *ptl;
+
+	pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	arch_enter_lazy_mmu_mode();
+	do {
+		ptent = *pte;
+		if (!pte_present(ptent) || pte_numa(vma, ptent))
+			continue;
+
+		/* Only pages that migrate_misplaced_page() could move */
+		page = vm_normal_page(vma, addr, ptent);
+		if (!page || PageKsm(page))
+			continue;
+
+		ptent = ptep_modify_prot_start(mm, addr, pte);
+		ptent = pte_modify(ptent, prot_none);
+		ptep_modify_prot_commit(mm, addr, pte, ptent);
+		pages++;
+	} while (pte++, addr += PAGE_SIZE, addr != end);
+	arch_leave_lazy_mmu_mode();
+	pte_unmap_unlock(pte - 1, ptl);
+
+	return pages;
+}
+
+static unsigned long change_pmd_range_numa(struct vm_area_struct *vma,
+		pud_t *pud, unsigned long addr, unsigned long end)
+{
+	unsigned long next, pages = 0;
+	pmd_t *pmd;
+
+	pmd = pmd_offset(pud, addr);
+	do {
+		next = pmd_addr_end(addr, end);
+		/*
+		 * Huge pmds are left alone: there is no hinting fault
+		 * handling for them, and splitting them just to sample
+		 * their accesses would cost more than it gains.  With
+		 * only mmap_sem held for read a huge pmd may also show
+		 * up under us, hence the careful check.
+		 */
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+			continue;
+		pages += change_pte_range_numa(vma, pmd, addr, next);
+	} while (pmd++, addr = next, addr != end);
+
+	return pages;
+}
+
+static unsigned long change_pud_range_numa(struct vm_area_struct *vma,
+		pgd_t *pgd, unsigned long addr, unsigned long end)
+{
+	unsigned long next, pages = 0;
+	pud_t *pud;
+
+	pud = pud_offset(pgd, addr);
+	do {
+		next = pud_addr_end(addr, end);
+		if (pud_none_or_clear_bad(pud))
+			continue;
+		pages += change_pmd_range_numa(vma, pud, addr, next);
+	} while (pud++, addr = next, addr != end);
+
+	return pages;
+}
+
+/**
+ * change_prot_numa - arm NUMA hinting faults on a range of a vma
+ * @vma: vma the range belongs to
+ * @start: first address of the range
+ * @end: end of the range
+ *
+ * Make the present ptes in [@start, @end) PROT_NONE, while the vma keeps
+ * its normal protections, so the next access to each page traps into
+ * do_numa_page().  Called with mmap_sem held for read.
+ *
+ * Returns the number of ptes that were updated.
+ */
+unsigned long change_prot_numa(struct vm_area_struct *vma,
+			unsigned long start, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr = start, next, pages = 0;
+	pgd_t *pgd;
+
+	BUG_ON(addr >= end);
+	pgd = pgd_offset(mm, addr);
+	flush_cache_range(vma, addr, end);
+	do {
+		next = pgd_addr_end(addr, end);
+		if (pgd_none_or_clear_bad(pgd))
+			continue;
+		pages += change_pud_range_numa(vma, pgd, addr, next);
+	} while (pgd++, addr = next, addr != end);
+
+	if (pages) {
+		flush_tlb_range(vma, start, end);
+		count_vm_numa_events(NUMA_PTE_UPDATES, pages);
+	}
+
+	return pages;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 int
 mprotect_fixup(struct vm_area_struct *vma, struct vm_area_struct **pprev,
 	unsigned long start, unsigned long end, unsigned long newflags)
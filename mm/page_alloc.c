@@ -618,10 +618,28 @@ static inline int free_pages_check(struct page *page)
 	return 0;
 }
 
+/* Orders small enough to be cached on the per-cpu lists */
+static inline bool pcp_allowed_order(unsigned int order)
+{
+	return order < NR_PCP_ORDERS;
+}
+
+static inline unsigned int order_to_pindex(int migratetype, unsigned int order)
+{
+	return order * MIGRATE_PCPTYPES + migratetype;
+}
+
+static inline unsigned int pindex_to_order(unsigned int pindex)
+{
+	return pindex / MIGRATE_PCPTYPES;
+}
+
 /*
  * Frees a number of pages from the PCP lists
- * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * Assumes all pages on list are in same zone.
+ * count is the number of base pages to free; since higher order pages
+ * are freed whole, slightly more than that may go.  pcp->count is
+ * updated accordingly.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -632,17 +650,20 @@ static inline int free_pages_check(struct page *page)
 static void free_pcppages_bulk(struct zone *zone, int count,
 					struct per_cpu_pages *pcp)
 {
-	int migratetype = 0;
+	unsigned int pindex = 0;
 	int batch_free = 0;
-	int to_free = count;
+	int nr_freed = 0;
+
+	count = min(pcp->count, count);
 
 	spin_lock(&zone->lock);
 	zone->all_unreclaimable = 0;
 	zone->pages_scanned = 0;
 
-	while (to_free) {
+	while (count > 0) {
 		struct page *page;
 		struct list_head *list;
+		unsigned int order;
 
 		/*
 		 * Remove pages from lists in a round-robin fashion. A
@@ -653,28 +674,73 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 		 */
 		do {
 			batch_free++;
-			if (++migratetype == MIGRATE_PCPTYPES)
-				migratetype = 0;
-			list = &pcp->lists[migratetype];
+			if (++pindex == NR_PCP_LISTS)
+				pindex = 0;
+			list = &pcp->lists[pindex];
 		} while (list_empty(list));
 
 		/* This is the only non-empty list. Free them all. */
-		if (batch_free == MIGRATE_PCPTYPES)
-			batch_free = to_free;
+		if (batch_free == NR_PCP_LISTS)
+			batch_free = count;
 
+		order = pindex_to_order(pindex);
 		do {
 			page = list_entry(list->prev, struct page, lru);
 			/* must delete as __free_one_page list manipulates */
 			list_del(&page->lru);
 			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, zone, 0, page_private(page));
-			trace_mm_page_pcpu_drain(page, 0, page_private(page));
-		} while (--to_free && --batch_free && !list_empty(list));
+			__free_one_page(page, zone, order, page_private(page));
+			trace_mm_page_pcpu_drain(page, order, page_private(page));
+			count -= 1 << order;
+			nr_freed += 1 << order;
+		} while (count > 0 && --batch_free && !list_empty(list));
 	}
-	__mod_zone_page_state(zone, NR_FREE_PAGES, count);
+	pcp->count -= nr_freed;
+	__mod_zone_page_state(zone, NR_FREE_PAGES, nr_freed);
 	spin_unlock(&zone->lock);
 }
 
+/*
+ * Spill the higher order per-cpu lists of this CPU for @zone back into the
+ * buddy allocator.  Pages parked there are not in NR_FREE_PAGES nor in
+ * zone->free_area, so __zone_watermark_ok() cannot see them for order > 0.
+ * Returns true if anything was freed.
+ */
+static bool drain_local_high_order_pages(struct zone *zone)
+{
+	struct per_cpu_pages *pcp;
+	unsigned long flags;
+	unsigned int pindex;
+	int nr_freed = 0;
+
+	local_irq_save(flags);
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	if (!pcp->count)
+		goto out;
+
+	spin_lock(&zone->lock);
+	for (pindex = MIGRATE_PCPTYPES; pindex < NR_PCP_LISTS; pindex++) {
+		struct list_head *list = &pcp->lists[pindex];
+		unsigned int order = pindex_to_order(pindex);
+
+		while (!list_empty(list)) {
+			struct page *page;
+
+			page = list_entry(list->prev, struct page, lru);
+			list_del(&page->lru);
+			__free_one_page(page, zone, order, page_private(page));
+			trace_mm_page_pcpu_drain(page, order, page_private(page));
+			nr_freed += 1 << order;
+		}
+	}
+	pcp->count -= nr_freed;
+	__mod_zone_page_state(zone, NR_FREE_PAGES, nr_freed);
+	spin_unlock(&zone->lock);
+out:
+	local_irq_restore(flags);
+	return nr_freed != 0;
+}
+
 static void free_one_page(struct zone *zone, struct page *page, int order,
 				int migratetype)
 {
@@ -697,6 +763,14 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 
 	if (PageAnon(page))
 		page->mapping = NULL;
+	/*
+	 * Compound pages of up to PAGE_ALLOC_COSTLY_ORDER go onto the
+	 * per-cpu lists and never reach __free_one_page() until drained:
+	 * take them apart here, or the next allocation of them would trip
+	 * over PG_head/PG_tail in check_new_page().
+	 */
+	if (order && PageCompound(page))
+		bad += destroy_compound_page(page, order);
 	for (i = 0; i < (1 << order); i++)
 		bad += free_pages_check(page + i);
 	if (bad)
@@ -713,11 +787,20 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 	return true;
 }
 
+static void __free_hot_cold_page(struct page *page, unsigned int order,
+				 int cold);
+
 static void __free_pages_ok(struct page *page, unsigned int order)
 {
 	unsigned long flags;
-	int wasMlocked = __TestClearPageMlocked(page);
+	int wasMlocked;
+
+	if (pcp_allowed_order(order)) {
+		__free_hot_cold_page(page, order, 0);
+		return;
+	}
 
+	wasMlocked = __TestClearPageMlocked(page);
 	if (!free_pages_prepare(page, order))
 		return;
 
@@ -1119,7 +1202,6 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 	else
 		to_drain = pcp->count;
 	free_pcppages_bulk(zone, to_drain, pcp);
-	pcp->count -= to_drain;
 	local_irq_restore(flags);
 }
 #endif
@@ -1144,10 +1226,11 @@ static void drain_pages(unsigned int cpu)
 		pset = per_cpu_ptr(zone->pageset, cpu);
 
 		pcp = &pset->pcp;
-		if (pcp->count) {
+		if (pcp->count)
 			free_pcppages_bulk(zone, pcp->count, pcp);
-			pcp->count = 0;
-		}
+		/* Drained for memory pressure: forget the auto-tuning */
+		pcp->high = pcp->high_min;
+		pcp->flags = 0;
 		local_irq_restore(flags);
 	}
 }
@@ -1241,18 +1324,20 @@ void mark_free_pages(struct zone *zone)
 #endif /* CONFIG_PM */
 
 /*
- * Free a 0-order page
+ * Free a page of up to PAGE_ALLOC_COSTLY_ORDER to the per-cpu lists
  * cold == 1 ? free a cold page : free a hot page
  */
-void free_hot_cold_page(struct page *page, int cold)
+static void __free_hot_cold_page(struct page *page, unsigned int order,
+				 int cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
+	struct list_head *list;
 	unsigned long flags;
 	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
 
-	if (!free_pages_prepare(page, 0))
+	if (!free_pages_prepare(page, order))
 		return;
 
 	migratetype = get_pageblock_migratetype(page);
@@ -1260,7 +1345,7 @@ void free_hot_cold_page(struct page *page, int cold)
 	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
-	__count_vm_event(PGFREE);
+	__count_vm_events(PGFREE, 1 << order);
 
 	/*
 	 * We only track unmovable, reclaimable and movable on pcp lists.
@@ -1271,27 +1356,45 @@ void free_hot_cold_page(struct page *page, int cold)
 	 */
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(migratetype == MIGRATE_ISOLATE)) {
-			free_one_page(zone, page, 0, migratetype);
+			free_one_page(zone, page, order, migratetype);
 			goto out;
 		}
 		migratetype = MIGRATE_MOVABLE;
 	}
 
 	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list = &pcp->lists[order_to_pindex(migratetype, order)];
 	if (cold)
-		list_add_tail(&page->lru, &pcp->lists[migratetype]);
+		list_add_tail(&page->lru, list);
 	else
-		list_add(&page->lru, &pcp->lists[migratetype]);
-	pcp->count++;
+		list_add(&page->lru, list);
+	pcp->count += 1 << order;
 	if (pcp->count >= pcp->high) {
-		free_pcppages_bulk(zone, pcp->batch, pcp);
-		pcp->count -= pcp->batch;
+		/*
+		 * A cpu that only frees has no use for a big cache: unless
+		 * it had to refill since the last time it got here, shrink
+		 * the high mark back towards its minimum.
+		 */
+		if (!(pcp->flags & PCPF_REFILLED))
+			pcp->high = max(pcp->high - pcp->batch, pcp->high_min);
+		pcp->flags = PCPF_FREE_HIGH;
+		free_pcppages_bulk(zone, pcp->count - pcp->high + pcp->batch,
+				   pcp);
 	}
 
 out:
 	local_irq_restore(flags);
 }
 
+/*
+ * Free a 0-order page
+ * cold == 1 ? free a cold page : free a hot page
+ */
+void free_hot_cold_page(struct page *page, int cold)
+{
+	__free_hot_cold_page(page, 0, cold);
+}
+
 /*
  * Free a list of 0-order pages
  */
@@ -1392,18 +1495,45 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 	struct page *page;
 	int cold = !!(gfp_flags & __GFP_COLD);
 
+	if (unlikely(gfp_flags & __GFP_NOFAIL)) {
+		/*
+		 * __GFP_NOFAIL is not to be used in new code.
+		 *
+		 * All __GFP_NOFAIL callers should be fixed so that they
+		 * properly detect and handle allocation failures.
+		 *
+		 * We most definitely don't want callers attempting to
+		 * allocate greater than order-1 page units with
+		 * __GFP_NOFAIL.
+		 */
+		WARN_ON_ONCE(order > 1);
+	}
+
 again:
-	if (likely(order == 0)) {
+	if (likely(pcp_allowed_order(order))) {
 		struct per_cpu_pages *pcp;
 		struct list_head *list;
 
 		local_irq_save(flags);
 		pcp = &this_cpu_ptr(zone->pageset)->pcp;
-		list = &pcp->lists[migratetype];
+		list = &pcp->lists[order_to_pindex(migratetype, order)];
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
-					pcp->batch, list,
-					migratetype, cold);
+			/* Refill roughly pcp->batch base pages worth */
+			int batch = order ? max(pcp->batch >> order, 2) :
+					    pcp->batch;
+
+			/*
+			 * Pages went back to the buddy lists at high and are
+			 * wanted again already: the cache is too small for
+			 * this cpu's working set, so let it grow.
+			 */
+			if (pcp->flags & PCPF_FREE_HIGH)
+				pcp->high = min(pcp->high + pcp->batch,
+						pcp->high_max);
+			pcp->flags = PCPF_REFILLED;
+
+			pcp->count += rmqueue_bulk(zone, order, batch, list,
+					migratetype, cold) << order;
 			if (unlikely(list_empty(list)))
 				goto failed;
 		}
@@ -1414,21 +1544,8 @@ again:
 			page = list_entry(list->next, struct page, lru);
 
 		list_del(&page->lru);
-		pcp->count--;
+		pcp->count -= 1 << order;
 	} else {
-		if (unlikely(gfp_flags & __GFP_NOFAIL)) {
-			/*
-			 * __GFP_NOFAIL is not to be used in new code.
-			 *
-			 * All __GFP_NOFAIL callers should be fixed so that they
-			 * properly detect and handle allocation failures.
-			 *
-			 * We most definitely don't want callers attempting to
-			 * allocate greater than order-1 page units with
-			 * __GFP_NOFAIL.
-			 */
-			WARN_ON_ONCE(order > 1);
-		}
 		spin_lock_irqsave(&zone->lock, flags);
 		page = __rmqueue(zone, order, migratetype);
 		spin_unlock(&zone->lock);
@@ -1802,6 +1919,18 @@ zonelist_scan:
 				    classzone_idx, alloc_flags))
 				goto try_this_zone;
 
+			/*
+			 * Higher order pages cached on this CPU do not count
+			 * towards the watermark: give them back and retry.
+			 * Other CPUs' lists are drained by the slow path
+			 * after direct reclaim.
+			 */
+			if (order && pcp_allowed_order(order) &&
+			    drain_local_high_order_pages(zone) &&
+			    zone_watermark_ok(zone, order, mark,
+				    classzone_idx, alloc_flags))
+				goto try_this_zone;
+
 			if (NUMA_BUILD && !did_zlc_setup && nr_online_nodes > 1) {
 				/*
 				 * we do zlc_setup if there are multiple nodes
@@ -3743,7 +3872,7 @@ static int zone_batchsize(struct zone *zone)
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	unsigned int pindex;
 
 	memset(p, 0, sizeof(*p));
 
@@ -3751,8 +3880,15 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->count = 0;
 	pcp->high = 6 * batch;
 	pcp->batch = max(1UL, 1 * batch);
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
-		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	/*
+	 * high floats between its default and four times that, depending
+	 * on whether the cpu keeps coming back for the pages it freed.
+	 */
+	pcp->high_min = pcp->high;
+	pcp->high_max = 4 * pcp->high;
+	pcp->flags = 0;
+	for (pindex = 0; pindex < NR_PCP_LISTS; pindex++)
+		INIT_LIST_HEAD(&pcp->lists[pindex]);
 }
 
 /*
@@ -3767,6 +3903,9 @@ static void setup_pagelist_highmark(struct per_cpu_pageset *p,
 
 	pcp = &p->pcp;
 	pcp->high = high;
+	/* An explicit high mark is not auto-tuned */
+	pcp->high_min = high;
+	pcp->high_max = high;
 	pcp->batch = max(1UL, high/4);
 	if ((high/4) > (PAGE_SHIFT * 8))
 		pcp->batch = PAGE_SHIFT * 8;
@@ -4300,6 +4439,11 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
 	pgdat->kswapd_max_order = 0;
+#ifdef CONFIG_NUMA_BALANCING
+	spin_lock_init(&pgdat->numabalancing_migrate_lock);
+	pgdat->numabalancing_migrate_nr_pages = 0;
+	pgdat->numabalancing_migrate_next_window = jiffies;
+#endif
 	pgdat_page_cgroup_init(pgdat);
 	
 	for (j = 0; j < MAX_NR_ZONES; j++) {
@@ -695,10 +695,9 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 {
 	struct mm_struct *mm = vma->vm_mm;
 	int referenced = 0;
+	pmd_t *pmd;
 
 	if (unlikely(PageTransHuge(page))) {
-		pmd_t *pmd;
-
 		spin_lock(&mm->page_table_lock);
 		/*
 		 * rmap might return false positives; we must filter
@@ -722,6 +721,20 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 		if (pmdp_clear_flush_young_notify(vma, address, pmd))
 			referenced++;
 		spin_unlock(&mm->page_table_lock);
+	} else if (!PageAnon(page) &&
+		   (pmd = page_check_address_file_pmd(page, mm, address))) {
+		/* page cache mapped by a huge pmd, see do_huge_pmd_file_fault() */
+		if (vma->vm_flags & VM_LOCKED) {
+			spin_unlock(&mm->page_table_lock);
+			*mapcount = 0;	/* break early from loop */
+			*vm_flags |= VM_LOCKED;
+			goto out;
+		}
+
+		if (page_file_pmd_referenced(page, vma, address, pmd) &&
+		    likely(!VM_SequentialReadHint(vma)))
+			referenced++;
+		spin_unlock(&mm->page_table_lock);
 	} else {
 		pte_t *pte;
 		spinlock_t *ptl;
@@ -928,8 +941,15 @@ static int page_mkclean_one(struct page *page, struct vm_area_struct *vma,
 	int ret = 0;
 
 	pte = page_check_address(page, mm, address, &ptl, 1);
-	if (!pte)
-		goto out;
+	if (!pte) {
+		/* clean the ptes of a split huge pmd of page cache */
+		if (PageAnon(page) ||
+		    !split_huge_file_page_address(page, vma, address))
+			goto out;
+		pte = page_check_address(page, mm, address, &ptl, 1);
+		if (!pte)
+			goto out;
+	}
 
 	if (pte_dirty(*pte) || pte_write(*pte)) {
 		pte_t entry;
@@ -1238,8 +1258,15 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	int ret = SWAP_AGAIN;
 
 	pte = page_check_address(page, mm, address, &ptl, 0);
-	if (!pte)
-		goto out;
+	if (!pte) {
+		/* page cache mapped by a huge pmd is unmapped as ptes */
+		if (PageAnon(page) || TTU_ACTION(flags) == TTU_MUNLOCK ||
+		    !split_huge_file_page_address(page, vma, address))
+			goto out;
+		pte = page_check_address(page, mm, address, &ptl, 0);
+		if (!pte)
+			goto out;
+	}
 
 	/*
 	 * If the page is mlock()d, we cannot swap it out.
@@ -391,6 +391,15 @@ static void shmem_deswap_pagevec(struct pagevec *pvec)
 	pvec->nr = j;
 }
 
+/*
+ * Does this mapping store swap entries as exceptional radix tree entries?
+ */
+bool shmem_mapping(struct address_space *mapping)
+{
+	return mapping->a_ops == &shmem_aops;
+}
+EXPORT_SYMBOL_GPL(shmem_mapping);
+
 /*
  * SysV IPC SHM_UNLOCK restore Unevictable pages to their evictable lists.
  */
@@ -828,6 +837,26 @@ static struct page *shmem_alloc_page(gfp_t gfp,
 	 */
 	return alloc_page_vma(gfp, &pvma, 0);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, pgoff_t index)
+{
+	struct vm_area_struct pvma;
+
+	/* Create a pseudo vma that just contains the policy */
+	pvma.vm_start = 0;
+	pvma.vm_pgoff = index;
+	pvma.vm_ops = NULL;
+	pvma.vm_policy = mpol_shared_policy_lookup(&info->policy, index);
+
+	/*
+	 * alloc_pages_vma() will drop the shared policy reference
+	 */
+	return alloc_pages_vma(gfp, HPAGE_PMD_ORDER, &pvma, 0,
+			       numa_node_id());
+}
+#endif
 #else /* !CONFIG_NUMA */
 #ifdef CONFIG_TMPFS
 static inline void shmem_show_mpol(struct seq_file *seq, struct mempolicy *mpol)
@@ -846,6 +875,14 @@ static inline struct page *shmem_alloc_page(gfp_t gfp,
 {
 	return alloc_page(gfp);
 }
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static inline struct page *shmem_alloc_hugepage(gfp_t gfp,
+			struct shmem_inode_info *info, pgoff_t index)
+{
+	return alloc_pages(gfp, HPAGE_PMD_ORDER);
+}
+#endif
 #endif /* CONFIG_NUMA */
 
 #if !defined(CONFIG_NUMA) || !defined(CONFIG_TMPFS)
@@ -877,7 +914,7 @@ static int shmem_getpage_gfp(struct inode *inode, pgoff_t index,
 		return -EFBIG;
 repeat:
 	swap.val = 0;
-	page = find_lock_page(mapping, index);
+	page = find_lock_entry(mapping, index);
 	if (radix_tree_exceptional_entry(page)) {
 		swap = radix_to_swp_entry(page);
 		page = NULL;
@@ -1025,7 +1062,7 @@ unacct:
 	shmem_unacct_blocks(info->flags, 1);
 failed:
 	if (swap.val && error != -EINVAL) {
-		struct page *test = find_get_page(mapping, index);
+		struct page *test = find_get_entry(mapping, index);
 		if (test && !radix_tree_exceptional_entry(test))
 			page_cache_release(test);
 		/* Have another try if the entry has changed */
@@ -1065,6 +1102,154 @@ static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	return ret;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Fill the hole of HPAGE_PMD_NR pages at @index with one naturally aligned
+ * and physically contiguous block, which do_huge_pmd_file_fault() can map
+ * with a huge pmd.  The block is split into ordinary page cache pages
+ * straight away, so swap, truncation and everything else keep working on
+ * them one at a time.  Returns 0 if the whole block was inserted.
+ */
+static int shmem_alloc_huge_block(struct inode *inode, pgoff_t index,
+				  struct vm_area_struct *vma)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
+	gfp_t gfp = mapping_gfp_mask(mapping);
+	gfp_t huge_gfp;
+	struct page *page;
+	unsigned long found;
+	void **slot;
+	int i, error = 0;
+
+	/* Don't mix with pages or swap entries already in the block */
+	rcu_read_lock();
+	if (radix_tree_gang_lookup_slot(&mapping->page_tree, &slot, &found,
+					index, 1) &&
+	    found < index + HPAGE_PMD_NR)
+		error = -EEXIST;
+	rcu_read_unlock();
+	if (error)
+		return error;
+
+	if (index + HPAGE_PMD_NR > (pgoff_t)((i_size_read(inode) +
+				PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT))
+		return -EINVAL;
+
+	if ((info->flags & VM_NORESERVE) &&
+	    security_vm_enough_memory_mm(current->mm, HPAGE_PMD_NR))
+		return -ENOSPC;
+	if (sbinfo->max_blocks) {
+		if (sbinfo->max_blocks < HPAGE_PMD_NR ||
+		    percpu_counter_compare(&sbinfo->used_blocks,
+				sbinfo->max_blocks - HPAGE_PMD_NR) > 0) {
+			error = -ENOSPC;
+			goto unacct;
+		}
+		percpu_counter_add(&sbinfo->used_blocks, HPAGE_PMD_NR);
+	}
+
+	/* Like a THP: don't try too hard, the caller falls back to pages */
+	huge_gfp = (gfp | GFP_TRANSHUGE) & ~__GFP_COMP;
+	if (!transparent_hugepage_defrag(vma))
+		huge_gfp &= ~__GFP_WAIT;
+	page = shmem_alloc_hugepage(huge_gfp, info, index);
+	if (!page) {
+		error = -ENOMEM;
+		goto decused;
+	}
+	split_page(page, HPAGE_PMD_ORDER);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		clear_highpage(page + i);
+		flush_dcache_page(page + i);
+		SetPageUptodate(page + i);
+		SetPageSwapBacked(page + i);
+		__set_page_locked(page + i);
+		error = mem_cgroup_cache_charge(page + i, current->mm,
+						gfp & GFP_RECLAIM_MASK);
+		if (!error)
+			error = shmem_add_to_page_cache(page + i, mapping,
+							index + i, gfp, NULL);
+		if (error) {
+			unlock_page(page + i);
+			page_cache_release(page + i);
+			break;
+		}
+		lru_cache_add_anon(page + i);
+	}
+	if (error) {
+		int nr = i;
+
+		while (++i < HPAGE_PMD_NR)
+			__free_page(page + i);
+		if (sbinfo->max_blocks)
+			percpu_counter_add(&sbinfo->used_blocks,
+					   nr - HPAGE_PMD_NR);
+		shmem_unacct_blocks(info->flags, HPAGE_PMD_NR - nr);
+		i = nr;
+	}
+
+	spin_lock(&info->lock);
+	info->alloced += i;
+	inode->i_blocks += i * BLOCKS_PER_PAGE;
+	shmem_recalc_inode(inode);
+	spin_unlock(&info->lock);
+
+	/* Perhaps the file has been truncated since we checked */
+	if (index + HPAGE_PMD_NR > (pgoff_t)((i_size_read(inode) +
+				PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT)) {
+		int nr = i;
+
+		while (--i >= 0)
+			delete_from_page_cache(page + i);
+		/* shmem_recalc_inode() unaccounts the deleted pages */
+		spin_lock(&info->lock);
+		shmem_recalc_inode(inode);
+		spin_unlock(&info->lock);
+		error = -EINVAL;
+		i = nr;
+	}
+
+	while (--i >= 0) {
+		unlock_page(page + i);
+		page_cache_release(page + i);
+	}
+	if (!error)
+		count_vm_event(THP_FILE_ALLOC);
+	return error;
+
+decused:
+	if (sbinfo->max_blocks)
+		percpu_counter_add(&sbinfo->used_blocks, -HPAGE_PMD_NR);
+unacct:
+	shmem_unacct_blocks(info->flags, HPAGE_PMD_NR);
+	return error;
+}
+
+static int shmem_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, unsigned int flags)
+{
+	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	int ret;
+
+	if (!SHMEM_SB(inode->i_sb)->huge)
+		return VM_FAULT_FALLBACK;
+
+	ret = do_huge_pmd_file_fault(vma, address, pmd, flags);
+	if (!(ret & VM_FAULT_FALLBACK) ||
+	    !huge_pmd_file_suitable(vma, address, flags))
+		return ret;
+
+	/* Not cached as a block yet: try to allocate one */
+	if (shmem_alloc_huge_block(inode, linear_page_index(vma, haddr), vma))
+		return VM_FAULT_FALLBACK;
+	return do_huge_pmd_file_fault(vma, address, pmd, flags);
+}
+#endif
+
 #ifdef CONFIG_NUMA
 static int shmem_set_policy(struct vm_area_struct *vma, struct mempolicy *mpol)
 {
@@ -2146,6 +2331,15 @@ static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 		} else if (!strcmp(this_char,"mpol")) {
 			if (mpol_parse_str(value, &sbinfo->mpol, 1))
 				goto bad_val;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		} else if (!strcmp(this_char,"huge")) {
+			if (!strcmp(value, "always"))
+				sbinfo->huge = true;
+			else if (!strcmp(value, "never"))
+				sbinfo->huge = false;
+			else
+				goto bad_val;
+#endif
 		} else {
 			printk(KERN_ERR "tmpfs: Bad mount option %s\n",
 			       this_char);
@@ -2191,6 +2385,7 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 	sbinfo->max_blocks  = config.max_blocks;
 	sbinfo->max_inodes  = config.max_inodes;
 	sbinfo->free_inodes = config.max_inodes - inodes;
+	sbinfo->huge        = config.huge;
 
 	mpol_put(sbinfo->mpol);
 	sbinfo->mpol        = config.mpol;	/* transfers initial ref */
@@ -2214,6 +2409,8 @@ static int shmem_show_options(struct seq_file *seq, struct dentry *root)
 		seq_printf(seq, ",uid=%u", sbinfo->uid);
 	if (sbinfo->gid != 0)
 		seq_printf(seq, ",gid=%u", sbinfo->gid);
+	if (sbinfo->huge)
+		seq_printf(seq, ",huge=always");
 	shmem_show_mpol(seq, sbinfo->mpol);
 	return 0;
 }
@@ -2426,6 +2623,10 @@ static const struct super_operations shmem_ops = {
 
 static const struct vm_operations_struct shmem_vm_ops = {
 	.fault		= shmem_fault,
+	.map_pages	= filemap_map_pages,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.pmd_fault	= shmem_pmd_fault,
+#endif
 #ifdef CONFIG_NUMA
 	.set_policy     = shmem_set_policy,
 	.get_policy     = shmem_get_policy,
@@ -2517,6 +2718,12 @@ int shmem_unuse(swp_entry_t swap, struct page *page)
 	return 0;
 }
 
+bool shmem_mapping(struct address_space *mapping)
+{
+	return false;
+}
+EXPORT_SYMBOL_GPL(shmem_mapping);
+
 int shmem_lock(struct file *file, int lock, struct user_struct *user)
 {
 	return 0;
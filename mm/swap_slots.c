@@ -0,0 +1,240 @@
+/*
+ * Per-cpu caches of swap slots
+ *
+ * Allocating or freeing a swap slot takes swap_lock, which serializes
+ * swapout from all cpus.  Each cpu therefore keeps a small cache of
+ * slots for allocation, refilled SWAP_SLOTS_CACHE_SIZE at a time
+ * through get_swap_pages(), and a cache of slots to be freed, which is
+ * returned in one batch through swapcache_free_entries() when full.
+ *
+ * Slots sitting in either cache are marked SWAP_HAS_CACHE in swap_map
+ * with no page in the swap cache, so nobody else can allocate them.
+ * Swapoff drains the caches and disables them while it runs, and so
+ * does running low on swap space, so that no cpu hoards slots that
+ * another one needs.
+ */
+
+#include <linux/swap_slots.h>
+#include <linux/cpu.h>
+#include <linux/init.h>
+#include <linux/mutex.h>
+#include <linux/notifier.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects slots, nr, cur */
+	swp_entry_t	slots[SWAP_SLOTS_CACHE_SIZE];
+	int		nr;
+	int		cur;
+	spinlock_t	free_lock;	/* protects slots_ret, n_ret */
+	swp_entry_t	slots_ret[SWAP_SLOTS_CACHE_SIZE];
+	int		n_ret;
+};
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swp_slots);
+
+/* Serializes swapoff's disabling of the caches */
+static DEFINE_MUTEX(swap_slots_cache_enable_mutex);
+/* Serializes activation and deactivation on swap space levels */
+static DEFINE_MUTEX(swap_slots_cache_mutex);
+
+static bool swap_slot_cache_active;
+bool swap_slot_cache_enabled;
+
+#define use_swap_slot_cache (swap_slot_cache_active && swap_slot_cache_enabled)
+
+#define SLOTS_CACHE	0x1
+#define SLOTS_CACHE_RET	0x2
+
+static void drain_slots_cache_cpu(unsigned int cpu, unsigned int type)
+{
+	struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+	if (type & SLOTS_CACHE) {
+		mutex_lock(&cache->alloc_lock);
+		swapcache_free_entries(cache->slots + cache->cur, cache->nr);
+		cache->cur = 0;
+		cache->nr = 0;
+		mutex_unlock(&cache->alloc_lock);
+	}
+	if (type & SLOTS_CACHE_RET) {
+		spin_lock(&cache->free_lock);
+		swapcache_free_entries(cache->slots_ret, cache->n_ret);
+		cache->n_ret = 0;
+		spin_unlock(&cache->free_lock);
+	}
+}
+
+static void __drain_swap_slots_cache(unsigned int type)
+{
+	unsigned int cpu;
+
+	/* offline cpus were drained by the hotplug callback */
+	for_each_possible_cpu(cpu)
+		drain_slots_cache_cpu(cpu, type);
+}
+
+static void deactivate_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slot_cache_active = false;
+	__drain_swap_slots_cache(SLOTS_CACHE | SLOTS_CACHE_RET);
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+static void reactivate_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_mutex);
+	swap_slot_cache_active = true;
+	mutex_unlock(&swap_slots_cache_mutex);
+}
+
+/* Called by swapon once the new area is in use */
+void enable_swap_slots_cache(void)
+{
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	swap_slot_cache_enabled = true;
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+/*
+ * Empty all the caches and keep them out of use until
+ * reenable_swap_slots_cache_unlock().
+ */
+void disable_swap_slots_cache_lock(void)
+{
+	mutex_lock(&swap_slots_cache_enable_mutex);
+	swap_slot_cache_enabled = false;
+	__drain_swap_slots_cache(SLOTS_CACHE | SLOTS_CACHE_RET);
+}
+
+void reenable_swap_slots_cache_unlock(void)
+{
+	swap_slot_cache_enabled = has_usable_swap();
+	mutex_unlock(&swap_slots_cache_enable_mutex);
+}
+
+static bool check_cache_active(void)
+{
+	long pages;
+
+	if (!swap_slot_cache_enabled)
+		return false;
+
+	pages = nr_swap_pages;
+	if (!swap_slot_cache_active) {
+		if (pages > num_online_cpus() *
+		    THRESHOLD_ACTIVATE_SWAP_SLOTS_CACHE)
+			reactivate_swap_slots_cache();
+		goto out;
+	}
+
+	/* if global pool of slot caches too low, deactivate cache */
+	if (pages < num_online_cpus() * THRESHOLD_DEACTIVATE_SWAP_SLOTS_CACHE)
+		deactivate_swap_slots_cache();
+out:
+	return swap_slot_cache_active;
+}
+
+/* called with cache->alloc_lock held */
+static int refill_swap_slots_cache(struct swap_slots_cache *cache)
+{
+	if (!use_swap_slot_cache || cache->nr)
+		return 0;
+
+	cache->cur = 0;
+	cache->nr = get_swap_pages(SWAP_SLOTS_CACHE_SIZE, cache->slots);
+
+	return cache->nr;
+}
+
+/**
+ * free_swap_slot - release a swap slot with no references left
+ * @entry: the slot, still marked SWAP_HAS_CACHE in swap_map
+ *
+ * The slot is queued on this cpu's cache and returned to its swap
+ * area together with a batch of others, or released at once when the
+ * caches are not in use.
+ */
+void free_swap_slot(swp_entry_t entry)
+{
+	struct swap_slots_cache *cache;
+
+	/* the lock, not the cpu, protects the cache: preemption is fine */
+	cache = __this_cpu_ptr(&swp_slots);
+	if (use_swap_slot_cache) {
+		spin_lock(&cache->free_lock);
+		/* Swap slots cache may be deactivated before acquiring lock */
+		if (!use_swap_slot_cache) {
+			spin_unlock(&cache->free_lock);
+			goto direct_free;
+		}
+		if (cache->n_ret >= SWAP_SLOTS_CACHE_SIZE) {
+			swapcache_free_entries(cache->slots_ret, cache->n_ret);
+			cache->n_ret = 0;
+		}
+		cache->slots_ret[cache->n_ret++] = entry;
+		spin_unlock(&cache->free_lock);
+	} else {
+direct_free:
+		swapcache_free_entries(&entry, 1);
+	}
+}
+
+/**
+ * get_swap_page - allocate a swap slot for the swap cache
+ *
+ * Returns the entry, or one with val 0 if there is no free swap.
+ * May sleep.
+ */
+swp_entry_t get_swap_page(void)
+{
+	swp_entry_t entry;
+	struct swap_slots_cache *cache;
+
+	/*
+	 * We may sleep in refill_swap_slots_cache(), and be migrated:
+	 * that is fine, since cache->alloc_lock protects the cache.
+	 */
+	cache = __this_cpu_ptr(&swp_slots);
+
+	entry.val = 0;
+	if (check_cache_active()) {
+		mutex_lock(&cache->alloc_lock);
+		if (cache->nr || refill_swap_slots_cache(cache)) {
+			entry = cache->slots[cache->cur++];
+			cache->nr--;
+		}
+		mutex_unlock(&cache->alloc_lock);
+		if (entry.val)
+			return entry;
+	}
+
+	get_swap_pages(1, &entry);
+	return entry;
+}
+
+static int __cpuinit swap_slots_cpu_notify(struct notifier_block *nb,
+					   unsigned long action, void *hcpu)
+{
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_slots_cache_cpu((long)hcpu,
+				      SLOTS_CACHE | SLOTS_CACHE_RET);
+	return NOTIFY_OK;
+}
+
+static int __init swap_slots_init(void)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swap_slots_cache *cache = &per_cpu(swp_slots, cpu);
+
+		mutex_init(&cache->alloc_lock);
+		spin_lock_init(&cache->free_lock);
+	}
+	hotcpu_notifier(swap_slots_cpu_notify, 0);
+	return 0;
+}
+__initcall(swap_slots_init);
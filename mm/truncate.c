@@ -183,6 +183,65 @@ int invalidate_inode_page(struct page *page)
 	return invalidate_complete_page(mapping, page);
 }
 
+/*
+ * Drop the shadow entries of evicted pages in the given range.  Shadow
+ * entries are only ever installed by reclaim and never carry tags, so
+ * it's enough to look them up and delete them under the tree_lock.
+ */
+static void truncate_shadow_entries(struct address_space *mapping,
+				    pgoff_t start, pgoff_t end)
+{
+	unsigned long indices[PAGEVEC_SIZE];
+	void **slots[PAGEVEC_SIZE];
+	pgoff_t index = start;
+	unsigned int nr, i;
+
+	while (index <= end && mapping->nrshadows) {
+		spin_lock_irq(&mapping->tree_lock);
+		nr = radix_tree_gang_lookup_slot(&mapping->page_tree, slots,
+						 indices, index, PAGEVEC_SIZE);
+		for (i = 0; i < nr; i++) {
+			struct radix_tree_node *node;
+			void **slot;
+			void *entry;
+
+			if (indices[i] > end)
+				break;
+			/*
+			 * Deleting an entry can shrink the tree and move
+			 * the remaining slots, look each index up again.
+			 */
+			entry = __radix_tree_lookup(&mapping->page_tree,
+						    indices[i], &node, &slot);
+			if (!radix_tree_exceptional_entry(entry))
+				continue;
+			radix_tree_replace_slot(slot, NULL);
+			mapping->nrshadows--;
+			if (!node)
+				continue;
+			workingset_node_shadows_dec(node);
+			/*
+			 * Don't track node without shadow entries.
+			 *
+			 * Avoid acquiring the list_lru lock if already
+			 * untracked.  The list_empty() test is safe as
+			 * node->private_list is protected by
+			 * mapping->tree_lock.
+			 */
+			if (!workingset_node_shadows(node) &&
+			    !list_empty(&node->private_list))
+				list_lru_del(&workingset_shadow_nodes,
+					     &node->private_list);
+			__radix_tree_delete_node(&mapping->page_tree, node);
+		}
+		spin_unlock_irq(&mapping->tree_lock);
+		if (i < nr || nr < PAGEVEC_SIZE || !(indices[nr - 1] + 1))
+			break;
+		index = indices[nr - 1] + 1;
+		cond_resched();
+	}
+}
+
 /**
  * truncate_inode_pages_range - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -214,8 +273,16 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	int i;
 
 	cleancache_invalidate_inode(mapping);
-	if (mapping->nrpages == 0)
-		return;
+	if (mapping->nrpages == 0) {
+		/*
+		 * Pairs with the write barrier in __delete_from_page_cache():
+		 * a page that reclaim just replaced by a shadow entry is
+		 * accounted in nrshadows by the time nrpages drops.
+		 */
+		smp_rmb();
+		if (mapping->nrshadows == 0)
+			return;
+	}
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
 	end = (lend >> PAGE_CACHE_SHIFT);
@@ -292,6 +359,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		mem_cgroup_uncharge_end();
 		index++;
 	}
+	truncate_shadow_entries(mapping, start, end);
 	cleancache_invalidate_inode(mapping);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
@@ -400,7 +468,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 
 	clear_page_mlock(page);
 	BUG_ON(page_has_private(page));
-	__delete_from_page_cache(page);
+	__delete_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
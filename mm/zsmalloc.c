@@ -27,8 +27,8 @@
 #include <linux/cpumask.h>
 #include <linux/cpu.h>
 #include <linux/vmalloc.h>
+#include <linux/zsmalloc.h>
 
-#include "zsmalloc.h"
 #include "zsmalloc_int.h"
 
 /*
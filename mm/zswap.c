@@ -0,0 +1,818 @@
+/*
+ * zswap.c - compressed write-back cache for swap pages
+ *
+ * Pages that reclaim hands to swap_writepage() are compressed and kept in
+ * a zsmalloc pool instead of being written to the swap device.  A later
+ * swap_readpage() of such a page costs a decompression rather than a disk
+ * read.  When the pool reaches its size limit, the least recently used
+ * compressed pages are decompressed again and written back to the real
+ * swap device to make room.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/rbtree.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/crypto.h>
+#include <linux/writeback.h>
+#include <linux/pagemap.h>
+#include <linux/zsmalloc.h>
+#include <linux/zswap.h>
+#include <linux/debugfs.h>
+
+/*********************************
+* statistics
+**********************************/
+/* Number of compressed pages currently stored in zswap */
+static atomic_t zswap_stored_pages = ATOMIC_INIT(0);
+
+/*
+ * The statistics below are not protected from concurrent access for
+ * performance reasons so they may not be 100% accurate.  However,
+ * they do provide useful information on roughly how many times a
+ * certain event is occurring.
+ */
+static u64 zswap_pool_limit_hit;
+static u64 zswap_written_back_pages;
+static u64 zswap_reject_reclaim_fail;
+static u64 zswap_reject_alloc_fail;
+static u64 zswap_reject_kmemcache_fail;
+static u64 zswap_reject_compress_poor;
+static u64 zswap_duplicate_entry;
+static u64 zswap_loads;
+
+/*********************************
+* tunables
+**********************************/
+/* Enable/disable zswap (disabled by default) */
+static bool zswap_enabled __read_mostly;
+module_param_named(enabled, zswap_enabled, bool, 0644);
+
+/* Compressor to be used by zswap (fixed at boot for now) */
+#define ZSWAP_COMPRESSOR_DEFAULT "lzo"
+static char *zswap_compressor = ZSWAP_COMPRESSOR_DEFAULT;
+module_param_named(compressor, zswap_compressor, charp, 0444);
+
+/* The maximum percentage of memory that the compressed pool can occupy */
+static unsigned int zswap_max_pool_percent = 20;
+module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
+
+/*
+ * Maximum compression ratio, as a percentage, for an acceptable compressed
+ * page.  Any pages that do not compress by at least this ratio are
+ * rejected and go straight to the swap device.
+ */
+static unsigned int zswap_max_compression_ratio = 80;
+module_param_named(max_compression_ratio, zswap_max_compression_ratio,
+		   uint, 0644);
+
+/* How many LRU pages to write back per store when the pool is full */
+#define ZSWAP_WRITEBACK_BATCH	16
+
+/*********************************
+* compression functions
+**********************************/
+/* per-cpu compression transforms */
+static struct crypto_comp * __percpu *zswap_comp_pcpu_tfms;
+
+enum comp_op {
+	ZSWAP_COMPOP_COMPRESS,
+	ZSWAP_COMPOP_DECOMPRESS
+};
+
+static int zswap_comp_op(enum comp_op op, const u8 *src, unsigned int slen,
+				u8 *dst, unsigned int *dlen)
+{
+	struct crypto_comp *tfm;
+	int ret;
+
+	tfm = *per_cpu_ptr(zswap_comp_pcpu_tfms, get_cpu());
+	switch (op) {
+	case ZSWAP_COMPOP_COMPRESS:
+		ret = crypto_comp_compress(tfm, src, slen, dst, dlen);
+		break;
+	case ZSWAP_COMPOP_DECOMPRESS:
+		ret = crypto_comp_decompress(tfm, src, slen, dst, dlen);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+
+	put_cpu();
+	return ret;
+}
+
+static int __init zswap_comp_init(void)
+{
+	if (!crypto_has_comp(zswap_compressor, 0, 0)) {
+		pr_info("%s compressor not available\n", zswap_compressor);
+		/* fall back to default compressor */
+		zswap_compressor = ZSWAP_COMPRESSOR_DEFAULT;
+		if (!crypto_has_comp(zswap_compressor, 0, 0))
+			/* can't even load the default compressor */
+			return -ENODEV;
+	}
+	pr_info("using %s compressor\n", zswap_compressor);
+
+	/* alloc percpu transforms */
+	zswap_comp_pcpu_tfms = alloc_percpu(struct crypto_comp *);
+	if (!zswap_comp_pcpu_tfms)
+		return -ENOMEM;
+	return 0;
+}
+
+static void zswap_comp_exit(void)
+{
+	/* free percpu transforms */
+	if (zswap_comp_pcpu_tfms)
+		free_percpu(zswap_comp_pcpu_tfms);
+}
+
+/*********************************
+* data structures
+**********************************/
+/*
+ * struct zswap_entry
+ *
+ * This structure contains the metadata for tracking a single compressed
+ * page within zswap.
+ *
+ * rbnode - links the entry into red-black tree for the appropriate swap type
+ * lru - links the entry into the LRU list of its tree, most recent first
+ * refcount - the number of outstanding references to the entry.  The tree
+ *            itself holds one while the entry is linked into it; loads and
+ *            writeback take a temporary one while they work on the data.
+ * offset - the swap offset for the entry.  Index into the red-black tree.
+ * handle - zsmalloc allocation handle that stores the compressed page data
+ * length - the length in bytes of the compressed page data.  Needed during
+ *          decompression
+ */
+struct zswap_entry {
+	struct rb_node rbnode;
+	struct list_head lru;
+	pgoff_t offset;
+	int refcount;
+	unsigned int length;
+	void *handle;
+};
+
+/*
+ * The tree lock in the zswap_tree struct protects a few things:
+ * - the rbtree
+ * - the lru list
+ * - the refcount field of each entry in the tree
+ */
+struct zswap_tree {
+	struct rb_root rbroot;
+	struct list_head lru;
+	spinlock_t lock;
+	unsigned type;
+};
+
+static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
+
+/* all compressed pages, regardless of swap type, live in one pool */
+static struct zs_pool *zswap_pool;
+
+/*
+ * zsmalloc is called with preemption disabled, so the pool must not sleep
+ * and must not dip into the reserves that reclaim itself depends on.
+ */
+#define ZSWAP_POOL_GFP	(__GFP_HIGHMEM | __GFP_NORETRY | __GFP_NOWARN | \
+			 __GFP_NOMEMALLOC)
+
+/*********************************
+* zswap entry functions
+**********************************/
+static struct kmem_cache *zswap_entry_cache;
+
+static int __init zswap_entry_cache_create(void)
+{
+	zswap_entry_cache = KMEM_CACHE(zswap_entry, 0);
+	return zswap_entry_cache == NULL;
+}
+
+static void zswap_entry_cache_destroy(void)
+{
+	kmem_cache_destroy(zswap_entry_cache);
+}
+
+static struct zswap_entry *zswap_entry_cache_alloc(gfp_t gfp)
+{
+	struct zswap_entry *entry;
+
+	entry = kmem_cache_alloc(zswap_entry_cache, gfp);
+	if (!entry)
+		return NULL;
+	entry->refcount = 1;
+	RB_CLEAR_NODE(&entry->rbnode);
+	INIT_LIST_HEAD(&entry->lru);
+	return entry;
+}
+
+/* Free the entry along with its compressed data */
+static void zswap_free_entry(struct zswap_entry *entry)
+{
+	zs_free(zswap_pool, entry->handle);
+	kmem_cache_free(zswap_entry_cache, entry);
+	atomic_dec(&zswap_stored_pages);
+}
+
+/* caller must hold the tree lock */
+static void zswap_entry_get(struct zswap_entry *entry)
+{
+	entry->refcount++;
+}
+
+/*
+ * caller must hold the tree lock; the entry is freed once the last
+ * reference is gone, by which time it is no longer linked anywhere.
+ */
+static void zswap_entry_put(struct zswap_entry *entry)
+{
+	int refcount = --entry->refcount;
+
+	BUG_ON(refcount < 0);
+	if (refcount == 0) {
+		WARN_ON_ONCE(!RB_EMPTY_NODE(&entry->rbnode));
+		zswap_free_entry(entry);
+	}
+}
+
+/*********************************
+* rbtree functions
+**********************************/
+static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
+{
+	struct rb_node *node = root->rb_node;
+	struct zswap_entry *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (entry->offset > offset)
+			node = node->rb_left;
+		else if (entry->offset < offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * In the case that an entry with the same offset is found, a pointer to
+ * the existing entry is stored in dupentry and the function returns -EEXIST
+ */
+static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
+			struct zswap_entry **dupentry)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	struct zswap_entry *myentry;
+
+	while (*link) {
+		parent = *link;
+		myentry = rb_entry(parent, struct zswap_entry, rbnode);
+		if (myentry->offset > entry->offset)
+			link = &(*link)->rb_left;
+		else if (myentry->offset < entry->offset)
+			link = &(*link)->rb_right;
+		else {
+			*dupentry = myentry;
+			return -EEXIST;
+		}
+	}
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	return 0;
+}
+
+/*
+ * Unlink the entry from the tree and the LRU and drop the reference the
+ * tree held on it.  Caller must hold the tree lock.
+ */
+static void zswap_invalidate_entry(struct zswap_tree *tree,
+				   struct zswap_entry *entry)
+{
+	if (RB_EMPTY_NODE(&entry->rbnode))
+		return;
+	rb_erase(&entry->rbnode, &tree->rbroot);
+	RB_CLEAR_NODE(&entry->rbnode);
+	list_del_init(&entry->lru);
+	zswap_entry_put(entry);
+}
+
+/*********************************
+* per-cpu code
+**********************************/
+static DEFINE_PER_CPU(u8 *, zswap_dstmem);
+
+static int __zswap_cpu_notifier(unsigned long action, unsigned long cpu)
+{
+	struct crypto_comp *tfm;
+	u8 *dst;
+
+	switch (action) {
+	case CPU_UP_PREPARE:
+		tfm = crypto_alloc_comp(zswap_compressor, 0, 0);
+		if (IS_ERR(tfm)) {
+			pr_err("can't allocate compressor transform\n");
+			return NOTIFY_BAD;
+		}
+		*per_cpu_ptr(zswap_comp_pcpu_tfms, cpu) = tfm;
+		dst = kmalloc_node(PAGE_SIZE * 2, GFP_KERNEL, cpu_to_node(cpu));
+		if (!dst) {
+			pr_err("can't allocate compressor buffer\n");
+			crypto_free_comp(tfm);
+			*per_cpu_ptr(zswap_comp_pcpu_tfms, cpu) = NULL;
+			return NOTIFY_BAD;
+		}
+		per_cpu(zswap_dstmem, cpu) = dst;
+		break;
+	case CPU_DEAD:
+	case CPU_UP_CANCELED:
+		tfm = *per_cpu_ptr(zswap_comp_pcpu_tfms, cpu);
+		if (tfm) {
+			crypto_free_comp(tfm);
+			*per_cpu_ptr(zswap_comp_pcpu_tfms, cpu) = NULL;
+		}
+		dst = per_cpu(zswap_dstmem, cpu);
+		kfree(dst);
+		per_cpu(zswap_dstmem, cpu) = NULL;
+		break;
+	default:
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static int zswap_cpu_notifier(struct notifier_block *nb,
+				unsigned long action, void *pcpu)
+{
+	unsigned long cpu = (unsigned long)pcpu;
+	return __zswap_cpu_notifier(action, cpu);
+}
+
+static struct notifier_block zswap_cpu_notifier_block = {
+	.notifier_call = zswap_cpu_notifier
+};
+
+static int __init zswap_cpu_init(void)
+{
+	unsigned long cpu;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu)
+		if (__zswap_cpu_notifier(CPU_UP_PREPARE, cpu) != NOTIFY_OK)
+			goto cleanup;
+	register_cpu_notifier(&zswap_cpu_notifier_block);
+	put_online_cpus();
+	return 0;
+
+cleanup:
+	for_each_online_cpu(cpu)
+		__zswap_cpu_notifier(CPU_UP_CANCELED, cpu);
+	put_online_cpus();
+	return -ENOMEM;
+}
+
+/*********************************
+* helpers
+**********************************/
+static bool zswap_is_full(void)
+{
+	u64 max = (u64)totalram_pages * zswap_max_pool_percent / 100;
+
+	return (zs_get_total_size_bytes(zswap_pool) >> PAGE_SHIFT) > max;
+}
+
+/* decompress the entry into a locked page; the caller holds a reference */
+static void zswap_decompress_entry(struct zswap_entry *entry,
+				   struct page *page)
+{
+	unsigned int dlen = PAGE_SIZE;
+	u8 *src, *dst;
+	int ret;
+
+	src = zs_map_object(zswap_pool, entry->handle);
+	dst = kmap_atomic(page);
+	ret = zswap_comp_op(ZSWAP_COMPOP_DECOMPRESS, src, entry->length,
+			    dst, &dlen);
+	kunmap_atomic(dst);
+	zs_unmap_object(zswap_pool, entry->handle);
+	BUG_ON(ret);
+	BUG_ON(dlen != PAGE_SIZE);
+}
+
+/*********************************
+* writeback code
+**********************************/
+/*
+ * Decompress the entry into a freshly allocated swap cache page and write
+ * that out to the swap device.  If the page is already in the swap cache
+ * somebody else is using it right now and we leave the entry alone.
+ */
+static int zswap_writeback_entry(struct zswap_tree *tree,
+				 struct zswap_entry *entry)
+{
+	swp_entry_t swpentry = swp_entry(tree->type, entry->offset);
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	bool page_was_allocated;
+	struct page *page;
+
+	page = __read_swap_cache_async(swpentry, GFP_KERNEL, NULL, 0,
+				       &page_was_allocated);
+	if (!page)
+		return -ENOMEM;
+	if (!page_was_allocated) {
+		page_cache_release(page);
+		return -EEXIST;
+	}
+
+	/*
+	 * The page is locked, in the swap cache and on the LRU.  The slot
+	 * may have been freed and reused while we allocated it, in which
+	 * case the entry is stale and must not be written over the new data.
+	 */
+	spin_lock(&tree->lock);
+	if (zswap_rb_search(&tree->rbroot, entry->offset) != entry) {
+		spin_unlock(&tree->lock);
+		delete_from_swap_cache(page);
+		unlock_page(page);
+		page_cache_release(page);
+		return -EEXIST;
+	}
+	spin_unlock(&tree->lock);
+
+	zswap_decompress_entry(entry, page);
+	SetPageUptodate(page);
+
+	/* move it to the tail of the inactive list after end_writeback */
+	SetPageReclaim(page);
+
+	/* start writeback, this unlocks the page */
+	__swap_writepage(page, &wbc);
+	page_cache_release(page);
+	zswap_written_back_pages++;
+
+	return 0;
+}
+
+/*
+ * Write back up to @nr of the oldest entries of @tree.  Returns the number
+ * of entries written back.
+ */
+static int zswap_shrink(struct zswap_tree *tree, int nr)
+{
+	struct zswap_entry *entry;
+	int written = 0, ret;
+
+	while (nr--) {
+		spin_lock(&tree->lock);
+		if (list_empty(&tree->lru)) {
+			spin_unlock(&tree->lock);
+			break;
+		}
+		entry = list_entry(tree->lru.prev, struct zswap_entry, lru);
+		/* keep other shrinkers off it while we work */
+		list_del_init(&entry->lru);
+		zswap_entry_get(entry);
+		spin_unlock(&tree->lock);
+
+		ret = zswap_writeback_entry(tree, entry);
+
+		spin_lock(&tree->lock);
+		if (!ret) {
+			/* the data lives on the swap device now */
+			if (zswap_rb_search(&tree->rbroot, entry->offset) == entry)
+				zswap_invalidate_entry(tree, entry);
+			written++;
+		} else if (!RB_EMPTY_NODE(&entry->rbnode)) {
+			/* in use or out of memory, try it again later */
+			list_add(&entry->lru, &tree->lru);
+		}
+		zswap_entry_put(entry);
+		spin_unlock(&tree->lock);
+	}
+
+	return written;
+}
+
+/*********************************
+* swap hooks
+**********************************/
+/*
+ * Attempt to compress and store a page that swap_writepage() was asked to
+ * write.  Returns 0 if the page was stored, in which case no IO must be
+ * done, or an error if the page should go to the swap device.
+ */
+int zswap_store(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page), };
+	unsigned type = swp_type(swp);
+	pgoff_t offset = swp_offset(swp);
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry, *dupentry;
+	unsigned int dlen = PAGE_SIZE;
+	u8 *src, *dst, *buf;
+	void *handle;
+	int ret;
+
+	if (!tree) {
+		ret = -ENODEV;
+		goto reject;
+	}
+
+	if (!zswap_enabled) {
+		ret = -EPERM;
+		goto reject;
+	}
+
+	/* reclaim space if needed */
+	if (zswap_is_full()) {
+		zswap_pool_limit_hit++;
+		zswap_shrink(tree, ZSWAP_WRITEBACK_BATCH);
+		if (zswap_is_full()) {
+			zswap_reject_reclaim_fail++;
+			ret = -ENOMEM;
+			goto reject;
+		}
+	}
+
+	/* allocate entry */
+	entry = zswap_entry_cache_alloc(GFP_KERNEL);
+	if (!entry) {
+		zswap_reject_kmemcache_fail++;
+		ret = -ENOMEM;
+		goto reject;
+	}
+
+	/* compress */
+	dst = get_cpu_var(zswap_dstmem);
+	src = kmap_atomic(page);
+	ret = zswap_comp_op(ZSWAP_COMPOP_COMPRESS, src, PAGE_SIZE, dst, &dlen);
+	kunmap_atomic(src);
+	if (ret) {
+		ret = -EINVAL;
+		goto freepage;
+	}
+	if (dlen > PAGE_SIZE * zswap_max_compression_ratio / 100) {
+		zswap_reject_compress_poor++;
+		ret = -E2BIG;
+		goto freepage;
+	}
+
+	/* store */
+	handle = zs_malloc(zswap_pool, dlen);
+	if (!handle) {
+		zswap_reject_alloc_fail++;
+		ret = -ENOMEM;
+		goto freepage;
+	}
+
+	buf = zs_map_object(zswap_pool, handle);
+	memcpy(buf, dst, dlen);
+	zs_unmap_object(zswap_pool, handle);
+	put_cpu_var(zswap_dstmem);
+
+	/* populate entry */
+	entry->offset = offset;
+	entry->handle = handle;
+	entry->length = dlen;
+	atomic_inc(&zswap_stored_pages);
+
+	/* map */
+	spin_lock(&tree->lock);
+	while (zswap_rb_insert(&tree->rbroot, entry, &dupentry) == -EEXIST) {
+		zswap_duplicate_entry++;
+		zswap_invalidate_entry(tree, dupentry);
+	}
+	list_add(&entry->lru, &tree->lru);
+	spin_unlock(&tree->lock);
+
+	return 0;
+
+freepage:
+	put_cpu_var(zswap_dstmem);
+	kmem_cache_free(zswap_entry_cache, entry);
+reject:
+	/*
+	 * An older copy of this page may still be stored; it must not
+	 * shadow the data that is about to be written to the swap device.
+	 */
+	zswap_invalidate_page(type, offset);
+	return ret;
+}
+
+/*
+ * Fill a locked swap cache page from zswap.  Returns 0 if the page was
+ * found and its contents are valid, an error if it must be read from the
+ * swap device.
+ */
+int zswap_load(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page), };
+	struct zswap_tree *tree = zswap_trees[swp_type(swp)];
+	struct zswap_entry *entry;
+
+	if (!tree)
+		return -ENODEV;
+
+	/* find and take a reference on the entry */
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, swp_offset(swp));
+	if (!entry) {
+		/* entry was written back or never stored */
+		spin_unlock(&tree->lock);
+		return -ENOENT;
+	}
+	zswap_entry_get(entry);
+	/* it is hot again */
+	if (!list_empty(&entry->lru))
+		list_move(&entry->lru, &tree->lru);
+	spin_unlock(&tree->lock);
+
+	zswap_decompress_entry(entry, page);
+	zswap_loads++;
+
+	spin_lock(&tree->lock);
+	zswap_entry_put(entry);
+	spin_unlock(&tree->lock);
+
+	return 0;
+}
+
+/* The swap slot is being freed, drop whatever we hold for it */
+void zswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+
+	if (!tree)
+		return;
+
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (entry)
+		zswap_invalidate_entry(tree, entry);
+	spin_unlock(&tree->lock);
+}
+
+/* All the slots of the swap area are free again, called from swapoff */
+void zswap_invalidate_area(unsigned type)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+	struct rb_node *node;
+
+	if (!tree)
+		return;
+
+	spin_lock(&tree->lock);
+	while ((node = rb_first(&tree->rbroot))) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		zswap_invalidate_entry(tree, entry);
+	}
+	spin_unlock(&tree->lock);
+
+	zswap_trees[type] = NULL;
+	kfree(tree);
+}
+
+/* A new swap area was enabled, called from swapon */
+void zswap_init_area(unsigned type)
+{
+	struct zswap_tree *tree;
+
+	if (!zswap_pool)
+		return;
+
+	tree = kzalloc(sizeof(struct zswap_tree), GFP_KERNEL);
+	if (!tree) {
+		pr_err("alloc failed, zswap disabled for swap type %d\n",
+			type);
+		return;
+	}
+
+	tree->rbroot = RB_ROOT;
+	INIT_LIST_HEAD(&tree->lru);
+	spin_lock_init(&tree->lock);
+	tree->type = type;
+	zswap_trees[type] = tree;
+}
+
+/*********************************
+* debugfs functions
+**********************************/
+#ifdef CONFIG_DEBUG_FS
+static int zswap_pool_pages_get(void *data, u64 *val)
+{
+	*val = zs_get_total_size_bytes(zswap_pool) >> PAGE_SHIFT;
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_pool_pages_fops, zswap_pool_pages_get,
+			NULL, "%llu\n");
+
+static int zswap_stored_pages_get(void *data, u64 *val)
+{
+	*val = atomic_read(&zswap_stored_pages);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_stored_pages_fops, zswap_stored_pages_get,
+			NULL, "%llu\n");
+
+static struct dentry *zswap_debugfs_root;
+
+static int __init zswap_debugfs_init(void)
+{
+	if (!debugfs_initialized())
+		return -ENODEV;
+
+	zswap_debugfs_root = debugfs_create_dir("zswap", NULL);
+	if (!zswap_debugfs_root)
+		return -ENOMEM;
+
+	debugfs_create_u64("pool_limit_hit", S_IRUGO,
+			zswap_debugfs_root, &zswap_pool_limit_hit);
+	debugfs_create_u64("reject_reclaim_fail", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_reclaim_fail);
+	debugfs_create_u64("reject_alloc_fail", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_alloc_fail);
+	debugfs_create_u64("reject_kmemcache_fail", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_kmemcache_fail);
+	debugfs_create_u64("reject_compress_poor", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_compress_poor);
+	debugfs_create_u64("written_back_pages", S_IRUGO,
+			zswap_debugfs_root, &zswap_written_back_pages);
+	debugfs_create_u64("duplicate_entry", S_IRUGO,
+			zswap_debugfs_root, &zswap_duplicate_entry);
+	debugfs_create_u64("loads", S_IRUGO,
+			zswap_debugfs_root, &zswap_loads);
+	debugfs_create_file("pool_pages", S_IRUGO,
+			zswap_debugfs_root, NULL, &zswap_pool_pages_fops);
+	debugfs_create_file("stored_pages", S_IRUGO,
+			zswap_debugfs_root, NULL, &zswap_stored_pages_fops);
+
+	return 0;
+}
+#else
+static int __init zswap_debugfs_init(void)
+{
+	return 0;
+}
+#endif
+
+/*********************************
+* module init and exit
+**********************************/
+static int __init init_zswap(void)
+{
+	pr_info("loading zswap\n");
+
+	zswap_pool = zs_create_pool("zswap", ZSWAP_POOL_GFP);
+	if (!zswap_pool) {
+		pr_err("zsmalloc pool creation failed\n");
+		goto error;
+	}
+	if (zswap_entry_cache_create()) {
+		pr_err("entry cache creation failed\n");
+		goto cachefail;
+	}
+	if (zswap_comp_init()) {
+		pr_err("compressor initialization failed\n");
+		goto compfail;
+	}
+	if (zswap_cpu_init()) {
+		pr_err("per-cpu initialization failed\n");
+		goto pcpufail;
+	}
+	if (zswap_debugfs_init())
+		pr_warn("debugfs initialization failed\n");
+	return 0;
+
+pcpufail:
+	zswap_comp_exit();
+compfail:
+	zswap_entry_cache_destroy();
+cachefail:
+	zs_destroy_pool(zswap_pool);
+	zswap_pool = NULL;
+error:
+	return -ENOMEM;
+}
+/* must be late so crypto has time to come up */
+late_initcall(init_zswap);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed cache for swap pages");
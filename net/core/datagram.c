@@ -55,6 +55,7 @@
 #include <net/checksum.h>
 #include <net/sock.h>
 #include <net/tcp_states.h>
+#include <net/busy_poll.h>
 #include <trace/events/skb.h>
 
 /*
@@ -201,6 +202,10 @@ struct sk_buff *__skb_recv_datagram(struct sock *sk, unsigned flags,
 		}
 		spin_unlock_irqrestore(&queue->lock, cpu_flags);
 
+		if (sk_can_busy_loop(sk) && skb_queue_empty(queue) &&
+		    sk_busy_loop(sk, flags & MSG_DONTWAIT))
+			continue;
+
 		/* User doesn't want to wait */
 		error = -EAGAIN;
 		if (!timeo)
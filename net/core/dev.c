@@ -135,6 +135,7 @@
 #include <linux/net_tstamp.h>
 #include <linux/static_key.h>
 #include <net/flow_keys.h>
+#include <net/busy_poll.h>
 
 #include "net-sysfs.h"
 
@@ -3153,6 +3154,102 @@ void netdev_rx_handler_unregister(struct net_device *dev)
 }
 EXPORT_SYMBOL_GPL(netdev_rx_handler_unregister);
 
+/**
+ *	dev_change_xdp_filter - attach or detach an XDP filter
+ *	@dev: device
+ *	@fp: filter from xdp_filter_create(), or NULL to detach
+ *
+ *	Replace the filter run on every frame @dev receives, before any
+ *	protocol sees it.  On success @dev takes over the reference to
+ *	@fp, and the previous filter is released after a grace period.
+ *
+ *	The caller must hold the rtnl_mutex.
+ */
+int dev_change_xdp_filter(struct net_device *dev, struct sk_filter *fp)
+{
+	const struct net_device_ops *ops = dev->netdev_ops;
+	struct sk_filter *old;
+	int err;
+
+	ASSERT_RTNL();
+
+	if (ops->ndo_xdp_filter) {
+		err = ops->ndo_xdp_filter(dev, fp);
+		if (err)
+			return err;
+	}
+
+	old = rtnl_dereference(dev->xdp_filter);
+	rcu_assign_pointer(dev->xdp_filter, fp);
+	if (old)
+		sk_filter_release(old);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(dev_change_xdp_filter);
+
+/**
+ *	netif_xdp_tx - send a received frame back out of its device
+ *	@skb: frame, as the driver would hand it to netif_receive_skb()
+ *
+ *	Carry out the XDP_TX verdict: the link-layer header pulled by
+ *	eth_type_trans() is pushed back and the frame is queued for
+ *	transmission on the device it arrived on.  Consumes @skb.
+ */
+void netif_xdp_tx(struct sk_buff *skb)
+{
+	if (skb_mac_header_was_set(skb))
+		skb_push(skb, skb->data - skb_mac_header(skb));
+	dev_queue_xmit(skb);
+}
+EXPORT_SYMBOL_GPL(netif_xdp_tx);
+
+/*
+ * Run the XDP filter of a device whose driver doesn't do it itself.
+ * The frame already is an skb by now, but it is still dropped before
+ * taps, rx_handlers and protocols get to see it.  Returns the verdict;
+ * @skb is consumed unless it is XDP_PASS.
+ */
+static u32 netif_receive_xdp(struct sk_buff *skb)
+{
+	struct net_device *dev = skb->dev;
+	struct sk_filter *fp;
+	struct xdp_buff xdp;
+	u32 act = XDP_PASS;
+
+	if (dev->netdev_ops->ndo_xdp_filter)
+		return XDP_PASS;
+
+	rcu_read_lock();
+	fp = rcu_dereference(dev->xdp_filter);
+	if (!fp)
+		goto out;
+
+	/* filters see the whole frame as one block */
+	if (skb_linearize(skb)) {
+		act = XDP_ABORTED;
+	} else {
+		xdp.data = skb_mac_header_was_set(skb) ? skb_mac_header(skb) :
+							 skb->data;
+		xdp.data_end = skb->data + skb->len;
+		act = xdp_run_filter(fp, &xdp);
+	}
+
+	switch (act) {
+	case XDP_PASS:
+		break;
+	case XDP_TX:
+		netif_xdp_tx(skb);
+		break;
+	default:
+		atomic_long_inc(&dev->rx_dropped);
+		kfree_skb(skb);
+		break;
+	}
+out:
+	rcu_read_unlock();
+	return act;
+}
+
 static int __netif_receive_skb(struct sk_buff *skb)
 {
 	struct packet_type *ptype, *pt_prev;
@@ -3171,8 +3268,10 @@ static int __netif_receive_skb(struct sk_buff *skb)
 	if (netpoll_receive_skb(skb))
 		return NET_RX_DROP;
 
-	if (!skb->skb_iif)
-		skb->skb_iif = skb->dev->ifindex;
+	if (rcu_access_pointer(skb->dev->xdp_filter) &&
+	    netif_receive_xdp(skb) != XDP_PASS)
+		return NET_RX_DROP;
+
 	orig_dev = skb->dev;
 
 	skb_reset_network_header(skb);
@@ -3184,6 +3283,7 @@ static int __netif_receive_skb(struct sk_buff *skb)
 	rcu_read_lock();
 
 another_round:
+	skb->skb_iif = skb->dev->ifindex;
 
 	__this_cpu_inc(softnet_data.processed);
 
@@ -3551,6 +3651,7 @@ EXPORT_SYMBOL(skb_gro_reset_offset);
 
 gro_result_t napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
+	skb_mark_napi_id(skb, napi);
 	skb_gro_reset_offset(skb);
 
 	return napi_skb_finish(__napi_gro_receive(napi, skb), skb);
@@ -3653,6 +3754,7 @@ gro_result_t napi_gro_frags(struct napi_struct *napi)
 	if (!skb)
 		return GRO_DROP;
 
+	skb_mark_napi_id(skb, napi);
 	return napi_frags_finish(napi, skb, __napi_gro_receive(napi, skb));
 }
 EXPORT_SYMBOL(napi_gro_frags);
@@ -3787,6 +3889,137 @@ void napi_complete(struct napi_struct *n)
 }
 EXPORT_SYMBOL(napi_complete);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+#define NAPI_HASH_BITS	8
+
+static DEFINE_SPINLOCK(napi_hash_lock);
+static unsigned int napi_gen_id;
+static struct hlist_head napi_hash[1 << NAPI_HASH_BITS];
+
+/* must be called under rcu_read_lock(), as we dont take a reference */
+struct napi_struct *napi_by_id(unsigned int napi_id)
+{
+	unsigned int hash = napi_id % (1 << NAPI_HASH_BITS);
+	struct napi_struct *napi;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_rcu(napi, node, &napi_hash[hash], napi_hash_node)
+		if (napi->napi_id == napi_id)
+			return napi;
+
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(napi_by_id);
+
+void napi_hash_add(struct napi_struct *napi)
+{
+	if (test_and_set_bit(NAPI_STATE_HASHED, &napi->state))
+		return;
+
+	spin_lock(&napi_hash_lock);
+
+	/* 0 is not a valid id, we also skip an id that is taken
+	 * we expect both events to be extremely rare
+	 */
+	do {
+		if (unlikely(!++napi_gen_id))
+			napi_gen_id = 1;
+	} while (napi_by_id(napi_gen_id));
+	napi->napi_id = napi_gen_id;
+
+	hlist_add_head_rcu(&napi->napi_hash_node,
+			   &napi_hash[napi->napi_id % (1 << NAPI_HASH_BITS)]);
+
+	spin_unlock(&napi_hash_lock);
+}
+EXPORT_SYMBOL_GPL(napi_hash_add);
+
+void napi_hash_del(struct napi_struct *napi)
+{
+	spin_lock(&napi_hash_lock);
+
+	if (test_and_clear_bit(NAPI_STATE_HASHED, &napi->state))
+		hlist_del_rcu(&napi->napi_hash_node);
+
+	spin_unlock(&napi_hash_lock);
+}
+EXPORT_SYMBOL_GPL(napi_hash_del);
+
+/**
+ * napi_busy_loop - poll a napi context from process context
+ * @napi_id: id of the napi context to poll, see skb_mark_napi_id()
+ * @loop_end: tells when to stop, gets @loop_end_arg and the start time
+ * @loop_end_arg: argument for @loop_end
+ *
+ * Keep calling the driver's ndo_busy_poll() for @napi_id until @loop_end
+ * returns true, or until the cpu is needed elsewhere.  With a NULL
+ * @loop_end the queues are polled only once.
+ */
+void napi_busy_loop(unsigned int napi_id,
+		    bool (*loop_end)(void *, unsigned long),
+		    void *loop_end_arg)
+{
+	unsigned long start_time = loop_end ? busy_loop_current_time() : 0;
+	const struct net_device_ops *ops;
+	struct napi_struct *napi;
+	int rc;
+
+	rcu_read_lock();
+
+	napi = napi_by_id(napi_id);
+	if (!napi)
+		goto out;
+
+	ops = napi->dev->netdev_ops;
+	if (!ops->ndo_busy_poll)
+		goto out;
+
+	for (;;) {
+		/* don't race with net_rx_action on this cpu */
+		local_bh_disable();
+		rc = ops->ndo_busy_poll(napi);
+		if (rc > 0)
+			NET_ADD_STATS_BH(dev_net(napi->dev),
+					 LINUX_MIB_BUSYPOLLRXPACKETS, rc);
+		local_bh_enable();
+
+		if (rc == LL_FLUSH_FAILED)
+			break; /* permanent failure */
+		if (!loop_end || loop_end(loop_end_arg, start_time))
+			break;
+		if (need_resched())
+			break;
+		cpu_relax();
+	}
+out:
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL(napi_busy_loop);
+
+static bool sk_busy_loop_end(void *p, unsigned long start_time)
+{
+	struct sock *sk = p;
+
+	return !skb_queue_empty(&sk->sk_receive_queue) ||
+	       sk_busy_loop_timeout(sk, start_time);
+}
+
+/**
+ * sk_busy_loop - busy poll for packets on a socket's receive queue
+ * @sk: socket to wait on
+ * @nonblock: poll the device queues only once
+ *
+ * Returns true if there is data on the receive queue afterwards.
+ */
+bool sk_busy_loop(struct sock *sk, int nonblock)
+{
+	napi_busy_loop(sk->sk_napi_id, nonblock ? NULL : sk_busy_loop_end, sk);
+
+	return !skb_queue_empty(&sk->sk_receive_queue);
+}
+EXPORT_SYMBOL(sk_busy_loop);
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 		    int (*poll)(struct napi_struct *, int), int weight)
 {
@@ -3811,6 +4044,7 @@ void netif_napi_del(struct napi_struct *napi)
 	struct sk_buff *skb, *next;
 
 	list_del_init(&napi->dev_list);
+	napi_hash_del(napi);
 	napi_free_frags(napi);
 
 	for (skb = napi->gro_list; skb; skb = next) {
@@ -5223,6 +5457,9 @@ static void rollback_registered_many(struct list_head *head)
 		/* Shutdown queueing discipline. */
 		dev_shutdown(dev);
 
+		/* Nothing is received any more, drop the XDP filter. */
+		dev_change_xdp_filter(dev, NULL);
+
 
 		/* Notify protocols, that we are about to destroy
 		   this device. They should clean all the things.
@@ -36,8 +36,10 @@
 #include <asm/uaccess.h>
 #include <asm/unaligned.h>
 #include <linux/filter.h>
+#include <linux/bpf.h>
 #include <linux/reciprocal_div.h>
 #include <linux/ratelimit.h>
+#include <linux/math64.h>
 
 /* No hurry in this branch
  *
@@ -364,6 +366,1024 @@ load_b:
 }
 EXPORT_SYMBOL(sk_run_filter);
 
+/* Base function for offset calculation of BPF_CALL targets.  Needs to
+ * stay in .text so that helpers can be reached with a 32-bit offset.
+ */
+noinline u64 __bpf_call_base(u64 r1, u64 r2, u64 r3, u64 r4, u64 r5)
+{
+	return 0;
+}
+EXPORT_SYMBOL_GPL(__bpf_call_base);
+
+/**
+ *	__sk_run_filter - run an internal BPF program on a given context
+ *	@ctx: buffer to run the filter on
+ *	@insn: filter to apply
+ *
+ * Decode and execute internal BPF instructions.  Unlike the classic
+ * interpreter above, dispatch happens through a table of label
+ * addresses indexed by the raw opcode, so every instruction costs a
+ * single indirect jump and no decoding.  Returns R0 on BPF_EXIT.
+ */
+static unsigned int __sk_run_filter(void *ctx,
+				    const struct sock_filter_int *insn)
+{
+	u64 stack[MAX_BPF_STACK / sizeof(u64)];
+	u64 regs[MAX_BPF_REG], tmp;
+	void *ptr;
+	int off;
+
+#define BPF_R0	regs[BPF_REG_0]
+#define BPF_R1	regs[BPF_REG_1]
+#define BPF_R2	regs[BPF_REG_2]
+#define BPF_R3	regs[BPF_REG_3]
+#define BPF_R4	regs[BPF_REG_4]
+#define BPF_R5	regs[BPF_REG_5]
+#define CTX	regs[BPF_REG_CTX]
+#define FP	regs[BPF_REG_FP]
+#define DST	regs[insn->dst_reg]
+#define SRC	regs[insn->src_reg]
+#define IMM	insn->imm
+
+#define CONT	 ({ insn++; goto select_insn; })
+#define CONT_JMP ({ insn++; goto select_insn; })
+
+	static const void *jumptable[256] = {
+		[0 ... 255] = &&default_label,
+		/* Now overwrite non-defaults ... */
+#define DL(A, B, C)	[BPF_##A|BPF_##B|BPF_##C] = &&A##_##B##_##C
+#define DL0(A, B)	[BPF_##A|BPF_##B] = &&A##_##B##_0
+		DL(ALU, ADD, X),
+		DL(ALU, ADD, K),
+		DL(ALU, SUB, X),
+		DL(ALU, SUB, K),
+		DL(ALU, AND, X),
+		DL(ALU, AND, K),
+		DL(ALU, OR, X),
+		DL(ALU, OR, K),
+		DL(ALU, LSH, X),
+		DL(ALU, LSH, K),
+		DL(ALU, RSH, X),
+		DL(ALU, RSH, K),
+		DL(ALU, XOR, X),
+		DL(ALU, XOR, K),
+		DL(ALU, MUL, X),
+		DL(ALU, MUL, K),
+		DL(ALU, MOV, X),
+		DL(ALU, MOV, K),
+		DL(ALU, DIV, X),
+		DL(ALU, DIV, K),
+		DL(ALU, MOD, X),
+		DL(ALU, MOD, K),
+		DL0(ALU, NEG),
+		DL(ALU, END, TO_BE),
+		DL(ALU, END, TO_LE),
+		DL(ALU64, ADD, X),
+		DL(ALU64, ADD, K),
+		DL(ALU64, SUB, X),
+		DL(ALU64, SUB, K),
+		DL(ALU64, AND, X),
+		DL(ALU64, AND, K),
+		DL(ALU64, OR, X),
+		DL(ALU64, OR, K),
+		DL(ALU64, LSH, X),
+		DL(ALU64, LSH, K),
+		DL(ALU64, RSH, X),
+		DL(ALU64, RSH, K),
+		DL(ALU64, XOR, X),
+		DL(ALU64, XOR, K),
+		DL(ALU64, MUL, X),
+		DL(ALU64, MUL, K),
+		DL(ALU64, MOV, X),
+		DL(ALU64, MOV, K),
+		DL(ALU64, ARSH, X),
+		DL(ALU64, ARSH, K),
+		DL(ALU64, DIV, X),
+		DL(ALU64, DIV, K),
+		DL(ALU64, MOD, X),
+		DL(ALU64, MOD, K),
+		DL0(ALU64, NEG),
+		DL0(JMP, CALL),
+		DL0(JMP, JA),
+		DL(JMP, JEQ, X),
+		DL(JMP, JEQ, K),
+		DL(JMP, JNE, X),
+		DL(JMP, JNE, K),
+		DL(JMP, JGT, X),
+		DL(JMP, JGT, K),
+		DL(JMP, JGE, X),
+		DL(JMP, JGE, K),
+		DL(JMP, JSGT, X),
+		DL(JMP, JSGT, K),
+		DL(JMP, JSGE, X),
+		DL(JMP, JSGE, K),
+		DL(JMP, JSET, X),
+		DL(JMP, JSET, K),
+		DL0(JMP, EXIT),
+		DL(STX, MEM, B),
+		DL(STX, MEM, H),
+		DL(STX, MEM, W),
+		DL(STX, MEM, DW),
+		DL(STX, XADD, W),
+		DL(STX, XADD, DW),
+		DL(ST, MEM, B),
+		DL(ST, MEM, H),
+		DL(ST, MEM, W),
+		DL(ST, MEM, DW),
+		DL(LDX, MEM, B),
+		DL(LDX, MEM, H),
+		DL(LDX, MEM, W),
+		DL(LDX, MEM, DW),
+		DL(LD, IMM, DW),
+		DL(LD, ABS, W),
+		DL(LD, ABS, H),
+		DL(LD, ABS, B),
+		DL(LD, IND, W),
+		DL(LD, IND, H),
+		DL(LD, IND, B),
+#undef DL0
+#undef DL
+	};
+
+	FP = (u64) (unsigned long) &stack[ARRAY_SIZE(stack)];
+	BPF_R1 = (u64) (unsigned long) ctx;
+
+select_insn:
+	goto *jumptable[insn->code];
+
+	/* ALU */
+#define ALU(OPCODE, OP)				\
+	ALU64_##OPCODE##_X:			\
+		DST = DST OP SRC;		\
+		CONT;				\
+	ALU_##OPCODE##_X:			\
+		DST = (u32) DST OP (u32) SRC;	\
+		CONT;				\
+	ALU64_##OPCODE##_K:			\
+		DST = DST OP IMM;		\
+		CONT;				\
+	ALU_##OPCODE##_K:			\
+		DST = (u32) DST OP (u32) IMM;	\
+		CONT;
+
+	ALU(ADD,  +)
+	ALU(SUB,  -)
+	ALU(AND,  &)
+	ALU(OR,   |)
+	ALU(LSH, <<)
+	ALU(RSH, >>)
+	ALU(XOR,  ^)
+	ALU(MUL,  *)
+#undef ALU
+	ALU_NEG_0:
+		DST = (u32) -DST;
+		CONT;
+	ALU64_NEG_0:
+		DST = -DST;
+		CONT;
+	ALU_MOV_X:
+		DST = (u32) SRC;
+		CONT;
+	ALU_MOV_K:
+		DST = (u32) IMM;
+		CONT;
+	ALU64_MOV_X:
+		DST = SRC;
+		CONT;
+	ALU64_MOV_K:
+		DST = IMM;
+		CONT;
+	ALU64_ARSH_X:
+		(*(s64 *) &DST) >>= SRC;
+		CONT;
+	ALU64_ARSH_K:
+		(*(s64 *) &DST) >>= IMM;
+		CONT;
+	ALU64_MOD_X:
+		if (unlikely(SRC == 0))
+			return 0;
+		DST -= div64_u64(DST, SRC) * SRC;
+		CONT;
+	ALU_MOD_X:
+		if (unlikely((u32) SRC == 0))
+			return 0;
+		tmp = (u32) DST;
+		DST = do_div(tmp, (u32) SRC);
+		CONT;
+	ALU64_MOD_K:
+		DST -= div64_u64(DST, IMM) * IMM;
+		CONT;
+	ALU_MOD_K:
+		tmp = (u32) DST;
+		DST = do_div(tmp, (u32) IMM);
+		CONT;
+	ALU64_DIV_X:
+		if (unlikely(SRC == 0))
+			return 0;
+		DST = div64_u64(DST, SRC);
+		CONT;
+	ALU_DIV_X:
+		if (unlikely((u32) SRC == 0))
+			return 0;
+		tmp = (u32) DST;
+		do_div(tmp, (u32) SRC);
+		DST = (u32) tmp;
+		CONT;
+	ALU64_DIV_K:
+		DST = div64_u64(DST, IMM);
+		CONT;
+	ALU_DIV_K:
+		tmp = (u32) DST;
+		do_div(tmp, (u32) IMM);
+		DST = (u32) tmp;
+		CONT;
+	ALU_END_TO_BE:
+		switch (IMM) {
+		case 16:
+			DST = (__force u16) cpu_to_be16(DST);
+			break;
+		case 32:
+			DST = (__force u32) cpu_to_be32(DST);
+			break;
+		case 64:
+			DST = (__force u64) cpu_to_be64(DST);
+			break;
+		}
+		CONT;
+	ALU_END_TO_LE:
+		switch (IMM) {
+		case 16:
+			DST = (__force u16) cpu_to_le16(DST);
+			break;
+		case 32:
+			DST = (__force u32) cpu_to_le32(DST);
+			break;
+		case 64:
+			DST = (__force u64) cpu_to_le64(DST);
+			break;
+		}
+		CONT;
+
+	/* CALL */
+	JMP_CALL_0:
+		/* Function call scratches R1-R5 registers, preserves R6-R9,
+		 * and stores return value into R0.
+		 */
+		BPF_R0 = (__bpf_call_base + insn->imm)(BPF_R1, BPF_R2, BPF_R3,
+						       BPF_R4, BPF_R5);
+		CONT;
+
+	/* JMP */
+	JMP_JA_0:
+		insn += insn->off;
+		CONT;
+	JMP_JEQ_X:
+		if (DST == SRC) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_JEQ_K:
+		if (DST == IMM) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_JNE_X:
+		if (DST != SRC) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_JNE_K:
+		if (DST != IMM) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_JGT_X:
+		if (DST > SRC) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_JGT_K:
+		if (DST > IMM) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_JGE_X:
+		if (DST >= SRC) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_JGE_K:
+		if (DST >= IMM) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_JSGT_X:
+		if (((s64) DST) > ((s64) SRC)) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_JSGT_K:
+		if (((s64) DST) > ((s64) IMM)) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_JSGE_X:
+		if (((s64) DST) >= ((s64) SRC)) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_JSGE_K:
+		if (((s64) DST) >= ((s64) IMM)) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_JSET_X:
+		if (DST & SRC) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_JSET_K:
+		if (DST & IMM) {
+			insn += insn->off;
+			CONT_JMP;
+		}
+		CONT;
+	JMP_EXIT_0:
+		return BPF_R0;
+
+	/* STX and ST and LDX*/
+#define LDST(SIZEOP, SIZE)						\
+	STX_MEM_##SIZEOP:						\
+		*(SIZE *)(unsigned long) (DST + insn->off) = SRC;	\
+		CONT;							\
+	ST_MEM_##SIZEOP:						\
+		*(SIZE *)(unsigned long) (DST + insn->off) = IMM;	\
+		CONT;							\
+	LDX_MEM_##SIZEOP:						\
+		DST = *(SIZE *)(unsigned long) (SRC + insn->off);	\
+		CONT;
+
+	LDST(B,   u8)
+	LDST(H,  u16)
+	LDST(W,  u32)
+	LDST(DW, u64)
+#undef LDST
+	STX_XADD_W: /* lock xadd *(u32 *)(DST + off16) += SRC */
+		atomic_add((u32) SRC, (atomic_t *)(unsigned long)
+			   (DST + insn->off));
+		CONT;
+	STX_XADD_DW: /* lock xadd *(u64 *)(DST + off16) += SRC */
+		atomic64_add((u64) SRC, (atomic64_t *)(unsigned long)
+			     (DST + insn->off));
+		CONT;
+	LD_IMM_DW: /* DST = imm64, split over this and the next slot */
+		DST = (u64) (u32) insn[0].imm | ((u64) (u32) insn[1].imm) << 32;
+		insn++;
+		CONT;
+	LD_ABS_W: /* R0 = ntohl(*(u32 *) (skb->data + IMM)) */
+		off = IMM;
+load_word:
+		/* BPF_LD | BPF_ABS and BPF_LD | BPF_IND only appear in
+		 * programs whose context is an skb, which is kept in CTX
+		 * (R6) by sk_convert_filter().  They are wrappers around
+		 * function calls: they scratch R1-R5, preserve R6-R9 and
+		 * return the 8/16/32-bit skb data, converted to cpu
+		 * endianness, in R0.  A failed load ends the program with
+		 * a return value of 0, exactly like classic BPF.
+		 */
+		ptr = load_pointer((struct sk_buff *) (unsigned long) CTX, off,
+				   4, &tmp);
+		if (likely(ptr != NULL)) {
+			BPF_R0 = get_unaligned_be32(ptr);
+			CONT;
+		}
+		return 0;
+	LD_ABS_H: /* R0 = ntohs(*(u16 *) (skb->data + IMM)) */
+		off = IMM;
+load_half:
+		ptr = load_pointer((struct sk_buff *) (unsigned long) CTX, off,
+				   2, &tmp);
+		if (likely(ptr != NULL)) {
+			BPF_R0 = get_unaligned_be16(ptr);
+			CONT;
+		}
+		return 0;
+	LD_ABS_B: /* R0 = *(u8 *) (skb->data + IMM) */
+		off = IMM;
+load_byte:
+		ptr = load_pointer((struct sk_buff *) (unsigned long) CTX, off,
+				   1, &tmp);
+		if (likely(ptr != NULL)) {
+			BPF_R0 = *(u8 *)ptr;
+			CONT;
+		}
+		return 0;
+	LD_IND_W: /* R0 = ntohl(*(u32 *) (skb->data + SRC + IMM)) */
+		off = IMM + SRC;
+		goto load_word;
+	LD_IND_H: /* R0 = ntohs(*(u16 *) (skb->data + SRC + IMM)) */
+		off = IMM + SRC;
+		goto load_half;
+	LD_IND_B: /* R0 = *(u8 *) (skb->data + SRC + IMM) */
+		off = IMM + SRC;
+		goto load_byte;
+
+	default_label:
+		/* If we ever reach this, we have a bug somewhere. */
+		WARN_RATELIMIT(1, "unknown opcode %02x\n", insn->code);
+		return 0;
+#undef BPF_R0
+#undef BPF_R1
+#undef BPF_R2
+#undef BPF_R3
+#undef BPF_R4
+#undef BPF_R5
+#undef CTX
+#undef FP
+#undef DST
+#undef SRC
+#undef IMM
+#undef CONT
+#undef CONT_JMP
+}
+
+unsigned int sk_run_filter_int_skb(const struct sk_buff *ctx,
+				   const struct sock_filter_int *insni)
+{
+	return __sk_run_filter((void *) ctx, insni);
+}
+EXPORT_SYMBOL_GPL(sk_run_filter_int_skb);
+
+/* Helper to find the offset of pkt_type in sk_buff structure.  We want
+ * to make sure it's still a 3-bit field starting at a byte boundary,
+ * since it can't be loaded with a plain load otherwise.
+ */
+#ifdef __BIG_ENDIAN_BITFIELD
+#define PKT_TYPE_MAX	(7 << 5)
+#else
+#define PKT_TYPE_MAX	7
+#endif
+
+static int pkt_type_offset(void)
+{
+	struct sk_buff skb_probe = { .pkt_type = ~0, };
+	u8 *ct = (u8 *) &skb_probe;
+	unsigned int off;
+
+	for (off = 0; off < sizeof(struct sk_buff); off++) {
+		if (ct[off] == PKT_TYPE_MAX)
+			return off;
+	}
+
+	pr_err_once("Please fix %s, as pkt_type couldn't be found!\n",
+		    __func__);
+	return -1;
+}
+
+/* Return value of a helper that wants the program to end with 0, as
+ * the classic interpreter does on malformed netlink attributes.  It
+ * can't be confused with A, which only ever holds 32-bit values.
+ */
+#define BPF_HELPER_ABORT	(~0ULL)
+
+static u64 __skb_get_nlattr(u64 ctx, u64 A, u64 X, u64 r4, u64 r5)
+{
+	struct sk_buff *skb = (struct sk_buff *)(unsigned long) ctx;
+	u32 a = A, x = X;
+	struct nlattr *nla;
+
+	if (skb_is_nonlinear(skb))
+		return BPF_HELPER_ABORT;
+	if (a > skb->len - sizeof(struct nlattr))
+		return BPF_HELPER_ABORT;
+
+	nla = nla_find((struct nlattr *) &skb->data[a], skb->len - a, x);
+	if (nla)
+		return (void *) nla - (void *) skb->data;
+
+	return 0;
+}
+
+static u64 __skb_get_nlattr_nest(u64 ctx, u64 A, u64 X, u64 r4, u64 r5)
+{
+	struct sk_buff *skb = (struct sk_buff *)(unsigned long) ctx;
+	u32 a = A, x = X;
+	struct nlattr *nla;
+
+	if (skb_is_nonlinear(skb))
+		return BPF_HELPER_ABORT;
+	if (a > skb->len - sizeof(struct nlattr))
+		return BPF_HELPER_ABORT;
+
+	nla = (struct nlattr *) &skb->data[a];
+	if (nla->nla_len > a - skb->len)
+		return BPF_HELPER_ABORT;
+
+	nla = nla_find_nested(nla, x);
+	if (nla)
+		return (void *) nla - (void *) skb->data;
+
+	return 0;
+}
+
+static u64 __get_raw_cpu_id(u64 ctx, u64 A, u64 X, u64 r4, u64 r5)
+{
+	return raw_smp_processor_id();
+}
+
+/* A = map[k][X], the low 32 bits of the value or 0 if X isn't there */
+static u64 __bpf_map_ld(u64 map, u64 X, u64 r3, u64 r4, u64 r5)
+{
+	return (u32) bpf_map_read_u64((struct bpf_map *)(unsigned long) map, X);
+}
+
+/* map[k][X] += A, leaving A alone */
+static u64 __bpf_map_add(u64 map, u64 X, u64 A, u64 r4, u64 r5)
+{
+	bpf_map_add_u64((struct bpf_map *)(unsigned long) map, X, (u32) A);
+	return A;
+}
+
+/* Size of a pointer-sized sk_buff or net_device field as a BPF load. */
+#define BPF_PTR_SIZE	(sizeof(void *) == sizeof(u64) ? BPF_DW : BPF_W)
+
+/* Offset of classic scratch memory word K in the internal stack frame. */
+#define BPF_MEM_OFF(K)	(-(BPF_MEMWORDS - (int) (K)) * 4)
+
+/* Longest translation of a packet access by xdp_convert_insn() */
+#define XDP_MAX_INSNS	12
+
+/*
+ * XDP filters get a struct xdp_buff instead of an skb, so their packet
+ * accesses become direct loads, checked against the end of the frame
+ * and ending the program with 0 if out of bounds, as in classic BPF.
+ * Anything else that would look at the skb is refused.  Returns the
+ * number of insns written to @insn, 0 if @fp is translated as usual
+ * or -EINVAL.
+ */
+static int xdp_convert_insn(const struct sock_filter *fp,
+			    struct sock_filter_int *insn)
+{
+	struct sock_filter_int *start = insn;
+	int size, dst = BPF_REG_A;
+
+	switch (fp->code) {
+	case BPF_S_LD_W_LEN:
+	case BPF_S_LDX_W_LEN:
+		if (fp->code == BPF_S_LDX_W_LEN)
+			dst = BPF_REG_X;
+		*insn++ = BPF_LDX_MEM(BPF_PTR_SIZE, dst, BPF_REG_CTX,
+				      offsetof(struct xdp_buff, data_end));
+		*insn++ = BPF_LDX_MEM(BPF_PTR_SIZE, BPF_REG_TMP, BPF_REG_CTX,
+				      offsetof(struct xdp_buff, data));
+		*insn++ = BPF_ALU32_REG(BPF_SUB, dst, BPF_REG_TMP);
+		return insn - start;
+
+	case BPF_S_LD_W_ABS:
+	case BPF_S_LD_H_ABS:
+	case BPF_S_LD_B_ABS:
+	case BPF_S_LDX_B_MSH:
+		/* negative offsets are the SKF_NET_OFF and SKF_LL_OFF areas */
+		if ((int) fp->k < 0)
+			return -EINVAL;
+		/* TMP = data + K */
+		*insn++ = BPF_LDX_MEM(BPF_PTR_SIZE, BPF_REG_TMP, BPF_REG_CTX,
+				      offsetof(struct xdp_buff, data));
+		*insn++ = BPF_ALU64_IMM(BPF_ADD, BPF_REG_TMP, fp->k);
+		break;
+
+	case BPF_S_LD_W_IND:
+	case BPF_S_LD_H_IND:
+	case BPF_S_LD_B_IND:
+		/* TMP = data + (u32) (X + K) */
+		*insn++ = BPF_MOV32_REG(BPF_REG_ARG1, BPF_REG_X);
+		*insn++ = BPF_ALU32_IMM(BPF_ADD, BPF_REG_ARG1, fp->k);
+		*insn++ = BPF_LDX_MEM(BPF_PTR_SIZE, BPF_REG_TMP, BPF_REG_CTX,
+				      offsetof(struct xdp_buff, data));
+		*insn++ = BPF_ALU64_REG(BPF_ADD, BPF_REG_TMP, BPF_REG_ARG1);
+		break;
+
+	case BPF_S_ANC_PROTOCOL:
+	case BPF_S_ANC_PKTTYPE:
+	case BPF_S_ANC_IFINDEX:
+	case BPF_S_ANC_NLATTR:
+	case BPF_S_ANC_NLATTR_NEST:
+	case BPF_S_ANC_MARK:
+	case BPF_S_ANC_QUEUE:
+	case BPF_S_ANC_HATYPE:
+	case BPF_S_ANC_RXHASH:
+		return -EINVAL;
+
+	default:
+		return 0;
+	}
+
+	switch (fp->code) {
+	case BPF_S_LD_W_ABS:
+	case BPF_S_LD_W_IND:
+		size = 4;
+		break;
+	case BPF_S_LD_H_ABS:
+	case BPF_S_LD_H_IND:
+		size = 2;
+		break;
+	case BPF_S_LDX_B_MSH:
+		dst = BPF_REG_X;
+		/* fall through */
+	default:
+		size = 1;
+		break;
+	}
+
+	/* if (TMP + size > data_end) return 0 */
+	*insn++ = BPF_MOV64_REG(BPF_REG_ARG1, BPF_REG_TMP);
+	*insn++ = BPF_ALU64_IMM(BPF_ADD, BPF_REG_ARG1, size);
+	*insn++ = BPF_LDX_MEM(BPF_PTR_SIZE, BPF_REG_ARG2, BPF_REG_CTX,
+			      offsetof(struct xdp_buff, data_end));
+	*insn++ = BPF_JMP_REG(BPF_JGE, BPF_REG_ARG2, BPF_REG_ARG1, 2);
+	*insn++ = BPF_MOV32_IMM(BPF_REG_A, 0);
+	*insn++ = BPF_EXIT_INSN();
+
+	switch (size) {
+	case 4:
+		*insn++ = BPF_LDX_MEM(BPF_W, dst, BPF_REG_TMP, 0);
+		*insn++ = BPF_ENDIAN(BPF_FROM_BE, dst, 32);
+		break;
+	case 2:
+		*insn++ = BPF_LDX_MEM(BPF_H, dst, BPF_REG_TMP, 0);
+		*insn++ = BPF_ENDIAN(BPF_FROM_BE, dst, 16);
+		break;
+	default:
+		*insn++ = BPF_LDX_MEM(BPF_B, dst, BPF_REG_TMP, 0);
+		break;
+	}
+
+	if (fp->code == BPF_S_LDX_B_MSH) {
+		*insn++ = BPF_ALU32_IMM(BPF_AND, BPF_REG_X, 0xf);
+		*insn++ = BPF_ALU32_IMM(BPF_LSH, BPF_REG_X, 2);
+	}
+	return insn - start;
+}
+
+/* sk_convert_filter(), for a program run on a struct xdp_buff if @xdp */
+static int __sk_convert_filter(struct sock_filter *prog, int len,
+			       struct sock_filter_int *new_prog, int *new_len,
+			       bool xdp)
+{
+	struct sock_filter_int xdp_insns[XDP_MAX_INSNS];
+	struct sock_filter *fp;
+	int *addrs, pass, n = 0, i, j, cnt, err = -EINVAL;
+
+	BUILD_BUG_ON(BPF_MEMWORDS * sizeof(u32) > MAX_BPF_STACK);
+	BUILD_BUG_ON(BPF_REG_FP + 1 != MAX_BPF_REG);
+	BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, len) != 4);
+	BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, protocol) != 2);
+	BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, mark) != 4);
+	BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, queue_mapping) != 2);
+	BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, rxhash) != 4);
+	BUILD_BUG_ON(FIELD_SIZEOF(struct net_device, ifindex) != 4);
+	BUILD_BUG_ON(FIELD_SIZEOF(struct net_device, type) != 2);
+
+	if (len <= 0 || len > BPF_MAXINSNS)
+		return -EINVAL;
+
+	/* addrs[i] is the index of the first internal insn of classic i */
+	addrs = kcalloc(len, sizeof(*addrs), GFP_KERNEL);
+	if (!addrs)
+		return -ENOMEM;
+
+#define EMIT(insn)				\
+do {						\
+	if (new_prog)				\
+		new_prog[n] = insn;		\
+	n++;					\
+} while (0)
+
+/* offset of the jump emitted next to reach classic insn T */
+#define JMP_OFF(T)	(addrs[T] - n - 1)
+
+	/* Lengths don't depend on jump offsets, so the first pass sizes the
+	 * program and fills addrs[], the second one emits the final code.
+	 */
+	for (pass = 0; pass < 2; pass++) {
+		if (pass && !new_prog)
+			break;
+		n = 0;
+
+		/* Classic BPF expects A and X to start out as zero. */
+		EMIT(BPF_MOV64_REG(BPF_REG_CTX, BPF_REG_ARG1));
+		EMIT(BPF_ALU32_REG(BPF_XOR, BPF_REG_A, BPF_REG_A));
+		EMIT(BPF_ALU32_REG(BPF_XOR, BPF_REG_X, BPF_REG_X));
+
+		for (fp = prog, i = 0; i < len; fp++, i++) {
+			struct sock_filter_int jmp;
+			int op, src, off;
+
+			addrs[i] = n;
+
+			if (xdp) {
+				cnt = xdp_convert_insn(fp, xdp_insns);
+				if (cnt < 0)
+					goto out;
+				for (j = 0; j < cnt; j++)
+					EMIT(xdp_insns[j]);
+				if (cnt)
+					continue;
+			}
+
+			switch (fp->code) {
+#define ALU_CASE(OP)							\
+			case BPF_S_ALU_##OP##_K:				\
+				EMIT(BPF_ALU32_IMM(BPF_##OP, BPF_REG_A, fp->k));	\
+				break;						\
+			case BPF_S_ALU_##OP##_X:				\
+				EMIT(BPF_ALU32_REG(BPF_##OP, BPF_REG_A,	\
+						   BPF_REG_X));		\
+				break;
+			ALU_CASE(ADD)
+			ALU_CASE(SUB)
+			ALU_CASE(MUL)
+			ALU_CASE(AND)
+			ALU_CASE(OR)
+			ALU_CASE(LSH)
+			ALU_CASE(RSH)
+#undef ALU_CASE
+			case BPF_S_ALU_DIV_X:
+				EMIT(BPF_ALU32_REG(BPF_DIV, BPF_REG_A, BPF_REG_X));
+				break;
+			case BPF_S_ALU_DIV_K:
+				/* sk_chk_filter() replaced K by its reciprocal:
+				 * A = ((u64) A * K) >> 32, A is zero extended.
+				 */
+				EMIT(BPF_MOV32_IMM(BPF_REG_TMP, fp->k));
+				EMIT(BPF_ALU64_REG(BPF_MUL, BPF_REG_A, BPF_REG_TMP));
+				EMIT(BPF_ALU64_IMM(BPF_RSH, BPF_REG_A, 32));
+				break;
+			case BPF_S_ALU_NEG:
+				EMIT(BPF_ALU32_IMM(BPF_NEG, BPF_REG_A, 0));
+				break;
+
+			case BPF_S_LD_W_ABS:
+				EMIT(BPF_LD_ABS(BPF_W, fp->k));
+				break;
+			case BPF_S_LD_H_ABS:
+				EMIT(BPF_LD_ABS(BPF_H, fp->k));
+				break;
+			case BPF_S_LD_B_ABS:
+				EMIT(BPF_LD_ABS(BPF_B, fp->k));
+				break;
+			case BPF_S_LD_W_IND:
+				EMIT(BPF_LD_IND(BPF_W, BPF_REG_X, fp->k));
+				break;
+			case BPF_S_LD_H_IND:
+				EMIT(BPF_LD_IND(BPF_H, BPF_REG_X, fp->k));
+				break;
+			case BPF_S_LD_B_IND:
+				EMIT(BPF_LD_IND(BPF_B, BPF_REG_X, fp->k));
+				break;
+			case BPF_S_LDX_B_MSH:
+				/* X = (*(u8 *)(skb->data + K) & 0xf) << 2,
+				 * the load goes through A so keep it in TMP.
+				 */
+				EMIT(BPF_MOV64_REG(BPF_REG_TMP, BPF_REG_A));
+				EMIT(BPF_LD_ABS(BPF_B, fp->k));
+				EMIT(BPF_ALU32_IMM(BPF_AND, BPF_REG_A, 0xf));
+				EMIT(BPF_ALU32_IMM(BPF_LSH, BPF_REG_A, 2));
+				EMIT(BPF_MOV64_REG(BPF_REG_X, BPF_REG_A));
+				EMIT(BPF_MOV64_REG(BPF_REG_A, BPF_REG_TMP));
+				break;
+			case BPF_S_LD_W_LEN:
+				EMIT(BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_CTX,
+						 offsetof(struct sk_buff, len)));
+				break;
+			case BPF_S_LDX_W_LEN:
+				EMIT(BPF_LDX_MEM(BPF_W, BPF_REG_X, BPF_REG_CTX,
+						 offsetof(struct sk_buff, len)));
+				break;
+			case BPF_S_LD_IMM:
+				EMIT(BPF_MOV32_IMM(BPF_REG_A, fp->k));
+				break;
+			case BPF_S_LDX_IMM:
+				EMIT(BPF_MOV32_IMM(BPF_REG_X, fp->k));
+				break;
+			case BPF_S_LD_MEM:
+				EMIT(BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_FP,
+						 BPF_MEM_OFF(fp->k)));
+				break;
+			case BPF_S_LDX_MEM:
+				EMIT(BPF_LDX_MEM(BPF_W, BPF_REG_X, BPF_REG_FP,
+						 BPF_MEM_OFF(fp->k)));
+				break;
+			case BPF_S_ST:
+				EMIT(BPF_STX_MEM(BPF_W, BPF_REG_FP, BPF_REG_A,
+						 BPF_MEM_OFF(fp->k)));
+				break;
+			case BPF_S_STX:
+				EMIT(BPF_STX_MEM(BPF_W, BPF_REG_FP, BPF_REG_X,
+						 BPF_MEM_OFF(fp->k)));
+				break;
+			case BPF_S_MISC_TAX:
+				EMIT(BPF_MOV32_REG(BPF_REG_X, BPF_REG_A));
+				break;
+			case BPF_S_MISC_TXA:
+				EMIT(BPF_MOV32_REG(BPF_REG_A, BPF_REG_X));
+				break;
+			case BPF_S_RET_K:
+				EMIT(BPF_MOV32_IMM(BPF_REG_A, fp->k));
+				EMIT(BPF_EXIT_INSN());
+				break;
+			case BPF_S_RET_A:
+				EMIT(BPF_EXIT_INSN());
+				break;
+
+			case BPF_S_ANC_PROTOCOL:
+				EMIT(BPF_LDX_MEM(BPF_H, BPF_REG_A, BPF_REG_CTX,
+						 offsetof(struct sk_buff, protocol)));
+				/* A = ntohs(A) */
+				EMIT(BPF_ENDIAN(BPF_FROM_BE, BPF_REG_A, 16));
+				break;
+			case BPF_S_ANC_PKTTYPE:
+				off = pkt_type_offset();
+				if (off < 0)
+					goto out;
+				EMIT(BPF_LDX_MEM(BPF_B, BPF_REG_A, BPF_REG_CTX, off));
+				EMIT(BPF_ALU32_IMM(BPF_AND, BPF_REG_A, PKT_TYPE_MAX));
+#ifdef __BIG_ENDIAN_BITFIELD
+				EMIT(BPF_ALU32_IMM(BPF_RSH, BPF_REG_A, 5));
+#endif
+				break;
+			case BPF_S_ANC_IFINDEX:
+			case BPF_S_ANC_HATYPE:
+				/* no device means the filter returns 0 */
+				EMIT(BPF_LDX_MEM(BPF_PTR_SIZE, BPF_REG_TMP,
+						 BPF_REG_CTX,
+						 offsetof(struct sk_buff, dev)));
+				EMIT(BPF_JMP_IMM(BPF_JNE, BPF_REG_TMP, 0, 2));
+				EMIT(BPF_MOV32_IMM(BPF_REG_A, 0));
+				EMIT(BPF_EXIT_INSN());
+				if (fp->code == BPF_S_ANC_IFINDEX)
+					EMIT(BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_TMP,
+							 offsetof(struct net_device,
+								  ifindex)));
+				else
+					EMIT(BPF_LDX_MEM(BPF_H, BPF_REG_A, BPF_REG_TMP,
+							 offsetof(struct net_device,
+								  type)));
+				break;
+			case BPF_S_ANC_MARK:
+				EMIT(BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_CTX,
+						 offsetof(struct sk_buff, mark)));
+				break;
+			case BPF_S_ANC_QUEUE:
+				EMIT(BPF_LDX_MEM(BPF_H, BPF_REG_A, BPF_REG_CTX,
+						 offsetof(struct sk_buff,
+							  queue_mapping)));
+				break;
+			case BPF_S_ANC_RXHASH:
+				EMIT(BPF_LDX_MEM(BPF_W, BPF_REG_A, BPF_REG_CTX,
+						 offsetof(struct sk_buff, rxhash)));
+				break;
+			case BPF_S_ANC_CPU:
+				EMIT(BPF_EMIT_CALL(__get_raw_cpu_id));
+				break;
+			case BPF_S_ANC_NLATTR:
+			case BPF_S_ANC_NLATTR_NEST:
+				/* A = helper(skb, A, X) */
+				EMIT(BPF_MOV64_REG(BPF_REG_ARG1, BPF_REG_CTX));
+				EMIT(BPF_MOV64_REG(BPF_REG_ARG2, BPF_REG_A));
+				EMIT(BPF_MOV64_REG(BPF_REG_ARG3, BPF_REG_X));
+				if (fp->code == BPF_S_ANC_NLATTR)
+					EMIT(BPF_EMIT_CALL(__skb_get_nlattr));
+				else
+					EMIT(BPF_EMIT_CALL(__skb_get_nlattr_nest));
+				EMIT(BPF_JMP_IMM(BPF_JNE, BPF_REG_A,
+						 (s32) BPF_HELPER_ABORT, 2));
+				EMIT(BPF_MOV32_IMM(BPF_REG_A, 0));
+				EMIT(BPF_EXIT_INSN());
+				break;
+			case BPF_S_MISC_MAP_LD:
+			case BPF_S_MISC_MAP_ADD: {
+				/* R1 = map fd, replaced by the map itself
+				 * when the filter is attached
+				 */
+				struct sock_filter_int ld_map[] = {
+					BPF_LD_MAP_FD(BPF_REG_ARG1, fp->k)
+				};
+
+				EMIT(ld_map[0]);
+				EMIT(ld_map[1]);
+				EMIT(BPF_MOV64_REG(BPF_REG_ARG2, BPF_REG_X));
+				if (fp->code == BPF_S_MISC_MAP_LD) {
+					EMIT(BPF_EMIT_CALL(__bpf_map_ld));
+				} else {
+					EMIT(BPF_MOV64_REG(BPF_REG_ARG3, BPF_REG_A));
+					EMIT(BPF_EMIT_CALL(__bpf_map_add));
+				}
+				break;
+			}
+
+			case BPF_S_JMP_JA:
+				EMIT(BPF_JMP_A(JMP_OFF(i + 1 + fp->k)));
+				break;
+#define JMP_CASE(OP, SRC)						\
+			case BPF_S_JMP_##OP##_##SRC:			\
+				op = BPF_##OP;					\
+				src = BPF_##SRC;				\
+				goto cond_jmp;
+			JMP_CASE(JEQ, K)
+			JMP_CASE(JEQ, X)
+			JMP_CASE(JGT, K)
+			JMP_CASE(JGT, X)
+			JMP_CASE(JGE, K)
+			JMP_CASE(JGE, X)
+			JMP_CASE(JSET, K)
+			JMP_CASE(JSET, X)
+#undef JMP_CASE
+cond_jmp:
+				if (fp->jt == fp->jf) {
+					if (fp->jt)
+						EMIT(BPF_JMP_A(JMP_OFF(i + 1 + fp->jt)));
+					break;
+				}
+				/* Internal immediates are sign extended to 64
+				 * bits while classic K is compared as u32, so
+				 * large constants go through TMP instead.
+				 */
+				if (src == BPF_K && (int) fp->k < 0) {
+					EMIT(BPF_MOV32_IMM(BPF_REG_TMP, fp->k));
+					jmp = BPF_JMP_REG(op, BPF_REG_A,
+							  BPF_REG_TMP, 0);
+				} else if (src == BPF_K) {
+					jmp = BPF_JMP_IMM(op, BPF_REG_A,
+							  fp->k, 0);
+				} else {
+					jmp = BPF_JMP_REG(op, BPF_REG_A,
+							  BPF_REG_X, 0);
+				}
+
+				if (fp->jf == 0) {
+					jmp.off = JMP_OFF(i + 1 + fp->jt);
+					EMIT(jmp);
+				} else if (fp->jt == 0 && op == BPF_JEQ) {
+					/* jump_true is the next insn */
+					jmp.code = BPF_JMP | BPF_JNE |
+						   BPF_SRC(jmp.code);
+					jmp.off = JMP_OFF(i + 1 + fp->jf);
+					EMIT(jmp);
+				} else {
+					/* Jxx to jump_true and JA to jump_false */
+					jmp.off = JMP_OFF(i + 1 + fp->jt);
+					EMIT(jmp);
+					EMIT(BPF_JMP_A(JMP_OFF(i + 1 + fp->jf)));
+				}
+				break;
+			default:
+				goto out;
+			}
+		}
+	}
+	*new_len = n;
+	err = 0;
+out:
+	kfree(addrs);
+	return err;
+#undef JMP_OFF
+#undef EMIT
+}
+
+/**
+ *	sk_convert_filter - convert a checked classic filter to internal BPF
+ *	@prog: classic filter, already verified by sk_chk_filter()
+ *	@len: length of the classic filter
+ *	@new_prog: buffer for the internal program, or NULL
+ *	@new_len: set to the length of the internal program
+ *
+ * With @new_prog set to NULL only the length of the internal program
+ * is computed; callers use it to size the buffer for the second call.
+ * Classic A and X live in R0 and R7, the skb is kept in R6 and the
+ * scratch memory words are placed on the stack below R10.  Returns 0
+ * or a negative errno.
+ */
+int sk_convert_filter(struct sock_filter *prog, int len,
+		      struct sock_filter_int *new_prog, int *new_len)
+{
+	return __sk_convert_filter(prog, len, new_prog, new_len, false);
+}
+EXPORT_SYMBOL_GPL(sk_convert_filter);
+
 /*
  * Security :
  * A BPF program is able to use 16 cells of memory to store intermediate
@@ -424,21 +1444,8 @@ error:
 	return ret;
 }
 
-/**
- *	sk_chk_filter - verify socket filter code
- *	@filter: filter to verify
- *	@flen: length of filter
- *
- * Check the user's filter code. If we let some ugly
- * filter code slip through kaboom! The filter must contain
- * no references or jumps that are out of range, no illegal
- * instructions, and must end with a RET instruction.
- *
- * All jumps are forward as they are not signed.
- *
- * Returns 0 if the rule set is legal or -EINVAL if not.
- */
-int sk_chk_filter(struct sock_filter *filter, unsigned int flen)
+static int __sk_chk_filter(struct sock_filter *filter, unsigned int flen,
+			   bool maps)
 {
 	/*
 	 * Valid instructions are initialized to non-0.
@@ -474,6 +1481,8 @@ int sk_chk_filter(struct sock_filter *filter, unsigned int flen)
 		[BPF_LDX|BPF_IMM]        = BPF_S_LDX_IMM,
 		[BPF_MISC|BPF_TAX]       = BPF_S_MISC_TAX,
 		[BPF_MISC|BPF_TXA]       = BPF_S_MISC_TXA,
+		[BPF_MISC|BPF_MAP_LD]    = BPF_S_MISC_MAP_LD,
+		[BPF_MISC|BPF_MAP_ADD]   = BPF_S_MISC_MAP_ADD,
 		[BPF_RET|BPF_K]          = BPF_S_RET_K,
 		[BPF_RET|BPF_A]          = BPF_S_RET_A,
 		[BPF_ALU|BPF_DIV|BPF_K]  = BPF_S_ALU_DIV_K,
@@ -544,6 +1553,12 @@ int sk_chk_filter(struct sock_filter *filter, unsigned int flen)
 			    pc + ftest->jf + 1 >= flen)
 				return -EINVAL;
 			break;
+		case BPF_S_MISC_MAP_LD:
+		case BPF_S_MISC_MAP_ADD:
+			/* only socket filters run as internal BPF */
+			if (!maps)
+				return -EINVAL;
+			break;
 		case BPF_S_LD_W_ABS:
 		case BPF_S_LD_H_ABS:
 		case BPF_S_LD_B_ABS:
@@ -574,8 +1589,87 @@ int sk_chk_filter(struct sock_filter *filter, unsigned int flen)
 	}
 	return -EINVAL;
 }
+
+/**
+ *	sk_chk_filter - verify socket filter code
+ *	@filter: filter to verify
+ *	@flen: length of filter
+ *
+ * Check the user's filter code. If we let some ugly
+ * filter code slip through kaboom! The filter must contain
+ * no references or jumps that are out of range, no illegal
+ * instructions, and must end with a RET instruction.
+ *
+ * All jumps are forward as they are not signed.  BPF map
+ * instructions are refused, as the caller may run @filter
+ * with sk_run_filter().
+ *
+ * Returns 0 if the rule set is legal or -EINVAL if not.
+ */
+int sk_chk_filter(struct sock_filter *filter, unsigned int flen)
+{
+	return __sk_chk_filter(filter, flen, false);
+}
 EXPORT_SYMBOL(sk_chk_filter);
 
+/* Map pointer loaded by a BPF_LD_MAP_FD insn after sk_resolve_maps() */
+static struct bpf_map *sk_insn_map(const struct sock_filter_int *insn)
+{
+	return (struct bpf_map *)(unsigned long)
+		((u64) (u32) insn[0].imm | ((u64) (u32) insn[1].imm) << 32);
+}
+
+/* Drop the map references held by the first @len insns of @fp. */
+static void sk_release_maps(struct sk_filter *fp, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if (fp->insnsi[i].code == (BPF_LD | BPF_IMM | BPF_DW))
+			bpf_map_put(sk_insn_map(&fp->insnsi[i++]));
+	}
+}
+
+/*
+ * Replace the map fds sk_convert_filter() left in BPF_LD_MAP_FD insns,
+ * the only 64-bit immediate loads it emits, by pointers to the maps and
+ * take a reference on each.  Filters see maps through bpf_map_read_u64()
+ * and bpf_map_add_u64(), so only u32 keys and u64 values are accepted.
+ */
+static int sk_resolve_maps(struct sk_filter *fp)
+{
+	struct sock_filter_int *insn;
+	struct bpf_map *map;
+	u64 addr;
+	int i;
+
+	for (i = 0; i < fp->len; i++) {
+		insn = &fp->insnsi[i];
+		if (insn->code != (BPF_LD | BPF_IMM | BPF_DW))
+			continue;
+
+		map = bpf_map_get(insn->imm);
+		if (IS_ERR(map)) {
+			sk_release_maps(fp, i);
+			return PTR_ERR(map);
+		}
+		if (map->key_size != sizeof(u32) ||
+		    map->value_size != sizeof(u64)) {
+			bpf_map_put(map);
+			sk_release_maps(fp, i);
+			return -EINVAL;
+		}
+
+		addr = (unsigned long) map;
+		insn[0].src_reg = 0;
+		insn[0].imm = (u32) addr;
+		insn[1].imm = addr >> 32;
+		fp->has_maps = 1;
+		i++;
+	}
+	return 0;
+}
+
 /**
  * 	sk_filter_release_rcu - Release a socket filter by rcu_head
  *	@rcu: rcu_head that contains the sk_filter to free
@@ -584,11 +1678,211 @@ void sk_filter_release_rcu(struct rcu_head *rcu)
 {
 	struct sk_filter *fp = container_of(rcu, struct sk_filter, rcu);
 
+	if (fp->has_maps)
+		sk_release_maps(fp, fp->len);
 	bpf_jit_free(fp);
 	kfree(fp);
 }
 EXPORT_SYMBOL(sk_filter_release_rcu);
 
+static void __sk_filter_free(struct sk_filter *fp, struct sock *sk)
+{
+	if (sk)
+		sock_kfree_s(sk, fp, sk_filter_len(fp));
+	else
+		kfree(fp);
+}
+
+static struct sk_filter *__sk_filter_alloc(unsigned int len, struct sock *sk)
+{
+	unsigned int fsize = len * sizeof(struct sock_filter) +
+			     sizeof(struct sk_filter);
+
+	if (sk)
+		return sock_kmalloc(sk, fsize, GFP_KERNEL);
+	return kmalloc(fsize, GFP_KERNEL);
+}
+
+/*
+ * Replace the classic program of @fp by its internal BPF translation,
+ * run on a struct xdp_buff rather than an skb if @xdp is set.  Both
+ * representations use 8-byte instructions, so sk_filter_len() stays
+ * valid for charging either of them to the socket.  The translation
+ * is allocated uncharged and only takes over the charge of @fp once
+ * @fp is gone, so a program close to sysctl_optmem_max still fits.
+ * If the translation itself does not fit, fail with -ENOMEM and leave
+ * the filter attached to @sk alone.
+ */
+static struct sk_filter *__sk_migrate_filter(struct sk_filter *fp,
+					     struct sock *sk, bool xdp)
+{
+	struct sk_filter *new_fp;
+	int err, new_len;
+
+	BUILD_BUG_ON(sizeof(struct sock_filter) !=
+		     sizeof(struct sock_filter_int));
+
+	err = __sk_convert_filter(fp->insns, fp->len, NULL, &new_len, xdp);
+	if (err)
+		goto out_err;
+
+	new_fp = __sk_filter_alloc(new_len, NULL);
+	if (!new_fp) {
+		err = -ENOMEM;
+		goto out_err;
+	}
+
+	new_fp->len = new_len;
+	new_fp->has_maps = 0;
+	err = __sk_convert_filter(fp->insns, fp->len, new_fp->insnsi,
+				  &new_len, xdp);
+	if (!err)
+		err = sk_resolve_maps(new_fp);
+	if (err) {
+		__sk_filter_free(new_fp, NULL);
+		goto out_err;
+	}
+
+	if (sk && atomic_read(&sk->sk_omem_alloc) - sk_filter_len(fp) +
+		  sk_filter_len(new_fp) > sysctl_optmem_max) {
+		__sk_filter_free(new_fp, NULL);
+		err = -ENOMEM;
+		goto out_err;
+	}
+
+	atomic_set(&new_fp->refcnt, 1);
+	new_fp->jited = 0;
+	new_fp->bpf_func = sk_run_filter_int_skb;
+	__sk_filter_free(fp, sk);
+	if (sk)
+		atomic_add(sk_filter_len(new_fp), &sk->sk_omem_alloc);
+
+	bpf_int_jit_compile(new_fp);
+	return new_fp;
+
+out_err:
+	__sk_filter_free(fp, sk);
+	return ERR_PTR(err);
+}
+
+/*
+ * Check a freshly copied classic program and pick how it runs: an
+ * architecture JIT for classic BPF gets the first go, everything else
+ * is translated to internal BPF and either JITed or interpreted.
+ * Consumes @fp on error.
+ */
+static struct sk_filter *__sk_prepare_filter(struct sk_filter *fp,
+					     struct sock *sk)
+{
+	int err;
+
+	atomic_set(&fp->refcnt, 1);
+	fp->jited = 0;
+	fp->has_maps = 0;
+	fp->bpf_func = NULL;
+
+	err = __sk_chk_filter(fp->insns, fp->len, true);
+	if (err) {
+		__sk_filter_free(fp, sk);
+		return ERR_PTR(err);
+	}
+
+	bpf_jit_compile(fp);
+	if (fp->jited)
+		return fp;
+
+	return __sk_migrate_filter(fp, sk, false);
+}
+
+/* Architectures JITing internal BPF provide their own version. */
+void __weak bpf_int_jit_compile(struct sk_filter *fp)
+{
+}
+
+/**
+ *	sk_unattached_filter_create - create a filter not bound to a socket
+ *	@pfp: the unattached filter that is created
+ *	@fprog: the filter program, with @fprog->filter in kernel memory
+ *
+ * Create a filter independent of any socket, for in-kernel users that
+ * want to run it with SK_RUN_FILTER().  Returns 0 or a negative errno.
+ */
+int sk_unattached_filter_create(struct sk_filter **pfp,
+				struct sock_fprog *fprog)
+{
+	unsigned int fsize = sizeof(struct sock_filter) * fprog->len;
+	struct sk_filter *fp;
+
+	/* Make sure new filter is there and in the right amounts. */
+	if (fprog->filter == NULL)
+		return -EINVAL;
+
+	fp = __sk_filter_alloc(fprog->len, NULL);
+	if (!fp)
+		return -ENOMEM;
+	memcpy(fp->insns, (void __force *) fprog->filter, fsize);
+	fp->len = fprog->len;
+
+	fp = __sk_prepare_filter(fp, NULL);
+	if (IS_ERR(fp))
+		return PTR_ERR(fp);
+
+	*pfp = fp;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sk_unattached_filter_create);
+
+void sk_unattached_filter_destroy(struct sk_filter *fp)
+{
+	sk_filter_release(fp);
+}
+EXPORT_SYMBOL_GPL(sk_unattached_filter_destroy);
+
+/**
+ *	xdp_filter_create - create a filter for received frames
+ *	@pfp: the filter that is created
+ *	@insns: classic filter program, in kernel memory
+ *	@len: number of instructions in @insns
+ *
+ * Create a filter to be run with xdp_run_filter() by a driver, on a
+ * frame that has no skb yet.  The filter may only look at the frame
+ * data and its length; ancillary loads and the SKF_NET_OFF and
+ * SKF_LL_OFF areas are refused.  It returns one of the XDP_* verdicts.
+ * Release it with sk_filter_release().  Returns 0 or a negative errno.
+ */
+int xdp_filter_create(struct sk_filter **pfp, const struct sock_filter *insns,
+		      unsigned int len)
+{
+	struct sk_filter *fp;
+	int err;
+
+	if (len == 0 || len > BPF_MAXINSNS)
+		return -EINVAL;
+
+	fp = __sk_filter_alloc(len, NULL);
+	if (!fp)
+		return -ENOMEM;
+	memcpy(fp->insns, insns, len * sizeof(*insns));
+	fp->len = len;
+	fp->jited = 0;
+	fp->has_maps = 0;
+
+	/* classic JITs only know about skbs, go straight to internal BPF */
+	err = __sk_chk_filter(fp->insns, fp->len, true);
+	if (err) {
+		__sk_filter_free(fp, NULL);
+		return err;
+	}
+
+	fp = __sk_migrate_filter(fp, NULL, true);
+	if (IS_ERR(fp))
+		return PTR_ERR(fp);
+
+	*pfp = fp;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(xdp_filter_create);
+
 /**
  *	sk_attach_filter - attach a socket filter
  *	@fprog: the filter program
@@ -603,31 +1897,23 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 {
 	struct sk_filter *fp, *old_fp;
 	unsigned int fsize = sizeof(struct sock_filter) * fprog->len;
-	int err;
 
 	/* Make sure new filter is there and in the right amounts. */
 	if (fprog->filter == NULL)
 		return -EINVAL;
 
-	fp = sock_kmalloc(sk, fsize+sizeof(*fp), GFP_KERNEL);
+	fp = __sk_filter_alloc(fprog->len, sk);
 	if (!fp)
 		return -ENOMEM;
 	if (copy_from_user(fp->insns, fprog->filter, fsize)) {
 		sock_kfree_s(sk, fp, fsize+sizeof(*fp));
 		return -EFAULT;
 	}
-
-	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
-	fp->bpf_func = sk_run_filter;
 
-	err = sk_chk_filter(fp->insns, fp->len);
-	if (err) {
-		sk_filter_uncharge(sk, fp);
-		return err;
-	}
-
-	bpf_jit_compile(fp);
+	fp = __sk_prepare_filter(fp, sk);
+	if (IS_ERR(fp))
+		return PTR_ERR(fp);
 
 	old_fp = rcu_dereference_protected(sk->sk_filter,
 					   sock_owned_by_user(sk));
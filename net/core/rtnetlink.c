@@ -788,10 +788,28 @@ static noinline size_t if_nlmsg_size(const struct net_device *dev,
 			        & RTEXT_FILTER_VF ? 4 : 0) /* IFLA_NUM_VF */
 	       + rtnl_vfinfo_size(dev, ext_filter_mask) /* IFLA_VFINFO_LIST */
 	       + rtnl_port_size(dev) /* IFLA_VF_PORTS + IFLA_PORT_SELF */
+	       + nla_total_size(0) /* IFLA_XDP */
+	       + nla_total_size(1) /* IFLA_XDP_ATTACHED */
 	       + rtnl_link_get_size(dev) /* IFLA_LINKINFO */
 	       + rtnl_link_get_af_size(dev); /* IFLA_AF_SPEC */
 }
 
+static int rtnl_xdp_fill(struct sk_buff *skb, struct net_device *dev)
+{
+	struct nlattr *xdp;
+
+	xdp = nla_nest_start(skb, IFLA_XDP);
+	if (!xdp)
+		return -EMSGSIZE;
+	if (nla_put_u8(skb, IFLA_XDP_ATTACHED,
+		       !!rcu_access_pointer(dev->xdp_filter))) {
+		nla_nest_cancel(skb, xdp);
+		return -EMSGSIZE;
+	}
+	nla_nest_end(skb, xdp);
+	return 0;
+}
+
 static int rtnl_vf_ports_fill(struct sk_buff *skb, struct net_device *dev)
 {
 	struct nlattr *vf_ports;
@@ -1000,6 +1018,9 @@ static int rtnl_fill_ifinfo(struct sk_buff *skb, struct net_device *dev,
 	if (rtnl_port_fill(skb, dev))
 		goto nla_put_failure;
 
+	if (rtnl_xdp_fill(skb, dev))
+		goto nla_put_failure;
+
 	if (dev->rtnl_link_ops) {
 		if (rtnl_link_fill(skb, dev) < 0)
 			goto nla_put_failure;
@@ -1113,6 +1134,7 @@ const struct nla_policy ifla_policy[IFLA_MAX+1] = {
 	[IFLA_PORT_SELF]	= { .type = NLA_NESTED },
 	[IFLA_AF_SPEC]		= { .type = NLA_NESTED },
 	[IFLA_EXT_MASK]		= { .type = NLA_U32 },
+	[IFLA_XDP]		= { .type = NLA_NESTED },
 };
 EXPORT_SYMBOL(ifla_policy);
 
@@ -1150,6 +1172,11 @@ static const struct nla_policy ifla_port_policy[IFLA_PORT_MAX+1] = {
 	[IFLA_PORT_RESPONSE]	= { .type = NLA_U16, },
 };
 
+static const struct nla_policy ifla_xdp_policy[IFLA_XDP_MAX+1] = {
+	[IFLA_XDP_INSNS]	= { .type = NLA_BINARY },
+	[IFLA_XDP_ATTACHED]	= { .type = NLA_U8 },
+};
+
 struct net *rtnl_link_get_net(struct net *src_net, struct nlattr *tb[])
 {
 	struct net *net;
@@ -1257,6 +1284,28 @@ static int do_setvfinfo(struct net_device *dev, struct nlattr *attr)
 	return err;
 }
 
+static int do_setxdp(struct net_device *dev, struct nlattr *attr)
+{
+	unsigned int len = nla_len(attr);
+	struct sk_filter *fp = NULL;
+	int err;
+
+	if (len % sizeof(struct sock_filter))
+		return -EINVAL;
+
+	if (len) {
+		err = xdp_filter_create(&fp, nla_data(attr),
+					len / sizeof(struct sock_filter));
+		if (err)
+			return err;
+	}
+
+	err = dev_change_xdp_filter(dev, fp);
+	if (err && fp)
+		sk_filter_release(fp);
+	return err;
+}
+
 static int do_set_master(struct net_device *dev, int ifindex)
 {
 	struct net_device *master_dev;
@@ -1515,6 +1564,27 @@ static int do_setlink(struct net_device *dev, struct ifinfomsg *ifm,
 	}
 	err = 0;
 
+	if (tb[IFLA_XDP]) {
+		struct nlattr *xdp[IFLA_XDP_MAX+1];
+
+		err = nla_parse_nested(xdp, IFLA_XDP_MAX, tb[IFLA_XDP],
+				       ifla_xdp_policy);
+		if (err < 0)
+			goto errout;
+
+		if (xdp[IFLA_XDP_ATTACHED]) {
+			err = -EINVAL;
+			goto errout;
+		}
+
+		if (xdp[IFLA_XDP_INSNS]) {
+			err = do_setxdp(dev, xdp[IFLA_XDP_INSNS]);
+			if (err < 0)
+				goto errout;
+			modified = 1;
+		}
+	}
+
 errout:
 	if (err < 0 && modified && net_ratelimit())
 		printk(KERN_WARNING "A link change request failed with "
@@ -141,10 +141,41 @@ const struct fib_prop fib_props[RTN_MAX + 1] = {
 };
 
 /* Release a nexthop info record */
+static void rt_nexthop_free(struct rtable __rcu **rtp)
+{
+	struct rtable *rt = xchg((__force struct rtable **)rtp, NULL);
+
+	if (rt)
+		call_rcu(&rt->dst.rcu_head, dst_rcu_free);
+}
+
+/*
+ * Drop the routes cached in the nexthops of @fi.  Routes with custom
+ * metrics hold a client reference on @fi, so this has to happen when
+ * the last alias goes away rather than when @fi itself is freed.
+ */
+static void fib_flush_nexthop_cache(struct fib_info *fi)
+{
+	int cpu;
+
+	change_nexthops(fi) {
+		rt_nexthop_free(&nexthop_nh->nh_rth_input);
+		if (!nexthop_nh->nh_pcpu_rth_output)
+			continue;
+		for_each_possible_cpu(cpu)
+			rt_nexthop_free(per_cpu_ptr(nexthop_nh->nh_pcpu_rth_output,
+						    cpu));
+	} endfor_nexthops(fi);
+}
+
 static void free_fib_info_rcu(struct rcu_head *head)
 {
 	struct fib_info *fi = container_of(head, struct fib_info, rcu);
 
+	fib_flush_nexthop_cache(fi);
+	change_nexthops(fi) {
+		free_percpu(nexthop_nh->nh_pcpu_rth_output);
+	} endfor_nexthops(fi);
 	if (fi->fib_metrics != (u32 *) dst_default_metrics)
 		kfree(fi->fib_metrics);
 	kfree(fi);
@@ -179,6 +210,9 @@ void fib_release_info(struct fib_info *fi)
 			hlist_del(&nexthop_nh->nh_hash);
 		} endfor_nexthops(fi)
 		fi->fib_dead = 1;
+		/* pairs with the fib_dead check in rt_cache_route() */
+		smp_mb();
+		fib_flush_nexthop_cache(fi);
 		fib_info_put(fi);
 	}
 	spin_unlock_bh(&fib_info_lock);
@@ -342,14 +376,21 @@ errout:
 		rtnl_set_sk_err(info->nl_net, RTNLGRP_IPV4_ROUTE, err);
 }
 
-/* Return the first fib alias matching TOS with
- * priority less than or equal to PRIO.
+/* Return the first fib alias matching suffix length SLEN and TOS with
+ * priority less than or equal to PRIO.  Aliases are kept sorted by
+ * ascending suffix length, so the first alias with a longer suffix is
+ * returned if no alias of SLEN qualifies.
  */
-struct fib_alias *fib_find_alias(struct list_head *fah, u8 tos, u32 prio)
+struct fib_alias *fib_find_alias(struct list_head *fah, u8 slen,
+				 u8 tos, u32 prio)
 {
 	if (fah) {
 		struct fib_alias *fa;
 		list_for_each_entry(fa, fah, fa_list) {
+			if (fa->fa_slen < slen)
+				continue;
+			if (fa->fa_slen != slen)
+				return fa;
 			if (fa->fa_tos > tos)
 				continue;
 			if (fa->fa_info->fib_priority >= prio ||
@@ -769,6 +810,9 @@ struct fib_info *fib_create_info(struct fib_config *cfg)
 	fi->fib_nhs = nhs;
 	change_nexthops(fi) {
 		nexthop_nh->nh_parent = fi;
+		nexthop_nh->nh_pcpu_rth_output = alloc_percpu(struct rtable __rcu *);
+		if (!nexthop_nh->nh_pcpu_rth_output)
+			goto failure;
 	} endfor_nexthops(fi)
 
 	if (cfg->fc_mx) {
@@ -1090,6 +1134,8 @@ void fib_select_default(struct fib_result *res)
 	list_for_each_entry_rcu(fa, fa_head, fa_list) {
 		struct fib_info *next_fi = fa->fa_info;
 
+		if (fa->fa_slen != 32 - res->prefixlen)
+			continue;
 		if (next_fi->fib_scope != res->scope ||
 		    fa->fa_type != RTN_UNICAST)
 			continue;
@@ -96,23 +96,29 @@ typedef unsigned int t_key;
 #define IS_TNODE(n) (!(n->parent & T_LEAF))
 #define IS_LEAF(n) (n->parent & T_LEAF)
 
+/*
+ * Leaves and tnodes share a common header, so the lookup can test any
+ * node without first checking its type.  A leaf looks like a tnode with
+ * pos == KEYLENGTH and no index bits.  slen is the longest suffix length
+ * (KEYLENGTH - prefix length) of any prefix stored below the node; it is
+ * never lower than the number of key bits below the node's index, and
+ * may be higher than strictly necessary, which only costs a backtrack.
+ */
 struct rt_trie_node {
 	unsigned long parent;
 	t_key key;
+	unsigned char pos;
+	unsigned char bits;
+	unsigned char slen;
 };
 
 struct leaf {
 	unsigned long parent;
 	t_key key;
-	struct hlist_head list;
-	struct rcu_head rcu;
-};
-
-struct leaf_info {
-	struct hlist_node hlist;
-	int plen;
-	u32 mask_plen; /* ntohl(inet_make_mask(plen)) */
-	struct list_head falh;
+	unsigned char pos;
+	unsigned char bits;
+	unsigned char slen;
+	struct list_head falh;		/* sorted by ascending fa_slen */
 	struct rcu_head rcu;
 };
 
@@ -121,11 +127,11 @@ struct tnode {
 	t_key key;
 	unsigned char pos;		/* 2log(KEYLENGTH) bits needed */
 	unsigned char bits;		/* 2log(KEYLENGTH) bits needed */
+	unsigned char slen;		/* 2log(KEYLENGTH) bits needed */
 	unsigned int full_children;	/* KEYLENGTH bits needed */
 	unsigned int empty_children;	/* KEYLENGTH bits needed */
 	union {
 		struct rcu_head rcu;
-		struct work_struct work;
 		struct tnode *tnode_free;
 	};
 	struct rt_trie_node __rcu *child[0];
@@ -238,6 +244,35 @@ static inline int tnode_child_length(const struct tnode *tn)
 	return 1 << tn->bits;
 }
 
+/* Number of key bits below the child index of a node; zero for leaves */
+static inline unsigned int node_lsb(const struct rt_trie_node *n)
+{
+	return KEYLENGTH - n->pos - n->bits;
+}
+
+/*
+ * Child index of key in n.  Anything above the index bits is left in
+ * place, so a result that does not fit in n->bits means that key does
+ * not match the bits skipped by n.  For a leaf this is zero only if key
+ * is the leaf key.
+ */
+static inline t_key get_index(t_key key, const struct rt_trie_node *n)
+{
+	return (key ^ n->key) >> node_lsb(n);
+}
+
+/*
+ * Non-zero if key differs from n->key at or above the least significant
+ * bit set in n->key.  Differences below it can still be covered by a
+ * shorter prefix found by following child 0 all the way down.
+ */
+static inline t_key prefix_mismatch(t_key key, const struct rt_trie_node *n)
+{
+	t_key prefix = n->key;
+
+	return (key ^ prefix) & (prefix | -prefix);
+}
+
 static inline t_key mask_pfx(t_key k, unsigned int l)
 {
 	return (l == 0) ? 0 : k >> (KEYLENGTH-l) << (KEYLENGTH-l);
@@ -371,25 +406,42 @@ static inline void free_leaf(struct leaf *l)
 	call_rcu_bh(&l->rcu, __leaf_free_rcu);
 }
 
-static inline void free_leaf_info(struct leaf_info *leaf)
-{
-	kfree_rcu(leaf, rcu);
-}
-
+/*
+ * Small tnodes are rounded up to whole cache lines so that they come from
+ * naturally aligned kmalloc caches: the header and the first children of
+ * a tnode then always share one line, and a binary tnode fits in it.
+ */
 static struct tnode *tnode_alloc(size_t size)
 {
 	if (size <= PAGE_SIZE)
-		return kzalloc(size, GFP_KERNEL);
+		return kzalloc(L1_CACHE_ALIGN(size), GFP_KERNEL);
 	else
 		return vzalloc(size);
 }
 
-static void __tnode_vfree(struct work_struct *arg)
+/* vmalloc'ed tnodes waiting for process context, linked by tnode_free */
+static struct tnode *tnode_vfree_head;
+static DEFINE_SPINLOCK(tnode_vfree_lock);
+
+static void tnode_vfree_work_fn(struct work_struct *work)
 {
-	struct tnode *tn = container_of(arg, struct tnode, work);
-	vfree(tn);
+	struct tnode *tn;
+
+	spin_lock_bh(&tnode_vfree_lock);
+	tn = tnode_vfree_head;
+	tnode_vfree_head = NULL;
+	spin_unlock_bh(&tnode_vfree_lock);
+
+	while (tn) {
+		struct tnode *next = tn->tnode_free;
+
+		vfree(tn);
+		tn = next;
+	}
 }
 
+static DECLARE_WORK(tnode_vfree_work, tnode_vfree_work_fn);
+
 static void __tnode_free_rcu(struct rcu_head *head)
 {
 	struct tnode *tn = container_of(head, struct tnode, rcu);
@@ -399,8 +451,11 @@ static void __tnode_free_rcu(struct rcu_head *head)
 	if (size <= PAGE_SIZE)
 		kfree(tn);
 	else {
-		INIT_WORK(&tn->work, __tnode_vfree);
-		schedule_work(&tn->work);
+		spin_lock(&tnode_vfree_lock);
+		tn->tnode_free = tnode_vfree_head;
+		tnode_vfree_head = tn;
+		spin_unlock(&tnode_vfree_lock);
+		schedule_work(&tnode_vfree_work);
 	}
 }
 
@@ -442,22 +497,18 @@ static struct leaf *leaf_new(void)
 	struct leaf *l = kmem_cache_alloc(trie_leaf_kmem, GFP_KERNEL);
 	if (l) {
 		l->parent = T_LEAF;
-		INIT_HLIST_HEAD(&l->list);
+		l->pos = KEYLENGTH;
+		l->bits = 0;
+		l->slen = 0;
+		INIT_LIST_HEAD(&l->falh);
 	}
 	return l;
 }
 
-static struct leaf_info *leaf_info_new(int plen)
-{
-	struct leaf_info *li = kmalloc(sizeof(struct leaf_info),  GFP_KERNEL);
-	if (li) {
-		li->plen = plen;
-		li->mask_plen = ntohl(inet_make_mask(plen));
-		INIT_LIST_HEAD(&li->falh);
-	}
-	return li;
-}
-
+/*
+ * Only the bits above the child index are kept in a tnode key, which
+ * lets get_index() and prefix_mismatch() work on the key as it is.
+ */
 static struct tnode *tnode_new(t_key key, int pos, int bits)
 {
 	size_t sz = sizeof(struct tnode) + (sizeof(struct rt_trie_node *) << bits);
@@ -467,7 +518,8 @@ static struct tnode *tnode_new(t_key key, int pos, int bits)
 		tn->parent = T_TNODE;
 		tn->pos = pos;
 		tn->bits = bits;
-		tn->key = key;
+		tn->slen = KEYLENGTH - pos - bits;
+		tn->key = mask_pfx(key, pos);
 		tn->full_children = 0;
 		tn->empty_children = 1<<bits;
 	}
@@ -525,6 +577,9 @@ static void tnode_put_child_reorg(struct tnode *tn, int i, struct rt_trie_node *
 	else if (!wasfull && isfull)
 		tn->full_children++;
 
+	if (n && n->slen > tn->slen)
+		tn->slen = n->slen;
+
 	if (n)
 		node_set_parent(n, tn);
 
@@ -915,53 +970,67 @@ nomem:
 	return ERR_PTR(-ENOMEM);
 }
 
-/* readside must use rcu_read_lock currently dump routines
- via get_fa_head and dump */
-
-static struct leaf_info *find_leaf_info(struct leaf *l, int plen)
+/*
+ * Recompute the suffix length of a tnode from its children.
+ */
+static unsigned char update_suffix(struct tnode *tn)
 {
-	struct hlist_head *head = &l->list;
-	struct hlist_node *node;
-	struct leaf_info *li;
+	unsigned char slen = node_lsb((struct rt_trie_node *)tn);
+	int i;
 
-	hlist_for_each_entry_rcu(li, node, head, hlist)
-		if (li->plen == plen)
-			return li;
+	for (i = 0; i < tnode_child_length(tn); i++) {
+		struct rt_trie_node *n = tnode_get_child(tn, i);
 
-	return NULL;
+		if (n && n->slen > slen)
+			slen = n->slen;
+	}
+	tn->slen = slen;
+
+	return slen;
 }
 
-static inline struct list_head *get_fa_head(struct leaf *l, int plen)
+/*
+ * A child of tp whose suffix length used to be slen has shrunk or gone
+ * away; lower the suffix length of tp and its ancestors accordingly.
+ * Stop as soon as another child still holds the old value.
+ */
+static void trie_pull_suffix(struct tnode *tp, unsigned char slen)
 {
-	struct leaf_info *li = find_leaf_info(l, plen);
-
-	if (!li)
-		return NULL;
-
-	return &li->falh;
+	while (tp && tp->slen == slen &&
+	       slen > node_lsb((struct rt_trie_node *)tp)) {
+		if (update_suffix(tp) == slen)
+			break;
+		tp = node_parent((struct rt_trie_node *)tp);
+	}
 }
 
-static void insert_leaf_info(struct hlist_head *head, struct leaf_info *new)
+static inline unsigned char leaf_suffix(const struct leaf *l)
 {
-	struct leaf_info *li = NULL, *last = NULL;
-	struct hlist_node *node;
+	return list_entry(l->falh.prev, struct fib_alias, fa_list)->fa_slen;
+}
 
-	if (hlist_empty(head)) {
-		hlist_add_head_rcu(&new->hlist, head);
-	} else {
-		hlist_for_each_entry(li, node, head, hlist) {
-			if (new->plen > li->plen)
-				break;
+/* The leaf gained a shorter prefix; raise its ancestors to match */
+static void leaf_push_suffix(struct leaf *l)
+{
+	struct tnode *tp = node_parent((struct rt_trie_node *)l);
 
-			last = li;
-		}
-		if (last)
-			hlist_add_after_rcu(&last->hlist, &new->hlist);
-		else
-			hlist_add_before_rcu(&new->hlist, &li->hlist);
+	l->slen = leaf_suffix(l);
+	while (tp && tp->slen < l->slen) {
+		tp->slen = l->slen;
+		tp = node_parent((struct rt_trie_node *)tp);
 	}
 }
 
+/* Aliases were removed from a leaf that still has some left */
+static void leaf_pull_suffix(struct leaf *l)
+{
+	unsigned char slen = l->slen;
+
+	l->slen = leaf_suffix(l);
+	if (l->slen < slen)
+		trie_pull_suffix(node_parent((struct rt_trie_node *)l), slen);
+}
+
 /* rcu_read_lock needs to be hold by caller from readside */
 
 static struct leaf *
@@ -1030,17 +1099,18 @@ static void trie_rebalance(struct trie *t, struct tnode *tn)
 	tnode_free_flush();
 }
 
-/* only used from updater-side */
-
-static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
+/*
+ * Only used from updater-side.  Returns a new, still empty leaf for key
+ * whose suffix length is already set to slen, so that the tnodes above
+ * it are correct before the first alias is linked in.
+ */
+static struct leaf *fib_insert_node(struct trie *t, u32 key, u8 slen)
 {
 	int pos, newpos;
 	struct tnode *tp = NULL, *tn = NULL;
 	struct rt_trie_node *n;
 	struct leaf *l;
 	int missbit;
-	struct list_head *fa_head = NULL;
-	struct leaf_info *li;
 	t_key cindex;
 
 	pos = 0;
@@ -1090,34 +1160,16 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 
 	BUG_ON(tp && IS_LEAF(tp));
 
-	/* Case 1: n is a leaf. Compare prefixes */
+	/* The caller has already looked for a leaf with this key */
+	BUG_ON(n != NULL && IS_LEAF(n) && tkey_equals(key, n->key));
 
-	if (n != NULL && IS_LEAF(n) && tkey_equals(key, n->key)) {
-		l = (struct leaf *) n;
-		li = leaf_info_new(plen);
-
-		if (!li)
-			return NULL;
-
-		fa_head = &li->falh;
-		insert_leaf_info(&l->list, li);
-		goto done;
-	}
 	l = leaf_new();
 
 	if (!l)
 		return NULL;
 
 	l->key = key;
-	li = leaf_info_new(plen);
-
-	if (!li) {
-		free_leaf(l);
-		return NULL;
-	}
-
-	fa_head = &li->falh;
-	insert_leaf_info(&l->list, li);
+	l->slen = slen;
 
 	if (t->trie && n == NULL) {
 		/* Case 2: n is NULL, and will just insert a new leaf */
@@ -1147,7 +1199,6 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 		}
 
 		if (!tn) {
-			free_leaf_info(li);
 			free_leaf(l);
 			return NULL;
 		}
@@ -1169,14 +1220,13 @@ static struct list_head *fib_insert_node(struct trie *t, u32 key, int plen)
 	}
 
 	if (tp && tp->pos + tp->bits > 32)
-		pr_warn("fib_trie tp=%p pos=%d, bits=%d, key=%0x plen=%d\n",
-			tp, tp->pos, tp->bits, key, plen);
+		pr_warn("fib_trie tp=%p pos=%d, bits=%d, key=%0x slen=%d\n",
+			tp, tp->pos, tp->bits, key, slen);
 
 	/* Rebalance the trie */
 
 	trie_rebalance(t, tp);
-done:
-	return fa_head;
+	return l;
 }
 
 /*
@@ -1186,9 +1236,9 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 {
 	struct trie *t = (struct trie *) tb->tb_data;
 	struct fib_alias *fa, *new_fa;
-	struct list_head *fa_head = NULL;
 	struct fib_info *fi;
 	int plen = cfg->fc_dst_len;
+	u8 slen = KEYLENGTH - plen;
 	u8 tos = cfg->fc_tos;
 	u32 key, mask;
 	int err;
@@ -1215,25 +1265,20 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 	}
 
 	l = fib_find_node(t, key);
-	fa = NULL;
-
-	if (l) {
-		fa_head = get_fa_head(l, plen);
-		fa = fib_find_alias(fa_head, tos, fi->fib_priority);
-	}
+	fa = l ? fib_find_alias(&l->falh, slen, tos, fi->fib_priority) : NULL;
 
 	/* Now fa, if non-NULL, points to the first fib alias
 	 * with the same keys [prefix,tos,priority], if such key already
 	 * exists or to the node before which we will insert new one.
 	 *
 	 * If fa is NULL, we will need to allocate a new one and
-	 * insert to the head of f.
+	 * insert to the tail of the leaf's alias list.
 	 *
-	 * If f is NULL, no fib node matched the destination key
+	 * If l is NULL, no leaf matched the destination key
 	 * and we need to allocate a new one of those as well.
 	 */
 
-	if (fa && fa->fa_tos == tos &&
+	if (fa && fa->fa_slen == slen && fa->fa_tos == tos &&
 	    fa->fa_info->fib_priority == fi->fib_priority) {
 		struct fib_alias *fa_first, *fa_match;
 
@@ -1249,7 +1294,9 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 		fa_match = NULL;
 		fa_first = fa;
 		fa = list_entry(fa->fa_list.prev, struct fib_alias, fa_list);
-		list_for_each_entry_continue(fa, fa_head, fa_list) {
+		list_for_each_entry_continue(fa, &l->falh, fa_list) {
+			if (fa->fa_slen != slen)
+				break;
 			if (fa->fa_tos != tos)
 				break;
 			if (fa->fa_info->fib_priority != fi->fib_priority)
@@ -1282,13 +1329,14 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 			new_fa->fa_type = cfg->fc_type;
 			state = fa->fa_state;
 			new_fa->fa_state = state & ~FA_S_ACCESSED;
+			new_fa->fa_slen = fa->fa_slen;
 
 			list_replace_rcu(&fa->fa_list, &new_fa->fa_list);
 			alias_free_mem_rcu(fa);
 
 			fib_release_info(fi_drop);
 			if (state & FA_S_ACCESSED)
-				rt_cache_flush(cfg->fc_nlinfo.nl_net, -1);
+				rt_cache_flush(cfg->fc_nlinfo.nl_net);
 			rtmsg_fib(RTM_NEWROUTE, htonl(key), new_fa, plen,
 				tb->tb_id, &cfg->fc_nlinfo, NLM_F_REPLACE);
 
@@ -1317,13 +1365,14 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 	new_fa->fa_tos = tos;
 	new_fa->fa_type = cfg->fc_type;
 	new_fa->fa_state = 0;
+	new_fa->fa_slen = slen;
 	/*
 	 * Insert new entry to the list.
 	 */
 
-	if (!fa_head) {
-		fa_head = fib_insert_node(t, key, plen);
-		if (unlikely(!fa_head)) {
+	if (!l) {
+		l = fib_insert_node(t, key, slen);
+		if (unlikely(!l)) {
 			err = -ENOMEM;
 			goto out_free_new_fa;
 		}
@@ -1333,9 +1382,11 @@ int fib_table_insert(struct fib_table *tb, struct fib_config *cfg)
 		tb->tb_num_default++;
 
 	list_add_tail_rcu(&new_fa->fa_list,
-			  (fa ? &fa->fa_list : fa_head));
+			  (fa ? &fa->fa_list : &l->falh));
+	if (slen > l->slen)
+		leaf_push_suffix(l);
 
-	rt_cache_flush(cfg->fc_nlinfo.nl_net, -1);
+	rt_cache_flush(cfg->fc_nlinfo.nl_net);
 	rtmsg_fib(RTM_NEWROUTE, htonl(key), new_fa, plen, tb->tb_id,
 		  &cfg->fc_nlinfo, 0);
 succeeded:
@@ -1348,260 +1399,165 @@ out:
 err:
 	return err;
 }
+EXPORT_SYMBOL_GPL(fib_table_insert);
 
-/* should be called with rcu_read_lock */
-static int check_leaf(struct fib_table *tb, struct trie *t, struct leaf *l,
-		      t_key key,  const struct flowi4 *flp,
-		      struct fib_result *res, int fib_flags)
-{
-	struct leaf_info *li;
-	struct hlist_head *hhead = &l->list;
-	struct hlist_node *node;
-
-	hlist_for_each_entry_rcu(li, node, hhead, hlist) {
-		struct fib_alias *fa;
-
-		if (l->key != (key & li->mask_plen))
-			continue;
-
-		list_for_each_entry_rcu(fa, &li->falh, fa_list) {
-			struct fib_info *fi = fa->fa_info;
-			int nhsel, err;
-
-			if (fa->fa_tos && fa->fa_tos != flp->flowi4_tos)
-				continue;
-			if (fa->fa_info->fib_scope < flp->flowi4_scope)
-				continue;
-			fib_alias_accessed(fa);
-			err = fib_props[fa->fa_type].error;
-			if (err) {
-#ifdef CONFIG_IP_FIB_TRIE_STATS
-				t->stats.semantic_match_passed++;
-#endif
-				return err;
-			}
-			if (fi->fib_flags & RTNH_F_DEAD)
-				continue;
-			for (nhsel = 0; nhsel < fi->fib_nhs; nhsel++) {
-				const struct fib_nh *nh = &fi->fib_nh[nhsel];
-
-				if (nh->nh_flags & RTNH_F_DEAD)
-					continue;
-				if (flp->flowi4_oif && flp->flowi4_oif != nh->nh_oif)
-					continue;
-
-#ifdef CONFIG_IP_FIB_TRIE_STATS
-				t->stats.semantic_match_passed++;
-#endif
-				res->prefixlen = li->plen;
-				res->nh_sel = nhsel;
-				res->type = fa->fa_type;
-				res->scope = fa->fa_info->fib_scope;
-				res->fi = fi;
-				res->table = tb;
-				res->fa_head = &li->falh;
-				if (!(fib_flags & FIB_LOOKUP_NOREF))
-					atomic_inc(&fi->fib_clntref);
-				return 0;
-			}
-		}
-
-#ifdef CONFIG_IP_FIB_TRIE_STATS
-		t->stats.semantic_match_miss++;
-#endif
-	}
-
-	return 1;
-}
-
+/*
+ * The lookup runs in three steps.  It first walks down while the key
+ * matches every node exactly, remembering the deepest tnode below which
+ * a shorter prefix could still exist.  Once the key runs off the path,
+ * it keeps going down through child 0 of each node whose prefix is still
+ * compatible with the key, which is where the longest shorter prefix must
+ * live.  A leaf is then checked alias by alias; if none applies, the
+ * lowest set bit of the remembered child index is cleared and the walk
+ * resumes from there, climbing to the parent once the index runs out.
+ * No node is visited twice, and the suffix lengths kept in the tnodes let
+ * whole subtrees without any usable prefix be skipped.
+ */
 int fib_table_lookup(struct fib_table *tb, const struct flowi4 *flp,
 		     struct fib_result *res, int fib_flags)
 {
 	struct trie *t = (struct trie *) tb->tb_data;
-	int ret;
-	struct rt_trie_node *n;
-	struct tnode *pn;
-	unsigned int pos, bits;
 	t_key key = ntohl(flp->daddr);
-	unsigned int chopped_off;
+	struct rt_trie_node __rcu **cptr;
+	struct rt_trie_node *n;
+	struct tnode *pn = NULL;
 	t_key cindex = 0;
-	unsigned int current_prefix_length = KEYLENGTH;
-	struct tnode *cn;
-	t_key pref_mismatch;
+	t_key index;
+	struct fib_alias *fa;
+	struct leaf *l;
+	int ret = 1;
 
 	rcu_read_lock();
 
 	n = rcu_dereference(t->trie);
 	if (!n)
-		goto failed;
+		goto out;
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 	t->stats.gets++;
 #endif
 
-	/* Just a leaf? */
-	if (IS_LEAF(n)) {
-		ret = check_leaf(tb, t, (struct leaf *)n, key, flp, res, fib_flags);
-		goto found;
-	}
-
-	pn = (struct tnode *) n;
-	chopped_off = 0;
+	/* Step 1: travel to the longest prefix match in the trie */
+	for (;;) {
+		index = get_index(key, n);
 
-	while (pn) {
-		pos = pn->pos;
-		bits = pn->bits;
+		/* the key does not match the bits skipped by this node */
+		if (index >> n->bits)
+			break;
 
-		if (!chopped_off)
-			cindex = tkey_extract_bits(mask_pfx(key, current_prefix_length),
-						   pos, bits);
+		/* a leaf reached this way holds exactly our key */
+		if (IS_LEAF(n))
+			goto found;
 
-		n = tnode_get_child_rcu(pn, cindex);
+		/* only remember the node if chopping its bits can help */
+		if (n->slen > node_lsb(n)) {
+			pn = (struct tnode *) n;
+			cindex = index;
+		}
 
-		if (n == NULL) {
+		n = rcu_dereference(((struct tnode *) n)->child[index]);
+		if (unlikely(!n)) {
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 			t->stats.null_node_hit++;
 #endif
 			goto backtrace;
 		}
+	}
 
-		if (IS_LEAF(n)) {
-			ret = check_leaf(tb, t, (struct leaf *)n, key, flp, res, fib_flags);
-			if (ret > 0)
-				goto backtrace;
-			goto found;
-		}
-
-		cn = (struct tnode *)n;
-
-		/*
-		 * It's a tnode, and we can do some extra checks here if we
-		 * like, to avoid descending into a dead-end branch.
-		 * This tnode is in the parent's child array at index
-		 * key[p_pos..p_pos+p_bits] but potentially with some bits
-		 * chopped off, so in reality the index may be just a
-		 * subprefix, padded with zero at the end.
-		 * We can also take a look at any skipped bits in this
-		 * tnode - everything up to p_pos is supposed to be ok,
-		 * and the non-chopped bits of the index (se previous
-		 * paragraph) are also guaranteed ok, but the rest is
-		 * considered unknown.
-		 *
-		 * The skipped bits are key[pos+bits..cn->pos].
-		 */
-
-		/* If current_prefix_length < pos+bits, we are already doing
-		 * actual prefix  matching, which means everything from
-		 * pos+(bits-chopped_off) onward must be zero along some
-		 * branch of this subtree - otherwise there is *no* valid
-		 * prefix present. Here we can only check the skipped
-		 * bits. Remember, since we have already indexed into the
-		 * parent's child array, we know that the bits we chopped of
-		 * *are* zero.
-		 */
-
-		/* NOTA BENE: Checking only skipped bits
-		   for the new node here */
-
-		if (current_prefix_length < pos+bits) {
-			if (tkey_extract_bits(cn->key, current_prefix_length,
-						cn->pos - current_prefix_length)
-			    || !(cn->child[0]))
-				goto backtrace;
-		}
-
-		/*
-		 * If chopped_off=0, the index is fully validated and we
-		 * only need to look at the skipped bits for this, the new,
-		 * tnode. What we actually want to do is to find out if
-		 * these skipped bits match our key perfectly, or if we will
-		 * have to count on finding a matching prefix further down,
-		 * because if we do, we would like to have some way of
-		 * verifying the existence of such a prefix at this point.
-		 */
+	/* Step 2: sort out leaves and backtrack for the longest prefix */
+	for (;;) {
+		if (prefix_mismatch(key, n) || n->slen == node_lsb(n))
+			goto backtrace;
 
-		/* The only thing we can do at this point is to verify that
-		 * any such matching prefix can indeed be a prefix to our
-		 * key, and if the bits in the node we are inspecting that
-		 * do not match our key are not ZERO, this cannot be true.
-		 * Thus, find out where there is a mismatch (before cn->pos)
-		 * and verify that all the mismatching bits are zero in the
-		 * new tnode's key.
-		 */
+		if (IS_LEAF(n))
+			break;
 
-		/*
-		 * Note: We aren't very concerned about the piece of
-		 * the key that precede pn->pos+pn->bits, since these
-		 * have already been checked. The bits after cn->pos
-		 * aren't checked since these are by definition
-		 * "unknown" at this point. Thus, what we want to see
-		 * is if we are about to enter the "prefix matching"
-		 * state, and in that case verify that the skipped
-		 * bits that will prevail throughout this subtree are
-		 * zero, as they have to be if we are to find a
-		 * matching prefix.
+		/* Everything below here is reached through child 0, and
+		 * the walk comes back to pn anyway, so leave it alone.
 		 */
+		cptr = &((struct tnode *) n)->child[0];
 
-		pref_mismatch = mask_pfx(cn->key ^ key, cn->pos);
+		while ((n = rcu_dereference(*cptr)) == NULL) {
+backtrace:
+			/* no bits left to strip here, go back up one level */
+			while (!cindex) {
+				t_key pkey;
 
-		/*
-		 * In short: If skipped bits in this node do not match
-		 * the search key, enter the "prefix matching"
-		 * state.directly.
-		 */
-		if (pref_mismatch) {
-			int mp = KEYLENGTH - fls(pref_mismatch);
+				if (!pn)
+					goto out;
 
-			if (tkey_extract_bits(cn->key, mp, cn->pos - mp) != 0)
-				goto backtrace;
+				pkey = pn->key;
+				pn = node_parent_rcu((struct rt_trie_node *) pn);
+				if (!pn)
+					goto out;
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+				t->stats.backtrack++;
+#endif
+				cindex = get_index(pkey, (struct rt_trie_node *) pn);
+			}
 
-			if (current_prefix_length >= cn->pos)
-				current_prefix_length = mp;
+			/* strip the least significant bit from the index */
+			cindex &= cindex - 1;
+			cptr = &pn->child[cindex];
 		}
+	}
 
-		pn = (struct tnode *)n; /* Descend */
-		chopped_off = 0;
-		continue;
-
-backtrace:
-		chopped_off++;
-
-		/* As zero don't change the child key (cindex) */
-		while ((chopped_off <= pn->bits)
-		       && !(cindex & (1<<(chopped_off-1))))
-			chopped_off++;
-
-		/* Decrease current_... with bits chopped off */
-		if (current_prefix_length > pn->pos + pn->bits - chopped_off)
-			current_prefix_length = pn->pos + pn->bits
-				- chopped_off;
+found:
+	/* Step 3: check the aliases of the leaf, longest prefix first */
+	l = (struct leaf *) n;
+	index = key ^ l->key;
 
-		/*
-		 * Either we do the actual chop off according or if we have
-		 * chopped off all bits in this tnode walk up to our parent.
-		 */
+	list_for_each_entry_rcu(fa, &l->falh, fa_list) {
+		struct fib_info *fi = fa->fa_info;
+		int nhsel, err;
 
-		if (chopped_off <= pn->bits) {
-			cindex &= ~(1 << (chopped_off-1));
-		} else {
-			struct tnode *parent = node_parent_rcu((struct rt_trie_node *) pn);
-			if (!parent)
-				goto failed;
+		if (fa->fa_slen < KEYLENGTH && (index >> fa->fa_slen))
+			continue;
+		if (fa->fa_tos && fa->fa_tos != flp->flowi4_tos)
+			continue;
+		if (fi->fib_scope < flp->flowi4_scope)
+			continue;
+		fib_alias_accessed(fa);
+		err = fib_props[fa->fa_type].error;
+		if (err) {
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+			t->stats.semantic_match_passed++;
+#endif
+			ret = err;
+			goto out;
+		}
+		if (fi->fib_flags & RTNH_F_DEAD)
+			continue;
+		for (nhsel = 0; nhsel < fi->fib_nhs; nhsel++) {
+			const struct fib_nh *nh = &fi->fib_nh[nhsel];
 
-			/* Get Child's index */
-			cindex = tkey_extract_bits(pn->key, parent->pos, parent->bits);
-			pn = parent;
-			chopped_off = 0;
+			if (nh->nh_flags & RTNH_F_DEAD)
+				continue;
+			if (flp->flowi4_oif && flp->flowi4_oif != nh->nh_oif)
+				continue;
 
 #ifdef CONFIG_IP_FIB_TRIE_STATS
-			t->stats.backtrack++;
+			t->stats.semantic_match_passed++;
 #endif
-			goto backtrace;
+			res->prefixlen = KEYLENGTH - fa->fa_slen;
+			res->nh_sel = nhsel;
+			res->type = fa->fa_type;
+			res->scope = fi->fib_scope;
+			res->fi = fi;
+			res->table = tb;
+			res->fa_head = &l->falh;
+			if (!(fib_flags & FIB_LOOKUP_NOREF))
+				atomic_inc(&fi->fib_clntref);
+			ret = 0;
+			goto out;
 		}
 	}
-failed:
-	ret = 1;
-found:
+#ifdef CONFIG_IP_FIB_TRIE_STATS
+	t->stats.semantic_match_miss++;
+#endif
+	goto backtrace;
+
+out:
 	rcu_read_unlock();
 	return ret;
 }
@@ -1619,6 +1575,7 @@ static void trie_leaf_remove(struct trie *t, struct leaf *l)
 	if (tp) {
 		t_key cindex = tkey_extract_bits(l->key, tp->pos, tp->bits);
 		put_child(t, (struct tnode *)tp, cindex, NULL);
+		trie_pull_suffix(tp, l->slen);
 		trie_rebalance(t, tp);
 	} else
 		RCU_INIT_POINTER(t->trie, NULL);
@@ -1634,11 +1591,10 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 	struct trie *t = (struct trie *) tb->tb_data;
 	u32 key, mask;
 	int plen = cfg->fc_dst_len;
+	u8 slen = KEYLENGTH - plen;
 	u8 tos = cfg->fc_tos;
 	struct fib_alias *fa, *fa_to_delete;
-	struct list_head *fa_head;
 	struct leaf *l;
-	struct leaf_info *li;
 
 	if (plen > 32)
 		return -EINVAL;
@@ -1655,8 +1611,7 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 	if (!l)
 		return -ESRCH;
 
-	fa_head = get_fa_head(l, plen);
-	fa = fib_find_alias(fa_head, tos, 0);
+	fa = fib_find_alias(&l->falh, slen, tos, 0);
 
 	if (!fa)
 		return -ESRCH;
@@ -1665,10 +1620,10 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 
 	fa_to_delete = NULL;
 	fa = list_entry(fa->fa_list.prev, struct fib_alias, fa_list);
-	list_for_each_entry_continue(fa, fa_head, fa_list) {
+	list_for_each_entry_continue(fa, &l->falh, fa_list) {
 		struct fib_info *fi = fa->fa_info;
 
-		if (fa->fa_tos != tos)
+		if (fa->fa_slen != slen || fa->fa_tos != tos)
 			break;
 
 		if ((!cfg->fc_type || fa->fa_type == cfg->fc_type) &&
@@ -1691,36 +1646,31 @@ int fib_table_delete(struct fib_table *tb, struct fib_config *cfg)
 	rtmsg_fib(RTM_DELROUTE, htonl(key), fa, plen, tb->tb_id,
 		  &cfg->fc_nlinfo, 0);
 
-	l = fib_find_node(t, key);
-	li = find_leaf_info(l, plen);
-
 	list_del_rcu(&fa->fa_list);
 
 	if (!plen)
 		tb->tb_num_default--;
 
-	if (list_empty(fa_head)) {
-		hlist_del_rcu(&li->hlist);
-		free_leaf_info(li);
-	}
-
-	if (hlist_empty(&l->list))
+	if (list_empty(&l->falh))
 		trie_leaf_remove(t, l);
+	else
+		leaf_pull_suffix(l);
 
 	if (fa->fa_state & FA_S_ACCESSED)
-		rt_cache_flush(cfg->fc_nlinfo.nl_net, -1);
+		rt_cache_flush(cfg->fc_nlinfo.nl_net);
 
 	fib_release_info(fa->fa_info);
 	alias_free_mem_rcu(fa);
 	return 0;
 }
+EXPORT_SYMBOL_GPL(fib_table_delete);
 
-static int trie_flush_list(struct list_head *head)
+static int trie_flush_leaf(struct leaf *l)
 {
 	struct fib_alias *fa, *fa_node;
 	int found = 0;
 
-	list_for_each_entry_safe(fa, fa_node, head, fa_list) {
+	list_for_each_entry_safe(fa, fa_node, &l->falh, fa_list) {
 		struct fib_info *fi = fa->fa_info;
 
 		if (fi && (fi->fib_flags & RTNH_F_DEAD)) {
@@ -1730,24 +1680,10 @@ static int trie_flush_list(struct list_head *head)
 			found++;
 		}
 	}
-	return found;
-}
 
-static int trie_flush_leaf(struct leaf *l)
-{
-	int found = 0;
-	struct hlist_head *lih = &l->list;
-	struct hlist_node *node, *tmp;
-	struct leaf_info *li = NULL;
-
-	hlist_for_each_entry_safe(li, node, tmp, lih, hlist) {
-		found += trie_flush_list(&li->falh);
+	if (found && !list_empty(&l->falh))
+		leaf_pull_suffix(l);
 
-		if (list_empty(&li->falh)) {
-			hlist_del_rcu(&li->hlist);
-			free_leaf_info(li);
-		}
-	}
 	return found;
 }
 
@@ -1834,12 +1770,12 @@ int fib_table_flush(struct fib_table *tb)
 	for (l = trie_firstleaf(t); l; l = trie_nextleaf(l)) {
 		found += trie_flush_leaf(l);
 
-		if (ll && hlist_empty(&ll->list))
+		if (ll && list_empty(&ll->falh))
 			trie_leaf_remove(t, ll);
 		ll = l;
 	}
 
-	if (ll && hlist_empty(&ll->list))
+	if (ll && list_empty(&ll->falh))
 		trie_leaf_remove(t, ll);
 
 	pr_debug("trie_flush found=%d\n", found);
@@ -1850,21 +1786,20 @@ void fib_free_table(struct fib_table *tb)
 {
 	kfree(tb);
 }
+EXPORT_SYMBOL_GPL(fib_free_table);
 
-static int fn_trie_dump_fa(t_key key, int plen, struct list_head *fah,
-			   struct fib_table *tb,
-			   struct sk_buff *skb, struct netlink_callback *cb)
+static int fn_trie_dump_leaf(struct leaf *l, struct fib_table *tb,
+			struct sk_buff *skb, struct netlink_callback *cb)
 {
-	int i, s_i;
+	__be32 xkey = htonl(l->key);
 	struct fib_alias *fa;
-	__be32 xkey = htonl(key);
+	int i, s_i;
 
-	s_i = cb->args[5];
+	s_i = cb->args[4];
 	i = 0;
 
 	/* rcu_read_lock is hold by caller */
-
-	list_for_each_entry_rcu(fa, fah, fa_list) {
+	list_for_each_entry_rcu(fa, &l->falh, fa_list) {
 		if (i < s_i) {
 			i++;
 			continue;
@@ -1876,42 +1811,9 @@ static int fn_trie_dump_fa(t_key key, int plen, struct list_head *fah,
 				  tb->tb_id,
 				  fa->fa_type,
 				  xkey,
-				  plen,
+				  KEYLENGTH - fa->fa_slen,
 				  fa->fa_tos,
 				  fa->fa_info, NLM_F_MULTI) < 0) {
-			cb->args[5] = i;
-			return -1;
-		}
-		i++;
-	}
-	cb->args[5] = i;
-	return skb->len;
-}
-
-static int fn_trie_dump_leaf(struct leaf *l, struct fib_table *tb,
-			struct sk_buff *skb, struct netlink_callback *cb)
-{
-	struct leaf_info *li;
-	struct hlist_node *node;
-	int i, s_i;
-
-	s_i = cb->args[4];
-	i = 0;
-
-	/* rcu_read_lock is hold by caller */
-	hlist_for_each_entry_rcu(li, node, &l->list, hlist) {
-		if (i < s_i) {
-			i++;
-			continue;
-		}
-
-		if (i > s_i)
-			cb->args[5] = 0;
-
-		if (list_empty(&li->falh))
-			continue;
-
-		if (fn_trie_dump_fa(l->key, li->plen, &li->falh, tb, skb, cb) < 0) {
 			cb->args[4] = i;
 			return -1;
 		}
@@ -1971,8 +1873,7 @@ void __init fib_trie_init(void)
 					  0, SLAB_PANIC, NULL);
 
 	trie_leaf_kmem = kmem_cache_create("ip_fib_trie",
-					   max(sizeof(struct leaf),
-					       sizeof(struct leaf_info)),
+					   sizeof(struct leaf),
 					   0, SLAB_PANIC, NULL);
 }
 
@@ -1996,6 +1897,7 @@ struct fib_table *fib_trie_table(u32 id)
 
 	return tb;
 }
+EXPORT_SYMBOL_GPL(fib_trie_table);
 
 #ifdef CONFIG_PROC_FS
 /* Depth first Trie walk iterator */
@@ -2088,16 +1990,19 @@ static void trie_collect_stats(struct trie *t, struct trie_stat *s)
 	for (n = fib_trie_get_first(&iter, t); n; n = fib_trie_get_next(&iter)) {
 		if (IS_LEAF(n)) {
 			struct leaf *l = (struct leaf *)n;
-			struct leaf_info *li;
-			struct hlist_node *tmp;
+			struct fib_alias *fa;
+			int slen = -1;
 
 			s->leaves++;
 			s->totdepth += iter.depth;
 			if (iter.depth > s->maxdepth)
 				s->maxdepth = iter.depth;
 
-			hlist_for_each_entry_rcu(li, tmp, &l->list, hlist)
-				++s->prefixes;
+			list_for_each_entry_rcu(fa, &l->falh, fa_list) {
+				if (fa->fa_slen != slen)
+					++s->prefixes;
+				slen = fa->fa_slen;
+			}
 		} else {
 			const struct tnode *tn = (const struct tnode *) n;
 			int i;
@@ -2134,7 +2039,6 @@ static void trie_show_stats(struct seq_file *seq, struct trie_stat *stat)
 	bytes = sizeof(struct leaf) * stat->leaves;
 
 	seq_printf(seq, "\tPrefixes:       %u\n", stat->prefixes);
-	bytes += sizeof(struct leaf_info) * stat->prefixes;
 
 	seq_printf(seq, "\tInternal nodes: %u\n\t", stat->tnodes);
 	bytes += sizeof(struct tnode) * stat->tnodes;
@@ -2377,29 +2281,25 @@ static int fib_trie_seq_show(struct seq_file *seq, void *v)
 
 	} else {
 		struct leaf *l = (struct leaf *) n;
-		struct leaf_info *li;
-		struct hlist_node *node;
+		struct fib_alias *fa;
 		__be32 val = htonl(l->key);
 
 		seq_indent(seq, iter->depth);
 		seq_printf(seq, "  |-- %pI4\n", &val);
 
-		hlist_for_each_entry_rcu(li, node, &l->list, hlist) {
-			struct fib_alias *fa;
-
-			list_for_each_entry_rcu(fa, &li->falh, fa_list) {
-				char buf1[32], buf2[32];
-
-				seq_indent(seq, iter->depth+1);
-				seq_printf(seq, "  /%d %s %s", li->plen,
-					   rtn_scope(buf1, sizeof(buf1),
-						     fa->fa_info->fib_scope),
-					   rtn_type(buf2, sizeof(buf2),
-						    fa->fa_type));
-				if (fa->fa_tos)
-					seq_printf(seq, " tos=%d", fa->fa_tos);
-				seq_putc(seq, '\n');
-			}
+		list_for_each_entry_rcu(fa, &l->falh, fa_list) {
+			int plen = KEYLENGTH - fa->fa_slen;
+			char buf1[32], buf2[32];
+
+			seq_indent(seq, iter->depth+1);
+			seq_printf(seq, "  /%d %s %s", plen,
+				   rtn_scope(buf1, sizeof(buf1),
+					     fa->fa_info->fib_scope),
+				   rtn_type(buf2, sizeof(buf2),
+					    fa->fa_type));
+			if (fa->fa_tos)
+				seq_printf(seq, " tos=%d", fa->fa_tos);
+			seq_putc(seq, '\n');
 		}
 	}
 
@@ -2528,8 +2428,8 @@ static unsigned int fib_flag_trans(int type, __be32 mask, const struct fib_info
 static int fib_route_seq_show(struct seq_file *seq, void *v)
 {
 	struct leaf *l = v;
-	struct leaf_info *li;
-	struct hlist_node *node;
+	struct fib_alias *fa;
+	__be32 prefix;
 
 	if (v == SEQ_START_TOKEN) {
 		seq_printf(seq, "%-127s\n", "Iface\tDestination\tGateway "
@@ -2538,44 +2438,39 @@ static int fib_route_seq_show(struct seq_file *seq, void *v)
 		return 0;
 	}
 
-	hlist_for_each_entry_rcu(li, node, &l->list, hlist) {
-		struct fib_alias *fa;
-		__be32 mask, prefix;
-
-		mask = inet_make_mask(li->plen);
-		prefix = htonl(l->key);
+	prefix = htonl(l->key);
 
-		list_for_each_entry_rcu(fa, &li->falh, fa_list) {
-			const struct fib_info *fi = fa->fa_info;
-			unsigned int flags = fib_flag_trans(fa->fa_type, mask, fi);
-			int len;
+	list_for_each_entry_rcu(fa, &l->falh, fa_list) {
+		const struct fib_info *fi = fa->fa_info;
+		__be32 mask = inet_make_mask(KEYLENGTH - fa->fa_slen);
+		unsigned int flags = fib_flag_trans(fa->fa_type, mask, fi);
+		int len;
 
-			if (fa->fa_type == RTN_BROADCAST
-			    || fa->fa_type == RTN_MULTICAST)
-				continue;
+		if (fa->fa_type == RTN_BROADCAST
+		    || fa->fa_type == RTN_MULTICAST)
+			continue;
 
-			if (fi)
-				seq_printf(seq,
-					 "%s\t%08X\t%08X\t%04X\t%d\t%u\t"
-					 "%d\t%08X\t%d\t%u\t%u%n",
-					 fi->fib_dev ? fi->fib_dev->name : "*",
-					 prefix,
-					 fi->fib_nh->nh_gw, flags, 0, 0,
-					 fi->fib_priority,
-					 mask,
-					 (fi->fib_advmss ?
-					  fi->fib_advmss + 40 : 0),
-					 fi->fib_window,
-					 fi->fib_rtt >> 3, &len);
-			else
-				seq_printf(seq,
-					 "*\t%08X\t%08X\t%04X\t%d\t%u\t"
-					 "%d\t%08X\t%d\t%u\t%u%n",
-					 prefix, 0, flags, 0, 0, 0,
-					 mask, 0, 0, 0, &len);
+		if (fi)
+			seq_printf(seq,
+				 "%s\t%08X\t%08X\t%04X\t%d\t%u\t"
+				 "%d\t%08X\t%d\t%u\t%u%n",
+				 fi->fib_dev ? fi->fib_dev->name : "*",
+				 prefix,
+				 fi->fib_nh->nh_gw, flags, 0, 0,
+				 fi->fib_priority,
+				 mask,
+				 (fi->fib_advmss ?
+				  fi->fib_advmss + 40 : 0),
+				 fi->fib_window,
+				 fi->fib_rtt >> 3, &len);
+		else
+			seq_printf(seq,
+				 "*\t%08X\t%08X\t%04X\t%d\t%u\t"
+				 "%d\t%08X\t%d\t%u\t%u%n",
+				 prefix, 0, flags, 0, 0, 0,
+				 mask, 0, 0, 0, &len);
 
-			seq_printf(seq, "%*s\n", 127 - len, "");
-		}
+		seq_printf(seq, "%*s\n", 127 - len, "");
 	}
 
 	return 0;
@@ -66,6 +66,7 @@
 #include <net/ip.h>
 #include <net/protocol.h>
 #include <net/route.h>
+#include <net/ip_fib.h>
 #include <net/xfrm.h>
 #include <linux/skbuff.h>
 #include <net/sock.h>
@@ -214,6 +215,18 @@ static inline int ip_finish_output2(struct sk_buff *skb)
 	}
 	rcu_read_unlock();
 
+	/*
+	 * Routes shared by all the destinations of an on-link nexthop
+	 * have no neighbour bound, resolve it from rt_gateway ?: daddr.
+	 */
+	neigh = dst_neigh_lookup(dst, &ip_hdr(skb)->daddr);
+	if (!IS_ERR(neigh)) {
+		int res = neigh_output(neigh, skb);
+
+		neigh_release(neigh);
+		return res;
+	}
+
 	if (net_ratelimit())
 		printk(KERN_DEBUG "ip_finish_output2: No header cache and no neighbour!\n");
 	kfree_skb(skb);
@@ -380,7 +393,7 @@ int ip_queue_xmit(struct sk_buff *skb, struct flowi *fl)
 	skb_dst_set_noref(skb, &rt->dst);
 
 packet_routed:
-	if (inet_opt && inet_opt->opt.is_strictroute && fl4->daddr != rt->rt_gateway)
+	if (inet_opt && inet_opt->opt.is_strictroute && rt->rt_uses_gateway)
 		goto no_route;
 
 	/* OK, we know where to send it, allocate and build IP header. */
@@ -1484,7 +1497,7 @@ void ip_send_reply(struct sock *sk, struct sk_buff *skb, __be32 daddr,
 	struct ip_options_data replyopts;
 	struct ipcm_cookie ipc;
 	struct flowi4 fl4;
-	struct rtable *rt = skb_rtable(skb);
+	struct rtable *rt;
 
 	if (ip_options_echo(&replyopts.opt.opt, skb))
 		return;
@@ -1504,7 +1517,7 @@ void ip_send_reply(struct sock *sk, struct sk_buff *skb, __be32 daddr,
 			   RT_TOS(arg->tos),
 			   RT_SCOPE_UNIVERSE, sk->sk_protocol,
 			   ip_reply_arg_flowi_flags(arg),
-			   daddr, rt->rt_spec_dst,
+			   daddr, fib_compute_spec_dst(skb),
 			   tcp_hdr(skb)->source, tcp_hdr(skb)->dest);
 	security_skb_classify_flow(skb, flowi4_to_flowi(&fl4));
 	rt = ip_route_output_key(sock_net(sk), &fl4);
@@ -35,6 +35,7 @@
 #include <linux/mroute.h>
 #include <net/inet_ecn.h>
 #include <net/route.h>
+#include <net/ip_fib.h>
 #include <net/xfrm.h>
 #include <net/compat.h>
 #if IS_ENABLED(CONFIG_IPV6)
@@ -1014,18 +1015,18 @@ e_inval:
  * @sk: socket
  * @skb: buffer
  *
- * To support IP_CMSG_PKTINFO option, we store rt_iif and rt_spec_dst
- * in skb->cb[] before dst drop.
- * This way, receiver doesnt make cache line misses to read rtable.
+ * To support IP_CMSG_PKTINFO option, we store the incoming ifindex and
+ * the specific destination in skb->cb[] before dst drop, provided the
+ * socket asked for them.  The route may be shared by many sources, so
+ * the specific destination is computed here rather than read from it.
  */
-void ipv4_pktinfo_prepare(struct sk_buff *skb)
+void ipv4_pktinfo_prepare(const struct sock *sk, struct sk_buff *skb)
 {
 	struct in_pktinfo *pktinfo = PKTINFO_SKB_CB(skb);
-	const struct rtable *rt = skb_rtable(skb);
 
-	if (rt) {
-		pktinfo->ipi_ifindex = rt->rt_iif;
-		pktinfo->ipi_spec_dst.s_addr = rt->rt_spec_dst;
+	if ((inet_sk(sk)->cmsg_flags & IP_CMSG_PKTINFO) && skb_rtable(skb)) {
+		pktinfo->ipi_ifindex = inet_iif(skb);
+		pktinfo->ipi_spec_dst.s_addr = fib_compute_spec_dst(skb);
 	} else {
 		pktinfo->ipi_ifindex = 0;
 		pktinfo->ipi_spec_dst.s_addr = 0;
@@ -613,7 +613,7 @@ out:
 	return err;
 
 do_confirm:
-	dst_confirm(&rt->dst);
+	dst_confirm_neigh(&rt->dst, &fl4.daddr);
 	if (!(msg->msg_flags & MSG_PROBE) || len)
 		goto back_from_confirm;
 	err = 0;
@@ -737,7 +737,7 @@ void tcp_update_metrics(struct sock *sk)
 	if (sysctl_tcp_nometrics_save)
 		return;
 
-	dst_confirm(dst);
+	dst_confirm_neigh(dst, &inet_sk(sk)->inet_daddr);
 
 	if (dst && (dst->flags & DST_HOST)) {
 		const struct inet_connection_sock *icsk = inet_csk(sk);
@@ -888,7 +888,7 @@ static void tcp_init_metrics(struct sock *sk)
 	if (dst == NULL)
 		goto reset;
 
-	dst_confirm(dst);
+	dst_confirm_neigh(dst, &inet_sk(sk)->inet_daddr);
 
 	if (dst_metric_locked(dst, RTAX_CWND))
 		tp->snd_cwnd_clamp = dst_metric(dst, RTAX_CWND);
@@ -3787,7 +3787,7 @@ static int tcp_ack(struct sock *sk, const struct sk_buff *skb, int flag)
 	}
 
 	if ((flag & FLAG_FORWARD_PROGRESS) || !(flag & FLAG_NOT_DUP))
-		dst_confirm(__sk_dst_get(sk));
+		dst_confirm_neigh(__sk_dst_get(sk), &inet_sk(sk)->inet_daddr);
 
 	return 1;
 
@@ -5957,7 +5957,8 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 			if (tp->snd_una == tp->write_seq) {
 				tcp_set_state(sk, TCP_FIN_WAIT2);
 				sk->sk_shutdown |= SEND_SHUTDOWN;
-				dst_confirm(__sk_dst_get(sk));
+				dst_confirm_neigh(__sk_dst_get(sk),
+						  &inet_sk(sk)->inet_daddr);
 
 				if (!sock_flag(sk, SOCK_DEAD))
 					/* Wake up lingering close() */
@@ -32,6 +32,9 @@ int inet6_csk_bind_conflict(const struct sock *sk,
 {
 	const struct sock *sk2;
 	const struct hlist_node *node;
+	int reuse = sk->sk_reuse;
+	int reuseport = sk->sk_reuseport;
+	int uid = sock_i_uid((struct sock *)sk);
 
 	/* We must walk the whole port owner list in this case. -DaveM */
 	/*
@@ -43,9 +46,12 @@ int inet6_csk_bind_conflict(const struct sock *sk,
 		    (!sk->sk_bound_dev_if ||
 		     !sk2->sk_bound_dev_if ||
 		     sk->sk_bound_dev_if == sk2->sk_bound_dev_if) &&
-		    (!sk->sk_reuse || !sk2->sk_reuse ||
+		    (!reuse || !sk2->sk_reuse ||
 		     sk2->sk_state == TCP_LISTEN) &&
-		     ipv6_rcv_saddr_equal(sk, sk2))
+		    (!reuseport || !sk2->sk_reuseport ||
+		     (sk2->sk_state != TCP_TIME_WAIT &&
+		      uid != sock_i_uid((struct sock *)sk2))) &&
+		    ipv6_rcv_saddr_equal(sk, sk2))
 			break;
 	}
 
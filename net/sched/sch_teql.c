@@ -15,6 +15,7 @@
 #include <linux/string.h>
 #include <linux/errno.h>
 #include <linux/if_arp.h>
+#include <linux/ip.h>
 #include <linux/netdevice.h>
 #include <linux/init.h>
 #include <linux/skbuff.h>
@@ -281,6 +282,15 @@ static inline int teql_resolve(struct sk_buff *skb,
 	res = mn ? __teql_resolve(skb, skb_res, dev, txq, mn) : 0;
 	rcu_read_unlock();
 
+	/* IPv4 routes shared by an on-link nexthop have none bound */
+	if (!mn && skb->protocol == htons(ETH_P_IP)) {
+		mn = dst_neigh_lookup(dst, &ip_hdr(skb)->daddr);
+		if (!IS_ERR(mn)) {
+			res = __teql_resolve(skb, skb_res, dev, txq, mn);
+			neigh_release(mn);
+		}
+	}
+
 	return res;
 }
 
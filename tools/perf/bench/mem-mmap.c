@@ -0,0 +1,182 @@
+/*
+ * mem-mmap.c
+ *
+ * mmap: mmap()/munmap() against page faults from concurrent threads
+ *
+ * Some threads map, touch and unmap a small anonymous region over and
+ * over, taking mmap_sem for writing.  The others fault in a private
+ * region, drop it with madvise(MADV_DONTNEED) and fault it in again,
+ * taking mmap_sem for reading.  All threads share one mm, so this
+ * measures how well mmap_sem scales under a mixed read/write load.
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+static int nr_mappers = 1;
+static int nr_faulters = 4;
+static int nr_pages = 16;
+static int runtime = 5;
+
+static const struct option options[] = {
+	OPT_INTEGER('m', "mappers", &nr_mappers,
+		    "Specify number of mmap()/munmap() threads"),
+	OPT_INTEGER('t', "faulters", &nr_faulters,
+		    "Specify number of page faulting threads"),
+	OPT_INTEGER('p', "pages", &nr_pages,
+		    "Specify number of pages mapped or faulted per loop"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Specify runtime in seconds"),
+	OPT_END()
+};
+
+static const char * const bench_mem_mmap_usage[] = {
+	"perf bench mem mmap <options>",
+	NULL
+};
+
+struct worker {
+	pthread_t thread;
+	unsigned long long ops;
+};
+
+static volatile int done;
+static size_t page_size;
+
+static void touch(char *p)
+{
+	int i;
+
+	for (i = 0; i < nr_pages; i++)
+		p[i * page_size] = 1;
+}
+
+static void *mapper(void *arg)
+{
+	struct worker *w = arg;
+	size_t len = nr_pages * page_size;
+	char *p;
+
+	while (!done) {
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			die("mmap() failed\n");
+		touch(p);
+		munmap(p, len);
+		w->ops++;
+	}
+	return NULL;
+}
+
+static void *faulter(void *arg)
+{
+	struct worker *w = arg;
+	size_t len = nr_pages * page_size;
+	char *p;
+
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		die("mmap() failed\n");
+
+	while (!done) {
+		touch(p);
+		madvise(p, len, MADV_DONTNEED);
+		w->ops++;
+	}
+	munmap(p, len);
+	return NULL;
+}
+
+static unsigned long long sum_ops(struct worker *w, int nr)
+{
+	unsigned long long ops = 0;
+	int i;
+
+	for (i = 0; i < nr; i++)
+		ops += w[i].ops;
+	return ops;
+}
+
+int bench_mem_mmap(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	struct worker *workers;
+	struct timeval start, stop, diff;
+	unsigned long long map_ops, fault_ops;
+	double secs;
+	int i, nr;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_mmap_usage, 0);
+
+	if (nr_mappers < 0 || nr_faulters < 0 ||
+	    nr_mappers + nr_faulters < 1 || nr_pages < 1 || runtime < 1) {
+		usage_with_options(bench_mem_mmap_usage, options);
+		return 1;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	nr = nr_mappers + nr_faulters;
+	workers = calloc(nr, sizeof(*workers));
+	if (!workers)
+		die("calloc() failed\n");
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr; i++) {
+		if (pthread_create(&workers[i].thread, NULL,
+				   i < nr_mappers ? mapper : faulter,
+				   &workers[i]))
+			die("pthread_create() failed\n");
+	}
+
+	sleep(runtime);
+	done = 1;
+
+	for (i = 0; i < nr; i++)
+		pthread_join(workers[i].thread, NULL);
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	map_ops = sum_ops(workers, nr_mappers);
+	fault_ops = sum_ops(workers + nr_mappers, nr_faulters);
+	secs = diff.tv_sec + diff.tv_usec / 1000000.0;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d mmap/munmap and %d page fault threads,"
+		       " %d pages per loop\n\n",
+		       nr_mappers, nr_faulters, nr_pages);
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec, (unsigned long)(diff.tv_usec / 1000));
+		printf(" %14.0lf mmap/munmap loops/sec\n", map_ops / secs);
+		printf(" %14.0lf page faults/sec\n",
+		       fault_ops * nr_pages / secs);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0lf %.0lf\n", map_ops / secs,
+		       fault_ops * nr_pages / secs);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	free(workers);
+	return 0;
+}
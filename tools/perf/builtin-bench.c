@@ -55,6 +55,9 @@ static struct bench_suite mem_suites[] = {
 	{ "memset",
 	  "Simple memory set in various ways",
 	  bench_mem_memset },
+	{ "mmap",
+	  "mmap()/munmap() against page faults from concurrent threads",
+	  bench_mem_mmap },
 	suite_all,
 	{ NULL,
 	  NULL,